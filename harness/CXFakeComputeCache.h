@@ -0,0 +1,269 @@
+/*
+	CXFakeComputeCache.h
+
+	CX Animation Tools - Test Harness
+	An in-process AEGP_ComputeCacheSuite1 for CXComputeCache on Linux.
+
+	Each registered class keeps its entries in LRU order under a byte
+	budget. Keys come from the class's generate_key, values from its
+	compute callback, sizes from approx_size_value. A store that pushes a
+	class over budget evicts from the cold end, including entries that are
+	checked out: an evicted entry leaves the index at once, and its
+	delete_compute_value runs when the last receipt is checked in. That is
+	the harshest order a host may choose, and CXComputeCache must not care.
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#pragma once
+#ifndef CX_FAKE_COMPUTE_CACHE_H
+#define CX_FAKE_COMPUTE_CACHE_H
+
+#include "AE_ComputeCacheSuite.h"
+
+#include <chrono>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class CXFakeComputeCache {
+public:
+	struct Stats {
+		long	hits;			// CheckoutCached found the key
+		long	misses;			// CheckoutCached did not
+		long	computes;		// compute callbacks run
+		long	evictions;
+		long	evictedCheckedOut;	// evictions of entries with open receipts
+		long	deletes;		// delete_compute_value calls
+		long	openReceipts;
+	};
+
+	static CXFakeComputeCache &Get() {
+		static CXFakeComputeCache cache;
+		return cache;
+	}
+
+	AEGP_ComputeCacheSuite1 *Suite() {
+		static AEGP_ComputeCacheSuite1 suite = {
+			ClassRegister, ClassUnregister, ComputeIfNeededAndCheckout,
+			CheckoutCached, GetReceiptComputeValue, CheckinComputeReceipt
+		};
+		return &suite;
+	}
+
+	// Budget per class; applies from the next store
+	void SetBudget(size_t bytes) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_budget = bytes;
+	}
+
+	// Delays every CheckoutCached answer, which widens the race windows
+	void SetLookupDelay(int microseconds) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_lookupDelay = microseconds;
+	}
+
+	void ResetStats() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		long open = m_stats.openReceipts;
+		m_stats = Stats();
+		m_stats.openReceipts = open;
+	}
+
+	Stats GetStats() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	size_t ClassCount() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_classes.size();
+	}
+
+private:
+	struct Entry {
+		std::string					key;
+		AEGP_CCComputeValueRefconP	value;
+		size_t						bytes;
+		A_long						checkouts;
+		bool						evicted;
+	};
+	typedef std::shared_ptr<Entry> EntryPtr;
+
+	struct Class {
+		AEGP_ComputeCacheCallbacks	callbacks;
+		std::list<EntryPtr>			lru;		// Front is most recent
+		size_t						bytes;
+	};
+
+	struct Receipt {
+		Class		*owner;
+		EntryPtr	entry;
+		AEGP_ComputeCacheCallbacks	callbacks;
+	};
+
+	CXFakeComputeCache() : m_budget((size_t)1 << 30), m_lookupDelay(0) {
+		m_stats = Stats();
+	}
+
+	static std::string MakeKey(const Class &c, AEGP_CCComputeOptionsRefconP options) {
+		AEGP_CCComputeKey key;
+		memset(&key, 0, sizeof(key));
+		c.callbacks.generate_key(options, &key);
+		return std::string(reinterpret_cast<const char*>(&key), sizeof(key));
+	}
+
+	Class *FindClass(const A_char *cacheId) {
+		std::map<std::string, Class>::iterator it = m_classes.find(cacheId);
+		return it == m_classes.end() ? NULL : &it->second;
+	}
+
+	// Moves a hit to the front and returns it
+	static EntryPtr Touch(Class *c, const std::string &key) {
+		for (std::list<EntryPtr>::iterator it = c->lru.begin(); it != c->lru.end(); ++it) {
+			if ((*it)->key == key) {
+				c->lru.splice(c->lru.begin(), c->lru, it);
+				return c->lru.front();
+			}
+		}
+		return EntryPtr();
+	}
+
+	void Drop(Class *c, const EntryPtr &entry) {
+		entry->evicted = true;
+		c->bytes -= entry->bytes;
+		if (entry->checkouts > 0) {
+			m_stats.evictedCheckedOut++;
+		} else {
+			c->callbacks.delete_compute_value(entry->value);
+			m_stats.deletes++;
+		}
+	}
+
+	void Trim(Class *c) {
+		while (c->bytes > m_budget && !c->lru.empty()) {
+			EntryPtr victim = c->lru.back();
+			c->lru.pop_back();
+			Drop(c, victim);
+			m_stats.evictions++;
+		}
+	}
+
+	AEGP_CCCheckoutReceiptP Checkout(Class *c, const EntryPtr &entry) {
+		entry->checkouts++;
+		m_stats.openReceipts++;
+		Receipt *receipt = new Receipt;
+		receipt->owner = c;
+		receipt->entry = entry;
+		receipt->callbacks = c->callbacks;
+		return reinterpret_cast<AEGP_CCCheckoutReceiptP>(receipt);
+	}
+
+	static A_Err ClassRegister(const A_char *cacheId, const AEGP_ComputeCacheCallbacks *callbacks) {
+		CXFakeComputeCache &self = Get();
+		std::lock_guard<std::mutex> lock(self.m_mutex);
+		if (self.FindClass(cacheId)) return A_Err_GENERIC;
+		Class &c = self.m_classes[cacheId];
+		c.callbacks = *callbacks;
+		c.bytes = 0;
+		return A_Err_NONE;
+	}
+
+	static A_Err ClassUnregister(const A_char *cacheId) {
+		CXFakeComputeCache &self = Get();
+		std::lock_guard<std::mutex> lock(self.m_mutex);
+		Class *c = self.FindClass(cacheId);
+		if (!c) return A_Err_GENERIC;
+		for (const EntryPtr &entry : c->lru) {
+			self.Drop(c, entry);
+		}
+		self.m_classes.erase(cacheId);
+		return A_Err_NONE;
+	}
+
+	static A_Err ComputeIfNeededAndCheckout(const A_char *cacheId, AEGP_CCComputeOptionsRefconP options,
+	                                        bool, AEGP_CCCheckoutReceiptP *receiptP) {
+		CXFakeComputeCache &self = Get();
+		std::lock_guard<std::mutex> lock(self.m_mutex);
+		*receiptP = NULL;
+		Class *c = self.FindClass(cacheId);
+		if (!c) return A_Err_GENERIC;
+
+		std::string key = MakeKey(*c, options);
+		EntryPtr entry = Touch(c, key);
+		if (!entry) {
+			AEGP_CCComputeValueRefconP value = NULL;
+			A_Err err = c->callbacks.compute(options, &value);
+			if (err) return err;
+			self.m_stats.computes++;
+
+			entry = std::make_shared<Entry>();
+			entry->key = key;
+			entry->value = value;
+			entry->bytes = c->callbacks.approx_size_value(value);
+			entry->checkouts = 0;
+			entry->evicted = false;
+			c->lru.push_front(entry);
+			c->bytes += entry->bytes;
+		}
+		*receiptP = self.Checkout(c, entry);
+		self.Trim(c);
+		return A_Err_NONE;
+	}
+
+	static A_Err CheckoutCached(const A_char *cacheId, AEGP_CCComputeOptionsRefconP options,
+	                            AEGP_CCCheckoutReceiptP *receiptP) {
+		CXFakeComputeCache &self = Get();
+		int delay;
+		{
+			std::lock_guard<std::mutex> lock(self.m_mutex);
+			delay = self.m_lookupDelay;
+			*receiptP = NULL;
+			Class *c = self.FindClass(cacheId);
+			if (!c) return A_Err_GENERIC;
+
+			EntryPtr entry = Touch(c, MakeKey(*c, options));
+			if (entry) {
+				self.m_stats.hits++;
+				*receiptP = self.Checkout(c, entry);
+			} else {
+				self.m_stats.misses++;
+			}
+		}
+		// The answer may be stale by the time the caller sees it
+		if (delay) std::this_thread::sleep_for(std::chrono::microseconds(delay));
+		return A_Err_NONE;
+	}
+
+	static A_Err GetReceiptComputeValue(const AEGP_CCCheckoutReceiptP receiptP, AEGP_CCComputeValueRefconP *valueP) {
+		*valueP = reinterpret_cast<const Receipt*>(receiptP)->entry->value;
+		return A_Err_NONE;
+	}
+
+	static A_Err CheckinComputeReceipt(AEGP_CCCheckoutReceiptP receiptP) {
+		CXFakeComputeCache &self = Get();
+		std::lock_guard<std::mutex> lock(self.m_mutex);
+		Receipt *receipt = reinterpret_cast<Receipt*>(receiptP);
+		Entry &entry = *receipt->entry;
+		entry.checkouts--;
+		self.m_stats.openReceipts--;
+		if (entry.evicted && entry.checkouts == 0) {
+			receipt->callbacks.delete_compute_value(entry.value);
+			self.m_stats.deletes++;
+		}
+		delete receipt;
+		return A_Err_NONE;
+	}
+
+	std::mutex						m_mutex;
+	std::map<std::string, Class>	m_classes;
+	size_t							m_budget;
+	int								m_lookupDelay;
+	Stats							m_stats;
+};
+
+#endif // CX_FAKE_COMPUTE_CACHE_H
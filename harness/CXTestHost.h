@@ -0,0 +1,641 @@
+/*
+	CXTestHost.h
+
+	CX Animation Tools - Test Harness
+	A fake After Effects / Premiere host that drives a plugin's EffectMain
+	on Linux: params with optional linear animation, the handle, world,
+	iterate and param-utils suites, Premiere's pixel format suite, and AE's
+	compute cache (CXFakeComputeCache.h) when a test turns it on.
+
+	Renders go through the same commands the hosts send: SmartFX pre-render
+	and render for AE, PF_Cmd_RENDER with BGRA worlds for Premiere. Inputs
+	are synthetic cels (flat regions, dark and red lines, anti-aliased and
+	transparent patches) and outputs come back packed as ARGB bytes, so the
+	tests can compare renders bit for bit.
+
+	The host keeps its state in globals, so only one CXTestHost may exist
+	at a time; include this header from exactly one file of each test
+	program.
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#pragma once
+#ifndef CX_TEST_HOST_H
+#define CX_TEST_HOST_H
+
+#include "AE_Effect.h"
+#include "AE_ComputeCacheSuite.h"
+#include "CXCommon.h"
+#include "CXFakeComputeCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" PF_Err EffectMain(PF_Cmd cmd, PF_InData *in_data, PF_OutData *out_data,
+                             PF_ParamDef *params[], PF_LayerDef *output, void *extra);
+
+// ============================================================================
+// Test reporting
+// ============================================================================
+
+static int g_cxFailures = 0;
+
+#define CX_CHECK(COND) \
+	do { if (!(COND)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); g_cxFailures++; } } while (0)
+
+#define CX_CHECK_ERR(EXPR) \
+	do { PF_Err cx_err_ = (EXPR); if (cx_err_) { fprintf(stderr, "%s:%d: %s returned %d\n", __FILE__, __LINE__, #EXPR, (int)cx_err_); g_cxFailures++; } } while (0)
+
+static int CX_TestResult(const char *name) {
+	if (g_cxFailures) {
+		fprintf(stderr, "%s: %d check(s) failed\n", name, g_cxFailures);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
+
+// ============================================================================
+// Host state
+// ============================================================================
+
+enum CXTestFormat {
+	CX_TEST_ARGB32 = 0,		// AE 8 bpc
+	CX_TEST_ARGB64,			// AE 16 bpc
+	CX_TEST_ARGB128,		// AE 32 bpc
+	CX_TEST_BGRA_8U,		// Premiere 8 bpc
+	CX_TEST_BGRA_32F		// Premiere 32 bpc
+};
+
+static inline bool CX_TestIsPremiere(CXTestFormat format) {
+	return format == CX_TEST_BGRA_8U || format == CX_TEST_BGRA_32F;
+}
+
+static inline int CX_TestPixelBytes(CXTestFormat format) {
+	switch (format) {
+		case CX_TEST_ARGB32:
+		case CX_TEST_BGRA_8U: return 4;
+		case CX_TEST_ARGB64: return 8;
+		default: return 16;
+	}
+}
+
+static inline int CX_TestBitDepth(CXTestFormat format) {
+	int bytes = CX_TestPixelBytes(format);
+	return bytes == 4 ? 8 : bytes == 8 ? 16 : 32;
+}
+
+struct CXTestParam {
+	PF_ParamDef	def;
+	PF_FpLong	delta;		// Float sliders: value change per frame
+	bool		animated;
+};
+
+struct CXTestHostState {
+	std::vector<CXTestParam>	params;
+	std::mutex					mutex;
+	std::map<const PF_EffectWorld*, CXTestFormat> worlds;
+	long						checkouts;
+	int							threads;
+	bool						computeCache;
+	int							premiereFormats;	// Formats added in GlobalSetup
+};
+
+static CXTestHostState g_cxHost;
+
+// ============================================================================
+// Interact callbacks and suites
+// ============================================================================
+
+static PF_Err CX_HostAddParam(PF_ProgPtr, A_long, PF_ParamDef *def) {
+	CXTestParam param;
+	param.def = *def;
+	param.delta = 0;
+	param.animated = false;
+	g_cxHost.params.push_back(param);
+	return PF_Err_NONE;
+}
+
+static PF_ParamDef CX_HostParamAt(A_long index, A_long frame) {
+	const CXTestParam &param = g_cxHost.params[index];
+	PF_ParamDef def = param.def;
+	if (param.animated) {
+		def.u.fs_d.value += param.delta * frame;
+	}
+	return def;
+}
+
+static PF_Err CX_HostCheckoutParam(PF_ProgPtr, A_long index, A_long time, A_long step, A_u_long, PF_ParamDef *param) {
+	if (index < 0 || index >= (A_long)g_cxHost.params.size()) return PF_Err_INVALID_INDEX;
+	{
+		std::lock_guard<std::mutex> lock(g_cxHost.mutex);
+		g_cxHost.checkouts++;
+	}
+	*param = CX_HostParamAt(index, step ? time / step : time);
+	return PF_Err_NONE;
+}
+
+static PF_Err CX_HostCheckinParam(PF_ProgPtr, PF_ParamDef *) {
+	return PF_Err_NONE;
+}
+
+static PF_Handle CX_HostNewHandle(A_HandleSize size) {
+	void **handle = static_cast<void**>(malloc(sizeof(void*)));
+	*handle = calloc(1, size ? size : 1);
+	return handle;
+}
+
+static void *CX_HostLockHandle(PF_Handle handle) {
+	return handle ? *handle : NULL;
+}
+
+static void CX_HostUnlockHandle(PF_Handle) {}
+
+static void CX_HostDisposeHandle(PF_Handle handle) {
+	if (!handle) return;
+	free(*handle);
+	free(handle);
+}
+
+static A_HandleSize CX_HostHandleSize(PF_Handle) {
+	return 0;
+}
+
+static PF_Err CX_HostNewWorldOf(A_long width, A_long height, CXTestFormat format, PF_EffectWorld *world) {
+	memset(world, 0, sizeof(*world));
+	world->width = width;
+	world->height = height;
+	world->rowbytes = width * CX_TestPixelBytes(format) + 48;	// Padded like AE's worlds
+	world->data = calloc((size_t)world->rowbytes * height, 1);
+	world->extent_hint.right = width;
+	world->extent_hint.bottom = height;
+	world->pix_aspect_ratio.num = 1;
+	world->pix_aspect_ratio.den = 1;
+	if (!world->data) return PF_Err_OUT_OF_MEMORY;
+	std::lock_guard<std::mutex> lock(g_cxHost.mutex);
+	g_cxHost.worlds[world] = format;
+	return PF_Err_NONE;
+}
+
+static PF_Err CX_HostNewWorld(PF_ProgPtr, A_long width, A_long height, PF_Boolean, PF_PixelFormat format, PF_EffectWorld *world) {
+	CXTestFormat testFormat = format == PF_PixelFormat_ARGB32 ? CX_TEST_ARGB32 :
+	                          format == PF_PixelFormat_ARGB64 ? CX_TEST_ARGB64 : CX_TEST_ARGB128;
+	return CX_HostNewWorldOf(width, height, testFormat, world);
+}
+
+static PF_Err CX_HostDisposeWorld(PF_ProgPtr, PF_EffectWorld *world) {
+	free(world->data);
+	world->data = NULL;
+	std::lock_guard<std::mutex> lock(g_cxHost.mutex);
+	g_cxHost.worlds.erase(world);
+	return PF_Err_NONE;
+}
+
+static bool CX_HostWorldFormat(const PF_EffectWorld *world, CXTestFormat *format) {
+	std::lock_guard<std::mutex> lock(g_cxHost.mutex);
+	std::map<const PF_EffectWorld*, CXTestFormat>::const_iterator it = g_cxHost.worlds.find(world);
+	if (it == g_cxHost.worlds.end()) return false;
+	*format = it->second;
+	return true;
+}
+
+// AE only knows ARGB; Premiere's BGRA worlds report no AE format
+static PF_Err CX_HostGetPixelFormat(const PF_EffectWorld *world, PF_PixelFormat *format) {
+	CXTestFormat testFormat;
+	if (!CX_HostWorldFormat(world, &testFormat)) return PF_Err_BAD_CALLBACK_PARAM;
+	switch (testFormat) {
+		case CX_TEST_ARGB32: *format = PF_PixelFormat_ARGB32; break;
+		case CX_TEST_ARGB64: *format = PF_PixelFormat_ARGB64; break;
+		case CX_TEST_ARGB128: *format = PF_PixelFormat_ARGB128; break;
+		default: *format = PF_PixelFormat_INVALID; break;
+	}
+	return PF_Err_NONE;
+}
+
+// Interleaved over the host's threads, like AE's render threads
+static PF_Err CX_HostIterateGeneric(A_long iterations, void *refcon, PF_Err (*fn)(void*, A_long, A_long, A_long)) {
+	const int threads = std::max(1, g_cxHost.threads);
+	std::vector<std::thread> workers;
+	std::vector<PF_Err> errs(threads, PF_Err_NONE);
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([&, t] {
+			for (A_long i = t; i < iterations; i += threads) {
+				PF_Err err = fn(refcon, t, i, iterations);
+				if (err) errs[t] = err;
+			}
+		});
+	}
+	for (std::thread &worker : workers) worker.join();
+	for (PF_Err err : errs) {
+		if (err) return err;
+	}
+	return PF_Err_NONE;
+}
+
+static PF_Err CX_HostUpdateParamUI(PF_ProgPtr, A_long, const PF_ParamDef*) {
+	return PF_Err_NONE;
+}
+
+static void CX_HostHashState(A_u_longlong *hash, const void *data, size_t bytes) {
+	const A_u_char *p = static_cast<const A_u_char*>(data);
+	for (size_t i = 0; i < bytes; i++) {
+		*hash = (*hash ^ p[i]) * 0x100000001B3ULL;
+	}
+}
+
+// Over all time an animated param hashes its animation; over one frame, its value then
+static void CX_HostHashParamState(A_u_longlong *hash, A_long index, const A_Time *start) {
+	const CXTestParam &param = g_cxHost.params[index];
+	CX_HostHashState(hash, &index, sizeof(index));
+	if (param.animated && !start) {
+		CX_HostHashState(hash, "keys", 4);
+		CX_HostHashState(hash, &param.def.u, sizeof(param.def.u));
+		CX_HostHashState(hash, &param.delta, sizeof(param.delta));
+		return;
+	}
+	PF_ParamDef def = CX_HostParamAt(index, start ? start->value : 0);
+	CX_HostHashState(hash, &def.u, sizeof(def.u));
+}
+
+static PF_Err CX_HostGetCurrentState(PF_ProgPtr, A_long index, const A_Time *start, const A_Time *, PF_State *state) {
+	A_u_longlong hash = 14695981039346656037ULL;
+	if (index == PF_ParamIndex_CHECK_ALL || index == PF_ParamIndex_CHECK_ALL_EXCEPT_LAYER_PARAMS) {
+		for (A_long i = 0; i < (A_long)g_cxHost.params.size(); i++) {
+			if (index == PF_ParamIndex_CHECK_ALL_EXCEPT_LAYER_PARAMS && g_cxHost.params[i].def.param_type == PF_Param_LAYER) continue;
+			CX_HostHashParamState(&hash, i, start);
+		}
+	} else if (index >= 0 && index < (A_long)g_cxHost.params.size()) {
+		CX_HostHashParamState(&hash, index, start);
+	} else {
+		return PF_Err_INVALID_INDEX;
+	}
+	memset(state, 0, sizeof(*state));
+	memcpy(state->data, &hash, sizeof(hash));
+	return PF_Err_NONE;
+}
+
+static PF_Err CX_HostAreStatesIdentical(PF_ProgPtr, const PF_State *a, const PF_State *b, A_Boolean *identical) {
+	*identical = memcmp(a, b, sizeof(*a)) == 0;
+	return PF_Err_NONE;
+}
+
+static PF_Err CX_HostAddPixelFormat(PF_ProgPtr, PrPixelFormat) {
+	g_cxHost.premiereFormats++;
+	return PF_Err_NONE;
+}
+
+static PF_Err CX_HostClearPixelFormats(PF_ProgPtr) {
+	g_cxHost.premiereFormats = 0;
+	return PF_Err_NONE;
+}
+
+static PF_Err CX_HostGetPremiereFormat(PF_EffectWorld *world, PrPixelFormat *format) {
+	CXTestFormat testFormat;
+	if (!CX_HostWorldFormat(world, &testFormat)) return PF_Err_BAD_CALLBACK_PARAM;
+	*format = testFormat == CX_TEST_BGRA_8U ? PrPixelFormat_BGRA_4444_8u :
+	          testFormat == CX_TEST_BGRA_32F ? PrPixelFormat_BGRA_4444_32f : PrPixelFormat_Invalid;
+	return PF_Err_NONE;
+}
+
+template<> PF_HandleSuite1 *CXStubSuite<PF_HandleSuite1>() {
+	static PF_HandleSuite1 suite = { CX_HostNewHandle, CX_HostLockHandle, CX_HostUnlockHandle,
+	                                 CX_HostDisposeHandle, CX_HostHandleSize };
+	return &suite;
+}
+
+template<> PF_WorldSuite2 *CXStubSuite<PF_WorldSuite2>() {
+	static PF_WorldSuite2 suite = { CX_HostNewWorld, CX_HostDisposeWorld, CX_HostGetPixelFormat };
+	return &suite;
+}
+
+template<> PF_Iterate8Suite2 *CXStubSuite<PF_Iterate8Suite2>() {
+	static PF_Iterate8Suite2 suite = { CX_HostIterateGeneric };
+	return &suite;
+}
+
+template<> PF_ParamUtilsSuite3 *CXStubSuite<PF_ParamUtilsSuite3>() {
+	static PF_ParamUtilsSuite3 suite = { CX_HostUpdateParamUI, CX_HostGetCurrentState, CX_HostAreStatesIdentical };
+	return &suite;
+}
+
+template<> PF_PixelFormatSuite1 *CXStubSuite<PF_PixelFormatSuite1>() {
+	static PF_PixelFormatSuite1 suite = { CX_HostAddPixelFormat, CX_HostClearPixelFormats, CX_HostGetPremiereFormat };
+	return &suite;
+}
+
+// Tests of the shared caches alone switch AE's compute cache on here
+static inline void CX_TestUseComputeCache(bool enabled) {
+	g_cxHost.computeCache = enabled;
+}
+
+// Only the compute cache is acquired by name; hosts without it refuse
+PF_Err AEFX_AcquireSuite(PF_InData *, PF_OutData *, const char *name, int, const char *, void **suite) {
+	*suite = NULL;
+	if (g_cxHost.computeCache && !strcmp(name, kAEGPComputeCacheSuite)) {
+		*suite = CXFakeComputeCache::Get().Suite();
+		return PF_Err_NONE;
+	}
+	return PF_Err_BAD_CALLBACK_PARAM;
+}
+
+PF_Err AEFX_ReleaseSuite(PF_InData *, PF_OutData *, const char *, int, const char *) {
+	return PF_Err_NONE;
+}
+
+#ifndef CX_STUB_NO_UNION_LRECT
+void UnionLRect(const PF_LRect *src, PF_LRect *dst) {
+	if (src->left < dst->left) dst->left = src->left;
+	if (src->top < dst->top) dst->top = src->top;
+	if (src->right > dst->right) dst->right = src->right;
+	if (src->bottom > dst->bottom) dst->bottom = src->bottom;
+}
+#endif
+
+// ============================================================================
+// Synthetic cels
+// ============================================================================
+
+template<typename Pixel>
+static void CX_TestSetPixel(Pixel *p, int r, int g, int b, int a);
+
+template<> void CX_TestSetPixel(PF_Pixel8 *p, int r, int g, int b, int a) {
+	p->red = (A_u_char)r; p->green = (A_u_char)g; p->blue = (A_u_char)b; p->alpha = (A_u_char)a;
+}
+
+template<> void CX_TestSetPixel(PF_Pixel16 *p, int r, int g, int b, int a) {
+	p->red = (A_u_short)(r * PF_MAX_CHAN16 / 255); p->green = (A_u_short)(g * PF_MAX_CHAN16 / 255);
+	p->blue = (A_u_short)(b * PF_MAX_CHAN16 / 255); p->alpha = (A_u_short)(a * PF_MAX_CHAN16 / 255);
+}
+
+template<> void CX_TestSetPixel(PF_PixelFloat *p, int r, int g, int b, int a) {
+	p->red = r / 255.f; p->green = g / 255.f; p->blue = b / 255.f; p->alpha = a / 255.f;
+}
+
+// Flat regions crossed by dark and red lines, with transparent and
+// half-transparent patches. Equal seeds give equal cels.
+template<typename Pixel>
+static void CX_TestFillCel(PF_EffectWorld *world, int seed) {
+	for (A_long y = 0; y < world->height; y++) {
+		Pixel *row = reinterpret_cast<Pixel*>(static_cast<char*>(world->data) + (size_t)y * world->rowbytes);
+		for (A_long x = 0; x < world->width; x++) {
+			int r = (x * 7 / (world->width + 1)) * 30 + 40;
+			int g = (y * 5 / (world->height + 1)) * 40 + 30;
+			int b = ((x + y) % 97 < 50) ? 200 : 120;
+			int a = 255;
+			int dark = abs((x - world->width / 2) * 3 + (y - world->height / 3) * 2 + seed) % 61;
+			if (dark < 3) r = g = b = dark * 10;
+			if (abs(x * x / 37 + y - seed) % 83 < 2) { r = 250; g = 10; b = 10; }
+			if ((x / 13 + y / 11) % 19 == 0) a = 0;
+			else if ((x / 13 + y / 11) % 23 == 0) a = 128;
+			CX_TestSetPixel(row + x, r, g, b, a);
+		}
+	}
+}
+
+// ARGB <-> BGRA in place: the channel order reverses
+static void CX_TestSwapChannels(PF_EffectWorld *world, int channelBytes) {
+	for (A_long y = 0; y < world->height; y++) {
+		char *row = static_cast<char*>(world->data) + (size_t)y * world->rowbytes;
+		for (A_long x = 0; x < world->width; x++) {
+			char *p = row + (size_t)x * 4 * channelBytes;
+			char pixel[16];
+			memcpy(pixel, p, 4 * channelBytes);
+			for (int c = 0; c < 4; c++) {
+				memcpy(p + c * channelBytes, pixel + (3 - c) * channelBytes, channelBytes);
+			}
+		}
+	}
+}
+
+// ============================================================================
+// CXTestHost
+// ============================================================================
+
+class CXTestHost {
+public:
+	explicit CXTestHost(CXTestFormat format, bool computeCache = false, int threads = 4)
+		: m_format(format) {
+		g_cxHost.params.clear();
+		g_cxHost.worlds.clear();
+		g_cxHost.checkouts = 0;
+		g_cxHost.threads = threads;
+		g_cxHost.computeCache = computeCache;
+		g_cxHost.premiereFormats = 0;
+
+		memset(&m_in, 0, sizeof(m_in));
+		memset(&m_out, 0, sizeof(m_out));
+		m_in.inter.add_param = CX_HostAddParam;
+		m_in.inter.checkout_param = CX_HostCheckoutParam;
+		m_in.inter.checkin_param = CX_HostCheckinParam;
+		m_in.appl_id = CX_TestIsPremiere(format) ? 'PrMr' : 'FXTC';
+		m_in.time_step = 1;
+		m_in.time_scale = 24;
+		m_in.downsample_x.num = m_in.downsample_x.den = 1;
+		m_in.downsample_y.num = m_in.downsample_y.den = 1;
+		memset(&m_input, 0, sizeof(m_input));
+		memset(&m_output, 0, sizeof(m_output));
+	}
+
+	~CXTestHost() {
+		if (m_in.global_data) {
+			EffectMain(PF_Cmd_GLOBAL_SETDOWN, &m_in, &m_out, NULL, NULL, NULL);
+		}
+		if (m_input.data) CX_HostDisposeWorld(NULL, &m_input);
+		if (m_output.data) CX_HostDisposeWorld(NULL, &m_output);
+	}
+
+	// GlobalSetup and ParamsSetup; the input layer is param 0
+	PF_Err Setup() {
+		PF_Err err = EffectMain(PF_Cmd_GLOBAL_SETUP, &m_in, &m_out, NULL, NULL, NULL);
+		if (err) return err;
+		m_in.global_data = m_out.global_data;
+
+		PF_ParamDef layer;
+		memset(&layer, 0, sizeof(layer));
+		layer.param_type = PF_Param_LAYER;
+		CX_HostAddParam(NULL, 0, &layer);
+		err = EffectMain(PF_Cmd_PARAMS_SETUP, &m_in, &m_out, NULL, NULL, NULL);
+		if (!err && CX_TestIsPremiere(m_format) && g_cxHost.premiereFormats != 2) {
+			err = PF_Err_INTERNAL_STRUCT_DAMAGED;
+		}
+		return err;
+	}
+
+	PF_ParamDef &Param(A_long index) {
+		return g_cxHost.params[index].def;
+	}
+
+	// The float slider at index changes by delta every frame
+	void Animate(A_long index, PF_FpLong delta) {
+		g_cxHost.params[index].animated = true;
+		g_cxHost.params[index].delta = delta;
+	}
+
+	long Checkouts() const {
+		return g_cxHost.checkouts;
+	}
+
+	// Params with a value: not the input layer or a group topic/end
+	A_long ValueParams() const {
+		A_long count = 0;
+		for (const CXTestParam &param : g_cxHost.params) {
+			switch (param.def.param_type) {
+				case PF_Param_LAYER:
+				case PF_Param_GROUP_START:
+				case PF_Param_GROUP_END:
+					break;
+				default:
+					count++;
+			}
+		}
+		return count;
+	}
+
+	// Renders one frame of a cel drawn from seed; the output comes back as
+	// packed ARGB rows, whatever order the host renders in.
+	PF_Err Render(A_long frame, int seed, A_long width, A_long height, std::vector<A_u_char> *pixels) {
+		PF_Err err = PrepareWorlds(width, height);
+		if (err) return err;
+
+		const int bytes = CX_TestPixelBytes(m_format);
+		switch (CX_TestBitDepth(m_format)) {
+			case 8: CX_TestFillCel<PF_Pixel8>(&m_input, seed); break;
+			case 16: CX_TestFillCel<PF_Pixel16>(&m_input, seed); break;
+			default: CX_TestFillCel<PF_PixelFloat>(&m_input, seed); break;
+		}
+		for (A_long y = 0; y < height; y++) {
+			memset(static_cast<char*>(m_output.data) + (size_t)y * m_output.rowbytes, 0xCD, m_output.rowbytes);
+		}
+
+		m_in.current_time = frame * m_in.time_step;
+		m_in.width = width;
+		m_in.height = height;
+		if (CX_TestIsPremiere(m_format)) {
+			err = RenderPremiere(bytes / 4);
+		} else {
+			err = RenderSmart();
+		}
+		if (err) return err;
+
+		pixels->resize((size_t)width * height * bytes);
+		for (A_long y = 0; y < height; y++) {
+			memcpy(&(*pixels)[(size_t)y * width * bytes],
+			       static_cast<const char*>(m_output.data) + (size_t)y * m_output.rowbytes, (size_t)width * bytes);
+		}
+		return PF_Err_NONE;
+	}
+
+private:
+	PF_Err PrepareWorlds(A_long width, A_long height) {
+		if (m_input.data && m_input.width == width && m_input.height == height) return PF_Err_NONE;
+		if (m_input.data) CX_HostDisposeWorld(NULL, &m_input);
+		if (m_output.data) CX_HostDisposeWorld(NULL, &m_output);
+		PF_Err err = CX_HostNewWorldOf(width, height, m_format, &m_input);
+		if (!err) err = CX_HostNewWorldOf(width, height, m_format, &m_output);
+		return err;
+	}
+
+	PF_Err RenderPremiere(int channelBytes) {
+		CX_TestSwapChannels(&m_input, channelBytes);
+		std::vector<PF_ParamDef> defs;
+		for (A_long i = 0; i < (A_long)g_cxHost.params.size(); i++) {
+			defs.push_back(CX_HostParamAt(i, m_in.current_time / m_in.time_step));
+		}
+		defs[0].u.ld = m_input;
+		std::vector<PF_ParamDef*> params;
+		for (PF_ParamDef &def : defs) params.push_back(&def);
+
+		// The input param is a copy: it must resolve to the same format
+		{
+			std::lock_guard<std::mutex> lock(g_cxHost.mutex);
+			g_cxHost.worlds[&defs[0].u.ld] = m_format;
+		}
+		PF_Err err = EffectMain(PF_Cmd_RENDER, &m_in, &m_out, params.data(), &m_output, NULL);
+		{
+			std::lock_guard<std::mutex> lock(g_cxHost.mutex);
+			g_cxHost.worlds.erase(&defs[0].u.ld);
+		}
+		if (!err) CX_TestSwapChannels(&m_output, channelBytes);
+		return err;
+	}
+
+	PF_Err RenderSmart() {
+		const A_long width = m_input.width, height = m_input.height;
+		PF_PreRenderCallbacks preCallbacks = { CheckoutLayer, GuidMixIn };
+		PF_SmartRenderCallbacks renderCallbacks = { CheckoutLayerPixels, CheckinLayerPixels, CheckoutOutput };
+
+		PF_PreRenderInput preInput;
+		memset(&preInput, 0, sizeof(preInput));
+		preInput.output_request.rect.right = width;
+		preInput.output_request.rect.bottom = height;
+		preInput.bitdepth = (short)CX_TestBitDepth(m_format);
+		PF_PreRenderOutput preOutput;
+		memset(&preOutput, 0, sizeof(preOutput));
+		PF_PreRenderExtra preExtra = { &preInput, &preOutput, &preCallbacks };
+
+		s_current = this;
+		PF_Err err = EffectMain(PF_Cmd_SMART_PRE_RENDER, &m_in, &m_out, NULL, NULL, &preExtra);
+		if (!err) {
+			PF_SmartRenderInput renderInput;
+			memset(&renderInput, 0, sizeof(renderInput));
+			renderInput.output_request = preInput.output_request;
+			renderInput.bitdepth = preInput.bitdepth;
+			renderInput.pre_render_data = preOutput.pre_render_data;
+			PF_SmartRenderExtra renderExtra = { &renderInput, &renderCallbacks };
+			err = EffectMain(PF_Cmd_SMART_RENDER, &m_in, &m_out, NULL, NULL, &renderExtra);
+		}
+		if (preOutput.delete_pre_render_data_func) {
+			preOutput.delete_pre_render_data_func(preOutput.pre_render_data);
+		}
+		s_current = NULL;
+		return err;
+	}
+
+	static PF_Err CheckoutLayer(PF_ProgPtr, A_long, A_long, const PF_RenderRequest *, A_long, A_long, A_u_long,
+	                            PF_CheckoutResult *result) {
+		memset(result, 0, sizeof(*result));
+		result->result_rect.right = s_current->m_input.width;
+		result->result_rect.bottom = s_current->m_input.height;
+		result->max_result_rect = result->result_rect;
+		result->par.num = 1;
+		result->par.den = 1;
+		return PF_Err_NONE;
+	}
+
+	static PF_Err GuidMixIn(PF_ProgPtr, A_u_long, const void *) {
+		return PF_Err_NONE;
+	}
+
+	static PF_Err CheckoutLayerPixels(PF_ProgPtr, A_long, PF_EffectWorld **pixels) {
+		*pixels = &s_current->m_input;
+		return PF_Err_NONE;
+	}
+
+	static PF_Err CheckinLayerPixels(PF_ProgPtr, A_long) {
+		return PF_Err_NONE;
+	}
+
+	static PF_Err CheckoutOutput(PF_ProgPtr, PF_EffectWorld **output) {
+		*output = &s_current->m_output;
+		return PF_Err_NONE;
+	}
+
+	static CXTestHost	*s_current;
+
+	CXTestFormat	m_format;
+	PF_InData		m_in;
+	PF_OutData		m_out;
+	PF_EffectWorld	m_input;
+	PF_EffectWorld	m_output;
+};
+
+CXTestHost *CXTestHost::s_current = NULL;
+
+#endif // CX_TEST_HOST_H
@@ -0,0 +1,526 @@
+/*
+	CXStubSDK.h
+
+	CX Animation Tools - Test Harness
+	The subset of the After Effects / Premiere SDK that the plugins and the
+	shared headers use, declared just far enough to build them on Linux.
+	Every SDK header the sources include maps to this file (see sdk/).
+
+	Layouts are NOT the SDK's: only names and types match. Nothing built
+	against this header can be loaded by a host; it only links with the
+	fake host in CXTestHost.h.
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#pragma once
+#ifndef CX_STUB_SDK_H
+#define CX_STUB_SDK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// ============================================================================
+// Basic types
+// ============================================================================
+
+typedef int32_t			A_long;
+typedef uint32_t		A_u_long;
+typedef int16_t			A_short;
+typedef uint16_t		A_u_short;
+typedef char			A_char;
+typedef unsigned char	A_u_char;
+typedef unsigned char	A_Boolean;
+typedef int32_t			A_Err;
+typedef int64_t			A_long_long;
+typedef uint64_t		A_u_longlong;
+typedef double			A_FpLong;
+typedef float			A_FpShort;
+typedef size_t			A_HandleSize;
+
+typedef A_Boolean		PF_Boolean;
+typedef double			PF_FpLong;
+typedef float			PF_FpShort;
+typedef A_long			PF_Err;
+typedef A_long			PF_Cmd;
+typedef void			**PF_Handle;
+typedef void			*PF_PixelPtr;
+
+#ifndef TRUE
+#define TRUE	1
+#define FALSE	0
+#endif
+
+#define DllExport
+
+#define A_Err_NONE		0
+#define A_Err_GENERIC	1
+#define A_Err_ALLOC		3
+
+typedef struct {
+	A_long	value;
+	A_u_long	scale;
+} A_Time;
+
+typedef struct {
+	A_long	bytes[4];
+} AEGP_GUID;
+
+// ============================================================================
+// Pixels and worlds
+// ============================================================================
+
+#define PF_MAX_CHAN8	255
+#define PF_MAX_CHAN16	32768
+#define PF_HALF_CHAN16	16384
+
+typedef struct {
+	A_u_char	alpha, red, green, blue;
+} PF_Pixel;
+typedef PF_Pixel PF_Pixel8;
+
+typedef struct {
+	A_u_short	alpha, red, green, blue;
+} PF_Pixel16;
+
+typedef struct {
+	PF_FpShort	alpha, red, green, blue;
+} PF_PixelFloat;
+typedef PF_PixelFloat PF_Pixel32;
+
+typedef struct {
+	A_long	left, top, right, bottom;
+} PF_LRect;
+typedef PF_LRect PF_Rect;
+typedef PF_LRect PF_UnionableRect;
+
+typedef struct {
+	A_long		num;
+	A_u_long	den;
+} PF_RationalScale;
+
+typedef struct {
+	void				*data;
+	A_long				rowbytes;
+	A_long				width;
+	A_long				height;
+	PF_UnionableRect	extent_hint;
+	PF_RationalScale	pix_aspect_ratio;
+	A_long				origin_x;
+	A_long				origin_y;
+	A_long				world_flags;
+} PF_EffectWorld;
+typedef PF_EffectWorld PF_LayerDef;
+
+typedef A_long PF_PixelFormat;
+enum {
+	PF_PixelFormat_ARGB32 = 0x61726762,
+	PF_PixelFormat_ARGB64,
+	PF_PixelFormat_ARGB128,
+	PF_PixelFormat_INVALID = 0x21215321
+};
+
+// ============================================================================
+// Params
+// ============================================================================
+
+typedef struct _PF_ProgPtr *PF_ProgPtr;
+struct PF_ParamDef;
+struct SPBasicSuite;
+
+typedef struct {
+	A_long	value;
+	A_long	valid_min, valid_max, slider_min, slider_max, dephault;
+} PF_SliderDef;
+
+typedef struct {
+	PF_FpLong	value;
+	PF_FpLong	valid_min, valid_max, slider_min, slider_max, dephault;
+	A_short		precision;
+	A_short		display_flags;
+	A_u_long	fs_flags;
+} PF_FloatSliderDef;
+
+typedef struct {
+	PF_Pixel	value;
+	PF_Pixel	dephault;
+} PF_ColorDef;
+
+typedef struct {
+	A_long		value;
+	A_long		num_choices;
+	A_long		dephault;
+	const char	*u;
+} PF_PopupDef;
+
+typedef struct {
+	A_long		value;
+	PF_Boolean	dephault;
+	const char	*u;
+} PF_CheckBoxDef;
+
+typedef union {
+	PF_SliderDef		sd;
+	PF_FloatSliderDef	fs_d;
+	PF_ColorDef			cd;
+	PF_PopupDef			pd;
+	PF_CheckBoxDef		bd;
+	PF_LayerDef			ld;
+} PF_ParamDefUnion;
+
+struct PF_ParamDef {
+	union {
+		A_long	id;
+		A_long	change_flags;
+	} uu;
+	A_long				ui_flags;
+	A_long				param_type;
+	A_char				name[32];
+	A_long				flags;
+	PF_ParamDefUnion	u;
+};
+
+enum {
+	PF_Param_LAYER = 0,
+	PF_Param_SLIDER,
+	PF_Param_CHECKBOX,
+	PF_Param_COLOR,
+	PF_Param_POPUP,
+	PF_Param_FLOAT_SLIDER,
+	PF_Param_GROUP_START,
+	PF_Param_GROUP_END
+};
+
+enum { PF_PUI_NONE = 0, PF_PUI_DISABLED = 1 << 5 };
+enum { PF_ParamFlag_START_COLLAPSED = 1 << 5, PF_ParamFlag_SUPERVISE = 1 << 6 };
+enum { PF_Precision_INTEGER = 0, PF_Precision_TENTHS, PF_Precision_HUNDREDTHS };
+enum { PF_ValueDisplayFlag_NONE = 0, PF_ValueDisplayFlag_PERCENT = 1 };
+
+#define PF_ParamIndex_CHECK_ALL							(-1)
+#define PF_ParamIndex_CHECK_ALL_EXCEPT_LAYER_PARAMS		(-2)
+
+typedef struct {
+	char	data[16];
+} PF_State;
+
+// ============================================================================
+// Commands, in/out data
+// ============================================================================
+
+enum {
+	PF_Err_NONE = 0,
+	PF_Err_OUT_OF_MEMORY = 4,
+	PF_Err_INTERNAL_STRUCT_DAMAGED = 512,
+	PF_Err_INVALID_INDEX,
+	PF_Err_UNRECOGNIZED_PARAM_TYPE,
+	PF_Err_INVALID_CALLBACK,
+	PF_Err_BAD_CALLBACK_PARAM
+};
+
+enum {
+	PF_Cmd_ABOUT = 0,
+	PF_Cmd_GLOBAL_SETUP,
+	PF_Cmd_GLOBAL_SETDOWN,
+	PF_Cmd_PARAMS_SETUP,
+	PF_Cmd_RENDER,
+	PF_Cmd_UPDATE_PARAMS_UI,
+	PF_Cmd_SMART_PRE_RENDER,
+	PF_Cmd_SMART_RENDER
+};
+
+enum {
+	PF_OutFlag_NON_PARAM_VARY = 1L << 2,
+	PF_OutFlag_PIX_INDEPENDENT = 1L << 10,
+	PF_OutFlag_SEND_UPDATE_PARAMS_UI = 1L << 17,
+	PF_OutFlag_DEEP_COLOR_AWARE = 1L << 25
+};
+
+enum {
+	PF_OutFlag2_SUPPORTS_SMART_RENDER = 1L << 10,
+	PF_OutFlag2_FLOAT_COLOR_AWARE = 1L << 12,
+	PF_OutFlag2_SUPPORTS_THREADED_RENDERING = 1L << 27
+};
+
+enum { PF_Stage_DEVELOP = 0, PF_Stage_ALPHA, PF_Stage_BETA, PF_Stage_RELEASE };
+enum { PF_Field_FRAME = 0 };
+
+#define PF_VERSION(VERS, SUBVERS, BUGVERS, STAGE, BUILD) \
+	((A_u_long)(((VERS) << 19) | ((SUBVERS) << 15) | ((BUGVERS) << 11) | ((STAGE) << 9) | (BUILD)))
+
+typedef struct {
+	PF_Err	(*checkout_param)(PF_ProgPtr, A_long index, A_long time, A_long step, A_u_long scale, PF_ParamDef *param);
+	PF_Err	(*checkin_param)(PF_ProgPtr, PF_ParamDef *param);
+	PF_Err	(*add_param)(PF_ProgPtr, A_long index, PF_ParamDef *def);
+} PF_InteractCallbacks;
+
+typedef struct {
+	PF_InteractCallbacks	inter;
+	PF_ProgPtr				effect_ref;
+	A_long					appl_id;
+	A_long					current_time;
+	A_long					time_step;
+	A_u_long				time_scale;
+	A_long					width;
+	A_long					height;
+	A_long					output_origin_x;
+	A_long					output_origin_y;
+	PF_RationalScale		downsample_x;
+	PF_RationalScale		downsample_y;
+	PF_Handle				global_data;
+	PF_Handle				sequence_data;
+} PF_InData;
+
+#define PF_MAX_EFFECT_MSG_LEN	255
+
+typedef struct {
+	A_u_long	my_version;
+	PF_Handle	global_data;
+	PF_Handle	sequence_data;
+	A_long		num_params;
+	A_long		out_flags;
+	A_long		out_flags2;
+	A_char		return_msg[PF_MAX_EFFECT_MSG_LEN + 1];
+} PF_OutData;
+
+// ============================================================================
+// SmartFX
+// ============================================================================
+
+typedef struct {
+	PF_LRect	rect;
+	A_long		field;
+	A_long		channel_mask;
+	PF_Boolean	preserve_rgb_of_zero_alpha;
+} PF_RenderRequest;
+
+typedef struct {
+	PF_LRect			result_rect;
+	PF_LRect			max_result_rect;
+	PF_RationalScale	par;
+	A_long				solid;
+	A_long				ref_width;
+	A_long				ref_height;
+} PF_CheckoutResult;
+
+typedef void (*PF_DeletePreRenderDataFunc)(void *pre_render_data);
+
+typedef struct {
+	PF_RenderRequest	output_request;
+	short				bitdepth;
+} PF_PreRenderInput;
+
+typedef struct {
+	PF_LRect					result_rect;
+	PF_LRect					max_result_rect;
+	PF_Boolean					solid;
+	A_long						flags;
+	void						*pre_render_data;
+	PF_DeletePreRenderDataFunc	delete_pre_render_data_func;
+} PF_PreRenderOutput;
+
+typedef struct {
+	PF_Err	(*checkout_layer)(PF_ProgPtr, A_long index, A_long checkout_id, const PF_RenderRequest *req,
+	                          A_long time, A_long step, A_u_long scale, PF_CheckoutResult *result);
+	PF_Err	(*GuidMixInPtr)(PF_ProgPtr, A_u_long size, const void *buf);
+} PF_PreRenderCallbacks;
+
+typedef struct {
+	PF_PreRenderInput		*input;
+	PF_PreRenderOutput		*output;
+	PF_PreRenderCallbacks	*cb;
+} PF_PreRenderExtra;
+
+typedef struct {
+	PF_RenderRequest	output_request;
+	short				bitdepth;
+	void				*pre_render_data;
+} PF_SmartRenderInput;
+
+typedef struct {
+	PF_Err	(*checkout_layer_pixels)(PF_ProgPtr, A_long checkout_id, PF_EffectWorld **pixels);
+	PF_Err	(*checkin_layer_pixels)(PF_ProgPtr, A_long checkout_id);
+	PF_Err	(*checkout_output)(PF_ProgPtr, PF_EffectWorld **output);
+} PF_SmartRenderCallbacks;
+
+typedef struct {
+	PF_SmartRenderInput		*input;
+	PF_SmartRenderCallbacks	*cb;
+} PF_SmartRenderExtra;
+
+// ============================================================================
+// Suites
+// ============================================================================
+
+#define kPFHandleSuite				"PF Handle Suite"
+#define kPFHandleSuiteVersion1		1
+#define kPFWorldSuite				"PF World Suite"
+#define kPFWorldSuiteVersion2		2
+#define kPFIterate8Suite			"PF Iterate8 Suite"
+#define kPFIterate8SuiteVersion2	2
+#define kPFParamUtilsSuite			"PF Param Utils Suite"
+#define kPFParamUtilsSuiteVersion3	3
+
+typedef struct {
+	PF_Handle		(*host_new_handle)(A_HandleSize size);
+	void			*(*host_lock_handle)(PF_Handle h);
+	void			(*host_unlock_handle)(PF_Handle h);
+	void			(*host_dispose_handle)(PF_Handle h);
+	A_HandleSize	(*host_get_handle_size)(PF_Handle h);
+} PF_HandleSuite1;
+
+typedef struct {
+	PF_Err	(*PF_NewWorld)(PF_ProgPtr, A_long width, A_long height, PF_Boolean clear, PF_PixelFormat format, PF_EffectWorld *world);
+	PF_Err	(*PF_DisposeWorld)(PF_ProgPtr, PF_EffectWorld *world);
+	PF_Err	(*PF_GetPixelFormat)(const PF_EffectWorld *world, PF_PixelFormat *format);
+} PF_WorldSuite2;
+
+typedef struct {
+	PF_Err	(*iterate_generic)(A_long iterations, void *refcon, PF_Err (*fn)(void *refcon, A_long thread, A_long i, A_long iterations));
+} PF_Iterate8Suite2;
+
+typedef struct {
+	PF_Err	(*PF_UpdateParamUI)(PF_ProgPtr, A_long index, const PF_ParamDef *def);
+	PF_Err	(*PF_GetCurrentState)(PF_ProgPtr, A_long index, const A_Time *start, const A_Time *duration, PF_State *state);
+	PF_Err	(*PF_AreStatesIdentical)(PF_ProgPtr, const PF_State *a, const PF_State *b, A_Boolean *identical);
+} PF_ParamUtilsSuite3;
+
+// The fake host hands out its suites through these
+template<typename Suite> Suite *CXStubSuite();
+template<> PF_HandleSuite1 *CXStubSuite<PF_HandleSuite1>();
+template<> PF_WorldSuite2 *CXStubSuite<PF_WorldSuite2>();
+template<> PF_Iterate8Suite2 *CXStubSuite<PF_Iterate8Suite2>();
+template<> PF_ParamUtilsSuite3 *CXStubSuite<PF_ParamUtilsSuite3>();
+
+PF_Err AEFX_AcquireSuite(PF_InData *in_data, PF_OutData *out_data, const char *name, int version,
+                         const char *error, void **suite);
+PF_Err AEFX_ReleaseSuite(PF_InData *in_data, PF_OutData *out_data, const char *name, int version,
+                         const char *error);
+
+template<typename Suite>
+class AEFX_SuiteScoper {
+public:
+	AEFX_SuiteScoper(const PF_InData *, const char *, int, const PF_OutData * = NULL, const char * = NULL)
+		: m_suite(CXStubSuite<Suite>()) {}
+
+	Suite *operator->() const { return m_suite; }
+	Suite *get() const { return m_suite; }
+
+private:
+	Suite	*m_suite;
+};
+
+// ============================================================================
+// Premiere pixel formats
+// ============================================================================
+
+typedef enum {
+	PrPixelFormat_BGRA_4444_8u = 1,
+	PrPixelFormat_BGRA_4444_32f,
+	PrPixelFormat_VUYA_4444_8u,
+	PrPixelFormat_Invalid = 0x7fffffff
+} PrPixelFormat;
+
+#define kPFPixelFormatSuite			"PF Pixel Format Suite"
+#define kPFPixelFormatSuiteVersion1	1
+
+typedef struct {
+	PF_Err	(*AddSupportedPixelFormat)(PF_ProgPtr, PrPixelFormat format);
+	PF_Err	(*ClearSupportedPixelFormats)(PF_ProgPtr);
+	PF_Err	(*GetPixelFormat)(PF_EffectWorld *world, PrPixelFormat *format);
+} PF_PixelFormatSuite1;
+
+template<> PF_PixelFormatSuite1 *CXStubSuite<PF_PixelFormatSuite1>();
+
+// ============================================================================
+// AEGP compute cache
+// ============================================================================
+
+#define kAEGPComputeCacheSuite			"AEGP Compute Cache Suite"
+#define kAEGPComputeCacheSuiteVersion1	2
+
+typedef struct _AEGP_CCComputeOptionsRefcon	*AEGP_CCComputeOptionsRefconP;
+typedef struct _AEGP_CCComputeValueRefcon	*AEGP_CCComputeValueRefconP;
+typedef struct _AEGP_CCCheckoutReceipt		*AEGP_CCCheckoutReceiptP;
+typedef AEGP_GUID							AEGP_CCComputeKey;
+typedef AEGP_CCComputeKey					*AEGP_CCComputeKeyP;
+
+typedef struct {
+	A_Err	(*generate_key)(AEGP_CCComputeOptionsRefconP options, AEGP_CCComputeKeyP key);
+	A_Err	(*compute)(AEGP_CCComputeOptionsRefconP options, AEGP_CCComputeValueRefconP *value);
+	size_t	(*approx_size_value)(AEGP_CCComputeValueRefconP value);
+	void	(*delete_compute_value)(AEGP_CCComputeValueRefconP value);
+} AEGP_ComputeCacheCallbacks;
+
+typedef struct {
+	A_Err	(*AEGP_ClassRegister)(const A_char *cache_id, const AEGP_ComputeCacheCallbacks *callbacks);
+	A_Err	(*AEGP_ClassUnregister)(const A_char *cache_id);
+	A_Err	(*AEGP_ComputeIfNeededAndCheckout)(const A_char *cache_id, AEGP_CCComputeOptionsRefconP options,
+	                                           bool wait, AEGP_CCCheckoutReceiptP *receipt);
+	A_Err	(*AEGP_CheckoutCached)(const A_char *cache_id, AEGP_CCComputeOptionsRefconP options,
+	                               AEGP_CCCheckoutReceiptP *receipt);
+	A_Err	(*AEGP_GetReceiptComputeValue)(const AEGP_CCCheckoutReceiptP receipt, AEGP_CCComputeValueRefconP *value);
+	A_Err	(*AEGP_CheckinComputeReceipt)(AEGP_CCCheckoutReceiptP receipt);
+} AEGP_ComputeCacheSuite1;
+
+// ============================================================================
+// Macros and registration
+// ============================================================================
+
+#define AEFX_CLR_STRUCT(STRUCT)	memset(&(STRUCT), 0, sizeof(STRUCT))
+#define ERR(FUNC)				do { if (!err) { err = (FUNC); } } while (0)
+#define PF_SPRINTF				sprintf
+#define PF_STRCPY				strcpy
+
+#define PF_CHECKOUT_PARAM(IN_DATA, INDEX, TIME, STEP, SCALE, PARAM) \
+	((IN_DATA)->inter.checkout_param((IN_DATA)->effect_ref, (INDEX), (TIME), (STEP), (SCALE), (PARAM)))
+#define PF_CHECKIN_PARAM(IN_DATA, PARAM) \
+	((IN_DATA)->inter.checkin_param((IN_DATA)->effect_ref, (PARAM)))
+#define PF_ADD_PARAM(IN_DATA, INDEX, DEF) \
+	((IN_DATA)->inter.add_param((IN_DATA)->effect_ref, (INDEX), (DEF)))
+
+// Param_Utils.h macros: expect `def`, `err` and `in_data` in scope
+#define CX_STUB_ADD(DEF_SETUP) \
+	do { DEF_SETUP; if ((err = PF_ADD_PARAM(in_data, -1, &def)) != PF_Err_NONE) return err; } while (0)
+
+#define PF_ADD_TOPIC(NAME, ID) \
+	CX_STUB_ADD(def.param_type = PF_Param_GROUP_START; PF_STRCPY(def.name, NAME); def.uu.id = (ID))
+#define PF_END_TOPIC(ID) \
+	CX_STUB_ADD(AEFX_CLR_STRUCT(def); def.param_type = PF_Param_GROUP_END; def.uu.id = (ID))
+#define PF_ADD_COLOR(NAME, RED, GREEN, BLUE, ID) \
+	CX_STUB_ADD(def.param_type = PF_Param_COLOR; PF_STRCPY(def.name, NAME); \
+	            def.u.cd.value.alpha = PF_MAX_CHAN8; def.u.cd.value.red = (RED); \
+	            def.u.cd.value.green = (GREEN); def.u.cd.value.blue = (BLUE); \
+	            def.u.cd.dephault = def.u.cd.value; def.uu.id = (ID))
+#define PF_ADD_FLOAT_SLIDERX(NAME, VALID_MIN, VALID_MAX, SLIDER_MIN, SLIDER_MAX, DFLT, PREC, DISP, FLAGS, ID) \
+	CX_STUB_ADD(def.param_type = PF_Param_FLOAT_SLIDER; PF_STRCPY(def.name, NAME); \
+	            def.u.fs_d.valid_min = (VALID_MIN); def.u.fs_d.valid_max = (VALID_MAX); \
+	            def.u.fs_d.slider_min = (SLIDER_MIN); def.u.fs_d.slider_max = (SLIDER_MAX); \
+	            def.u.fs_d.value = def.u.fs_d.dephault = (DFLT); def.u.fs_d.precision = (PREC); \
+	            def.u.fs_d.display_flags = (DISP); def.flags |= (FLAGS); def.uu.id = (ID))
+#define PF_ADD_SLIDER(NAME, VALID_MIN, VALID_MAX, SLIDER_MIN, SLIDER_MAX, DFLT, ID) \
+	CX_STUB_ADD(def.param_type = PF_Param_SLIDER; PF_STRCPY(def.name, NAME); \
+	            def.u.sd.valid_min = (VALID_MIN); def.u.sd.valid_max = (VALID_MAX); \
+	            def.u.sd.slider_min = (SLIDER_MIN); def.u.sd.slider_max = (SLIDER_MAX); \
+	            def.u.sd.value = def.u.sd.dephault = (DFLT); def.uu.id = (ID))
+#define PF_ADD_CHECKBOX(NAME, COMMENT, DFLT, FLAGS, ID) \
+	CX_STUB_ADD(def.param_type = PF_Param_CHECKBOX; PF_STRCPY(def.name, NAME); \
+	            def.u.bd.value = def.u.bd.dephault = (DFLT); def.flags |= (FLAGS); def.uu.id = (ID))
+#define PF_ADD_POPUP(NAME, CHOICES, DFLT, STRING, ID) \
+	CX_STUB_ADD(def.param_type = PF_Param_POPUP; PF_STRCPY(def.name, NAME); \
+	            def.u.pd.num_choices = (CHOICES); def.u.pd.value = def.u.pd.dephault = (DFLT); \
+	            def.u.pd.u = (STRING); def.uu.id = (ID))
+
+typedef void *PF_PluginDataPtr;
+typedef void *PF_PluginDataCB2;
+#define AE_RESERVED_INFO	8
+#define PF_REGISTER_EFFECT_EXT2(INPTR, CB, NAME, MATCH, CATEGORY, RESERVED, ENTRY, URL)	PF_Err_NONE
+
+// Smart_Utils.cpp, linked into both projects from the SDK's Util folder.
+// ColorLines keeps a static copy of its own, so its tests hide this one.
+#ifndef CX_STUB_NO_UNION_LRECT
+void UnionLRect(const PF_LRect *src, PF_LRect *dst);
+#endif
+
+#endif // CX_STUB_SDK_H
@@ -0,0 +1,2 @@
+// Stand-in for the SDK header of the same name; see CXStubSDK.h
+#include "CXStubSDK.h"
@@ -0,0 +1,151 @@
+/*
+	test_ColorLines.cpp
+
+	CX Animation Tools - Test Harness
+	ColorLines renders through its private stage cache and through AE's
+	compute cache, at a generous and at a tiny host budget, must match bit
+	for bit at every depth. Settings a render ignores must not cost it the
+	frame cache. Half Float Intermediates applies to Premiere's 32f renders
+	exactly as to AE's.
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#include "CXTestHost.h"
+#include "ColorLines.h"
+
+static const A_long kWidth = 160;
+static const A_long kHeight = 120;
+static const int kFrames = 6;
+
+// Black and red lines, an adjusted fill, Adaptive sampling
+static void SetupProject(CXTestHost *host) {
+	PF_Pixel black = { PF_MAX_CHAN8, 0, 0, 0 };
+	PF_Pixel red = { PF_MAX_CHAN8, 250, 10, 10 };
+	host->Param(COLORLINES_TARGET_COLOR).u.cd.value = black;
+	host->Param(COLORLINES_COLOR_TOLERANCE).u.fs_d.value = 10;
+	host->Param(COLOR_ENABLED_PARAM(2)).u.bd.value = TRUE;
+	host->Param(COLOR_PARAM(2)).u.cd.value = red;
+	host->Param(COLOR_TOLERANCE_PARAM(2)).u.fs_d.value = 10;
+	host->Param(COLORLINES_FILL_MODE).u.pd.value = FILL_MODE_ADAPTIVE;
+	host->Param(COLORLINES_CONTRAST).u.fs_d.value = 20;
+}
+
+// Held cel with a brightness ramp: stage products carry over between
+// frames, the finished frames do not
+static bool RenderSequence(CXTestFormat format, bool computeCache, size_t hostBudget,
+                           std::vector<std::vector<A_u_char>> *frames) {
+	CXFakeComputeCache::Get().SetBudget(hostBudget);
+	CXTestHost host(format, computeCache);
+	PF_Err err = host.Setup();
+	if (!err) {
+		SetupProject(&host);
+		host.Animate(COLORLINES_BRIGHTNESS, 5);
+	}
+	frames->assign(kFrames, std::vector<A_u_char>());
+	for (int frame = 0; frame < kFrames && !err; frame++) {
+		err = host.Render(frame, 11, kWidth, kHeight, &(*frames)[frame]);
+	}
+	CX_CHECK_ERR(err);
+	return !err;
+}
+
+static void TestPrivateAndHostCachesMatch(CXTestFormat format) {
+	std::vector<std::vector<A_u_char>> privateFrames, hostFrames, tinyFrames;
+
+	CXFakeComputeCache::Get().ResetStats();
+	if (!RenderSequence(format, false, (size_t)1 << 30, &privateFrames)) return;
+	CX_CHECK(CXFakeComputeCache::Get().GetStats().computes == 0);
+
+	CXFakeComputeCache::Get().ResetStats();
+	if (!RenderSequence(format, true, (size_t)1 << 30, &hostFrames)) return;
+	CXFakeComputeCache::Stats stats = CXFakeComputeCache::Get().GetStats();
+	CX_CHECK(stats.computes > 0);
+	CX_CHECK(stats.hits > 0);
+	CX_CHECK(stats.openReceipts == 0);
+
+	// Nothing fits: every store is evicted at once, under its own receipt
+	CXFakeComputeCache::Get().ResetStats();
+	if (!RenderSequence(format, true, 1024, &tinyFrames)) return;
+	stats = CXFakeComputeCache::Get().GetStats();
+	CX_CHECK(stats.evictions > 0);
+	CX_CHECK(stats.evictedCheckedOut > 0);
+	CX_CHECK(stats.deletes == stats.computes);
+	CXFakeComputeCache::Get().SetBudget((size_t)1 << 30);
+
+	for (int frame = 0; frame < kFrames; frame++) {
+		CX_CHECK(hostFrames[frame] == privateFrames[frame]);
+		CX_CHECK(tinyFrames[frame] == privateFrames[frame]);
+	}
+	// The ramp must show, or the comparison proves little
+	CX_CHECK(privateFrames[0] != privateFrames[kFrames - 1]);
+}
+
+// Renders frame 0, applies change, renders it again: returns whether the
+// second render looked up any stage, i.e. missed the frame cache
+static bool RerenderLooksUpStages(CXTestFormat format, A_long fillMode, void (*change)(CXTestHost*)) {
+	CXTestHost host(format, true);
+	CX_CHECK_ERR(host.Setup());
+	SetupProject(&host);
+	host.Param(COLORLINES_FILL_MODE).u.pd.value = fillMode;
+
+	std::vector<A_u_char> before, after;
+	CX_CHECK_ERR(host.Render(0, 11, kWidth, kHeight, &before));
+	change(&host);
+	CXFakeComputeCache::Get().ResetStats();
+	CX_CHECK_ERR(host.Render(0, 11, kWidth, kHeight, &after));
+	CXFakeComputeCache::Stats stats = CXFakeComputeCache::Get().GetStats();
+	return stats.hits + stats.misses + stats.computes > 0;
+}
+
+static void ToggleHalfFloat(CXTestHost *host) {
+	host->Param(COLORLINES_HALF_FLOAT).u.bd.value = !host->Param(COLORLINES_HALF_FLOAT).u.bd.value;
+}
+
+static void ChangeSampleCount(CXTestHost *host) {
+	host->Param(COLORLINES_SAMPLE_COUNT).u.sd.value += 4;
+}
+
+static void TestFrameKeySkipsInertSettings() {
+	CX_CHECK(!RerenderLooksUpStages(CX_TEST_ARGB32, FILL_MODE_ADAPTIVE, ToggleHalfFloat));
+	CX_CHECK(!RerenderLooksUpStages(CX_TEST_ARGB64, FILL_MODE_ADAPTIVE, ToggleHalfFloat));
+	CX_CHECK(RerenderLooksUpStages(CX_TEST_ARGB128, FILL_MODE_ADAPTIVE, ToggleHalfFloat));
+
+	CX_CHECK(!RerenderLooksUpStages(CX_TEST_ARGB32, FILL_MODE_NEAREST, ChangeSampleCount));
+	CX_CHECK(!RerenderLooksUpStages(CX_TEST_ARGB32, FILL_MODE_PUSH_PULL, ChangeSampleCount));
+	CX_CHECK(RerenderLooksUpStages(CX_TEST_ARGB32, FILL_MODE_ADAPTIVE, ChangeSampleCount));
+}
+
+// Single frame, Half Float on or off, in ARGB byte order whatever the host
+static bool RenderHalfFloat(CXTestFormat format, bool halfFloat, std::vector<A_u_char> *frame) {
+	CXTestHost host(format);
+	PF_Err err = host.Setup();
+	if (!err) {
+		SetupProject(&host);
+		host.Param(COLORLINES_HALF_FLOAT).u.bd.value = halfFloat;
+		err = host.Render(0, 11, kWidth, kHeight, frame);
+	}
+	CX_CHECK_ERR(err);
+	return !err;
+}
+
+static void TestHalfFloatInPremiere() {
+	std::vector<A_u_char> aeFull, aeHalf, premiereFull, premiereHalf;
+	if (!RenderHalfFloat(CX_TEST_ARGB128, false, &aeFull)) return;
+	if (!RenderHalfFloat(CX_TEST_ARGB128, true, &aeHalf)) return;
+	if (!RenderHalfFloat(CX_TEST_BGRA_32F, false, &premiereFull)) return;
+	if (!RenderHalfFloat(CX_TEST_BGRA_32F, true, &premiereHalf)) return;
+
+	CX_CHECK(aeHalf != aeFull);
+	CX_CHECK(premiereFull == aeFull);
+	CX_CHECK(premiereHalf == aeHalf);
+}
+
+int main() {
+	TestPrivateAndHostCachesMatch(CX_TEST_ARGB32);
+	TestPrivateAndHostCachesMatch(CX_TEST_ARGB64);
+	TestPrivateAndHostCachesMatch(CX_TEST_ARGB128);
+	TestFrameKeySkipsInertSettings();
+	TestHalfFloatInPremiere();
+	return CX_TestResult("test_ColorLines");
+}
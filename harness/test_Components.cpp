@@ -0,0 +1,174 @@
+/*
+	test_Components.cpp
+
+	CX Animation Tools - Test Harness
+	CXComponentLabeler against a brute-force 8-connected flood fill: labels,
+	count, boxes, pixel counts and mean colours must not depend on how many
+	bands the frame is cut into.
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#include "CXTestHost.h"
+#include "CXComponents.h"
+
+static A_u_long g_seed = 12345;
+
+static A_u_long NextRandom() {
+	g_seed ^= g_seed << 13;
+	g_seed ^= g_seed >> 17;
+	g_seed ^= g_seed << 5;
+	return g_seed;
+}
+
+// Components numbered 1..count in raster order of their first pixel
+static A_u_long FloodFill(const std::vector<A_u_char> &mask, A_long width, A_long height,
+                          std::vector<A_u_long> *labels, std::vector<CXComponentStats> *stats) {
+	labels->assign(mask.size(), 0);
+	stats->clear();
+	std::vector<size_t> stack;
+	A_u_long count = 0;
+	for (size_t start = 0; start < mask.size(); start++) {
+		if (!mask[start] || (*labels)[start]) continue;
+		count++;
+		CXComponentStats s;
+		memset(&s, 0, sizeof(s));
+		s.left = width;
+		s.top = height;
+		double red = 0, green = 0, blue = 0;
+
+		(*labels)[start] = count;
+		stack.push_back(start);
+		while (!stack.empty()) {
+			const size_t i = stack.back();
+			stack.pop_back();
+			const A_long x = (A_long)(i % width), y = (A_long)(i / width);
+			s.left = std::min(s.left, x);
+			s.top = std::min(s.top, y);
+			s.right = std::max(s.right, x + 1);
+			s.bottom = std::max(s.bottom, y + 1);
+			s.pixels++;
+			red += x;
+			green += y;
+			blue += (x + y) % 7;
+			for (A_long dy = -1; dy <= 1; dy++) {
+				for (A_long dx = -1; dx <= 1; dx++) {
+					const A_long nx = x + dx, ny = y + dy;
+					if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+					const size_t n = (size_t)ny * width + nx;
+					if (mask[n] && !(*labels)[n]) {
+						(*labels)[n] = count;
+						stack.push_back(n);
+					}
+				}
+			}
+		}
+		s.red = (float)(red / s.pixels);
+		s.green = (float)(green / s.pixels);
+		s.blue = (float)(blue / s.pixels);
+		stats->push_back(s);
+	}
+	return count;
+}
+
+static void TestMask(const std::vector<A_u_char> &mask, A_long width, A_long height) {
+	std::vector<A_u_long> expected;
+	std::vector<CXComponentStats> expectedStats;
+	const A_u_long count = FloodFill(mask, width, height, &expected, &expectedStats);
+
+	PF_Iterate8Suite2 *iterate = CXStubSuite<PF_Iterate8Suite2>();
+	for (A_long bands = 1; bands <= 20; bands++) {
+		std::vector<A_u_long> labels(mask.size(), 0xDEADBEEF);
+		CXComponentLabeler labeler(mask.data(), width, height, bands, labels.data());
+		CX_CHECK_ERR(iterate->iterate_generic(labeler.BandCount(), &labeler, CX_LabelComponentsBand));
+		CX_CHECK(labeler.Merge() == count);
+
+		// Integer colours sum exactly, whatever the order
+		struct RefconColor {
+			CXComponentLabeler	*labeler;
+			static PF_Err Resolve(void *refcon, A_long, A_long band, A_long) {
+				static_cast<RefconColor*>(refcon)->labeler->ResolveBand(band, [](A_long x, A_long y, float *rgb) {
+					rgb[0] = (float)x;
+					rgb[1] = (float)y;
+					rgb[2] = (float)((x + y) % 7);
+				});
+				return PF_Err_NONE;
+			}
+		} refcon = { &labeler };
+		CX_CHECK_ERR(iterate->iterate_generic(labeler.BandCount(), &refcon, RefconColor::Resolve));
+
+		std::vector<CXComponentStats> stats;
+		labeler.Finish(&stats);
+		CX_CHECK(labeler.Count() == count);
+		CX_CHECK(labels == expected);
+		CX_CHECK(stats.size() == expectedStats.size());
+		for (size_t c = 0; c < stats.size() && c < expectedStats.size(); c++) {
+			const CXComponentStats &a = stats[c], &b = expectedStats[c];
+			CX_CHECK(a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom);
+			CX_CHECK(a.pixels == b.pixels);
+			CX_CHECK(a.red == b.red && a.green == b.green && a.blue == b.blue);
+		}
+
+		// Without colours: same labels and boxes, colours stay 0
+		std::vector<A_u_long> plain(mask.size(), 0xDEADBEEF);
+		CXComponentLabeler plainLabeler(mask.data(), width, height, bands, plain.data());
+		CX_CHECK_ERR(iterate->iterate_generic(plainLabeler.BandCount(), &plainLabeler, CX_LabelComponentsBand));
+		CX_CHECK(plainLabeler.Merge() == count);
+		CX_CHECK_ERR(iterate->iterate_generic(plainLabeler.BandCount(), &plainLabeler, CX_ResolveComponentsBand));
+		std::vector<CXComponentStats> plainStats;
+		plainLabeler.Finish(&plainStats);
+		CX_CHECK(plain == expected);
+		CX_CHECK(plainStats.size() == expectedStats.size());
+		for (size_t c = 0; c < plainStats.size() && c < expectedStats.size(); c++) {
+			const CXComponentStats &a = plainStats[c], &b = expectedStats[c];
+			CX_CHECK(a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom);
+			CX_CHECK(a.pixels == b.pixels);
+			CX_CHECK(a.red == 0 && a.green == 0 && a.blue == 0);
+		}
+
+		if (g_cxFailures) {
+			fprintf(stderr, "mask %dx%d, %d bands\n", (int)width, (int)height, (int)bands);
+			return;
+		}
+	}
+}
+
+// Random specks at several densities, thin and tall frames, and strokes
+// that cross every band boundary
+static void TestRandomMasks() {
+	const A_long sizes[][2] = { { 1, 1 }, { 1, 37 }, { 41, 1 }, { 7, 5 }, { 64, 48 }, { 97, 83 }, { 200, 150 } };
+	const int densities[] = { 5, 30, 45, 55, 80 };
+	for (const A_long *size : sizes) {
+		for (int density : densities) {
+			const A_long width = size[0], height = size[1];
+			std::vector<A_u_char> mask((size_t)width * height);
+			for (A_u_char &m : mask) {
+				m = (NextRandom() % 100) < (A_u_long)density ? 255 : 0;
+			}
+			TestMask(mask, width, height);
+		}
+	}
+
+	// Diagonals and a spiral-like snake joined only across band edges
+	const A_long width = 120, height = 90;
+	std::vector<A_u_char> mask((size_t)width * height, 0);
+	for (A_long i = 0; i < std::min(width, height); i++) {
+		mask[(size_t)i * width + i] = 255;
+		mask[(size_t)i * width + (width - 1 - i)] = 255;
+	}
+	for (A_long y = 3; y < height - 3; y += 6) {
+		for (A_long x = 5; x < width - 5; x++) {
+			mask[(size_t)y * width + x] = 255;
+		}
+		const A_long edge = (y / 6) % 2 ? 5 : width - 6;
+		for (A_long k = 1; k < 6 && y + k < height; k++) {
+			mask[(size_t)(y + k) * width + edge] = 255;
+		}
+	}
+	TestMask(mask, width, height);
+}
+
+int main() {
+	TestRandomMasks();
+	return CX_TestResult("test_Components");
+}
@@ -0,0 +1,163 @@
+/*
+	test_ComputeCache.cpp
+
+	CX Animation Tools - Test Harness
+	CXComputeCache against both back ends: the private CXLRUCache and AE's
+	compute cache (CXFakeComputeCache.h).
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#include "CXTestHost.h"
+#include "CXComputeCache.h"
+
+#include <atomic>
+
+typedef CXComputeCache<std::vector<int>> TestCache;
+
+static CXCacheKey TestKey(int n) {
+	CXCacheKey key = { (uint64_t)n * 0x9E3779B97F4A7C15ULL + 1, (uint64_t)n };
+	return key;
+}
+
+static TestCache::ValuePtr TestValue(int n, size_t count) {
+	return std::make_shared<const std::vector<int>>(count, n);
+}
+
+// Same calls, same answers, with and without the host
+static void TestBackEndsAgree() {
+	for (int pass = 0; pass < 2; pass++) {
+		const bool host = pass == 1;
+		CX_TestUseComputeCache(host);
+		PF_InData in_data;
+		memset(&in_data, 0, sizeof(in_data));
+		CXFakeComputeCache::Get().SetBudget((size_t)1 << 30);
+		CXFakeComputeCache::Get().ResetStats();
+
+		TestCache cache("CX Test Values", (size_t)1 << 20);
+		cache.AttachHost(&in_data);
+		CX_CHECK(cache.UsesHost() == host);
+		CX_CHECK(CXFakeComputeCache::Get().ClassCount() == (host ? 1u : 0u));
+
+		for (int n = 0; n < 16; n++) {
+			bool reserved = false;
+			TestCache::ValuePtr hit = cache.FindOrReserve(TestKey(n), &reserved);
+			CX_CHECK(!hit && reserved);
+			cache.Insert(TestKey(n), TestValue(n, 64), 64 * sizeof(int));
+		}
+		for (int n = 0; n < 16; n++) {
+			bool reserved = false;
+			TestCache::ValuePtr hit = cache.FindOrReserve(TestKey(n), &reserved);
+			CX_CHECK(hit && !reserved && hit->size() == 64 && (*hit)[0] == n);
+		}
+		CX_CHECK(!cache.Find(TestKey(99)));
+
+		// A released reservation stores nothing
+		bool reserved = false;
+		CX_CHECK(!cache.FindOrReserve(TestKey(99), &reserved) && reserved);
+		cache.Release(TestKey(99));
+		CX_CHECK(!cache.Find(TestKey(99)));
+
+		if (host) {
+			CXFakeComputeCache::Stats stats = CXFakeComputeCache::Get().GetStats();
+			CX_CHECK(stats.computes == 16);
+			CX_CHECK(stats.hits >= 16);
+		}
+		cache.DetachHost(&in_data);
+		CX_CHECK(CXFakeComputeCache::Get().ClassCount() == 0);
+		if (host) {
+			CXFakeComputeCache::Stats stats = CXFakeComputeCache::Get().GetStats();
+			CX_CHECK(stats.deletes == stats.computes);
+			CX_CHECK(stats.openReceipts == 0);
+		}
+	}
+}
+
+// A budget below one value evicts each entry while its store still holds
+// the receipt. Values already handed out stay valid.
+static void TestEvictionWhileCheckedOut() {
+	CX_TestUseComputeCache(true);
+	PF_InData in_data;
+	memset(&in_data, 0, sizeof(in_data));
+	CXFakeComputeCache::Get().SetBudget(16);
+	CXFakeComputeCache::Get().ResetStats();
+
+	TestCache cache("CX Test Evicted", (size_t)1 << 20);
+	cache.AttachHost(&in_data);
+	CX_CHECK(cache.UsesHost());
+
+	TestCache::ValuePtr kept = TestValue(7, 1024);
+	cache.Insert(TestKey(7), kept, 1024 * sizeof(int));
+	CX_CHECK(!cache.Find(TestKey(7)));
+	CX_CHECK(kept.use_count() == 1 && (*kept)[1023] == 7);
+
+	// The key can be reserved and stored again
+	bool reserved = false;
+	CX_CHECK(!cache.FindOrReserve(TestKey(7), &reserved) && reserved);
+	cache.Insert(TestKey(7), TestValue(7, 1024), 1024 * sizeof(int));
+
+	CXFakeComputeCache::Stats stats = CXFakeComputeCache::Get().GetStats();
+	CX_CHECK(stats.computes == 2);
+	CX_CHECK(stats.evictedCheckedOut == 2);
+	CX_CHECK(stats.deletes == 2);
+	CX_CHECK(stats.openReceipts == 0);
+
+	cache.DetachHost(&in_data);
+	CXFakeComputeCache::Get().SetBudget((size_t)1 << 30);
+}
+
+// Many threads ask for one key at a time: exactly one computes it and the
+// rest get its value, through both back ends. Threads start staggered and
+// host lookups answer late, so some misses arrive after the value was
+// stored and its reservation released.
+static void TestOneComputePerKey() {
+	const int threads = 8;
+	const int keys = 200;
+	for (int pass = 0; pass < 2; pass++) {
+		const bool host = pass == 1;
+		CX_TestUseComputeCache(host);
+		PF_InData in_data;
+		memset(&in_data, 0, sizeof(in_data));
+		CXFakeComputeCache::Get().ResetStats();
+		CXFakeComputeCache::Get().SetLookupDelay(host ? 300 : 0);
+
+		TestCache cache("CX Test Race", (size_t)1 << 24);
+		cache.AttachHost(&in_data);
+		CX_CHECK(cache.UsesHost() == host);
+
+		std::atomic<int> computes(0), wrong(0);
+		for (int n = 0; n < keys; n++) {
+			std::vector<std::thread> workers;
+			for (int t = 0; t < threads; t++) {
+				workers.emplace_back([&, n, t] {
+					std::this_thread::sleep_for(std::chrono::microseconds(50 * t));
+					bool reserved = false;
+					TestCache::ValuePtr value = cache.FindOrReserve(TestKey(n), &reserved);
+					if (reserved) {
+						computes++;
+						std::this_thread::sleep_for(std::chrono::microseconds(50));
+						value = TestValue(n, 16);
+						cache.Insert(TestKey(n), value, 16 * sizeof(int));
+					}
+					if (!value || (*value)[0] != n) wrong++;
+				});
+			}
+			for (std::thread &worker : workers) worker.join();
+		}
+		CX_CHECK(computes.load() == keys);
+		CX_CHECK(wrong.load() == 0);
+		if (host) {
+			CX_CHECK(CXFakeComputeCache::Get().GetStats().computes == keys);
+		}
+
+		CXFakeComputeCache::Get().SetLookupDelay(0);
+		cache.DetachHost(&in_data);
+	}
+}
+
+int main() {
+	TestBackEndsAgree();
+	TestEvictionWhileCheckedOut();
+	TestOneComputePerKey();
+	return CX_TestResult("test_ComputeCache");
+}
@@ -0,0 +1,142 @@
+/*
+	test_PencilLine.cpp
+
+	CX Animation Tools - Test Harness
+	PencilLine renders through its private mask cache and through AE's
+	compute cache, at a generous and at a tiny host budget, must match bit
+	for bit at every depth. The param plan must check out only what is
+	animated once it is built, and render what a fresh read renders.
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#include "CXTestHost.h"
+#include "PencilLine.h"
+
+static const A_long kWidth = 160;
+static const A_long kHeight = 120;
+static const int kFrames = 6;
+
+// Black and red lines, widened and textured
+static void SetupProject(CXTestHost *host) {
+	PF_Pixel black = { PF_MAX_CHAN8, 0, 0, 0 };
+	PF_Pixel red = { PF_MAX_CHAN8, 250, 10, 10 };
+	host->Param(COLOR_ENABLED_PARAM(1)).u.bd.value = TRUE;
+	host->Param(COLOR_PARAM(1)).u.cd.value = black;
+	host->Param(COLOR_TOLERANCE_PARAM(1)).u.fs_d.value = 10;
+	host->Param(COLOR_ENABLED_PARAM(2)).u.bd.value = TRUE;
+	host->Param(COLOR_PARAM(2)).u.cd.value = red;
+	host->Param(COLOR_TOLERANCE_PARAM(2)).u.fs_d.value = 10;
+	host->Param(PENCILLINE_LINE_WIDTH).u.sd.value = 3;
+	host->Param(PENCILLINE_TEXTURE_STRENGTH).u.fs_d.value = 20;
+}
+
+// Held cel with a texture ramp: color masks carry over between frames,
+// the finished frames do not
+static bool RenderSequence(CXTestFormat format, bool computeCache, size_t hostBudget,
+                           std::vector<std::vector<A_u_char>> *frames) {
+	CXFakeComputeCache::Get().SetBudget(hostBudget);
+	CXTestHost host(format, computeCache);
+	PF_Err err = host.Setup();
+	if (!err) {
+		SetupProject(&host);
+		host.Animate(PENCILLINE_TEXTURE_STRENGTH, 8);
+	}
+	frames->assign(kFrames, std::vector<A_u_char>());
+	for (int frame = 0; frame < kFrames && !err; frame++) {
+		err = host.Render(frame, 11, kWidth, kHeight, &(*frames)[frame]);
+	}
+	CX_CHECK_ERR(err);
+	return !err;
+}
+
+static void TestPrivateAndHostCachesMatch(CXTestFormat format) {
+	std::vector<std::vector<A_u_char>> privateFrames, hostFrames, tinyFrames;
+
+	CXFakeComputeCache::Get().ResetStats();
+	if (!RenderSequence(format, false, (size_t)1 << 30, &privateFrames)) return;
+	CX_CHECK(CXFakeComputeCache::Get().GetStats().computes == 0);
+
+	CXFakeComputeCache::Get().ResetStats();
+	if (!RenderSequence(format, true, (size_t)1 << 30, &hostFrames)) return;
+	CXFakeComputeCache::Stats stats = CXFakeComputeCache::Get().GetStats();
+	CX_CHECK(stats.computes > 0);
+	CX_CHECK(stats.hits > 0);
+	CX_CHECK(stats.openReceipts == 0);
+
+	// Nothing fits: every store is evicted at once, under its own receipt
+	CXFakeComputeCache::Get().ResetStats();
+	if (!RenderSequence(format, true, 1024, &tinyFrames)) return;
+	stats = CXFakeComputeCache::Get().GetStats();
+	CX_CHECK(stats.evictions > 0);
+	CX_CHECK(stats.evictedCheckedOut > 0);
+	CX_CHECK(stats.deletes == stats.computes);
+	CXFakeComputeCache::Get().SetBudget((size_t)1 << 30);
+
+	for (int frame = 0; frame < kFrames; frame++) {
+		CX_CHECK(hostFrames[frame] == privateFrames[frame]);
+		CX_CHECK(tinyFrames[frame] == privateFrames[frame]);
+	}
+	// The ramp must show, or the comparison proves little
+	CX_CHECK(privateFrames[0] != privateFrames[kFrames - 1]);
+}
+
+// Checkouts per frame: all value params for the first, then only the
+// animated ones. Every frame matches a render by an instance that has
+// never seen the project before.
+static void TestParamPlan(A_long animated) {
+	std::vector<std::vector<A_u_char>> frames(kFrames);
+	{
+		CXTestHost host(CX_TEST_ARGB32);
+		CX_CHECK_ERR(host.Setup());
+		SetupProject(&host);
+		if (animated >= 0) host.Animate(animated, 2);
+
+		for (int frame = 0; frame < kFrames; frame++) {
+			const long before = host.Checkouts();
+			CX_CHECK_ERR(host.Render(frame, 11 + frame, kWidth, kHeight, &frames[frame]));
+			const long checkouts = host.Checkouts() - before;
+			if (frame == 0) {
+				CX_CHECK(checkouts == host.ValueParams());
+			} else {
+				CX_CHECK(checkouts == (animated >= 0 ? 1 : 0));
+			}
+		}
+	}
+
+	// One host at a time: each fresh instance renders a single frame
+	for (int frame = 0; frame < kFrames; frame++) {
+		CXTestHost host(CX_TEST_ARGB32);
+		CX_CHECK_ERR(host.Setup());
+		SetupProject(&host);
+		if (animated >= 0) host.Animate(animated, 2);
+		std::vector<A_u_char> fresh;
+		CX_CHECK_ERR(host.Render(frame, 11 + frame, kWidth, kHeight, &fresh));
+		CX_CHECK(fresh == frames[frame]);
+	}
+}
+
+// A changed static value misses the plan and is read again
+static void TestParamPlanChange() {
+	CXTestHost host(CX_TEST_ARGB32);
+	CX_CHECK_ERR(host.Setup());
+	SetupProject(&host);
+
+	std::vector<A_u_char> before, after;
+	CX_CHECK_ERR(host.Render(0, 11, kWidth, kHeight, &before));
+	host.Param(PENCILLINE_TEXTURE_STRENGTH).u.fs_d.value = 70;
+	const long checkouts = host.Checkouts();
+	CX_CHECK_ERR(host.Render(1, 11, kWidth, kHeight, &after));
+	CX_CHECK(host.Checkouts() - checkouts == host.ValueParams());
+	CX_CHECK(before != after);
+}
+
+int main() {
+	TestPrivateAndHostCachesMatch(CX_TEST_ARGB32);
+	TestPrivateAndHostCachesMatch(CX_TEST_ARGB64);
+	TestPrivateAndHostCachesMatch(CX_TEST_ARGB128);
+	TestParamPlan(-1);
+	TestParamPlan(COLOR_TOLERANCE_PARAM(1));
+	TestParamPlanChange();
+	return CX_TestResult("test_PencilLine");
+}
@@ -9,12 +9,28 @@
 	- Squared distance comparisons (avoid sqrt)
 	- Cached row pointers for faster pixel access
 	- Precomputed color adjustment factors
+	- Staged pipeline (distance -> mask -> fill -> adjust -> blur) with cached intermediates
+	- Per-colour palettes for distance and color adjustment on flat-colour cels
+	- Prescan that turns frames without line pixels into a plain copy
+	- Push-pull pyramid fill with cost independent of the line width
+	- Adaptive fill that stops at the first rings holding enough samples
+	- Wide fill and blur windows read from per-tile staging buffers
+	- Blur streams through horizontal bands instead of a full-frame buffer
+	- Optional strip rendering that keeps working memory under a budget
+	- Premiere's BGRA 8u/32f frames processed natively, without conversion
 */
 
 #include "ColorLines.h"
+#include <float.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 // ============================================================================
 // Precomputed Tables and Constants
@@ -24,16 +40,43 @@
 #define MAX_WEIGHT_TABLE_RADIUS 50
 #define WEIGHT_TABLE_SIZE ((MAX_WEIGHT_TABLE_RADIUS * 2 + 1) * (MAX_WEIGHT_TABLE_RADIUS * 2 + 1))
 
-// Precomputed inverse distance weights for weighted average mode
+// Memory budget for cached stage products (mask, fill, adjust, blur) on hosts
+// without AE's compute cache
+#define STAGE_CACHE_BUDGET (static_cast<size_t>(384) << 20)
+
+// Line pixels handled per parallel work item
+#define LINE_CHUNK_SIZE 2048
+
+// Distance plane values saturate here; 8-bit squared distances reach 3 * 255^2
+#define DISTANCE_SATURATED 65535
+
+// Work bands for the parallel distance histogram and the per-band palettes
+#define PALETTE_BANDS 16
+
+// Neighbourhood kernels with at least this radius run tile by tile from a
+// staged copy of the tile and its halo; smaller windows stay in cache anyway
+#define TILE_SIZE 64
+#define TILE_MIN_RADIUS 8
+
+// The blur streams through bands of this many tile rows; its dense frame only
+// covers one band plus the blur halo
+#define BLUR_BAND_TILE_ROWS 4
+
+// Strip renders never go below this many rows per strip; a budget too small
+// for them and their halos renders the whole frame instead
+#define STRIP_MIN_ROWS 64
+
+// Work bands for labelling the mask's connected components, and specks
+// cleared per parallel work item
+#define COMPONENT_BANDS 16
+#define SPECK_CHUNK_SIZE 256
+
+// Weight tables are built per render into caller-owned storage, so concurrent
+// frames with different radii never share a table.
 // Index: (dy + radius) * (radius * 2 + 1) + (dx + radius)
-static PF_FpLong g_invDistWeights[WEIGHT_TABLE_SIZE];
-static PF_FpLong g_gaussianWeights[WEIGHT_TABLE_SIZE];
-static A_long g_currentWeightRadius = 0;
-static A_long g_currentBlurRadius = 0;
 
 // Precompute inverse distance weight table
-static void PrecomputeInvDistWeights(A_long radius) {
-	if (radius == g_currentWeightRadius) return;
+static void PrecomputeInvDistWeights(A_long radius, PF_FpLong *weights) {
 	if (radius > MAX_WEIGHT_TABLE_RADIUS) radius = MAX_WEIGHT_TABLE_RADIUS;
 
 	A_long size = radius * 2 + 1;
@@ -41,19 +84,17 @@ static void PrecomputeInvDistWeights(A_long radius) {
 		for (A_long dx = -radius; dx <= radius; dx++) {
 			A_long idx = (dy + radius) * size + (dx + radius);
 			if (dx == 0 && dy == 0) {
-				g_invDistWeights[idx] = 0.0;
+				weights[idx] = 0.0;
 			} else {
 				PF_FpLong dist = sqrt((PF_FpLong)(dx * dx + dy * dy));
-				g_invDistWeights[idx] = 1.0 / (dist + 0.1);
+				weights[idx] = 1.0 / (dist + 0.1);
 			}
 		}
 	}
-	g_currentWeightRadius = radius;
 }
 
 // Precompute gaussian weight table for blur
-static void PrecomputeGaussianWeights(A_long blurRadius) {
-	if (blurRadius == g_currentBlurRadius) return;
+static void PrecomputeGaussianWeights(A_long blurRadius, PF_FpLong *weights) {
 	if (blurRadius > MAX_WEIGHT_TABLE_RADIUS) blurRadius = MAX_WEIGHT_TABLE_RADIUS;
 
 	A_long size = blurRadius * 2 + 1;
@@ -63,10 +104,9 @@ static void PrecomputeGaussianWeights(A_long blurRadius) {
 		for (A_long dx = -blurRadius; dx <= blurRadius; dx++) {
 			A_long idx = (dy + blurRadius) * size + (dx + blurRadius);
 			A_long distSq = dx * dx + dy * dy;
-			g_gaussianWeights[idx] = exp(-(PF_FpLong)distSq / sigma2);
+			weights[idx] = exp(-(PF_FpLong)distSq / sigma2);
 		}
 	}
-	g_currentBlurRadius = blurRadius;
 }
 
 // ============================================================================
@@ -92,36 +132,14 @@ static void UnionLRect(const PF_LRect *src, PF_LRect *dst) {
 	if (src->bottom > dst->bottom) dst->bottom = src->bottom;
 }
 
-// Fast mask access - no bounds check (caller ensures bounds)
-static inline A_u_char GetMaskAtFast(ColorLinesInfo *info, A_long x, A_long y) {
-	return info->lineMask[y * info->maskRowBytes + x];
-}
-
-static inline void SetMaskAtFast(ColorLinesInfo *info, A_long x, A_long y, A_u_char value) {
-	info->lineMask[y * info->maskRowBytes + x] = value;
-}
-
-// Safe mask access with bounds check
-static inline A_u_char GetMaskAt(ColorLinesInfo *info, A_long x, A_long y) {
-	if (x < 0 || x >= info->maskWidth || y < 0 || y >= info->maskHeight) return 0;
-	return info->lineMask[y * info->maskRowBytes + x];
-}
-
 // ============================================================================
 // Optimized Pixel Access - Direct pointer arithmetic
 // ============================================================================
 
 // Get row pointer once, then access pixels directly
-static inline PF_Pixel8* GetRow8(PF_EffectWorld *world, A_long y) {
-	return (PF_Pixel8*)((char*)world->data + y * world->rowbytes);
-}
-
-static inline PF_Pixel16* GetRow16(PF_EffectWorld *world, A_long y) {
-	return (PF_Pixel16*)((char*)world->data + y * world->rowbytes);
-}
-
-static inline PF_PixelFloat* GetRowFloat(PF_EffectWorld *world, A_long y) {
-	return (PF_PixelFloat*)((char*)world->data + y * world->rowbytes);
+template<typename P>
+static inline P* GetRow(const PF_EffectWorld *world, A_long y) {
+	return (P*)((char*)world->data + y * world->rowbytes);
 }
 
 // ============================================================================
@@ -177,40 +195,80 @@ static void HSLtoRGB(PF_FpLong h, PF_FpLong s, PF_FpLong l, PF_FpLong *r, PF_FpL
 // Optimized Color Matching - Use squared distance
 // ============================================================================
 
-// All color matching is done in 8-bit space to match AE color picker behavior
-static inline PF_Boolean IsTargetColor8Fast(PF_Pixel8 *pixel, A_long targetR, A_long targetG, A_long targetB, A_long toleranceSq) {
-	A_long dr = (A_long)pixel->red - targetR;
-	A_long dg = (A_long)pixel->green - targetG;
-	A_long db = (A_long)pixel->blue - targetB;
-	A_long distSq = dr * dr + dg * dg + db * db;
-	return (distSq <= toleranceSq);
+// All color matching is done in 8-bit space to match AE color picker behavior.
+// The 8-bit and float versions also take Premiere's BGRA pixels.
+
+// One target color in 8-bit space
+typedef struct {
+	A_long targetR8, targetG8, targetB8;
+	A_long toleranceSq8;
+	CXLab targetLab;		// Target in OKLab, for perceptual matching
+} MatchTarget;
+
+typedef struct {
+	MatchTarget targets[COLORLINES_MAX_COLORS];
+	A_long targetCount;		// Target Color, then the enabled additional colors
+	A_long toleranceSq8;	// Threshold on MatchDistanceSq8: the tolerance of a single target, else 0
+	A_long matchSpace;		// CX_MATCH_SPACE_RGB or CX_MATCH_SPACE_OKLAB
+} MatchParams;
+
+static inline A_long TargetDistanceSq8(A_long r8, A_long g8, A_long b8, const MatchTarget *t) {
+	A_long dr = r8 - t->targetR8;
+	A_long dg = g8 - t->targetG8;
+	A_long db = b8 - t->targetB8;
+	return dr * dr + dg * dg + db * db;
+}
+
+// Distance of an 8-bit color to the targets in the match space; OKLab
+// distances are scaled to 8-bit RGB units so tolerances carry over.
+// With one target this is the squared distance to it. With several it is how
+// far the color lies outside the nearest tolerance, 0 inside any of them, so
+// a single threshold classifies every target at once.
+static inline A_long MatchDistanceSq8(A_long r8, A_long g8, A_long b8, const MatchParams *m) {
+	const bool oklab = (m->matchSpace == CX_MATCH_SPACE_OKLAB);
+	CXLab lab = {};
+	if (oklab) lab = CX_OKLabFrom8(r8, g8, b8);
+	if (m->targetCount == 1) {
+		return oklab ? CX_OKLabDistanceSq(lab, m->targets[0].targetLab) : TargetDistanceSq8(r8, g8, b8, &m->targets[0]);
+	}
+	A_long excess = INT32_MAX;
+	for (A_long i = 0; i < m->targetCount; i++) {
+		const MatchTarget *t = &m->targets[i];
+		A_long d = oklab ? CX_OKLabDistanceSq(lab, t->targetLab) : TargetDistanceSq8(r8, g8, b8, t);
+		if (d <= t->toleranceSq8) return 0;
+		if (d - t->toleranceSq8 < excess) excess = d - t->toleranceSq8;
+	}
+	return excess;
+}
+
+template<typename P8>
+static inline A_long ColorDistanceSq8(const P8 *pixel, const MatchParams *m) {
+	return MatchDistanceSq8(pixel->red, pixel->green, pixel->blue, m);
 }
 
 // 16-bit version: convert 16-bit pixel to 8-bit space for comparison
-static inline PF_Boolean IsTargetColor16Fast(PF_Pixel16 *pixel, A_long targetR8, A_long targetG8, A_long targetB8, A_long toleranceSq8) {
-	A_long r8 = (A_long)((double)pixel->red / PF_MAX_CHAN16 * PF_MAX_CHAN8 + 0.5);
-	A_long g8 = (A_long)((double)pixel->green / PF_MAX_CHAN16 * PF_MAX_CHAN8 + 0.5);
-	A_long b8 = (A_long)((double)pixel->blue / PF_MAX_CHAN16 * PF_MAX_CHAN8 + 0.5);
-	A_long dr = r8 - targetR8;
-	A_long dg = g8 - targetG8;
-	A_long db = b8 - targetB8;
-	A_long distSq = dr * dr + dg * dg + db * db;
-	return (distSq <= toleranceSq8);
+static inline A_long ColorDistanceSq16(const PF_Pixel16 *pixel, const MatchParams *m) {
+	return MatchDistanceSq8(CX_Channel16To8(pixel->red), CX_Channel16To8(pixel->green), CX_Channel16To8(pixel->blue), m);
 }
 
 // 32-bit float: convert to 8-bit space for comparison
-static inline PF_Boolean IsTargetColorFloatFast(PF_PixelFloat *pixel, A_long targetR8, A_long targetG8, A_long targetB8, A_long toleranceSq8) {
-	A_long r8 = (A_long)(pixel->red * 255.0 + 0.5);
-	A_long g8 = (A_long)(pixel->green * 255.0 + 0.5);
-	A_long b8 = (A_long)(pixel->blue * 255.0 + 0.5);
-	if (r8 < 0) r8 = 0; else if (r8 > 255) r8 = 255;
-	if (g8 < 0) g8 = 0; else if (g8 > 255) g8 = 255;
-	if (b8 < 0) b8 = 0; else if (b8 > 255) b8 = 255;
-	A_long dr = r8 - targetR8;
-	A_long dg = g8 - targetG8;
-	A_long db = b8 - targetB8;
-	A_long distSq = dr * dr + dg * dg + db * db;
-	return (distSq <= toleranceSq8);
+template<typename PF>
+static inline A_long ColorDistanceSqFloat(const PF *pixel, const MatchParams *m) {
+	return MatchDistanceSq8(CX_ChannelFloatTo8(pixel->red), CX_ChannelFloatTo8(pixel->green), CX_ChannelFloatTo8(pixel->blue), m);
+}
+
+template<typename P8>
+static inline PF_Boolean IsTargetColor8Fast(const P8 *pixel, const MatchParams *m) {
+	return ColorDistanceSq8(pixel, m) <= m->toleranceSq8;
+}
+
+static inline PF_Boolean IsTargetColor16Fast(const PF_Pixel16 *pixel, const MatchParams *m) {
+	return ColorDistanceSq16(pixel, m) <= m->toleranceSq8;
+}
+
+template<typename PF>
+static inline PF_Boolean IsTargetColorFloatFast(const PF *pixel, const MatchParams *m) {
+	return ColorDistanceSqFloat(pixel, m) <= m->toleranceSq8;
 }
 
 // ============================================================================
@@ -245,7 +303,8 @@ static void InitColorAdjustParams(ColorAdjustParams *adj, ColorLinesInfo *info)
 	}
 }
 
-static inline void ApplyColorAdjustments8Fast(PF_Pixel8 *pixel, const ColorAdjustParams *adj) {
+template<typename P8>
+static inline void ApplyColorAdjustments8Fast(P8 *pixel, const ColorAdjustParams *adj) {
 	if (!adj->needsAdjustment) return;
 
 	PF_FpLong r = pixel->red * 0.00392156863;  // / 255.0
@@ -308,7 +367,8 @@ static inline void ApplyColorAdjustments16Fast(PF_Pixel16 *pixel, const ColorAdj
 	pixel->blue = Clamp16(b * PF_MAX_CHAN16);
 }
 
-static inline void ApplyColorAdjustmentsFloatFast(PF_PixelFloat *pixel, const ColorAdjustParams *adj) {
+template<typename PF>
+static inline void ApplyColorAdjustmentsFloatFast(PF *pixel, const ColorAdjustParams *adj) {
 	if (!adj->needsAdjustment) return;
 
 	PF_FpLong r = pixel->red;
@@ -340,650 +400,2263 @@ static inline void ApplyColorAdjustmentsFloatFast(PF_PixelFloat *pixel, const Co
 }
 
 // ============================================================================
-// Optimized Fill Functions
+// Pixel Traits - one kernel source for 8-bit, 16-bit and 32-bit float
 // ============================================================================
 
-static void FillLinePixel8(ColorLinesInfo *info, A_long x, A_long y, PF_Pixel8 *inP, PF_Pixel8 *outP,
-                           A_long targetR, A_long targetG, A_long targetB, A_long toleranceSq,
-                           const ColorAdjustParams *adj) {
-	A_long radius = info->searchRadius;
-	A_long width = info->srcWorld->width;
-	A_long height = info->srcWorld->height;
-	A_long weightSize = radius * 2 + 1;
-
-	if (info->fillMode == FILL_MODE_NEAREST) {
-		// Find nearest non-target pixel
-		A_long nearestDistSq = 999999;
-		PF_Pixel8 *nearestPixel = NULL;
-
-		// Search in expanding rings for early termination
-		for (A_long ring = 1; ring <= radius && nearestDistSq > 1; ring++) {
-			A_long ringSq = ring * ring;
-			if (ringSq >= nearestDistSq) break;  // Can't find closer
-
-			for (A_long dy = -ring; dy <= ring; dy++) {
-				A_long ny = y + dy;
-				if (ny < 0 || ny >= height) continue;
-
-				PF_Pixel8 *rowPtr = GetRow8(info->srcWorld, ny);
-
-				for (A_long dx = -ring; dx <= ring; dx++) {
-					// Only process ring boundary
-					if (dy != -ring && dy != ring && dx != -ring && dx != ring) continue;
-
-					A_long nx = x + dx;
-					if (nx < 0 || nx >= width) continue;
-
-					PF_Pixel8 *neighbor = rowPtr + nx;
-					if (info->ignoreTransparent && neighbor->alpha < 255) continue;
-					if (IsTargetColor8Fast(neighbor, targetR, targetG, targetB, toleranceSq)) continue;
-
-					A_long distSq = dx * dx + dy * dy;
-					if (distSq < nearestDistSq) {
-						nearestDistSq = distSq;
-						nearestPixel = neighbor;
-						if (distSq == 1) goto found_nearest;  // Can't get closer
-					}
-				}
-			}
-		}
-		found_nearest:
-
-		if (nearestPixel) {
-			*outP = *nearestPixel;
-		} else {
-			*outP = *inP;
-		}
-	} else {
-		// Average or Weighted mode
-		PF_FpLong totalWeight = 0;
-		PF_FpLong sumR = 0, sumG = 0, sumB = 0, sumA = 0;
-		PF_Boolean isAverage = (info->fillMode == FILL_MODE_AVERAGE);
-
-		for (A_long dy = -radius; dy <= radius; dy++) {
-			A_long ny = y + dy;
-			if (ny < 0 || ny >= height) continue;
-
-			PF_Pixel8 *rowPtr = GetRow8(info->srcWorld, ny);
-			A_long weightRowOffset = (dy + radius) * weightSize;
+template<typename P> struct PixelTraits;
 
-			for (A_long dx = -radius; dx <= radius; dx++) {
-				if (dx == 0 && dy == 0) continue;
+// 8-bit and float traits serve both AE's ARGB and Premiere's BGRA layout;
+// kernels address channels by name, so only the traits see the pixel type
+template<typename P8> struct PixelTraits8 {
+	typedef A_u_char Channel;
+	static constexpr Channel kMaxAlpha = PF_MAX_CHAN8;
+	static constexpr bool kSingleAccum = false;
+	static inline A_long DistanceSq(const P8 *p, const MatchParams *m) {
+		return ColorDistanceSq8(p, m);
+	}
+	static inline PF_Boolean IsTarget(const P8 *p, const MatchParams *m) {
+		return IsTargetColor8Fast(p, m);
+	}
+	static inline Channel FromAccum(PF_FpLong v) { return ClampByte(v); }
+	static inline void Adjust(P8 *p, const ColorAdjustParams *adj) { ApplyColorAdjustments8Fast(p, adj); }
+};
+
+template<typename PF> struct PixelTraitsFloat {
+	typedef PF_FpShort Channel;
+	static constexpr Channel kMaxAlpha = 1.0f;
+	// Window sums run in float; see AccumulatePlanarWindowSingle
+	static constexpr bool kSingleAccum = true;
+	static inline A_long DistanceSq(const PF *p, const MatchParams *m) {
+		return ColorDistanceSqFloat(p, m);
+	}
+	static inline PF_Boolean IsTarget(const PF *p, const MatchParams *m) {
+		return IsTargetColorFloatFast(p, m);
+	}
+	static inline Channel FromAccum(PF_FpLong v) { return (PF_FpShort)v; }
+	static inline void Adjust(PF *p, const ColorAdjustParams *adj) { ApplyColorAdjustmentsFloatFast(p, adj); }
+};
+
+template<> struct PixelTraits<PF_Pixel8> : PixelTraits8<PF_Pixel8> {};
+template<> struct PixelTraits<PF_Pixel_BGRA_8u> : PixelTraits8<PF_Pixel_BGRA_8u> {};
+
+template<> struct PixelTraits<PF_Pixel16> {
+	typedef A_u_short Channel;
+	static constexpr Channel kMaxAlpha = PF_MAX_CHAN16;
+	static constexpr bool kSingleAccum = false;
+	static inline A_long DistanceSq(const PF_Pixel16 *p, const MatchParams *m) {
+		return ColorDistanceSq16(p, m);
+	}
+	static inline PF_Boolean IsTarget(const PF_Pixel16 *p, const MatchParams *m) {
+		return IsTargetColor16Fast(p, m);
+	}
+	static inline Channel FromAccum(PF_FpLong v) { return Clamp16(v); }
+	static inline void Adjust(PF_Pixel16 *p, const ColorAdjustParams *adj) { ApplyColorAdjustments16Fast(p, adj); }
+};
 
-				A_long nx = x + dx;
-				if (nx < 0 || nx >= width) continue;
+template<> struct PixelTraits<PF_PixelFloat> : PixelTraitsFloat<PF_PixelFloat> {};
+template<> struct PixelTraits<PF_Pixel_BGRA_32f> : PixelTraitsFloat<PF_Pixel_BGRA_32f> {};
 
-				PF_Pixel8 *neighbor = rowPtr + nx;
-				if (info->ignoreTransparent && neighbor->alpha < 255) continue;
-				if (IsTargetColor8Fast(neighbor, targetR, targetG, targetB, toleranceSq)) continue;
+// ============================================================================
+// Pipeline Stages
+// ============================================================================
+//
+// Rendering runs as five stages. Each stage declares the parameters it reads,
+// and its cache key is the upstream key mixed with exactly those parameters,
+// so changing a parameter re-runs only its own stage and the ones after it:
+//
+//   DIST   <- input pixels, Target Color, Match Colors In, Additional Colors
+//   MASK   <- DIST, Color Tolerance, Minimum Line Size
+//   FILL   <- MASK, Fill Mode, Search Radius, Sample Count, Ignore Transparent,
+//             Half Float Intermediates (32-bit)
+//   ADJUST <- FILL, Brightness, Contrast, Saturation
+//   BLUR   <- ADJUST, Sample Blur (and whether Lines Only forces opacity)
+//
+// Output Mode is applied while writing the output world and is never cached,
+// so switching it reuses every stage.
+//
+// The MASK key uses the number of pixels the tolerance selects rather than the
+// tolerance itself: masks are nested in the tolerance, so equal counts mean
+// identical masks and a tolerance change that flips no pixel reuses FILL and
+// everything after it.
+//
+// Additional Colors are classified in the same DIST pass: with several
+// targets the distance plane holds how far each pixel lies outside the
+// nearest target's tolerance, MASK selects the pixels at 0, and FILL and the
+// stages after it run once for the lines of every color. The tolerances are
+// then part of the DIST key.
+//
+// With a Minimum Line Size, MASK drops the connected pieces of the mask with
+// fewer pixels (dust and scan noise in the target colour) before anything
+// is filled, so they are neither filled nor cleared by Background Only.
+
+enum PipelineStage {
+	STAGE_DIST = 0,
+	STAGE_MASK,
+	STAGE_FILL,
+	STAGE_ADJUST,
+	STAGE_BLUR,
+	STAGE_NUM_STAGES
+};
+
+// Immutable result of one stage. DIST and MASK cover the full frame; FILL and
+// later stages store one pixel per line pixel and share FILL's line list.
+struct ColorLinesProduct {
+	std::vector<A_u_short>						distance;	// DIST: MatchDistanceSq8 of each pixel, saturated
+	std::vector<A_u_long>						countAtMost;// DIST: number of pixels with distance <= d
+	std::vector<A_u_char>						mask;		// MASK: 255 where the source matches the target color
+	std::shared_ptr<const std::vector<A_long> >	lines;		// FILL+: line pixel offsets (y * width + x), raster order
+	std::vector<char>							pixels;		// FILL+: one pixel per entry of lines
+
+	size_t Bytes() const {
+		return sizeof(*this) + distance.size() * sizeof(A_u_short) + countAtMost.size() * sizeof(A_u_long) +
+			mask.size() + pixels.size() + (lines ? lines->size() * sizeof(A_long) : 0);
+	}
+};
 
-				PF_FpLong weight = isAverage ? 1.0 : g_invDistWeights[weightRowOffset + dx + radius];
-				sumR += neighbor->red * weight;
-				sumG += neighbor->green * weight;
-				sumB += neighbor->blue * weight;
-				sumA += neighbor->alpha * weight;
-				totalWeight += weight;
-			}
-		}
+typedef std::shared_ptr<const ColorLinesProduct> ProductPtr;
 
-		if (totalWeight > 0) {
-			PF_FpLong invWeight = 1.0 / totalWeight;
-			outP->red = ClampByte(sumR * invWeight);
-			outP->green = ClampByte(sumG * invWeight);
-			outP->blue = ClampByte(sumB * invWeight);
-			outP->alpha = ClampByte(sumA * invWeight);
-		} else {
-			*outP = *inP;
-		}
-	}
-	ApplyColorAdjustments8Fast(outP, adj);
+typedef struct {
+	PF_InData			*in_data;
+	PF_OutData			*out_data;
+	ColorLinesInfo		*info;
+	PF_EffectWorld		*srcWorld;
+	A_long				width, height;
+	PF_LRect			area;			// Output extent clipped to the source
+	A_long				fillTop, fillBottom;	// Rows whose line pixels are filled; strips reach past area
+	A_long				frameTop, frameHeight;	// Frame row of srcWorld's first row, and the frame height
+	A_long				edgeMargin;
+	MatchParams			match;
+	ColorAdjustParams	colorAdj;
+	A_long				blurRadius;
+	PF_Boolean			forceOpaque;	// Lines Only: line pixels are written fully opaque
+	PF_Boolean			halfFloat;		// 32-bit line pixels stored as HalfPixel
+	A_long				minLineSize;	// Pieces of the mask below this many pixels are dropped; 0 keeps all
+	ColorLinesStageCache	*stageCache;
+	CXCacheKey			stageKeys[STAGE_NUM_STAGES];
+} PipelineContext;
+
+static void AddMatchTarget(MatchParams *match, const PF_Pixel &color, PF_FpLong tolerance) {
+	MatchTarget *t = &match->targets[match->targetCount++];
+	t->targetR8 = color.red;
+	t->targetG8 = color.green;
+	t->targetB8 = color.blue;
+	A_long maxDist8 = (A_long)(tolerance * CX_TOLERANCE_SCALE + 0.5);
+	t->toleranceSq8 = maxDist8 * maxDist8;
+	t->targetLab = CX_OKLabFrom8(color.red, color.green, color.blue);
 }
 
-static void FillLinePixel16(ColorLinesInfo *info, A_long x, A_long y, PF_Pixel16 *inP, PF_Pixel16 *outP,
-                            A_long targetR8, A_long targetG8, A_long targetB8, A_long toleranceSq8,
-                            const ColorAdjustParams *adj) {
-	A_long radius = info->searchRadius;
-	A_long width = info->srcWorld->width;
-	A_long height = info->srcWorld->height;
-	A_long weightSize = radius * 2 + 1;
+static void InitPipelineContext(PipelineContext *ctx, ColorLinesInfo *info, const PF_EffectWorld *output) {
+	ctx->info = info;
+	ctx->srcWorld = info->srcWorld;
+	ctx->width = info->srcWorld->width;
+	ctx->height = info->srcWorld->height;
+	// Windowed fills leave a search radius wide border untouched; push-pull has no window
+	ctx->edgeMargin = (info->fillMode == FILL_MODE_PUSH_PULL) ? 0 : info->searchRadius;
+
+	ctx->area = output->extent_hint;
+	if (ctx->area.left < 0) ctx->area.left = 0;
+	if (ctx->area.top < 0) ctx->area.top = 0;
+	if (ctx->area.right > output->width) ctx->area.right = output->width;
+	if (ctx->area.bottom > output->height) ctx->area.bottom = output->height;
+	ctx->fillTop = ctx->area.top;
+	ctx->fillBottom = ctx->area.bottom;
+	ctx->frameTop = 0;
+	ctx->frameHeight = ctx->height;
+
+	// All bit depths use 8-bit target colors (matches AE color picker)
+	ctx->match.targetCount = 0;
+	AddMatchTarget(&ctx->match, info->targetColor, info->tolerance);
+	for (A_long i = 0; i < COLORLINES_MAX_COLORS - 1; i++) {
+		const ColorLinesColor *color = &info->moreColors[i];
+		if (color->enabled) AddMatchTarget(&ctx->match, color->color, color->tolerance);
+	}
+	ctx->match.toleranceSq8 = (ctx->match.targetCount == 1) ? ctx->match.targets[0].toleranceSq8 : 0;
+	ctx->match.matchSpace = info->matchSpace;
 
-	if (info->fillMode == FILL_MODE_NEAREST) {
-		A_long nearestDistSq = 999999;
-		PF_Pixel16 *nearestPixel = NULL;
+	InitColorAdjustParams(&ctx->colorAdj, info);
+	ctx->blurRadius = (A_long)(info->sampleBlur / 10.0);
+	ctx->forceOpaque = (info->outputMode == OUTPUT_MODE_LINE_ONLY);
+	ctx->halfFloat = FALSE;
+	ctx->minLineSize = info->minLineSize > 1 ? info->minLineSize : 0;
+	ctx->stageCache = NULL;
+}
 
-		for (A_long ring = 1; ring <= radius && nearestDistSq > 1; ring++) {
-			A_long ringSq = ring * ring;
-			if (ringSq >= nearestDistSq) break;
+static inline void MixKey(CXHasher &hasher, const CXCacheKey &key) {
+	hasher.Add(key.lo);
+	hasher.Add(key.hi);
+}
 
-			for (A_long dy = -ring; dy <= ring; dy++) {
-				A_long ny = y + dy;
-				if (ny < 0 || ny >= height) continue;
+// Stage keys follow the dependency graph above
+static void ComputeDistanceKey(PipelineContext *ctx, const CXCacheKey &inputKey) {
+	CXHasher dist;
+	MixKey(dist, inputKey);
+	dist.Add(STAGE_DIST);
+	dist.Add(ctx->match.matchSpace);
+	dist.Add(ctx->match.targetCount);
+	for (A_long i = 0; i < ctx->match.targetCount; i++) {
+		const MatchTarget *t = &ctx->match.targets[i];
+		dist.Add(t->targetR8);
+		dist.Add(t->targetG8);
+		dist.Add(t->targetB8);
+		// A single target's tolerance is only a threshold on its distances
+		if (ctx->match.targetCount > 1) dist.Add(t->toleranceSq8);
+	}
+	ctx->stageKeys[STAGE_DIST] = dist.Finish();
+}
 
-				PF_Pixel16 *rowPtr = GetRow16(info->srcWorld, ny);
+static void ComputeStageKeys(PipelineContext *ctx, const ColorLinesProduct *distance) {
+	const ColorLinesInfo *info = ctx->info;
+	A_long toleranceSq = ctx->match.toleranceSq8;
 
-				for (A_long dx = -ring; dx <= ring; dx++) {
-					if (dy != -ring && dy != ring && dx != -ring && dx != ring) continue;
+	CXHasher mask;
+	MixKey(mask, ctx->stageKeys[STAGE_DIST]);
+	mask.Add(STAGE_MASK);
+	if (toleranceSq < DISTANCE_SATURATED) {
+		mask.Add(false);
+		mask.Add(distance->countAtMost[toleranceSq]);
+	} else {
+		// Saturated distances are resolved per pixel, so key on the tolerance
+		mask.Add(true);
+		mask.Add(toleranceSq);
+	}
+	mask.Add(ctx->minLineSize);
+	ctx->stageKeys[STAGE_MASK] = mask.Finish();
+
+	CXHasher fill;
+	MixKey(fill, ctx->stageKeys[STAGE_MASK]);
+	fill.Add(STAGE_FILL);
+	fill.Add(info->fillMode);
+	fill.Add(info->fillMode == FILL_MODE_PUSH_PULL ? 0 : info->searchRadius);
+	fill.Add(info->fillMode == FILL_MODE_ADAPTIVE ? info->sampleCount : 0);
+	fill.Add(info->ignoreTransparent);
+	fill.Add(ctx->halfFloat);
+	fill.Add(ctx->area.left);
+	fill.Add(ctx->area.top);
+	fill.Add(ctx->area.right);
+	fill.Add(ctx->area.bottom);
+	ctx->stageKeys[STAGE_FILL] = fill.Finish();
+
+	CXHasher adjust;
+	MixKey(adjust, ctx->stageKeys[STAGE_FILL]);
+	adjust.Add(STAGE_ADJUST);
+	adjust.Add(info->brightness);
+	adjust.Add(info->contrast);
+	adjust.Add(info->saturation);
+	ctx->stageKeys[STAGE_ADJUST] = adjust.Finish();
+
+	CXHasher blur;
+	MixKey(blur, ctx->stageKeys[STAGE_ADJUST]);
+	blur.Add(STAGE_BLUR);
+	blur.Add(ctx->blurRadius);
+	blur.Add(ctx->forceOpaque);
+	ctx->stageKeys[STAGE_BLUR] = blur.Finish();
+}
 
-					A_long nx = x + dx;
-					if (nx < 0 || nx >= width) continue;
+// Shared refcon for the parallel stage workers
+typedef struct {
+	PipelineContext				*ctx;
+	const ColorLinesProduct		*upstream;
+	ColorLinesProduct			*product;
+	const ColorLinesProduct		*result;
+	const PF_FpLong				*weights;
+	const float					*weightsSingle;
+	const short					*weightsQ15;
+	const struct FillOffset		*offsets;
+	A_long						offsetCount;
+	char						*dense;
+	size_t						lineBegin, lineEnd;
+	A_u_char					*denseMaskOut;
+	A_long						*rowCounts;
+	A_u_long					*histograms;
+	struct PushPullLevel		*levels;
+	A_long						level;
+	std::vector<A_long>			*lines;
+	const struct NeighborhoodView	*frameView;
+	A_long						haloRadius;
+	const A_long				*tileStarts;
+	const A_long				*tileLines;
+	const A_long				*tiles;
+	std::atomic<bool>			*found;
+	PF_EffectWorld				*output;
+	const A_u_long				*labels;
+	const CXComponentStats		*components;
+	const A_u_long				*specks;
+	A_long						speckCount;
+} StageJob;
+
+typedef PF_Err (*ParallelFunc)(void *refcon, A_long thread, A_long i, A_long count);
+
+// Run fn for every index in [0, count) on AE's render threads
+static PF_Err ParallelFor(PipelineContext *ctx, A_long count, void *refcon, ParallelFunc fn) {
+	if (count <= 0) return PF_Err_NONE;
+	AEFX_SuiteScoper<PF_Iterate8Suite2> iterSuite = AEFX_SuiteScoper<PF_Iterate8Suite2>(ctx->in_data, kPFIterate8Suite, kPFIterate8SuiteVersion2, ctx->out_data);
+	return iterSuite->iterate_generic(count, refcon, fn);
+}
 
-					PF_Pixel16 *neighbor = rowPtr + nx;
-					if (info->ignoreTransparent && neighbor->alpha < PF_MAX_CHAN16) continue;
-					if (IsTargetColor16Fast(neighbor, targetR8, targetG8, targetB8, toleranceSq8)) continue;
+static inline A_long NumLineChunks(size_t lineCount) {
+	return (A_long)((lineCount + LINE_CHUNK_SIZE - 1) / LINE_CHUNK_SIZE);
+}
 
-					A_long distSq = dx * dx + dy * dy;
-					if (distSq < nearestDistSq) {
-						nearestDistSq = distSq;
-						nearestPixel = neighbor;
-						if (distSq == 1) goto found_nearest16;
-					}
-				}
-			}
-		}
-		found_nearest16:
+static inline void LineChunkRange(size_t lineCount, A_long chunk, size_t *beginP, size_t *endP) {
+	*beginP = (size_t)chunk * LINE_CHUNK_SIZE;
+	*endP = *beginP + LINE_CHUNK_SIZE;
+	if (*endP > lineCount) *endP = lineCount;
+}
 
-		if (nearestPixel) {
-			*outP = *nearestPixel;
-		} else {
-			*outP = *inP;
-		}
-	} else {
-		PF_FpLong totalWeight = 0;
-		PF_FpLong sumR = 0, sumG = 0, sumB = 0, sumA = 0;
-		PF_Boolean isAverage = (info->fillMode == FILL_MODE_AVERAGE);
+// ============================================================================
+// Line Pixel Storage
+// ============================================================================
+//
+// Stage products and the blur's dense frame hold one pixel per line pixel. With
+// Half Float Intermediates, 32-bit float renders (AE ARGB128 and Premiere
+// BGRA_4444_32f) store them as half floats (8 instead of 16 bytes) and convert
+// at every kernel boundary; window sums and the output world stay float. Each stored value is rounded to 11 significant bits
+// (relative error <= 2^-11, below one 10-bit code value) and clamped to
+// +-65504. ADJUST and BLUR round once more each, so a full FILL -> ADJUST ->
+// BLUR chain stays within about 3 * 2^-11 relative. 8 and 16-bit renders
+// always store P.
+
+// Half float pixel in ARGB order, whatever the layout of the float pixel it
+// stores: the blur's dense half frame always deinterleaves as ARGB
+struct HalfPixel {
+	A_u_short	alpha, red, green, blue;
+};
+
+template<typename PF>
+static inline PF LoadHalfPixel(const HalfPixel &half) {
+	float argb[4];
+	CX_HalfToFloatRow(&half.alpha, argb, 4);
+	PF pixel;
+	pixel.alpha = argb[0];
+	pixel.red = argb[1];
+	pixel.green = argb[2];
+	pixel.blue = argb[3];
+	return pixel;
+}
 
-		for (A_long dy = -radius; dy <= radius; dy++) {
-			A_long ny = y + dy;
-			if (ny < 0 || ny >= height) continue;
+template<typename PF>
+static inline void StoreHalfPixel(const PF &pixel, HalfPixel *half) {
+	const float argb[4] = { pixel.alpha, pixel.red, pixel.green, pixel.blue };
+	CX_FloatToHalfRow(argb, &half->alpha, 4);
+}
 
-			PF_Pixel16 *rowPtr = GetRow16(info->srcWorld, ny);
-			A_long weightRowOffset = (dy + radius) * weightSize;
+template<typename P>
+static inline size_t LinePixelBytes(const PipelineContext *ctx) {
+	return sizeof(P);
+}
 
-			for (A_long dx = -radius; dx <= radius; dx++) {
-				if (dx == 0 && dy == 0) continue;
+template<typename P>
+static inline P LoadLinePixel(const PipelineContext *ctx, const char *pixels, size_t i) {
+	return ((const P*)pixels)[i];
+}
 
-				A_long nx = x + dx;
-				if (nx < 0 || nx >= width) continue;
+template<typename P>
+static inline void StoreLinePixel(const PipelineContext *ctx, char *pixels, size_t i, const P &pixel) {
+	((P*)pixels)[i] = pixel;
+}
 
-				PF_Pixel16 *neighbor = rowPtr + nx;
-				if (info->ignoreTransparent && neighbor->alpha < PF_MAX_CHAN16) continue;
-				if (IsTargetColor16Fast(neighbor, targetR8, targetG8, targetB8, toleranceSq8)) continue;
+template<>
+inline size_t LinePixelBytes<PF_PixelFloat>(const PipelineContext *ctx) {
+	return ctx->halfFloat ? sizeof(HalfPixel) : sizeof(PF_PixelFloat);
+}
 
-				PF_FpLong weight = isAverage ? 1.0 : g_invDistWeights[weightRowOffset + dx + radius];
-				sumR += neighbor->red * weight;
-				sumG += neighbor->green * weight;
-				sumB += neighbor->blue * weight;
-				sumA += neighbor->alpha * weight;
-				totalWeight += weight;
-			}
-		}
+template<>
+inline PF_PixelFloat LoadLinePixel<PF_PixelFloat>(const PipelineContext *ctx, const char *pixels, size_t i) {
+	if (!ctx->halfFloat) return ((const PF_PixelFloat*)pixels)[i];
+	return LoadHalfPixel<PF_PixelFloat>(((const HalfPixel*)pixels)[i]);
+}
 
-		if (totalWeight > 0) {
-			PF_FpLong invWeight = 1.0 / totalWeight;
-			outP->red = Clamp16(sumR * invWeight);
-			outP->green = Clamp16(sumG * invWeight);
-			outP->blue = Clamp16(sumB * invWeight);
-			outP->alpha = Clamp16(sumA * invWeight);
-		} else {
-			*outP = *inP;
-		}
+template<>
+inline void StoreLinePixel<PF_PixelFloat>(const PipelineContext *ctx, char *pixels, size_t i, const PF_PixelFloat &pixel) {
+	if (!ctx->halfFloat) {
+		((PF_PixelFloat*)pixels)[i] = pixel;
+	} else {
+		StoreHalfPixel(pixel, &((HalfPixel*)pixels)[i]);
 	}
-	ApplyColorAdjustments16Fast(outP, adj);
 }
 
-static void FillLinePixelFloat(ColorLinesInfo *info, A_long x, A_long y, PF_PixelFloat *inP, PF_PixelFloat *outP,
-                               A_long targetR8, A_long targetG8, A_long targetB8, A_long toleranceSq8,
-                               const ColorAdjustParams *adj) {
-	A_long radius = info->searchRadius;
-	A_long width = info->srcWorld->width;
-	A_long height = info->srcWorld->height;
-	A_long weightSize = radius * 2 + 1;
-
-	if (info->fillMode == FILL_MODE_NEAREST) {
-		A_long nearestDistSq = 999999;
-		PF_PixelFloat *nearestPixel = NULL;
-
-		for (A_long ring = 1; ring <= radius && nearestDistSq > 1; ring++) {
-			A_long ringSq = ring * ring;
-			if (ringSq >= nearestDistSq) break;
-
-			for (A_long dy = -ring; dy <= ring; dy++) {
-				A_long ny = y + dy;
-				if (ny < 0 || ny >= height) continue;
+// Premiere's BGRA_4444_32f: the same storage through the same conversions
+template<>
+inline size_t LinePixelBytes<PF_Pixel_BGRA_32f>(const PipelineContext *ctx) {
+	return ctx->halfFloat ? sizeof(HalfPixel) : sizeof(PF_Pixel_BGRA_32f);
+}
 
-				PF_PixelFloat *rowPtr = GetRowFloat(info->srcWorld, ny);
+template<>
+inline PF_Pixel_BGRA_32f LoadLinePixel<PF_Pixel_BGRA_32f>(const PipelineContext *ctx, const char *pixels, size_t i) {
+	if (!ctx->halfFloat) return ((const PF_Pixel_BGRA_32f*)pixels)[i];
+	return LoadHalfPixel<PF_Pixel_BGRA_32f>(((const HalfPixel*)pixels)[i]);
+}
 
-				for (A_long dx = -ring; dx <= ring; dx++) {
-					if (dy != -ring && dy != ring && dx != -ring && dx != ring) continue;
+template<>
+inline void StoreLinePixel<PF_Pixel_BGRA_32f>(const PipelineContext *ctx, char *pixels, size_t i, const PF_Pixel_BGRA_32f &pixel) {
+	if (!ctx->halfFloat) {
+		((PF_Pixel_BGRA_32f*)pixels)[i] = pixel;
+	} else {
+		StoreHalfPixel(pixel, &((HalfPixel*)pixels)[i]);
+	}
+}
 
-					A_long nx = x + dx;
-					if (nx < 0 || nx >= width) continue;
+// ============================================================================
+// Tiled Neighbourhood Traversal
+// ============================================================================
+//
+// Fill and blur kernels read a (2r+1)^2 window around every line pixel. Walking
+// the line list in scan order touches 2r+1 full frame rows per pixel, which
+// stops fitting in cache for wide windows. With a wide window the line pixels
+// are binned into TILE_SIZE tiles instead; each tile copies its rectangle plus
+// an r pixel halo into a contiguous buffer, and the kernels read from that.
+
+// Pixels and line mask of a frame rectangle whose top-left is (left, top)
+struct NeighborhoodView {
+	const char			*pixels;
+	A_long				rowBytes;
+	const A_u_char		*mask;
+	A_long				maskStride;
+	A_long				left, top;
+};
+
+template<typename P>
+static inline const P* ViewRow(const NeighborhoodView *view, A_long y) {
+	return (const P*)(view->pixels + (size_t)(y - view->top) * view->rowBytes) - view->left;
+}
 
-					PF_PixelFloat *neighbor = rowPtr + nx;
-					if (info->ignoreTransparent && neighbor->alpha < 1.0f) continue;
-					if (IsTargetColorFloatFast(neighbor, targetR8, targetG8, targetB8, toleranceSq8)) continue;
+static inline const A_u_char* ViewMaskRow(const NeighborhoodView *view, A_long y) {
+	return view->mask + (size_t)(y - view->top) * view->maskStride - view->left;
+}
 
-					A_long distSq = dx * dx + dy * dy;
-					if (distSq < nearestDistSq) {
-						nearestDistSq = distSq;
-						nearestPixel = neighbor;
-						if (distSq == 1) goto found_nearestF;
-					}
-				}
-			}
-		}
-		found_nearestF:
+// Groups line indices by tile, keeping scan order inside each tile
+static void BuildTileBins(const PipelineContext *ctx, const std::vector<A_long> &lines,
+                          std::vector<A_long> *tileStarts, std::vector<A_long> *tileLines, std::vector<A_long> *tiles) {
+	A_long tilesX = (ctx->width + TILE_SIZE - 1) / TILE_SIZE;
+	A_long tilesY = (ctx->height + TILE_SIZE - 1) / TILE_SIZE;
+	A_long tileCount = tilesX * tilesY;
+	std::vector<A_long> tileOf(lines.size());
+
+	tileStarts->assign(tileCount + 1, 0);
+	for (size_t i = 0; i < lines.size(); i++) {
+		A_long y = lines[i] / ctx->width;
+		A_long x = lines[i] - y * ctx->width;
+		tileOf[i] = (y / TILE_SIZE) * tilesX + x / TILE_SIZE;
+		(*tileStarts)[tileOf[i] + 1]++;
+	}
 
-		if (nearestPixel) {
-			*outP = *nearestPixel;
-		} else {
-			*outP = *inP;
-		}
-	} else {
-		PF_FpLong totalWeight = 0;
-		PF_FpLong sumR = 0, sumG = 0, sumB = 0, sumA = 0;
-		PF_Boolean isAverage = (info->fillMode == FILL_MODE_AVERAGE);
+	tiles->clear();
+	for (A_long t = 0; t < tileCount; t++) {
+		if ((*tileStarts)[t + 1]) tiles->push_back(t);
+		(*tileStarts)[t + 1] += (*tileStarts)[t];
+	}
 
-		for (A_long dy = -radius; dy <= radius; dy++) {
-			A_long ny = y + dy;
-			if (ny < 0 || ny >= height) continue;
+	std::vector<A_long> cursor(tileStarts->begin(), tileStarts->end() - 1);
+	tileLines->resize(lines.size());
+	for (size_t i = 0; i < lines.size(); i++) {
+		(*tileLines)[cursor[tileOf[i]]++] = (A_long)i;
+	}
+}
 
-			PF_PixelFloat *rowPtr = GetRowFloat(info->srcWorld, ny);
-			A_long weightRowOffset = (dy + radius) * weightSize;
+// Runs Kernel on the line pixels of one tile, reading from a staged copy of the
+// tile grown by the halo radius and clipped to the frame
+template<typename P, void (*Kernel)(const StageJob*, const NeighborhoodView*, size_t)>
+static PF_Err TileLines(void *refcon, A_long thread, A_long index, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	const PipelineContext *ctx = job->ctx;
+	const NeighborhoodView *frame = job->frameView;
+	A_long tile = job->tiles[index];
+	A_long tilesX = (ctx->width + TILE_SIZE - 1) / TILE_SIZE;
+	A_long r = job->haloRadius;
+
+	A_long left = (tile % tilesX) * TILE_SIZE - r;
+	A_long top = (tile / tilesX) * TILE_SIZE - r;
+	A_long right = left + TILE_SIZE + 2 * r;
+	A_long bottom = top + TILE_SIZE + 2 * r;
+	if (left < 0) left = 0;
+	if (top < 0) top = 0;
+	if (right > ctx->width) right = ctx->width;
+	if (bottom > ctx->height) bottom = ctx->height;
+
+	A_long stagedWidth = right - left;
+	A_long stagedHeight = bottom - top;
+	std::unique_ptr<P[]> pixels(new P[(size_t)stagedWidth * stagedHeight]);
+	std::vector<A_u_char> mask((size_t)stagedWidth * stagedHeight);
+	for (A_long y = top; y < bottom; y++) {
+		size_t offset = (size_t)(y - top) * stagedWidth;
+		memcpy(pixels.get() + offset, ViewRow<P>(frame, y) + left, stagedWidth * sizeof(P));
+		memcpy(&mask[offset], ViewMaskRow(frame, y) + left, stagedWidth);
+	}
 
-			for (A_long dx = -radius; dx <= radius; dx++) {
-				if (dx == 0 && dy == 0) continue;
+	NeighborhoodView staged;
+	staged.pixels = (const char*)pixels.get();
+	staged.rowBytes = stagedWidth * sizeof(P);
+	staged.mask = mask.data();
+	staged.maskStride = stagedWidth;
+	staged.left = left;
+	staged.top = top;
 
-				A_long nx = x + dx;
-				if (nx < 0 || nx >= width) continue;
+	for (A_long k = job->tileStarts[tile]; k < job->tileStarts[tile + 1]; k++) {
+		Kernel(job, &staged, job->tileLines[k]);
+	}
+	return PF_Err_NONE;
+}
 
-				PF_PixelFloat *neighbor = rowPtr + nx;
-				if (info->ignoreTransparent && neighbor->alpha < 1.0f) continue;
-				if (IsTargetColorFloatFast(neighbor, targetR8, targetG8, targetB8, toleranceSq8)) continue;
+// Runs Kernel on one scan order chunk of line pixels, reading the frame directly
+template<typename P, void (*Kernel)(const StageJob*, const NeighborhoodView*, size_t)>
+static PF_Err ChunkLines(void *refcon, A_long thread, A_long chunk, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	size_t begin, end;
+	LineChunkRange(job->product->lines->size(), chunk, &begin, &end);
+	for (size_t i = begin; i < end; i++) {
+		Kernel(job, job->frameView, i);
+	}
+	return PF_Err_NONE;
+}
 
-				PF_FpLong weight = isAverage ? 1.0 : g_invDistWeights[weightRowOffset + dx + radius];
-				sumR += neighbor->red * weight;
-				sumG += neighbor->green * weight;
-				sumB += neighbor->blue * weight;
-				sumA += neighbor->alpha * weight;
-				totalWeight += weight;
-			}
-		}
+// Runs Kernel on every line pixel, tile by tile for wide windows and in scan
+// order chunks otherwise
+template<typename P, void (*Kernel)(const StageJob*, const NeighborhoodView*, size_t)>
+static PF_Err RunNeighborhoodKernel(PipelineContext *ctx, StageJob *job, const NeighborhoodView *frame, A_long radius) {
+	const std::vector<A_long> &lines = *job->product->lines;
+	job->frameView = frame;
+	job->haloRadius = radius;
 
-		if (totalWeight > 0) {
-			PF_FpLong invWeight = 1.0 / totalWeight;
-			outP->red = (PF_FpShort)(sumR * invWeight);
-			outP->green = (PF_FpShort)(sumG * invWeight);
-			outP->blue = (PF_FpShort)(sumB * invWeight);
-			outP->alpha = (PF_FpShort)(sumA * invWeight);
-		} else {
-			*outP = *inP;
-		}
+	if (radius < TILE_MIN_RADIUS) {
+		return ParallelFor(ctx, NumLineChunks(lines.size()), job, ChunkLines<P, Kernel>);
 	}
-	ApplyColorAdjustmentsFloatFast(outP, adj);
+
+	std::vector<A_long> tileStarts, tileLines, tiles;
+	BuildTileBins(ctx, lines, &tileStarts, &tileLines, &tiles);
+	job->tileStarts = tileStarts.data();
+	job->tileLines = tileLines.data();
+	job->tiles = tiles.data();
+	return ParallelFor(ctx, (A_long)tiles.size(), job, TileLines<P, Kernel>);
 }
 
 // ============================================================================
-// Extended Info for Optimized Processing
+// Planar Tiles
 // ============================================================================
+//
+// The Average/Weighted fill and the blur sum weight * channel over every tap
+// of their window. They run from planar tiles: the tile and its halo are
+// transposed into float R, G, B and A planes next to the mask, so each window
+// row is a contiguous run per channel and the sums vectorize across taps.
+// Stage products stay interleaved; only the L2 sized tiles are planar.
+
+enum { PLANE_R, PLANE_G, PLANE_B, PLANE_A, PLANE_COUNT };
+
+// Channel planes and line mask of a frame rectangle whose top-left is (left, top).
+// Planes hold float, or A_u_short for the integer kernels of 8/16-bit frames.
+template<typename T>
+struct PlanarView {
+	const T				*planes[PLANE_COUNT];
+	const A_u_char		*mask;
+	A_long				stride;		// Elements per row in every plane and the mask
+	A_long				left, top;
+};
+
+// Splits interleaved pixels into channel planes
+template<typename P, typename T>
+static void DeinterleaveRow(const P *src, A_long count, T **planes) {
+	for (A_long x = 0; x < count; x++) {
+		planes[PLANE_R][x] = (T)src[x].red;
+		planes[PLANE_G][x] = (T)src[x].green;
+		planes[PLANE_B][x] = (T)src[x].blue;
+		planes[PLANE_A][x] = (T)src[x].alpha;
+	}
+}
 
-typedef struct {
-	ColorLinesInfo *info;
-	// All bit depths use 8-bit color space for comparison
-	A_long targetR8, targetG8, targetB8;
-	A_long toleranceSq8;
-	ColorAdjustParams colorAdj;
-	A_long edgeMargin;
-	A_long width, height;
-} ProcessingContext;
-
-static void InitProcessingContext(ProcessingContext *ctx, ColorLinesInfo *info) {
-	ctx->info = info;
-	ctx->edgeMargin = info->searchRadius;
-	ctx->width = info->srcWorld->width;
-	ctx->height = info->srcWorld->height;
+#if CX_SSE2
+// Four ARGB pixels as float vectors -> four channel vectors
+static inline void StoreTransposed(__m128 p0, __m128 p1, __m128 p2, __m128 p3, float **planes, A_long x) {
+	_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+	_mm_storeu_ps(planes[PLANE_A] + x, p0);
+	_mm_storeu_ps(planes[PLANE_R] + x, p1);
+	_mm_storeu_ps(planes[PLANE_G] + x, p2);
+	_mm_storeu_ps(planes[PLANE_B] + x, p3);
+}
 
-	// All bit depths use 8-bit target color (matches AE color picker)
-	ctx->targetR8 = info->targetColor.red;
-	ctx->targetG8 = info->targetColor.green;
-	ctx->targetB8 = info->targetColor.blue;
-	A_long maxDist8 = (A_long)(info->tolerance * 4.4167 + 0.5);
-	ctx->toleranceSq8 = maxDist8 * maxDist8;
+template<>
+void DeinterleaveRow<PF_Pixel8, float>(const PF_Pixel8 *src, A_long count, float **planes) {
+	const __m128i zero = _mm_setzero_si128();
+	A_long x = 0;
+	for (; x + 4 <= count; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		StoreTransposed(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)),
+		                _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)),
+		                planes, x);
+	}
+	for (; x < count; x++) {
+		planes[PLANE_R][x] = src[x].red;
+		planes[PLANE_G][x] = src[x].green;
+		planes[PLANE_B][x] = src[x].blue;
+		planes[PLANE_A][x] = src[x].alpha;
+	}
+}
 
-	// Color adjustments
-	InitColorAdjustParams(&ctx->colorAdj, info);
+template<>
+void DeinterleaveRow<PF_Pixel16, float>(const PF_Pixel16 *src, A_long count, float **planes) {
+	const __m128i zero = _mm_setzero_si128();
+	A_long x = 0;
+	for (; x + 4 <= count; x += 4) {
+		__m128i v0 = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(src + x + 2));
+		StoreTransposed(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v0, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(v0, zero)),
+		                _mm_cvtepi32_ps(_mm_unpacklo_epi16(v1, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(v1, zero)),
+		                planes, x);
+	}
+	for (; x < count; x++) {
+		planes[PLANE_R][x] = src[x].red;
+		planes[PLANE_G][x] = src[x].green;
+		planes[PLANE_B][x] = src[x].blue;
+		planes[PLANE_A][x] = src[x].alpha;
+	}
+}
 
-	// Precompute weight tables if needed
-	if (info->fillMode == FILL_MODE_WEIGHTED) {
-		PrecomputeInvDistWeights(info->searchRadius);
+template<>
+void DeinterleaveRow<PF_PixelFloat, float>(const PF_PixelFloat *src, A_long count, float **planes) {
+	A_long x = 0;
+	for (; x + 4 <= count; x += 4) {
+		const float *p = (const float*)(src + x);
+		StoreTransposed(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), _mm_loadu_ps(p + 12), planes, x);
+	}
+	for (; x < count; x++) {
+		planes[PLANE_R][x] = src[x].red;
+		planes[PLANE_G][x] = src[x].green;
+		planes[PLANE_B][x] = src[x].blue;
+		planes[PLANE_A][x] = src[x].alpha;
 	}
 }
 
-// ============================================================================
-// Optimized Pixel Processing Callbacks
-// ============================================================================
+// Read as ARGB, a BGRA pixel holds B in alpha, G in red, R in green and A in
+// blue. The ARGB transposes run on Premiere's pixels with the planes swapped.
+template<typename T>
+static inline void SwapBGRAPlanes(T **planes, T **swapped) {
+	swapped[PLANE_A] = planes[PLANE_B];
+	swapped[PLANE_R] = planes[PLANE_G];
+	swapped[PLANE_G] = planes[PLANE_R];
+	swapped[PLANE_B] = planes[PLANE_A];
+}
 
-static PF_Err FillAndMask8_Optimized(void *refcon, A_long xL, A_long yL, PF_Pixel8 *inP, PF_Pixel8 *outP) {
-	ProcessingContext *ctx = (ProcessingContext*)refcon;
-	ColorLinesInfo *info = ctx->info;
+template<>
+void DeinterleaveRow<PF_Pixel_BGRA_8u, float>(const PF_Pixel_BGRA_8u *src, A_long count, float **planes) {
+	float *swapped[PLANE_COUNT];
+	SwapBGRAPlanes(planes, swapped);
+	DeinterleaveRow<PF_Pixel8, float>((const PF_Pixel8*)src, count, swapped);
+}
 
-	// Skip edge pixels
-	if (xL < ctx->edgeMargin || yL < ctx->edgeMargin ||
-		xL >= ctx->width - ctx->edgeMargin ||
-		yL >= ctx->height - ctx->edgeMargin) {
-		*outP = *inP;
-		SetMaskAtFast(info, xL, yL, 0);
-		return PF_Err_NONE;
+template<>
+void DeinterleaveRow<PF_Pixel_BGRA_32f, float>(const PF_Pixel_BGRA_32f *src, A_long count, float **planes) {
+	float *swapped[PLANE_COUNT];
+	SwapBGRAPlanes(planes, swapped);
+	DeinterleaveRow<PF_PixelFloat, float>((const PF_PixelFloat*)src, count, swapped);
+}
+#endif
+
+// Half float frames (Half Float Intermediates) widen to float while staging
+template<>
+void DeinterleaveRow<HalfPixel, float>(const HalfPixel *src, A_long count, float **planes) {
+	A_long x = 0;
+#if CX_F16C
+	for (; x + 4 <= count; x += 4) {
+		__m128i v0 = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(src + x + 2));
+		StoreTransposed(_mm_cvtph_ps(v0), _mm_cvtph_ps(_mm_srli_si128(v0, 8)),
+		                _mm_cvtph_ps(v1), _mm_cvtph_ps(_mm_srli_si128(v1, 8)), planes, x);
 	}
+#endif
+	for (; x < count; x++) {
+		float p[4];
+		CX_HalfToFloatRow(&src[x].alpha, p, 4);
+		planes[PLANE_A][x] = p[0];
+		planes[PLANE_R][x] = p[1];
+		planes[PLANE_G][x] = p[2];
+		planes[PLANE_B][x] = p[3];
+	}
+}
 
-	PF_Boolean isLine = IsTargetColor8Fast(inP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8);
-	SetMaskAtFast(info, xL, yL, isLine ? 255 : 0);
+// Adds weight * channel for the taps [x0, x1) of row y whose mask state is
+// wantLine and whose alpha is not below minAlpha. sums holds R, G, B, A and the
+// total weight; weights[0] belongs to tap x0.
+static inline void AccumulatePlanarRow(const PlanarView<float> *view, A_long y, A_long x0, A_long x1, const PF_FpLong *weights,
+                                       bool wantLine, float minAlpha, PF_FpLong *sums) {
+	size_t rowOffset = (size_t)(y - view->top) * view->stride - view->left;
+	const A_u_char *mask = view->mask + rowOffset;
+	const float *r = view->planes[PLANE_R] + rowOffset;
+	const float *g = view->planes[PLANE_G] + rowOffset;
+	const float *b = view->planes[PLANE_B] + rowOffset;
+	const float *a = view->planes[PLANE_A] + rowOffset;
+	A_long x = x0;
+
+#if CX_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lineFlag = wantLine ? _mm_set1_epi32(-1) : zero;
+	const __m128 alphaLimit = _mm_set1_ps(minAlpha);
+	__m128d sumR = _mm_setzero_pd(), sumG = _mm_setzero_pd(), sumB = _mm_setzero_pd();
+	__m128d sumA = _mm_setzero_pd(), sumW = _mm_setzero_pd();
+
+	for (; x + 4 <= x1; x += 4) {
+		int maskBytes;
+		memcpy(&maskBytes, mask + x, sizeof(maskBytes));
+		__m128i m = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(maskBytes), zero), zero);
+		// Lane valid when (mask != 0) == wantLine and !(alpha < minAlpha)
+		__m128i isLine = _mm_xor_si128(_mm_cmpeq_epi32(m, zero), _mm_set1_epi32(-1));
+		__m128 alpha = _mm_loadu_ps(a + x);
+		__m128 valid = _mm_and_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(isLine, lineFlag)), _mm_cmpnlt_ps(alpha, alphaLimit));
+		if (_mm_movemask_ps(valid) == 0) continue;
+
+		__m128d validLo = _mm_castps_pd(_mm_unpacklo_ps(valid, valid));
+		__m128d validHi = _mm_castps_pd(_mm_unpackhi_ps(valid, valid));
+		__m128d wLo = _mm_and_pd(_mm_loadu_pd(weights + (x - x0)), validLo);
+		__m128d wHi = _mm_and_pd(_mm_loadu_pd(weights + (x - x0) + 2), validHi);
+		sumW = _mm_add_pd(sumW, _mm_add_pd(wLo, wHi));
+
+		#define CX_ACCUMULATE_PLANE(SUM, V) { \
+			__m128 v = _mm_and_ps(V, valid); \
+			SUM = _mm_add_pd(SUM, _mm_add_pd(_mm_mul_pd(_mm_cvtps_pd(v), wLo), _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), wHi))); }
+		CX_ACCUMULATE_PLANE(sumR, _mm_loadu_ps(r + x));
+		CX_ACCUMULATE_PLANE(sumG, _mm_loadu_ps(g + x));
+		CX_ACCUMULATE_PLANE(sumB, _mm_loadu_ps(b + x));
+		CX_ACCUMULATE_PLANE(sumA, alpha);
+		#undef CX_ACCUMULATE_PLANE
+	}
 
-	switch (info->outputMode) {
-		case OUTPUT_MODE_FULL:
-			if (isLine) {
-				FillLinePixel8(info, xL, yL, inP, outP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8, &ctx->colorAdj);
-			} else {
-				*outP = *inP;
-			}
-			break;
-		case OUTPUT_MODE_LINE_ONLY:
-			if (isLine) {
-				FillLinePixel8(info, xL, yL, inP, outP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8, &ctx->colorAdj);
-				outP->alpha = 255;
-			} else {
-				outP->alpha = 0;
-				outP->red = 0;
-				outP->green = 0;
-				outP->blue = 0;
-			}
-			break;
-		case OUTPUT_MODE_BG_ONLY:
-			if (isLine) {
-				outP->alpha = 0;
-				outP->red = 0;
-				outP->green = 0;
-				outP->blue = 0;
-			} else {
-				*outP = *inP;
-			}
-			break;
-		default:
-			*outP = *inP;
-			break;
+	double lanes[2];
+	_mm_storeu_pd(lanes, sumR); sums[0] += lanes[0] + lanes[1];
+	_mm_storeu_pd(lanes, sumG); sums[1] += lanes[0] + lanes[1];
+	_mm_storeu_pd(lanes, sumB); sums[2] += lanes[0] + lanes[1];
+	_mm_storeu_pd(lanes, sumA); sums[3] += lanes[0] + lanes[1];
+	_mm_storeu_pd(lanes, sumW); sums[4] += lanes[0] + lanes[1];
+#endif
+
+	for (; x < x1; x++) {
+		if ((mask[x] != 0) != wantLine || a[x] < minAlpha) continue;
+		PF_FpLong weight = weights[x - x0];
+		sums[0] += r[x] * weight;
+		sums[1] += g[x] * weight;
+		sums[2] += b[x] * weight;
+		sums[3] += a[x] * weight;
+		sums[4] += weight;
 	}
-	return PF_Err_NONE;
 }
 
-static PF_Err FillAndMask16_Optimized(void *refcon, A_long xL, A_long yL, PF_Pixel16 *inP, PF_Pixel16 *outP) {
-	ProcessingContext *ctx = (ProcessingContext*)refcon;
-	ColorLinesInfo *info = ctx->info;
+// Weighted sums over the (2r+1)^2 window around (x, y), clipped to the frame
+static void AccumulatePlanarWindow(const PipelineContext *ctx, const PlanarView<float> *view, A_long x, A_long y, A_long radius,
+                                   const PF_FpLong *weights, bool wantLine, float minAlpha, PF_FpLong *sums) {
+	A_long size = radius * 2 + 1;
+	A_long x0 = x - radius < 0 ? 0 : x - radius;
+	A_long x1 = x + radius + 1 > ctx->width ? ctx->width : x + radius + 1;
 
-	if (xL < ctx->edgeMargin || yL < ctx->edgeMargin ||
-		xL >= ctx->width - ctx->edgeMargin ||
-		yL >= ctx->height - ctx->edgeMargin) {
-		*outP = *inP;
-		SetMaskAtFast(info, xL, yL, 0);
-		return PF_Err_NONE;
+	for (A_long dy = -radius; dy <= radius; dy++) {
+		A_long ny = y + dy;
+		if (ny < 0 || ny >= ctx->height) continue;
+		AccumulatePlanarRow(view, ny, x0, x1, weights + (dy + radius) * size + (x0 - x + radius), wantLine, minAlpha, sums);
 	}
+}
 
-	PF_Boolean isLine = IsTargetColor16Fast(inP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8);
-	SetMaskAtFast(info, xL, yL, isLine ? 255 : 0);
+// Single precision variant of AccumulatePlanarRow for float frames: four taps
+// per vector instead of two. Writes the row's R, G, B, A and weight sums.
+static inline void AccumulatePlanarRowSingle(const PlanarView<float> *view, A_long y, A_long x0, A_long x1, const float *weights,
+                                             bool wantLine, float minAlpha, float *rowSums) {
+	size_t rowOffset = (size_t)(y - view->top) * view->stride - view->left;
+	const A_u_char *mask = view->mask + rowOffset;
+	const float *r = view->planes[PLANE_R] + rowOffset;
+	const float *g = view->planes[PLANE_G] + rowOffset;
+	const float *b = view->planes[PLANE_B] + rowOffset;
+	const float *a = view->planes[PLANE_A] + rowOffset;
+	A_long x = x0;
+	for (A_long c = 0; c < 5; c++) rowSums[c] = 0.0f;
+
+#if CX_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lineFlag = wantLine ? _mm_set1_epi32(-1) : zero;
+	const __m128 alphaLimit = _mm_set1_ps(minAlpha);
+	__m128 sumR = _mm_setzero_ps(), sumG = _mm_setzero_ps(), sumB = _mm_setzero_ps();
+	__m128 sumA = _mm_setzero_ps(), sumW = _mm_setzero_ps();
+
+	for (; x + 4 <= x1; x += 4) {
+		int maskBytes;
+		memcpy(&maskBytes, mask + x, sizeof(maskBytes));
+		__m128i m = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(maskBytes), zero), zero);
+		__m128i isLine = _mm_xor_si128(_mm_cmpeq_epi32(m, zero), _mm_set1_epi32(-1));
+		__m128 alpha = _mm_loadu_ps(a + x);
+		__m128 valid = _mm_and_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(isLine, lineFlag)), _mm_cmpnlt_ps(alpha, alphaLimit));
+		if (_mm_movemask_ps(valid) == 0) continue;
+
+		__m128 w = _mm_and_ps(_mm_loadu_ps(weights + (x - x0)), valid);
+		sumW = _mm_add_ps(sumW, w);
+		sumR = _mm_add_ps(sumR, _mm_mul_ps(_mm_and_ps(_mm_loadu_ps(r + x), valid), w));
+		sumG = _mm_add_ps(sumG, _mm_mul_ps(_mm_and_ps(_mm_loadu_ps(g + x), valid), w));
+		sumB = _mm_add_ps(sumB, _mm_mul_ps(_mm_and_ps(_mm_loadu_ps(b + x), valid), w));
+		sumA = _mm_add_ps(sumA, _mm_mul_ps(_mm_and_ps(alpha, valid), w));
+	}
 
-	switch (info->outputMode) {
-		case OUTPUT_MODE_FULL:
-			if (isLine) {
-				FillLinePixel16(info, xL, yL, inP, outP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8, &ctx->colorAdj);
-			} else {
-				*outP = *inP;
-			}
-			break;
-		case OUTPUT_MODE_LINE_ONLY:
-			if (isLine) {
-				FillLinePixel16(info, xL, yL, inP, outP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8, &ctx->colorAdj);
-				outP->alpha = PF_MAX_CHAN16;
-			} else {
-				outP->alpha = 0;
-				outP->red = 0;
-				outP->green = 0;
-				outP->blue = 0;
-			}
-			break;
-		case OUTPUT_MODE_BG_ONLY:
-			if (isLine) {
-				outP->alpha = 0;
-				outP->red = 0;
-				outP->green = 0;
-				outP->blue = 0;
-			} else {
-				*outP = *inP;
-			}
-			break;
-		default:
-			*outP = *inP;
-			break;
+	float lanes[4];
+	__m128 sums[5] = { sumR, sumG, sumB, sumA, sumW };
+	for (A_long c = 0; c < 5; c++) {
+		_mm_storeu_ps(lanes, sums[c]);
+		rowSums[c] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+#endif
+
+	for (; x < x1; x++) {
+		if ((mask[x] != 0) != wantLine || a[x] < minAlpha) continue;
+		float weight = weights[x - x0];
+		rowSums[0] += r[x] * weight;
+		rowSums[1] += g[x] * weight;
+		rowSums[2] += b[x] * weight;
+		rowSums[3] += a[x] * weight;
+		rowSums[4] += weight;
 	}
-	return PF_Err_NONE;
 }
 
-static PF_Err FillAndMaskFloat_Optimized(void *refcon, A_long xL, A_long yL, PF_PixelFloat *inP, PF_PixelFloat *outP) {
-	ProcessingContext *ctx = (ProcessingContext*)refcon;
-	ColorLinesInfo *info = ctx->info;
+// Float frames sum their windows in single precision. Each row is summed in
+// four vector lanes and the rows are combined with Kahan summation, so the
+// error no longer grows with the number of taps: for a window of radius r the
+// sums are within (ceil((2r+1) / 4) + 6) * 2^-24 * sum|w * c| of the double
+// result, about 2e-6 relative at the maximum radius of 50. The mean of values
+// in [0, 1] is thus exact to well below the display precision of 16 bpc.
+static void AccumulatePlanarWindowSingle(const PipelineContext *ctx, const PlanarView<float> *view, A_long x, A_long y, A_long radius,
+                                         const float *weights, bool wantLine, float minAlpha, PF_FpLong *sums) {
+	A_long size = radius * 2 + 1;
+	A_long x0 = x - radius < 0 ? 0 : x - radius;
+	A_long x1 = x + radius + 1 > ctx->width ? ctx->width : x + radius + 1;
+	float total[5] = { 0, 0, 0, 0, 0 };
+	float carry[5] = { 0, 0, 0, 0, 0 };
 
-	if (xL < ctx->edgeMargin || yL < ctx->edgeMargin ||
-		xL >= ctx->width - ctx->edgeMargin ||
-		yL >= ctx->height - ctx->edgeMargin) {
-		*outP = *inP;
-		SetMaskAtFast(info, xL, yL, 0);
-		return PF_Err_NONE;
+	for (A_long dy = -radius; dy <= radius; dy++) {
+		A_long ny = y + dy;
+		if (ny < 0 || ny >= ctx->height) continue;
+
+		float rowSums[5];
+		AccumulatePlanarRowSingle(view, ny, x0, x1, weights + (dy + radius) * size + (x0 - x + radius), wantLine, minAlpha, rowSums);
+		for (A_long c = 0; c < 5; c++) {
+			float corrected = rowSums[c] - carry[c];
+			float next = total[c] + corrected;
+			carry[c] = (next - total[c]) - corrected;
+			total[c] = next;
+		}
 	}
+	for (A_long c = 0; c < 5; c++) sums[c] += total[c];
+}
 
-	PF_Boolean isLine = IsTargetColorFloatFast(inP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8);
-	SetMaskAtFast(info, xL, yL, isLine ? 255 : 0);
+// ----------------------------------------------------------------------------
+// Integer kernels for 8/16-bit frames
+// ----------------------------------------------------------------------------
+//
+// 8-bit tiles are staged as 16-bit integer planes and summed with Q15 weights
+// (1.0 = WEIGHT_Q15_ONE) through pmaddwd, eight taps per instruction against two
+// for double. Row sums stay below 2^31 (101 taps * 255 * 32767) and rows are
+// added in 64 bits. The quantized weights are a valid weighting of their own;
+// against the double path the mean moves by at most
+// spread * 0.5 / (32767 * min weight), under 0.3 LSB for the smallest inverse
+// distance weight, so outputs match it within +-1 LSB.
+//
+// At 16 bits the same bound reaches tens of LSB, so weighted sums stay in
+// double there. The Average fill needs no weights and runs at both depths as a
+// plain masked sum and count, which is exact and equals the double result.
+
+#define WEIGHT_Q15_ONE 32767
+
+#if CX_SSE2
+// Two registers of two ARGB pixels each -> four channel runs of four
+static inline void StoreTransposed16(__m128i p01, __m128i p23, A_u_short **planes, A_long x) {
+	__m128i t0 = _mm_unpacklo_epi16(p01, p23);	// a0 a2 r0 r2 g0 g2 b0 b2
+	__m128i t1 = _mm_unpackhi_epi16(p01, p23);	// a1 a3 r1 r3 g1 g3 b1 b3
+	__m128i ar = _mm_unpacklo_epi16(t0, t1);	// a0 a1 a2 a3 r0 r1 r2 r3
+	__m128i gb = _mm_unpackhi_epi16(t0, t1);	// g0 g1 g2 g3 b0 b1 b2 b3
+	_mm_storel_epi64((__m128i*)(planes[PLANE_A] + x), ar);
+	_mm_storel_epi64((__m128i*)(planes[PLANE_R] + x), _mm_srli_si128(ar, 8));
+	_mm_storel_epi64((__m128i*)(planes[PLANE_G] + x), gb);
+	_mm_storel_epi64((__m128i*)(planes[PLANE_B] + x), _mm_srli_si128(gb, 8));
+}
 
-	switch (info->outputMode) {
-		case OUTPUT_MODE_FULL:
-			if (isLine) {
-				FillLinePixelFloat(info, xL, yL, inP, outP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8, &ctx->colorAdj);
-			} else {
-				*outP = *inP;
-			}
-			break;
-		case OUTPUT_MODE_LINE_ONLY:
-			if (isLine) {
-				FillLinePixelFloat(info, xL, yL, inP, outP, ctx->targetR8, ctx->targetG8, ctx->targetB8, ctx->toleranceSq8, &ctx->colorAdj);
-				outP->alpha = 1.0f;
-			} else {
-				outP->alpha = 0;
-				outP->red = 0;
-				outP->green = 0;
-				outP->blue = 0;
-			}
-			break;
-		case OUTPUT_MODE_BG_ONLY:
-			if (isLine) {
-				outP->alpha = 0;
-				outP->red = 0;
-				outP->green = 0;
-				outP->blue = 0;
-			} else {
-				*outP = *inP;
-			}
-			break;
-		default:
-			*outP = *inP;
-			break;
+template<>
+void DeinterleaveRow<PF_Pixel8, A_u_short>(const PF_Pixel8 *src, A_long count, A_u_short **planes) {
+	const __m128i zero = _mm_setzero_si128();
+	A_long x = 0;
+	for (; x + 4 <= count; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+		StoreTransposed16(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero), planes, x);
+	}
+	for (; x < count; x++) {
+		planes[PLANE_R][x] = src[x].red;
+		planes[PLANE_G][x] = src[x].green;
+		planes[PLANE_B][x] = src[x].blue;
+		planes[PLANE_A][x] = src[x].alpha;
 	}
-	return PF_Err_NONE;
 }
 
-// ============================================================================
-// Optimized Blur Pass with Precomputed Weights
-// ============================================================================
+template<>
+void DeinterleaveRow<PF_Pixel16, A_u_short>(const PF_Pixel16 *src, A_long count, A_u_short **planes) {
+	A_long x = 0;
+	for (; x + 4 <= count; x += 4) {
+		StoreTransposed16(_mm_loadu_si128((const __m128i*)(src + x)), _mm_loadu_si128((const __m128i*)(src + x + 2)), planes, x);
+	}
+	for (; x < count; x++) {
+		planes[PLANE_R][x] = src[x].red;
+		planes[PLANE_G][x] = src[x].green;
+		planes[PLANE_B][x] = src[x].blue;
+		planes[PLANE_A][x] = src[x].alpha;
+	}
+}
 
-typedef struct {
-	ColorLinesInfo *info;
-	PF_EffectWorld *tempWorld;
-	A_long blurRadius;
-	A_long blurSize;
-} BlurContext;
+template<>
+void DeinterleaveRow<PF_Pixel_BGRA_8u, A_u_short>(const PF_Pixel_BGRA_8u *src, A_long count, A_u_short **planes) {
+	A_u_short *swapped[PLANE_COUNT];
+	SwapBGRAPlanes(planes, swapped);
+	DeinterleaveRow<PF_Pixel8, A_u_short>((const PF_Pixel8*)src, count, swapped);
+}
 
-static PF_Err BlurPass8_Optimized(void *refcon, A_long xL, A_long yL, PF_Pixel8 *inP, PF_Pixel8 *outP) {
-	BlurContext *ctx = (BlurContext*)refcon;
-	ColorLinesInfo *info = ctx->info;
+// Lanes whose (mask != 0) equals wantLine and whose alpha is not below the limit
+static inline __m128i ValidLanes16(const A_u_char *mask, const A_u_short *alpha, __m128i lineFlag, __m128i alphaLimit) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i allOnes = _mm_set1_epi16(-1);
+	__m128i m = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)mask), zero);
+	__m128i isLine = _mm_xor_si128(_mm_cmpeq_epi16(m, zero), allOnes);
+	// Unsigned alpha < limit  <=>  saturating limit - alpha != 0
+	__m128i below = _mm_xor_si128(_mm_cmpeq_epi16(_mm_subs_epu16(alphaLimit, _mm_loadu_si128((const __m128i*)alpha)), zero), allOnes);
+	return _mm_andnot_si128(below, _mm_cmpeq_epi16(isLine, lineFlag));
+}
 
-	if (GetMaskAt(info, xL, yL) == 0) {
-		*outP = *inP;
-		return PF_Err_NONE;
+static inline int64_t HorizontalSum32(__m128i v) {
+	int32_t lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, v);
+	return (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+// Q15 weighted sums of an 8-bit plane row; sums as in AccumulatePlanarRow
+static inline void AccumulatePlanarRowQ15(const PlanarView<A_u_short> *view, A_long y, A_long x0, A_long x1, const short *weights,
+                                          bool wantLine, A_long minAlpha, int64_t *sums) {
+	size_t rowOffset = (size_t)(y - view->top) * view->stride - view->left;
+	const A_u_char *mask = view->mask + rowOffset;
+	const A_u_short *r = view->planes[PLANE_R] + rowOffset;
+	const A_u_short *g = view->planes[PLANE_G] + rowOffset;
+	const A_u_short *b = view->planes[PLANE_B] + rowOffset;
+	const A_u_short *a = view->planes[PLANE_A] + rowOffset;
+	A_long x = x0;
+
+#if CX_SSE2
+	const __m128i lineFlag = wantLine ? _mm_set1_epi16(-1) : _mm_setzero_si128();
+	const __m128i alphaLimit = _mm_set1_epi16((short)minAlpha);
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i sumR = _mm_setzero_si128(), sumG = _mm_setzero_si128(), sumB = _mm_setzero_si128();
+	__m128i sumA = _mm_setzero_si128(), sumW = _mm_setzero_si128();
+
+	for (; x + 8 <= x1; x += 8) {
+		__m128i valid = ValidLanes16(mask + x, a + x, lineFlag, alphaLimit);
+		if (_mm_movemask_epi8(valid) == 0) continue;
+
+		__m128i w = _mm_and_si128(_mm_loadu_si128((const __m128i*)(weights + (x - x0))), valid);
+		sumW = _mm_add_epi32(sumW, _mm_madd_epi16(w, ones));
+		sumR = _mm_add_epi32(sumR, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(r + x)), w));
+		sumG = _mm_add_epi32(sumG, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(g + x)), w));
+		sumB = _mm_add_epi32(sumB, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(b + x)), w));
+		sumA = _mm_add_epi32(sumA, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(a + x)), w));
 	}
 
-	A_long blurRadius = ctx->blurRadius;
-	A_long blurSize = ctx->blurSize;
-	PF_FpLong sumR = 0, sumG = 0, sumB = 0, sumA = 0;
-	PF_FpLong totalWeight = 0;
+	sums[0] += HorizontalSum32(sumR);
+	sums[1] += HorizontalSum32(sumG);
+	sums[2] += HorizontalSum32(sumB);
+	sums[3] += HorizontalSum32(sumA);
+	sums[4] += HorizontalSum32(sumW);
+#endif
+
+	for (; x < x1; x++) {
+		if ((mask[x] != 0) != wantLine || a[x] < minAlpha) continue;
+		A_long weight = weights[x - x0];
+		sums[0] += r[x] * weight;
+		sums[1] += g[x] * weight;
+		sums[2] += b[x] * weight;
+		sums[3] += a[x] * weight;
+		sums[4] += weight;
+	}
+}
 
-	for (A_long dy = -blurRadius; dy <= blurRadius; dy++) {
-		A_long ny = yL + dy;
-		if (ny < 0 || ny >= info->maskHeight) continue;
-
-		if (GetMaskAt(info, xL, ny) == 0) {
-			// Quick check: if center of row is not masked, likely skip
-			PF_Boolean hasAnyMask = FALSE;
-			for (A_long dx = -blurRadius; dx <= blurRadius; dx++) {
-				if (GetMaskAt(info, xL + dx, ny) != 0) {
-					hasAnyMask = TRUE;
-					break;
-				}
-			}
-			if (!hasAnyMask) continue;
-		}
+// Unweighted sums and sample count of a 16-bit plane row
+static inline void AccumulatePlanarRowUnit(const PlanarView<A_u_short> *view, A_long y, A_long x0, A_long x1,
+                                           bool wantLine, A_long minAlpha, int64_t *sums) {
+	size_t rowOffset = (size_t)(y - view->top) * view->stride - view->left;
+	const A_u_char *mask = view->mask + rowOffset;
+	const A_u_short *r = view->planes[PLANE_R] + rowOffset;
+	const A_u_short *g = view->planes[PLANE_G] + rowOffset;
+	const A_u_short *b = view->planes[PLANE_B] + rowOffset;
+	const A_u_short *a = view->planes[PLANE_A] + rowOffset;
+	A_long x = x0;
+
+#if CX_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lineFlag = wantLine ? _mm_set1_epi16(-1) : zero;
+	const __m128i alphaLimit = _mm_set1_epi16((short)minAlpha);
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i sumR = zero, sumG = zero, sumB = zero, sumA = zero, count = zero;
+
+	for (; x + 8 <= x1; x += 8) {
+		__m128i valid = ValidLanes16(mask + x, a + x, lineFlag, alphaLimit);
+		if (_mm_movemask_epi8(valid) == 0) continue;
+
+		count = _mm_add_epi32(count, _mm_madd_epi16(_mm_and_si128(valid, ones), ones));
+		// Channels reach 32768, past the signed range of pmaddwd, so widen instead
+		#define CX_SUM_PLANE(SUM, SRC) { \
+			__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(SRC)), valid); \
+			SUM = _mm_add_epi32(SUM, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero))); }
+		CX_SUM_PLANE(sumR, r + x);
+		CX_SUM_PLANE(sumG, g + x);
+		CX_SUM_PLANE(sumB, b + x);
+		CX_SUM_PLANE(sumA, a + x);
+		#undef CX_SUM_PLANE
+	}
+
+	sums[0] += HorizontalSum32(sumR);
+	sums[1] += HorizontalSum32(sumG);
+	sums[2] += HorizontalSum32(sumB);
+	sums[3] += HorizontalSum32(sumA);
+	sums[4] += HorizontalSum32(count);
+#endif
+
+	for (; x < x1; x++) {
+		if ((mask[x] != 0) != wantLine || a[x] < minAlpha) continue;
+		sums[0] += r[x];
+		sums[1] += g[x];
+		sums[2] += b[x];
+		sums[3] += a[x];
+		sums[4] += 1;
+	}
+}
 
-		PF_Pixel8 *rowPtr = GetRow8(ctx->tempWorld, ny);
-		A_long weightRowOffset = (dy + blurRadius) * blurSize;
+// Integer window sums; without weights every sample counts once
+static void AccumulatePlanarWindowInteger(const PipelineContext *ctx, const PlanarView<A_u_short> *view, A_long x, A_long y, A_long radius,
+                                          const short *weights, bool wantLine, A_long minAlpha, PF_FpLong *sums) {
+	A_long size = radius * 2 + 1;
+	A_long x0 = x - radius < 0 ? 0 : x - radius;
+	A_long x1 = x + radius + 1 > ctx->width ? ctx->width : x + radius + 1;
+	int64_t total[5] = { 0, 0, 0, 0, 0 };
 
-		for (A_long dx = -blurRadius; dx <= blurRadius; dx++) {
-			A_long nx = xL + dx;
-			if (nx < 0 || nx >= info->maskWidth) continue;
-			if (GetMaskAt(info, nx, ny) == 0) continue;
-
-			PF_Pixel8 *neighbor = rowPtr + nx;
-			PF_FpLong weight = g_gaussianWeights[weightRowOffset + dx + blurRadius];
-			sumR += neighbor->red * weight;
-			sumG += neighbor->green * weight;
-			sumB += neighbor->blue * weight;
-			sumA += neighbor->alpha * weight;
-			totalWeight += weight;
+	for (A_long dy = -radius; dy <= radius; dy++) {
+		A_long ny = y + dy;
+		if (ny < 0 || ny >= ctx->height) continue;
+		if (weights) {
+			AccumulatePlanarRowQ15(view, ny, x0, x1, weights + (dy + radius) * size + (x0 - x + radius), wantLine, minAlpha, total);
+		} else {
+			AccumulatePlanarRowUnit(view, ny, x0, x1, wantLine, minAlpha, total);
 		}
 	}
+	for (A_long c = 0; c < 5; c++) sums[c] += (PF_FpLong)total[c];
+}
 
-	if (totalWeight > 0) {
-		PF_FpLong invWeight = 1.0 / totalWeight;
-		outP->red = ClampByte(sumR * invWeight);
-		outP->green = ClampByte(sumG * invWeight);
-		outP->blue = ClampByte(sumB * invWeight);
-		outP->alpha = ClampByte(sumA * invWeight);
+// Window sums of float planes: single precision for float frames, double otherwise
+template<typename P>
+static inline void AccumulateWindow(const StageJob *job, const PlanarView<float> *view, A_long x, A_long y, A_long radius,
+                                    bool wantLine, float minAlpha, PF_FpLong *sums) {
+	if (PixelTraits<P>::kSingleAccum) {
+		AccumulatePlanarWindowSingle(job->ctx, view, x, y, radius, job->weightsSingle, wantLine, minAlpha, sums);
 	} else {
-		*outP = *inP;
+		AccumulatePlanarWindow(job->ctx, view, x, y, radius, job->weights, wantLine, minAlpha, sums);
 	}
-	return PF_Err_NONE;
 }
 
-static PF_Err BlurPass16_Optimized(void *refcon, A_long xL, A_long yL, PF_Pixel16 *inP, PF_Pixel16 *outP) {
-	BlurContext *ctx = (BlurContext*)refcon;
-	ColorLinesInfo *info = ctx->info;
+// Window sums of integer planes, Q15 weighted when the job carries Q15 weights
+template<typename P>
+static inline void AccumulateWindow(const StageJob *job, const PlanarView<A_u_short> *view, A_long x, A_long y, A_long radius,
+                                    bool wantLine, float minAlpha, PF_FpLong *sums) {
+	AccumulatePlanarWindowInteger(job->ctx, view, x, y, radius, job->weightsQ15, wantLine, minAlpha > 0 ? (A_long)minAlpha : 0, sums);
+}
 
-	if (GetMaskAt(info, xL, yL) == 0) {
-		*outP = *inP;
-		return PF_Err_NONE;
+// Q15 copy of a weight table
+static void QuantizeWeights(const std::vector<PF_FpLong> &weights, std::vector<short> *weightsQ15) {
+	weightsQ15->resize(weights.size());
+	for (size_t i = 0; i < weights.size(); i++) {
+		(*weightsQ15)[i] = (short)floor(weights[i] * WEIGHT_Q15_ONE + 0.5);
 	}
+}
 
-	A_long blurRadius = ctx->blurRadius;
-	A_long blurSize = ctx->blurSize;
-	PF_FpLong sumR = 0, sumG = 0, sumB = 0, sumA = 0;
-	PF_FpLong totalWeight = 0;
+// Stages one tile plus its halo as planes and runs Kernel on its line pixels
+template<typename P, typename T, void (*Kernel)(const StageJob*, const PlanarView<T>*, size_t)>
+static PF_Err PlanarTileLines(void *refcon, A_long thread, A_long index, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	const PipelineContext *ctx = job->ctx;
+	const NeighborhoodView *frame = job->frameView;
+	A_long tile = job->tiles[index];
+	A_long tilesX = (ctx->width + TILE_SIZE - 1) / TILE_SIZE;
+	A_long r = job->haloRadius;
+
+	A_long left = (tile % tilesX) * TILE_SIZE - r;
+	A_long top = (tile / tilesX) * TILE_SIZE - r;
+	A_long right = left + TILE_SIZE + 2 * r;
+	A_long bottom = top + TILE_SIZE + 2 * r;
+	if (left < 0) left = 0;
+	if (top < 0) top = 0;
+	if (right > ctx->width) right = ctx->width;
+	if (bottom > ctx->height) bottom = ctx->height;
+
+	// Rows padded to whole 16 byte vectors
+	A_long stride = (right - left + 7) & ~7;
+	size_t planeSize = (size_t)stride * (bottom - top);
+	std::vector<T> planes(planeSize * PLANE_COUNT);
+	std::vector<A_u_char> mask(planeSize);
+
+	for (A_long y = top; y < bottom; y++) {
+		size_t offset = (size_t)(y - top) * stride;
+		T *rows[PLANE_COUNT];
+		for (A_long c = 0; c < PLANE_COUNT; c++) rows[c] = &planes[c * planeSize + offset];
+		DeinterleaveRow<P, T>(ViewRow<P>(frame, y) + left, right - left, rows);
+		memcpy(&mask[offset], ViewMaskRow(frame, y) + left, right - left);
+	}
 
-	for (A_long dy = -blurRadius; dy <= blurRadius; dy++) {
-		A_long ny = yL + dy;
-		if (ny < 0 || ny >= info->maskHeight) continue;
+	PlanarView<T> staged;
+	for (A_long c = 0; c < PLANE_COUNT; c++) staged.planes[c] = &planes[c * planeSize];
+	staged.mask = mask.data();
+	staged.stride = stride;
+	staged.left = left;
+	staged.top = top;
 
-		PF_Pixel16 *rowPtr = GetRow16(ctx->tempWorld, ny);
-		A_long weightRowOffset = (dy + blurRadius) * blurSize;
+	for (A_long k = job->tileStarts[tile]; k < job->tileStarts[tile + 1]; k++) {
+		Kernel(job, &staged, job->tileLines[k]);
+	}
+	return PF_Err_NONE;
+}
 
-		for (A_long dx = -blurRadius; dx <= blurRadius; dx++) {
-			A_long nx = xL + dx;
-			if (nx < 0 || nx >= info->maskWidth) continue;
-			if (GetMaskAt(info, nx, ny) == 0) continue;
-
-			PF_Pixel16 *neighbor = rowPtr + nx;
-			PF_FpLong weight = g_gaussianWeights[weightRowOffset + dx + blurRadius];
-			sumR += neighbor->red * weight;
-			sumG += neighbor->green * weight;
-			sumB += neighbor->blue * weight;
-			sumA += neighbor->alpha * weight;
-			totalWeight += weight;
+// Runs Kernel on every line pixel from planar copies of the tiles of frame
+template<typename P, typename T, void (*Kernel)(const StageJob*, const PlanarView<T>*, size_t)>
+static PF_Err RunPlanarKernel(PipelineContext *ctx, StageJob *job, const NeighborhoodView *frame, A_long radius) {
+	std::vector<A_long> tileStarts, tileLines, tiles;
+	BuildTileBins(ctx, *job->product->lines, &tileStarts, &tileLines, &tiles);
+	job->frameView = frame;
+	job->haloRadius = radius;
+	job->tileStarts = tileStarts.data();
+	job->tileLines = tileLines.data();
+	job->tiles = tiles.data();
+	return ParallelFor(ctx, (A_long)tiles.size(), job, PlanarTileLines<P, T, Kernel>);
+}
+
+// Looks up a stage product, building and caching it on a miss
+static PF_Err RunStage(PipelineContext *ctx, PipelineStage stage,
+                       PF_Err (*build)(PipelineContext*, const ColorLinesProduct*, ColorLinesProduct*),
+                       const ColorLinesProduct *upstream, ProductPtr *productP) {
+	if (ctx->stageCache) {
+		*productP = ctx->stageCache->Find(ctx->stageKeys[stage]);
+		if (*productP) return PF_Err_NONE;
+	}
+
+	std::shared_ptr<ColorLinesProduct> product = std::make_shared<ColorLinesProduct>();
+	PF_Err err = build(ctx, upstream, product.get());
+	if (!err) {
+		if (ctx->stageCache) ctx->stageCache->Insert(ctx->stageKeys[stage], product, product->Bytes());
+		*productP = product;
+	}
+	return err;
+}
+
+// ============================================================================
+// DIST Stage
+// ============================================================================
+
+// Fills the distance plane for one band of rows and histograms it. Distances
+// are computed once per unique colour in the band until the palette overflows.
+template<typename P>
+static PF_Err DistanceBand(void *refcon, A_long thread, A_long band, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	A_u_long *histogram = job->histograms + (size_t)band * (DISTANCE_SATURATED + 1);
+	A_long y0 = (A_long)((PF_FpLong)ctx->height * band / count);
+	A_long y1 = (A_long)((PF_FpLong)ctx->height * (band + 1) / count);
+	CXPalette<P, A_u_short> palette;
+	PF_Boolean usePalette = TRUE;
+
+	for (A_long y = y0; y < y1; y++) {
+		P *row = GetRow<P>(ctx->srcWorld, y);
+		A_u_short *distRow = &job->product->distance[(size_t)y * ctx->width];
+		for (A_long x = 0; x < ctx->width; x++) {
+			bool isNew = false;
+			A_u_short *cached = usePalette ? palette.Lookup(row[x], &isNew) : NULL;
+			A_u_short d;
+			if (cached && !isNew) {
+				d = *cached;
+			} else {
+				A_long distSq = PixelTraits<P>::DistanceSq(row + x, &ctx->match);
+				d = (A_u_short)(distSq < DISTANCE_SATURATED ? distSq : DISTANCE_SATURATED);
+				if (cached) *cached = d;
+				else usePalette = FALSE;
+			}
+			distRow[x] = d;
+			histogram[d]++;
 		}
 	}
+	return PF_Err_NONE;
+}
 
-	if (totalWeight > 0) {
-		PF_FpLong invWeight = 1.0 / totalWeight;
-		outP->red = Clamp16(sumR * invWeight);
-		outP->green = Clamp16(sumG * invWeight);
-		outP->blue = Clamp16(sumB * invWeight);
-		outP->alpha = Clamp16(sumA * invWeight);
+template<typename P>
+static PF_Err BuildDistance(PipelineContext *ctx, const ColorLinesProduct *upstream, ColorLinesProduct *product) {
+	PF_Err err = PF_Err_NONE;
+	A_long bands = ctx->height < PALETTE_BANDS ? ctx->height : PALETTE_BANDS;
+	std::vector<A_u_long> histograms((size_t)bands * (DISTANCE_SATURATED + 1));
+
+	product->distance.resize((size_t)ctx->width * ctx->height);
+
+	StageJob job = {};
+	job.ctx = ctx;
+	job.product = product;
+	job.histograms = histograms.data();
+	ERR(ParallelFor(ctx, bands, &job, DistanceBand<P>));
+
+	if (!err) {
+		product->countAtMost.resize(DISTANCE_SATURATED + 1);
+		A_u_long total = 0;
+		for (A_long d = 0; d <= DISTANCE_SATURATED; d++) {
+			for (A_long b = 0; b < bands; b++) {
+				total += histograms[(size_t)b * (DISTANCE_SATURATED + 1) + d];
+			}
+			product->countAtMost[d] = total;
+		}
+	}
+	return err;
+}
+
+// ============================================================================
+// MASK Stage
+// ============================================================================
+
+// mask[i] = (distance[i] <= toleranceSq) ? 255 : 0 for toleranceSq < saturation
+static void ThresholdDistances(const A_u_short *distance, A_u_char *mask, A_long count, A_long toleranceSq) {
+	A_long x = 0;
+#if CX_SSE2
+	const __m128i threshold = _mm_set1_epi16((short)toleranceSq);
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 16 <= count; x += 16) {
+		__m128i d0 = _mm_loadu_si128((const __m128i*)(distance + x));
+		__m128i d1 = _mm_loadu_si128((const __m128i*)(distance + x + 8));
+		// Unsigned d <= t  <=>  saturating d - t == 0
+		__m128i in0 = _mm_cmpeq_epi16(_mm_subs_epu16(d0, threshold), zero);
+		__m128i in1 = _mm_cmpeq_epi16(_mm_subs_epu16(d1, threshold), zero);
+		_mm_storeu_si128((__m128i*)(mask + x), _mm_packs_epi16(in0, in1));
+	}
+#endif
+	for (; x < count; x++) {
+		mask[x] = distance[x] <= toleranceSq ? 255 : 0;
+	}
+}
+
+template<typename P>
+static PF_Err MaskRow(void *refcon, A_long thread, A_long y, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	const A_u_short *distRow = &job->upstream->distance[(size_t)y * ctx->width];
+	A_u_char *maskRow = &job->product->mask[(size_t)y * ctx->width];
+
+	if (ctx->match.toleranceSq8 < DISTANCE_SATURATED) {
+		ThresholdDistances(distRow, maskRow, ctx->width, ctx->match.toleranceSq8);
 	} else {
-		*outP = *inP;
+		// Everything below saturation matches; saturated pixels need their exact distance
+		P *row = GetRow<P>(ctx->srcWorld, y);
+		for (A_long x = 0; x < ctx->width; x++) {
+			PF_Boolean isTarget = distRow[x] < DISTANCE_SATURATED || PixelTraits<P>::IsTarget(row + x, &ctx->match);
+			maskRow[x] = isTarget ? 255 : 0;
+		}
+	}
+	return PF_Err_NONE;
+}
+
+// Clears the pixels of SPECK_CHUNK_SIZE specks, each within its bounding box
+static PF_Err ClearSpeckChunk(void *refcon, A_long thread, A_long chunk, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	A_long end = std::min((chunk + 1) * SPECK_CHUNK_SIZE, job->speckCount);
+
+	for (A_long i = chunk * SPECK_CHUNK_SIZE; i < end; i++) {
+		A_u_long label = job->specks[i];
+		const CXComponentStats &speck = job->components[label - 1];
+		for (A_long y = speck.top; y < speck.bottom; y++) {
+			size_t row = (size_t)y * ctx->width;
+			for (A_long x = speck.left; x < speck.right; x++) {
+				if (job->labels[row + x] == label) job->product->mask[row + x] = 0;
+			}
+		}
 	}
 	return PF_Err_NONE;
 }
 
-static PF_Err BlurPassFloat_Optimized(void *refcon, A_long xL, A_long yL, PF_PixelFloat *inP, PF_PixelFloat *outP) {
-	BlurContext *ctx = (BlurContext*)refcon;
-	ColorLinesInfo *info = ctx->info;
+// Rows past a strip's view that a speck test needs: a piece of fewer than
+// Minimum Line Size pixels spans fewer rows than that
+static inline A_long SpeckHalo(const PipelineContext *ctx) {
+	return ctx->minLineSize > 1 ? ctx->minLineSize - 1 : 0;
+}
 
-	if (GetMaskAt(info, xL, yL) == 0) {
-		*outP = *inP;
-		return PF_Err_NONE;
+// Drops the connected pieces of the mask below Minimum Line Size. A piece
+// touching a strip's cut edge is kept: the view reaches SpeckHalo() rows
+// past every row that is filled or read, so such a piece is too tall to be
+// a speck.
+static PF_Err DropSpecks(PipelineContext *ctx, ColorLinesProduct *product) {
+	PF_Err err = PF_Err_NONE;
+	std::vector<A_u_long> labels((size_t)ctx->width * ctx->height);
+	CXComponentLabeler labeler(product->mask.data(), ctx->width, ctx->height, COMPONENT_BANDS, labels.data());
+
+	ERR(ParallelFor(ctx, labeler.BandCount(), &labeler, CX_LabelComponentsBand));
+	if (!err) labeler.Merge();
+	ERR(ParallelFor(ctx, labeler.BandCount(), &labeler, CX_ResolveComponentsBand));
+	if (err) return err;
+
+	std::vector<CXComponentStats> components;
+	labeler.Finish(&components);
+	PF_Boolean cutTop = ctx->frameTop > 0;
+	PF_Boolean cutBottom = ctx->frameTop + ctx->height < ctx->frameHeight;
+	std::vector<A_u_long> specks;
+	for (size_t i = 0; i < components.size(); i++) {
+		const CXComponentStats &c = components[i];
+		if (c.pixels >= (A_u_long)ctx->minLineSize) continue;
+		if ((cutTop && c.top == 0) || (cutBottom && c.bottom == ctx->height)) continue;
+		specks.push_back((A_u_long)(i + 1));
 	}
 
-	A_long blurRadius = ctx->blurRadius;
-	A_long blurSize = ctx->blurSize;
-	PF_FpLong sumR = 0, sumG = 0, sumB = 0, sumA = 0;
-	PF_FpLong totalWeight = 0;
+	StageJob job = {};
+	job.ctx = ctx;
+	job.product = product;
+	job.labels = labels.data();
+	job.components = components.data();
+	job.specks = specks.data();
+	job.speckCount = (A_long)specks.size();
+	return ParallelFor(ctx, (job.speckCount + SPECK_CHUNK_SIZE - 1) / SPECK_CHUNK_SIZE, &job, ClearSpeckChunk);
+}
 
-	for (A_long dy = -blurRadius; dy <= blurRadius; dy++) {
-		A_long ny = yL + dy;
-		if (ny < 0 || ny >= info->maskHeight) continue;
+template<typename P>
+static PF_Err BuildMask(PipelineContext *ctx, const ColorLinesProduct *upstream, ColorLinesProduct *product) {
+	PF_Err err = PF_Err_NONE;
+	product->mask.resize((size_t)ctx->width * ctx->height);
+
+	StageJob job = {};
+	job.ctx = ctx;
+	job.upstream = upstream;
+	job.product = product;
+	ERR(ParallelFor(ctx, ctx->height, &job, MaskRow<P>));
+	if (!err && ctx->minLineSize > 1) {
+		ERR(DropSpecks(ctx, product));
+	}
+	return err;
+}
+
+// ============================================================================
+// FILL Stage
+// ============================================================================
 
-		PF_PixelFloat *rowPtr = GetRowFloat(ctx->tempWorld, ny);
-		A_long weightRowOffset = (dy + blurRadius) * blurSize;
+// Interior of the output area: pixels closer than the search radius to the
+// frame border are never filled and pass through unchanged.
+static void GetFillRect(const PipelineContext *ctx, PF_LRect *rect) {
+	A_long marginTop = ctx->edgeMargin - ctx->frameTop;
+	A_long marginBottom = ctx->frameHeight - ctx->edgeMargin - ctx->frameTop;
+	*rect = ctx->area;
+	rect->top = ctx->fillTop;
+	rect->bottom = ctx->fillBottom;
+	if (rect->left < ctx->edgeMargin) rect->left = ctx->edgeMargin;
+	if (rect->top < marginTop) rect->top = marginTop;
+	if (rect->right > ctx->width - ctx->edgeMargin) rect->right = ctx->width - ctx->edgeMargin;
+	if (rect->bottom > marginBottom) rect->bottom = marginBottom;
+	if (rect->right < rect->left) rect->right = rect->left;
+	if (rect->bottom < rect->top) rect->bottom = rect->top;
+}
 
-		for (A_long dx = -blurRadius; dx <= blurRadius; dx++) {
-			A_long nx = xL + dx;
-			if (nx < 0 || nx >= info->maskWidth) continue;
-			if (GetMaskAt(info, nx, ny) == 0) continue;
-
-			PF_PixelFloat *neighbor = rowPtr + nx;
-			PF_FpLong weight = g_gaussianWeights[weightRowOffset + dx + blurRadius];
-			sumR += neighbor->red * weight;
-			sumG += neighbor->green * weight;
-			sumB += neighbor->blue * weight;
-			sumA += neighbor->alpha * weight;
-			totalWeight += weight;
+template<typename P>
+static void NearestFillLinePixel(const PipelineContext *ctx, const NeighborhoodView *view, A_long x, A_long y, P *outP) {
+	const ColorLinesInfo *info = ctx->info;
+	A_long radius = info->searchRadius;
+	A_long width = ctx->width;
+	A_long height = ctx->height;
+	const P *inP = ViewRow<P>(view, y) + x;
+
+	// Find nearest non-target pixel
+	A_long nearestDistSq = 999999;
+	const P *nearestPixel = NULL;
+
+	// Search in expanding rings for early termination
+	for (A_long ring = 1; ring <= radius && nearestDistSq > 1; ring++) {
+		A_long ringSq = ring * ring;
+		if (ringSq >= nearestDistSq) break;  // Can't find closer
+
+		for (A_long dy = -ring; dy <= ring; dy++) {
+			A_long ny = y + dy;
+			if (ny < 0 || ny >= height) continue;
+
+			const P *rowPtr = ViewRow<P>(view, ny);
+			const A_u_char *maskRow = ViewMaskRow(view, ny);
+
+			for (A_long dx = -ring; dx <= ring; dx++) {
+				// Only process ring boundary
+				if (dy != -ring && dy != ring && dx != -ring && dx != ring) continue;
+
+				A_long nx = x + dx;
+				if (nx < 0 || nx >= width) continue;
+
+				const P *neighbor = rowPtr + nx;
+				if (info->ignoreTransparent && neighbor->alpha < PixelTraits<P>::kMaxAlpha) continue;
+				if (maskRow[nx]) continue;
+
+				A_long distSq = dx * dx + dy * dy;
+				if (distSq < nearestDistSq) {
+					nearestDistSq = distSq;
+					nearestPixel = neighbor;
+					if (distSq == 1) goto found_nearest;  // Can't get closer
+				}
+			}
+		}
+	}
+	found_nearest:
+
+	*outP = nearestPixel ? *nearestPixel : *inP;
+}
+
+// Window offset for the adaptive fill, visited in order of distance
+struct FillOffset {
+	A_long		dx, dy;
+	A_long		ring;		// ceil(distance), samples of one ring are taken together
+	PF_FpLong	weight;		// Inverse distance, as in Weighted mode
+};
+
+static bool FillOffsetCloser(const FillOffset &a, const FillOffset &b) {
+	A_long da = a.dx * a.dx + a.dy * a.dy;
+	A_long db = b.dx * b.dx + b.dy * b.dy;
+	if (da != db) return da < db;
+	if (a.dy != b.dy) return a.dy < b.dy;
+	return a.dx < b.dx;
+}
+
+// Offsets inside the search disk, nearest first
+static void PrecomputeFillOffsets(A_long radius, std::vector<FillOffset> *offsets) {
+	offsets->clear();
+	for (A_long dy = -radius; dy <= radius; dy++) {
+		for (A_long dx = -radius; dx <= radius; dx++) {
+			A_long distSq = dx * dx + dy * dy;
+			if (distSq == 0 || distSq > radius * radius) continue;
+
+			PF_FpLong dist = sqrt((PF_FpLong)distSq);
+			FillOffset offset;
+			offset.dx = dx;
+			offset.dy = dy;
+			offset.ring = (A_long)ceil(dist);
+			offset.weight = 1.0 / (dist + 0.1);
+			offsets->push_back(offset);
 		}
 	}
+	std::sort(offsets->begin(), offsets->end(), FillOffsetCloser);
+}
+
+// Weighted average of the nearest valid samples: rings are taken whole and the
+// search ends at the first ring boundary with at least Sample Count samples, so
+// the effective radius follows the local line thickness
+template<typename P>
+static void AdaptiveFillLinePixel(const PipelineContext *ctx, const NeighborhoodView *view, const FillOffset *offsets,
+                                  A_long offsetCount, A_long x, A_long y, P *outP) {
+	const ColorLinesInfo *info = ctx->info;
+	A_long width = ctx->width;
+	A_long height = ctx->height;
+	PF_FpLong totalWeight = 0;
+	PF_FpLong sumR = 0, sumG = 0, sumB = 0, sumA = 0;
+	A_long samples = 0;
+
+	for (A_long i = 0; i < offsetCount; i++) {
+		const FillOffset &offset = offsets[i];
+		if (samples >= info->sampleCount && offset.ring != offsets[i - 1].ring) break;
+
+		A_long nx = x + offset.dx;
+		A_long ny = y + offset.dy;
+		if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+		if (ViewMaskRow(view, ny)[nx]) continue;
+
+		const P *neighbor = ViewRow<P>(view, ny) + nx;
+		if (info->ignoreTransparent && neighbor->alpha < PixelTraits<P>::kMaxAlpha) continue;
+
+		sumR += neighbor->red * offset.weight;
+		sumG += neighbor->green * offset.weight;
+		sumB += neighbor->blue * offset.weight;
+		sumA += neighbor->alpha * offset.weight;
+		totalWeight += offset.weight;
+		samples++;
+	}
 
 	if (totalWeight > 0) {
 		PF_FpLong invWeight = 1.0 / totalWeight;
-		outP->red = (PF_FpShort)(sumR * invWeight);
-		outP->green = (PF_FpShort)(sumG * invWeight);
-		outP->blue = (PF_FpShort)(sumB * invWeight);
-		outP->alpha = (PF_FpShort)(sumA * invWeight);
+		outP->red = PixelTraits<P>::FromAccum(sumR * invWeight);
+		outP->green = PixelTraits<P>::FromAccum(sumG * invWeight);
+		outP->blue = PixelTraits<P>::FromAccum(sumB * invWeight);
+		outP->alpha = PixelTraits<P>::FromAccum(sumA * invWeight);
 	} else {
-		*outP = *inP;
+		*outP = ViewRow<P>(view, y)[x];
+	}
+}
+
+static PF_Err CountLineRow(void *refcon, A_long thread, A_long i, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	PF_LRect rect;
+	GetFillRect(ctx, &rect);
+
+	const A_u_char *maskRow = &job->upstream->mask[(size_t)(rect.top + i) * ctx->width];
+	A_long n = 0;
+	for (A_long x = rect.left; x < rect.right; x++) {
+		if (maskRow[x]) n++;
+	}
+	job->rowCounts[i] = n;
+	return PF_Err_NONE;
+}
+
+static PF_Err ListLineRow(void *refcon, A_long thread, A_long i, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	PF_LRect rect;
+	GetFillRect(ctx, &rect);
+
+	A_long y = rect.top + i;
+	const A_u_char *maskRow = &job->upstream->mask[(size_t)y * ctx->width];
+	A_long *out = job->lines->data() + job->rowCounts[i];
+	for (A_long x = rect.left; x < rect.right; x++) {
+		if (maskRow[x]) *out++ = y * ctx->width + x;
+	}
+	return PF_Err_NONE;
+}
+
+template<typename P>
+static void FillLineKernel(const StageJob *job, const NeighborhoodView *view, size_t i) {
+	const PipelineContext *ctx = job->ctx;
+	A_long line = (*job->product->lines)[i];
+	A_long y = line / ctx->width;
+	A_long x = line - y * ctx->width;
+	P out;
+
+	if (job->offsets) {
+		AdaptiveFillLinePixel<P>(ctx, view, job->offsets, job->offsetCount, x, y, &out);
+	} else {
+		NearestFillLinePixel<P>(ctx, view, x, y, &out);
+	}
+	StoreLinePixel<P>(ctx, job->product->pixels.data(), i, out);
+}
+
+// Average and Weighted modes: weighted mean of the valid window samples
+template<typename P, typename T>
+static void PlanarFillKernel(const StageJob *job, const PlanarView<T> *view, size_t i) {
+	const PipelineContext *ctx = job->ctx;
+	A_long line = (*job->product->lines)[i];
+	A_long y = line / ctx->width;
+	A_long x = line - y * ctx->width;
+	P out;
+	float minAlpha = ctx->info->ignoreTransparent ? (float)PixelTraits<P>::kMaxAlpha : -FLT_MAX;
+
+	// The center is a line pixel and never counts as a sample
+	PF_FpLong sums[5] = { 0, 0, 0, 0, 0 };
+	AccumulateWindow<P>(job, view, x, y, ctx->info->searchRadius, false, minAlpha, sums);
+
+	if (sums[4] > 0) {
+		PF_FpLong invWeight = 1.0 / sums[4];
+		out.red = PixelTraits<P>::FromAccum(sums[0] * invWeight);
+		out.green = PixelTraits<P>::FromAccum(sums[1] * invWeight);
+		out.blue = PixelTraits<P>::FromAccum(sums[2] * invWeight);
+		out.alpha = PixelTraits<P>::FromAccum(sums[3] * invWeight);
+	} else {
+		out = GetRow<P>(ctx->srcWorld, y)[x];
+	}
+	StoreLinePixel<P>(ctx, job->product->pixels.data(), i, out);
+}
+
+// ============================================================================
+// Push-Pull Fill
+// ============================================================================
+//
+// Fills line pixels from an image pyramid instead of a search window. Push:
+// each coarser level averages the valid (non-line) samples of the 2x2 block
+// below it and keeps their coverage. Pull: from the coarsest level down, the
+// uncovered part of every sample is filled from the bilinearly upsampled level
+// above. Cost is linear in the pixel count and independent of line width.
+
+struct PushPullLevel {
+	A_long				width, height;
+	std::vector<float>	color;		// RGBA average of the valid samples
+	std::vector<float>	weight;		// Coverage in [0, 1]
+};
+
+// Level 1 from the source: valid samples are non-line (and opaque if requested)
+template<typename P>
+static PF_Err PushFromSourceRow(void *refcon, A_long thread, A_long y, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	PushPullLevel &dst = job->levels[1];
+	const A_u_char *mask = job->upstream->mask.data();
+	PF_Boolean ignoreTransparent = ctx->info->ignoreTransparent;
+
+	for (A_long x = 0; x < dst.width; x++) {
+		float sum[4] = { 0, 0, 0, 0 };
+		float sumW = 0;
+		for (A_long sy = 2 * y; sy < 2 * y + 2 && sy < ctx->height; sy++) {
+			P *row = GetRow<P>(ctx->srcWorld, sy);
+			for (A_long sx = 2 * x; sx < 2 * x + 2 && sx < ctx->width; sx++) {
+				P *p = row + sx;
+				if (mask[(size_t)sy * ctx->width + sx]) continue;
+				if (ignoreTransparent && p->alpha < PixelTraits<P>::kMaxAlpha) continue;
+				sum[0] += p->red;
+				sum[1] += p->green;
+				sum[2] += p->blue;
+				sum[3] += p->alpha;
+				sumW += 1.0f;
+			}
+		}
+		size_t idx = (size_t)y * dst.width + x;
+		float inv = sumW > 0 ? 1.0f / sumW : 0.0f;
+		for (A_long c = 0; c < 4; c++) dst.color[idx * 4 + c] = sum[c] * inv;
+		dst.weight[idx] = sumW < 1.0f ? sumW : 1.0f;
+	}
+	return PF_Err_NONE;
+}
+
+static PF_Err PushLevelRow(void *refcon, A_long thread, A_long y, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	const PushPullLevel &src = job->levels[job->level];
+	PushPullLevel &dst = job->levels[job->level + 1];
+
+	for (A_long x = 0; x < dst.width; x++) {
+		float sum[4] = { 0, 0, 0, 0 };
+		float sumW = 0;
+		for (A_long sy = 2 * y; sy < 2 * y + 2 && sy < src.height; sy++) {
+			for (A_long sx = 2 * x; sx < 2 * x + 2 && sx < src.width; sx++) {
+				size_t s = (size_t)sy * src.width + sx;
+				float w = src.weight[s];
+				for (A_long c = 0; c < 4; c++) sum[c] += src.color[s * 4 + c] * w;
+				sumW += w;
+			}
+		}
+		size_t idx = (size_t)y * dst.width + x;
+		float inv = sumW > 0 ? 1.0f / sumW : 0.0f;
+		for (A_long c = 0; c < 4; c++) dst.color[idx * 4 + c] = sum[c] * inv;
+		dst.weight[idx] = sumW < 1.0f ? sumW : 1.0f;
+	}
+	return PF_Err_NONE;
+}
+
+// Bilinear sample of a level at the position of fine pixel (x, y) one level below
+static inline void SampleCoarser(const PushPullLevel &level, A_long x, A_long y, float *rgba) {
+	float fx = (x + 0.5f) * 0.5f - 0.5f;
+	float fy = (y + 0.5f) * 0.5f - 0.5f;
+	A_long x0 = (A_long)floorf(fx), y0 = (A_long)floorf(fy);
+	float tx = fx - x0, ty = fy - y0;
+	A_long x1 = x0 + 1, y1 = y0 + 1;
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > level.width - 1) x1 = level.width - 1;
+	if (y1 > level.height - 1) y1 = level.height - 1;
+
+	const float *c00 = &level.color[((size_t)y0 * level.width + x0) * 4];
+	const float *c10 = &level.color[((size_t)y0 * level.width + x1) * 4];
+	const float *c01 = &level.color[((size_t)y1 * level.width + x0) * 4];
+	const float *c11 = &level.color[((size_t)y1 * level.width + x1) * 4];
+	for (A_long c = 0; c < 4; c++) {
+		float top = c00[c] + (c10[c] - c00[c]) * tx;
+		float bottom = c01[c] + (c11[c] - c01[c]) * tx;
+		rgba[c] = top + (bottom - top) * ty;
+	}
+}
+
+static PF_Err PullLevelRow(void *refcon, A_long thread, A_long y, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PushPullLevel &dst = job->levels[job->level];
+	const PushPullLevel &src = job->levels[job->level + 1];
+
+	for (A_long x = 0; x < dst.width; x++) {
+		size_t idx = (size_t)y * dst.width + x;
+		float w = dst.weight[idx];
+		if (w >= 1.0f) continue;
+
+		float up[4];
+		SampleCoarser(src, x, y, up);
+		for (A_long c = 0; c < 4; c++) {
+			dst.color[idx * 4 + c] = dst.color[idx * 4 + c] * w + up[c] * (1.0f - w);
+		}
+	}
+	return PF_Err_NONE;
+}
+
+// Line pixels have no coverage of their own and take the pulled level 1 color
+template<typename P>
+static PF_Err PushPullLineChunk(void *refcon, A_long thread, A_long chunk, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	const std::vector<A_long> &lines = *job->product->lines;
+	char *pixels = job->product->pixels.data();
+
+	size_t begin, end;
+	LineChunkRange(lines.size(), chunk, &begin, &end);
+	for (size_t i = begin; i < end; i++) {
+		A_long y = lines[i] / ctx->width;
+		A_long x = lines[i] - y * ctx->width;
+		float rgba[4];
+		SampleCoarser(job->levels[1], x, y, rgba);
+		P pixel;
+		pixel.red = PixelTraits<P>::FromAccum(rgba[0]);
+		pixel.green = PixelTraits<P>::FromAccum(rgba[1]);
+		pixel.blue = PixelTraits<P>::FromAccum(rgba[2]);
+		pixel.alpha = PixelTraits<P>::FromAccum(rgba[3]);
+		StoreLinePixel<P>(ctx, pixels, i, pixel);
+	}
+	return PF_Err_NONE;
+}
+
+// Copies line pixels unchanged, used when no valid sample exists at all
+template<typename P>
+static PF_Err CopyLineChunk(void *refcon, A_long thread, A_long chunk, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	const std::vector<A_long> &lines = *job->product->lines;
+	char *pixels = job->product->pixels.data();
+
+	size_t begin, end;
+	LineChunkRange(lines.size(), chunk, &begin, &end);
+	for (size_t i = begin; i < end; i++) {
+		A_long y = lines[i] / ctx->width;
+		StoreLinePixel<P>(ctx, pixels, i, GetRow<P>(ctx->srcWorld, y)[lines[i] - y * ctx->width]);
+	}
+	return PF_Err_NONE;
+}
+
+template<typename P>
+static PF_Err FillPushPull(PipelineContext *ctx, StageJob *job) {
+	PF_Err err = PF_Err_NONE;
+	A_long chunks = NumLineChunks(job->product->lines->size());
+
+	// Level 0 is the source itself; levels halve down to a single sample
+	std::vector<PushPullLevel> levels(1);
+	for (A_long w = ctx->width, h = ctx->height; w > 1 || h > 1;) {
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+		PushPullLevel level;
+		level.width = w;
+		level.height = h;
+		level.color.resize((size_t)w * h * 4);
+		level.weight.resize((size_t)w * h);
+		levels.push_back(level);
+	}
+	A_long top = (A_long)levels.size() - 1;
+	job->levels = levels.data();
+
+	if (top < 1) {
+		return ParallelFor(ctx, chunks, job, CopyLineChunk<P>);
+	}
+
+	ERR(ParallelFor(ctx, levels[1].height, job, PushFromSourceRow<P>));
+	for (A_long l = 1; !err && l < top; l++) {
+		job->level = l;
+		ERR(ParallelFor(ctx, levels[l + 1].height, job, PushLevelRow));
+	}
+	if (err) return err;
+
+	// Same as the windowed modes: nothing to sample from leaves lines as they are
+	if (levels[top].weight[0] <= 0.0f) {
+		return ParallelFor(ctx, chunks, job, CopyLineChunk<P>);
+	}
+
+	for (A_long l = top - 1; !err && l >= 1; l--) {
+		job->level = l;
+		ERR(ParallelFor(ctx, levels[l].height, job, PullLevelRow));
+	}
+	ERR(ParallelFor(ctx, chunks, job, PushPullLineChunk<P>));
+	return err;
+}
+
+template<typename P>
+static PF_Err BuildFill(PipelineContext *ctx, const ColorLinesProduct *upstream, ColorLinesProduct *product) {
+	PF_Err err = PF_Err_NONE;
+	PF_LRect rect;
+	GetFillRect(ctx, &rect);
+	A_long rows = rect.bottom - rect.top;
+
+	StageJob job = {};
+	job.ctx = ctx;
+	job.upstream = upstream;
+	job.product = product;
+
+	// Collect line pixel offsets: count per row, prefix sum, then list
+	std::shared_ptr<std::vector<A_long> > lines = std::make_shared<std::vector<A_long> >();
+	std::vector<A_long> rowCounts(rows > 0 ? rows : 0);
+	job.rowCounts = rowCounts.data();
+	job.lines = lines.get();
+	ERR(ParallelFor(ctx, rows, &job, CountLineRow));
+	if (!err) {
+		A_long total = 0;
+		for (A_long i = 0; i < rows; i++) {
+			A_long n = rowCounts[i];
+			rowCounts[i] = total;
+			total += n;
+		}
+		lines->resize(total);
+	}
+	ERR(ParallelFor(ctx, rows, &job, ListLineRow));
+	product->lines = lines;
+	if (err) return err;
+
+	product->pixels.resize(lines->size() * LinePixelBytes<P>(ctx));
+	if (ctx->info->fillMode == FILL_MODE_PUSH_PULL) {
+		return FillPushPull<P>(ctx, &job);
+	}
+
+	std::vector<PF_FpLong> weights;
+	if (ctx->info->fillMode == FILL_MODE_WEIGHTED) {
+		weights.resize(WEIGHT_TABLE_SIZE);
+		PrecomputeInvDistWeights(ctx->info->searchRadius, weights.data());
+	} else if (ctx->info->fillMode == FILL_MODE_AVERAGE) {
+		weights.assign(WEIGHT_TABLE_SIZE, 1.0);
+	}
+	std::vector<float> weightsSingle;
+	if (PixelTraits<P>::kSingleAccum) weightsSingle.assign(weights.begin(), weights.end());
+	std::vector<short> weightsQ15;
+	if (sizeof(typename PixelTraits<P>::Channel) == 1 && ctx->info->fillMode == FILL_MODE_WEIGHTED) {
+		QuantizeWeights(weights, &weightsQ15);
+	}
+	job.weights = weights.data();
+	job.weightsSingle = weightsSingle.data();
+	job.weightsQ15 = weightsQ15.empty() ? NULL : weightsQ15.data();
+
+	std::vector<FillOffset> offsets;
+	if (ctx->info->fillMode == FILL_MODE_ADAPTIVE) {
+		PrecomputeFillOffsets(ctx->info->searchRadius, &offsets);
+		job.offsets = offsets.data();
+		job.offsetCount = (A_long)offsets.size();
+	}
+
+	NeighborhoodView frame;
+	frame.pixels = (const char*)ctx->srcWorld->data;
+	frame.rowBytes = ctx->srcWorld->rowbytes;
+	frame.mask = upstream->mask.data();
+	frame.maskStride = ctx->width;
+	frame.left = 0;
+	frame.top = 0;
+	if (ctx->info->fillMode == FILL_MODE_AVERAGE || ctx->info->fillMode == FILL_MODE_WEIGHTED) {
+		// Integer sums for 8-bit Weighted (Q15) and for Average at 8 and 16-bit (unweighted)
+		if (job.weightsQ15 || (!PixelTraits<P>::kSingleAccum && ctx->info->fillMode == FILL_MODE_AVERAGE)) {
+			return RunPlanarKernel<P, A_u_short, PlanarFillKernel<P, A_u_short> >(ctx, &job, &frame, ctx->info->searchRadius);
+		}
+		return RunPlanarKernel<P, float, PlanarFillKernel<P, float> >(ctx, &job, &frame, ctx->info->searchRadius);
+	}
+	return RunNeighborhoodKernel<P, FillLineKernel<P> >(ctx, &job, &frame, ctx->info->searchRadius);
+}
+
+// ============================================================================
+// ADJUST Stage
+// ============================================================================
+
+// Adjusts one band of line pixels, once per unique colour until the palette
+// overflows (filled lines repeat few colours in Nearest mode and on flat cels)
+template<typename P>
+static PF_Err AdjustLineBand(void *refcon, A_long thread, A_long band, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	const PipelineContext *ctx = job->ctx;
+	char *pixels = job->product->pixels.data();
+	size_t lineCount = job->product->lines->size();
+	size_t begin = lineCount * band / count;
+	size_t end = lineCount * (band + 1) / count;
+	CXPalette<P, P> palette;
+	PF_Boolean usePalette = TRUE;
+
+	for (size_t i = begin; i < end; i++) {
+		P pixel = LoadLinePixel<P>(ctx, pixels, i);
+		bool isNew = false;
+		P *cached = usePalette ? palette.Lookup(pixel, &isNew) : NULL;
+		if (cached && !isNew) {
+			pixel = *cached;
+		} else {
+			PixelTraits<P>::Adjust(&pixel, &ctx->colorAdj);
+			if (cached) *cached = pixel;
+			else usePalette = FALSE;
+		}
+		StoreLinePixel<P>(ctx, pixels, i, pixel);
+	}
+	return PF_Err_NONE;
+}
+
+template<typename P>
+static PF_Err BuildAdjust(PipelineContext *ctx, const ColorLinesProduct *upstream, ColorLinesProduct *product) {
+	product->lines = upstream->lines;
+	product->pixels = upstream->pixels;
+
+	A_long chunks = NumLineChunks(product->lines->size());
+	StageJob job = {};
+	job.ctx = ctx;
+	job.product = product;
+	return ParallelFor(ctx, chunks < PALETTE_BANDS ? chunks : PALETTE_BANDS, &job, AdjustLineBand<P>);
+}
+
+// ============================================================================
+// BLUR Stage
+// ============================================================================
+
+// Scatter the line pixels [lineBegin, lineEnd) into the dense band so the blur
+// can address neighbours. The band starts at row frameView->top.
+template<typename P>
+static PF_Err ScatterLineChunk(void *refcon, A_long thread, A_long chunk, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	const PipelineContext *ctx = job->ctx;
+	const std::vector<A_long> &lines = *job->upstream->lines;
+	const char *pixels = job->upstream->pixels.data();
+	A_long origin = job->frameView->top * ctx->width;
+
+	size_t begin, end;
+	LineChunkRange(job->lineEnd - job->lineBegin, chunk, &begin, &end);
+	for (size_t i = job->lineBegin + begin; i < job->lineBegin + end; i++) {
+		P pixel = LoadLinePixel<P>(ctx, pixels, i);
+		if (ctx->forceOpaque) pixel.alpha = PixelTraits<P>::kMaxAlpha;
+		StoreLinePixel<P>(ctx, job->dense, lines[i] - origin, pixel);
+		job->denseMaskOut[lines[i] - origin] = 255;
+	}
+	return PF_Err_NONE;
+}
+
+template<typename P, typename T>
+static void BlurLineKernel(const StageJob *job, const PlanarView<T> *view, size_t i) {
+	const PipelineContext *ctx = job->ctx;
+	A_long line = (*job->product->lines)[i];
+	A_long y = line / ctx->width;
+	A_long x = line - y * ctx->width;
+
+	PF_FpLong sums[5] = { 0, 0, 0, 0, 0 };
+	AccumulateWindow<P>(job, view, x, y, ctx->blurRadius, true, -FLT_MAX, sums);
+
+	// The center is always a line pixel, so the total weight is > 0
+	PF_FpLong invWeight = 1.0 / sums[4];
+	P out;
+	out.red = PixelTraits<P>::FromAccum(sums[0] * invWeight);
+	out.green = PixelTraits<P>::FromAccum(sums[1] * invWeight);
+	out.blue = PixelTraits<P>::FromAccum(sums[2] * invWeight);
+	out.alpha = PixelTraits<P>::FromAccum(sums[3] * invWeight);
+	StoreLinePixel<P>(ctx, job->product->pixels.data(), i, out);
+}
+
+// Runs the blur band by band. Each band scatters the line pixels of its rows
+// plus the blur halo into a band sized dense frame, then runs Kernel on the
+// band's tiles; the same buffer is reused for the next band. S is the stored
+// pixel type of the dense frame.
+template<typename P, typename S, typename T, void (*Kernel)(const StageJob*, const PlanarView<T>*, size_t)>
+static PF_Err RunBlurBands(PipelineContext *ctx, StageJob *job) {
+	PF_Err err = PF_Err_NONE;
+	const std::vector<A_long> &lines = *job->product->lines;
+	A_long r = ctx->blurRadius;
+	A_long tilesX = (ctx->width + TILE_SIZE - 1) / TILE_SIZE;
+	A_long bandRows = BLUR_BAND_TILE_ROWS * TILE_SIZE;
+	A_long denseRows = std::min(ctx->height, bandRows + 2 * r);
+	size_t pixelBytes = LinePixelBytes<P>(ctx);
+
+	std::vector<A_long> tileStarts, tileLines, tiles;
+	BuildTileBins(ctx, lines, &tileStarts, &tileLines, &tiles);
+	std::unique_ptr<char[]> dense(new char[(size_t)ctx->width * denseRows * pixelBytes]);
+	std::vector<A_u_char> denseMask((size_t)ctx->width * denseRows);
+
+	NeighborhoodView frame;
+	frame.pixels = dense.get();
+	frame.rowBytes = ctx->width * pixelBytes;
+	frame.mask = denseMask.data();
+	frame.maskStride = ctx->width;
+	frame.left = 0;
+
+	job->dense = dense.get();
+	job->denseMaskOut = denseMask.data();
+	job->frameView = &frame;
+	job->haloRadius = r;
+	job->tileStarts = tileStarts.data();
+	job->tileLines = tileLines.data();
+
+	for (A_long bandTop = 0; !err && bandTop < ctx->height; bandTop += bandRows) {
+		A_long top = std::max(bandTop - r, (A_long)0);
+		A_long bottom = std::min(bandTop + bandRows + r, ctx->height);
+		frame.top = top;
+		memset(denseMask.data(), 0, (size_t)ctx->width * (bottom - top));
+
+		// Lines are in raster order, so the band's rows are one run of the list
+		size_t lineBegin = std::lower_bound(lines.begin(), lines.end(), top * ctx->width) - lines.begin();
+		size_t lineEnd = std::lower_bound(lines.begin(), lines.end(), bottom * ctx->width) - lines.begin();
+		job->lineBegin = lineBegin;
+		job->lineEnd = lineEnd;
+		ERR(ParallelFor(ctx, NumLineChunks(lineEnd - lineBegin), job, ScatterLineChunk<P>));
+
+		// Tiles are in raster order too
+		A_long tileRow = bandTop / TILE_SIZE;
+		size_t first = std::lower_bound(tiles.begin(), tiles.end(), tileRow * tilesX) - tiles.begin();
+		size_t last = std::lower_bound(tiles.begin(), tiles.end(), (tileRow + BLUR_BAND_TILE_ROWS) * tilesX) - tiles.begin();
+		job->tiles = tiles.data() + first;
+		ERR(ParallelFor(ctx, (A_long)(last - first), job, PlanarTileLines<S, T, Kernel>));
+	}
+	return err;
+}
+
+template<typename P>
+static PF_Err BuildBlur(PipelineContext *ctx, const ColorLinesProduct *upstream, ColorLinesProduct *product) {
+	std::vector<PF_FpLong> weights(WEIGHT_TABLE_SIZE);
+	PrecomputeGaussianWeights(ctx->blurRadius, weights.data());
+	std::vector<float> weightsSingle;
+	if (PixelTraits<P>::kSingleAccum) weightsSingle.assign(weights.begin(), weights.end());
+	std::vector<short> weightsQ15;
+	if (sizeof(typename PixelTraits<P>::Channel) == 1) QuantizeWeights(weights, &weightsQ15);
+
+	product->lines = upstream->lines;
+	product->pixels.resize(upstream->pixels.size());
+
+	StageJob job = {};
+	job.ctx = ctx;
+	job.upstream = upstream;
+	job.product = product;
+	job.weights = weights.data();
+	job.weightsSingle = weightsSingle.data();
+	job.weightsQ15 = weightsQ15.data();
+
+	if (!weightsQ15.empty()) {
+		return RunBlurBands<P, P, A_u_short, BlurLineKernel<P, A_u_short> >(ctx, &job);
+	} else if (ctx->halfFloat) {
+		// Tiles widen the half float frame back to float planes
+		return RunBlurBands<P, HalfPixel, float, BlurLineKernel<P, float> >(ctx, &job);
+	}
+	return RunBlurBands<P, P, float, BlurLineKernel<P, float> >(ctx, &job);
+}
+
+// ============================================================================
+// Prescan
+// ============================================================================
+
+// Empty cels and hold frames often contain no line pixels at all. The prescan
+// looks for one target pixel inside the fill area and stops at the first hit;
+// without one, the output is the source (cleared interior for Lines Only) and
+// no stage runs.
+
+template<typename P>
+static PF_Err PrescanBand(void *refcon, A_long thread, A_long band, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	PF_LRect rect;
+	GetFillRect(ctx, &rect);
+	A_long rows = rect.bottom - rect.top;
+	A_long y0 = rect.top + (A_long)((PF_FpLong)rows * band / count);
+	A_long y1 = rect.top + (A_long)((PF_FpLong)rows * (band + 1) / count);
+	CXPalette<P, bool> palette;
+	auto isTarget = [ctx](const P *p) { return PixelTraits<P>::IsTarget(p, &ctx->match); };
+
+	// OKLab matches convert each colour, so 8-bit rows take the palette too
+	CXTargetColor8 targets8[COLORLINES_MAX_COLORS];
+	for (A_long i = 0; i < ctx->match.targetCount; i++) {
+		const MatchTarget *t = &ctx->match.targets[i];
+		targets8[i] = { t->targetR8, t->targetG8, t->targetB8, t->toleranceSq8 };
+	}
+	const CXTargetColor8 *rgbTargets = (ctx->match.matchSpace == CX_MATCH_SPACE_OKLAB) ? NULL : targets8;
+
+	for (A_long y = y0; y < y1 && !job->found->load(std::memory_order_relaxed); y++) {
+		P *row = GetRow<P>(ctx->srcWorld, y) + rect.left;
+		if (CX_RowHasTarget(row, rect.right - rect.left, &palette, isTarget, rgbTargets, ctx->match.targetCount)) {
+			job->found->store(true, std::memory_order_relaxed);
+		}
 	}
 	return PF_Err_NONE;
 }
 
+template<typename P>
+static PF_Err HasLinePixels(PipelineContext *ctx, PF_Boolean *foundP) {
+	PF_Err err = PF_Err_NONE;
+	PF_LRect rect;
+	GetFillRect(ctx, &rect);
+	A_long rows = rect.bottom - rect.top;
+	std::atomic<bool> found(false);
+
+	if (rows > 0 && rect.right > rect.left) {
+		StageJob job = {};
+		job.ctx = ctx;
+		job.found = &found;
+		ERR(ParallelFor(ctx, rows < PALETTE_BANDS ? rows : PALETTE_BANDS, &job, PrescanBand<P>));
+	}
+	*foundP = found.load();
+	return err;
+}
+
+// ============================================================================
+// Output
+// ============================================================================
+
+// Copies or clears the output area row by row according to the output mode
+template<typename P>
+static PF_Err WriteOutputRow(void *refcon, A_long thread, A_long i, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	A_long y = ctx->area.top + i;
+	A_long margin = ctx->edgeMargin;
+	P *inRow = GetRow<P>(ctx->srcWorld, y);
+	P *outRow = GetRow<P>(job->output, y);
+	const A_u_char *maskRow = job->upstream ? &job->upstream->mask[(size_t)y * ctx->width] : NULL;
+	A_long frameY = ctx->frameTop + y;
+	PF_Boolean edgeRow = (frameY < margin || frameY >= ctx->frameHeight - margin);
+
+	switch (ctx->info->outputMode) {
+		case OUTPUT_MODE_LINE_ONLY:
+			for (A_long x = ctx->area.left; x < ctx->area.right; x++) {
+				if (edgeRow || x < margin || x >= ctx->width - margin) {
+					outRow[x] = inRow[x];
+				} else {
+					memset(outRow + x, 0, sizeof(P));
+				}
+			}
+			break;
+		case OUTPUT_MODE_BG_ONLY:
+			for (A_long x = ctx->area.left; x < ctx->area.right; x++) {
+				if (!edgeRow && x >= margin && x < ctx->width - margin && maskRow && maskRow[x]) {
+					memset(outRow + x, 0, sizeof(P));
+				} else {
+					outRow[x] = inRow[x];
+				}
+			}
+			break;
+		default:
+			if (ctx->area.right > ctx->area.left) {
+				memcpy(outRow + ctx->area.left, inRow + ctx->area.left, (ctx->area.right - ctx->area.left) * sizeof(P));
+			}
+			break;
+	}
+	return PF_Err_NONE;
+}
+
+// Writes the final line pixels [lineBegin, lineEnd) over the prepared output area
+template<typename P>
+static PF_Err WriteLineChunk(void *refcon, A_long thread, A_long chunk, A_long count) {
+	StageJob *job = (StageJob*)refcon;
+	PipelineContext *ctx = job->ctx;
+	const std::vector<A_long> &lines = *job->result->lines;
+	const char *pixels = job->result->pixels.data();
+	PF_Boolean forceOpaque = ctx->forceOpaque && ctx->blurRadius < 1;
+
+	size_t begin, end;
+	LineChunkRange(job->lineEnd - job->lineBegin, chunk, &begin, &end);
+	for (size_t i = job->lineBegin + begin; i < job->lineBegin + end; i++) {
+		A_long y = lines[i] / ctx->width;
+		A_long x = lines[i] - y * ctx->width;
+		P *outP = GetRow<P>(job->output, y) + x;
+		*outP = LoadLinePixel<P>(ctx, pixels, i);
+		if (forceOpaque) outP->alpha = PixelTraits<P>::kMaxAlpha;
+	}
+	return PF_Err_NONE;
+}
+
+template<typename P>
+static PF_Err RunPipeline(PipelineContext *ctx, PF_EffectWorld *output) {
+	PF_Err err = PF_Err_NONE;
+	ProductPtr distance, mask, fill, adjust, result;
+	PF_Boolean hasLines = TRUE;
+
+	ERR(HasLinePixels<P>(ctx, &hasLines));
+	if (!err && hasLines) {
+		ERR(RunStage(ctx, STAGE_DIST, BuildDistance<P>, NULL, &distance));
+		if (!err && ctx->stageCache) {
+			ComputeStageKeys(ctx, distance.get());
+		}
+		ERR(RunStage(ctx, STAGE_MASK, BuildMask<P>, distance.get(), &mask));
+	}
+
+	// Background Only never shows filled pixels
+	if (!err && hasLines && ctx->info->outputMode != OUTPUT_MODE_BG_ONLY) {
+		ERR(RunStage(ctx, STAGE_FILL, BuildFill<P>, mask.get(), &fill));
+
+		adjust = fill;
+		if (!err && ctx->colorAdj.needsAdjustment) {
+			ERR(RunStage(ctx, STAGE_ADJUST, BuildAdjust<P>, fill.get(), &adjust));
+		}
+
+		result = adjust;
+		if (!err && ctx->blurRadius >= 1) {
+			ERR(RunStage(ctx, STAGE_BLUR, BuildBlur<P>, adjust.get(), &result));
+		}
+	}
+
+	if (!err) {
+		StageJob job = {};
+		job.ctx = ctx;
+		job.upstream = mask.get();
+		job.result = result.get();
+		job.output = output;
+		ERR(ParallelFor(ctx, ctx->area.bottom - ctx->area.top, &job, WriteOutputRow<P>));
+		if (!err && result) {
+			// Strips fill lines past their area for the blur; only the area is written
+			const std::vector<A_long> &lines = *result->lines;
+			job.lineBegin = std::lower_bound(lines.begin(), lines.end(), ctx->area.top * ctx->width) - lines.begin();
+			job.lineEnd = std::lower_bound(lines.begin(), lines.end(), ctx->area.bottom * ctx->width) - lines.begin();
+			ERR(ParallelFor(ctx, NumLineChunks(job.lineEnd - job.lineBegin), &job, WriteLineChunk<P>));
+		}
+	}
+	return err;
+}
+
+// ============================================================================
+// Strip Rendering
+// ============================================================================
+//
+// With a Memory Budget, frames whose working set would exceed it render in
+// horizontal strips. Each strip runs the whole pipeline on a view of the source
+// grown by the fill and blur halos: line pixels are filled up to the blur
+// radius past the strip so the blur sees the same neighbours as in a full-frame
+// render, and only the strip's own rows are written. The output is identical
+// to a full-frame render. Strip products are not cached, and Push-Pull (whose
+// pyramid spans the frame) always renders the whole frame. With a Minimum
+// Line Size the view reaches further, so that every speck the fill can see
+// lies inside it whole.
+
+// Upper bound on the bytes a render holds per source pixel: the distance and
+// mask planes, and as if every pixel were a line pixel, its offset, the FILL,
+// ADJUST and BLUR pixels and the blur band with its mask. The component labels
+// of a Minimum Line Size are freed before FILL and fit in the same bound.
+static size_t WorkingBytesPerPixel(size_t linePixelBytes) {
+	return sizeof(A_u_short) + 1 + sizeof(A_long) + 4 * linePixelBytes + 1;
+}
+
+// Rows per strip under the Memory Budget, or 0 to render the whole frame
+template<typename P>
+static A_long GetStripRows(const PipelineContext *ctx) {
+	if (ctx->info->memoryBudget <= 0 || ctx->info->fillMode == FILL_MODE_PUSH_PULL) return 0;
+
+	size_t rowBytes = (size_t)ctx->width * WorkingBytesPerPixel(LinePixelBytes<P>(ctx));
+	size_t budgetRows = ((size_t)ctx->info->memoryBudget << 20) / (rowBytes > 0 ? rowBytes : 1);
+	if (budgetRows >= (size_t)ctx->height) return 0;
+
+	// Every strip also holds the fill, blur and speck halos above and below it.
+	// Halos that leave no room for STRIP_MIN_ROWS would make each strip redo
+	// most of the frame, over budget all the same.
+	size_t halo = (size_t)ctx->edgeMargin + ctx->blurRadius + SpeckHalo(ctx);
+	if (2 * halo + STRIP_MIN_ROWS > budgetRows) return 0;
+	return (A_long)(budgetRows - 2 * halo);
+}
+
+template<typename P>
+static PF_Err RunStrips(PipelineContext *frameCtx, PF_EffectWorld *output, A_long stripRows) {
+	PF_Err err = PF_Err_NONE;
+	const PF_LRect &area = frameCtx->area;
+	A_long blurHalo = frameCtx->blurRadius;
+	A_long halo = frameCtx->edgeMargin + blurHalo + SpeckHalo(frameCtx);
+
+	for (A_long top = area.top; !err && top < area.bottom; top += stripRows) {
+		A_long bottom = std::min(top + stripRows, area.bottom);
+		A_long viewTop = std::max(top - halo, (A_long)0);
+		A_long viewBottom = std::min(bottom + halo, frameCtx->height);
+
+		// Source and output views starting at frame row viewTop
+		PF_EffectWorld src = *frameCtx->srcWorld;
+		src.data = (PF_PixelPtr)((char*)src.data + (size_t)viewTop * src.rowbytes);
+		src.height = viewBottom - viewTop;
+		PF_EffectWorld out = *output;
+		out.data = (PF_PixelPtr)((char*)out.data + (size_t)viewTop * out.rowbytes);
+		out.height = std::min(viewBottom, output->height) - viewTop;
+
+		PipelineContext ctx = *frameCtx;
+		ctx.srcWorld = &src;
+		ctx.height = src.height;
+		ctx.frameTop = viewTop;
+		ctx.area.top = top - viewTop;
+		ctx.area.bottom = bottom - viewTop;
+		ctx.fillTop = std::max(top - blurHalo, area.top) - viewTop;
+		ctx.fillBottom = std::min(bottom + blurHalo, area.bottom) - viewTop;
+		ctx.stageCache = NULL;
+		ERR(RunPipeline<P>(&ctx, &out));
+	}
+	return err;
+}
+
+template<typename P>
+static PF_Err RenderFrame(PipelineContext *ctx, PF_EffectWorld *output) {
+	A_long stripRows = GetStripRows<P>(ctx);
+	if (stripRows > 0) {
+		return RunStrips<P>(ctx, output, stripRows);
+	}
+	return RunPipeline<P>(ctx, output);
+}
+
 // ============================================================================
 // Plugin Entry Points
 // ============================================================================
@@ -997,6 +2670,44 @@ static PF_Err GlobalSetup(PF_InData *in_dataP, PF_OutData *out_data, PF_ParamDef
 	out_data->my_version = PF_VERSION(MAJOR_VERSION, MINOR_VERSION, BUG_VERSION, STAGE_VERSION, BUILD_VERSION);
 	out_data->out_flags = PF_OutFlag_DEEP_COLOR_AWARE;
 	out_data->out_flags2 = PF_OutFlag2_FLOAT_COLOR_AWARE | PF_OutFlag2_SUPPORTS_SMART_RENDER | PF_OutFlag2_SUPPORTS_THREADED_RENDERING;
+
+	// Premiere: take its BGRA frames as they are
+	PF_Err err = CX_AddPremierePixelFormats(in_dataP, out_data);
+	if (err) return err;
+
+	AEFX_SuiteScoper<PF_HandleSuite1> handleSuite = AEFX_SuiteScoper<PF_HandleSuite1>(in_dataP, kPFHandleSuite, kPFHandleSuiteVersion1, out_data);
+	PF_Handle globalH = handleSuite->host_new_handle(sizeof(ColorLinesGlobalData));
+	if (!globalH) return PF_Err_OUT_OF_MEMORY;
+
+	ColorLinesGlobalData *globalP = reinterpret_cast<ColorLinesGlobalData*>(handleSuite->host_lock_handle(globalH));
+	if (!globalP) {
+		handleSuite->host_dispose_handle(globalH);
+		return PF_Err_OUT_OF_MEMORY;
+	}
+	globalP->frameCache = new CXFrameCache(CX_FRAME_CACHE_BUDGET);
+	globalP->stageCache = new ColorLinesStageCache(NAME " Stage Products", STAGE_CACHE_BUDGET);
+	globalP->stageCache->AttachHost(in_dataP);
+	handleSuite->host_unlock_handle(globalH);
+
+	out_data->global_data = globalH;
+	return PF_Err_NONE;
+}
+
+static PF_Err GlobalSetdown(PF_InData *in_dataP, PF_OutData *out_data) {
+	if (!in_dataP->global_data) return PF_Err_NONE;
+
+	AEFX_SuiteScoper<PF_HandleSuite1> handleSuite = AEFX_SuiteScoper<PF_HandleSuite1>(in_dataP, kPFHandleSuite, kPFHandleSuiteVersion1, out_data);
+	ColorLinesGlobalData *globalP = reinterpret_cast<ColorLinesGlobalData*>(handleSuite->host_lock_handle(in_dataP->global_data));
+	if (globalP) {
+		globalP->stageCache->DetachHost(in_dataP);
+		delete globalP->frameCache;
+		delete globalP->stageCache;
+		globalP->frameCache = NULL;
+		globalP->stageCache = NULL;
+		handleSuite->host_unlock_handle(in_dataP->global_data);
+	}
+	handleSuite->host_dispose_handle(in_dataP->global_data);
+	out_data->global_data = NULL;
 	return PF_Err_NONE;
 }
 
@@ -1013,6 +2724,34 @@ static PF_Err ParamsSetup(PF_InData *in_data, PF_OutData *out_data, PF_ParamDef
 	AEFX_CLR_STRUCT(def);
 	PF_ADD_FLOAT_SLIDERX("Color Tolerance", TOLERANCE_MIN, TOLERANCE_MAX, TOLERANCE_MIN, TOLERANCE_MAX, TOLERANCE_DFLT, PF_Precision_TENTHS, PF_ValueDisplayFlag_PERCENT, 0, COLOR_TOLERANCE_DISK_ID);
 
+	AEFX_CLR_STRUCT(def);
+	def.flags = PF_ParamFlag_START_COLLAPSED;
+	PF_ADD_TOPIC("Additional Colors", MORE_COLORS_GROUP_START_DISK_ID);
+
+	for (A_long n = 2; n <= COLORLINES_MAX_COLORS; n++) {
+		char name[32];
+		AEFX_CLR_STRUCT(def);
+		snprintf(name, sizeof(name), "Color %d", (int)n);
+		PF_ADD_CHECKBOX(name, "", FALSE, 0, COLOR_ENABLED_DISK_ID(n));
+
+		AEFX_CLR_STRUCT(def);
+		snprintf(name, sizeof(name), "Target Color %d", (int)n);
+		PF_ADD_COLOR(name, 0, 0, 0, COLOR_ENABLED_DISK_ID(n) + 1);
+
+		AEFX_CLR_STRUCT(def);
+		snprintf(name, sizeof(name), "Color Tolerance %d", (int)n);
+		PF_ADD_FLOAT_SLIDERX(name, TOLERANCE_MIN, TOLERANCE_MAX, TOLERANCE_MIN, TOLERANCE_MAX, TOLERANCE_DFLT, PF_Precision_TENTHS, PF_ValueDisplayFlag_PERCENT, 0, COLOR_ENABLED_DISK_ID(n) + 2);
+	}
+
+	AEFX_CLR_STRUCT(def);
+	PF_END_TOPIC(MORE_COLORS_GROUP_END_DISK_ID);
+
+	AEFX_CLR_STRUCT(def);
+	PF_ADD_POPUP("Match Colors In", CX_MATCH_SPACE_NUM_SPACES - 1, CX_MATCH_SPACE_RGB, CX_MATCH_SPACE_POPUP, MATCH_SPACE_DISK_ID);
+
+	AEFX_CLR_STRUCT(def);
+	PF_ADD_SLIDER("Minimum Line Size", MIN_LINE_SIZE_MIN, MIN_LINE_SIZE_MAX, MIN_LINE_SIZE_MIN, 200, MIN_LINE_SIZE_DFLT, MIN_LINE_SIZE_DISK_ID);
+
 	AEFX_CLR_STRUCT(def);
 	PF_END_TOPIC(COLOR_GROUP_END_DISK_ID);
 
@@ -1020,11 +2759,14 @@ static PF_Err ParamsSetup(PF_InData *in_data, PF_OutData *out_data, PF_ParamDef
 	PF_ADD_TOPIC("Fill Settings", FILL_GROUP_START_DISK_ID);
 
 	AEFX_CLR_STRUCT(def);
-	PF_ADD_POPUP("Fill Mode", FILL_MODE_NUM_MODES - 1, FILL_MODE_WEIGHTED, "Nearest Pixel|Average|Weighted Average", FILL_MODE_DISK_ID);
+	PF_ADD_POPUP("Fill Mode", FILL_MODE_NUM_MODES - 1, FILL_MODE_WEIGHTED, "Nearest Pixel|Average|Weighted Average|Push-Pull|Adaptive Average", FILL_MODE_DISK_ID);
 
 	AEFX_CLR_STRUCT(def);
 	PF_ADD_SLIDER("Search Radius", SEARCH_RADIUS_MIN, SEARCH_RADIUS_MAX, SEARCH_RADIUS_MIN, SEARCH_RADIUS_MAX, SEARCH_RADIUS_DFLT, SEARCH_RADIUS_DISK_ID);
 
+	AEFX_CLR_STRUCT(def);
+	PF_ADD_SLIDER("Sample Count", SAMPLE_COUNT_MIN, SAMPLE_COUNT_MAX, SAMPLE_COUNT_MIN, SAMPLE_COUNT_MAX, SAMPLE_COUNT_DFLT, SAMPLE_COUNT_DISK_ID);
+
 	AEFX_CLR_STRUCT(def);
 	PF_ADD_CHECKBOX("Ignore Transparent", "", TRUE, 0, IGNORE_TRANSPARENT_DISK_ID);
 
@@ -1055,6 +2797,12 @@ static PF_Err ParamsSetup(PF_InData *in_data, PF_OutData *out_data, PF_ParamDef
 	AEFX_CLR_STRUCT(def);
 	PF_ADD_POPUP("Output Mode", OUTPUT_MODE_NUM_MODES - 1, OUTPUT_MODE_FULL, "Full Image|Lines Only|Background Only", OUTPUT_MODE_DISK_ID);
 
+	AEFX_CLR_STRUCT(def);
+	PF_ADD_CHECKBOX("Half Float Intermediates", "32-bit only", FALSE, 0, HALF_FLOAT_DISK_ID);
+
+	AEFX_CLR_STRUCT(def);
+	PF_ADD_SLIDER("Memory Budget (MB)", MEMORY_BUDGET_MIN, MEMORY_BUDGET_MAX, MEMORY_BUDGET_MIN, 2048, MEMORY_BUDGET_DFLT, MEMORY_BUDGET_DISK_ID);
+
 	AEFX_CLR_STRUCT(def);
 	PF_END_TOPIC(OUTPUT_GROUP_END_DISK_ID);
 
@@ -1086,6 +2834,31 @@ static PF_Err PreRender(PF_InData *in_dataP, PF_OutData *out_dataP, PF_PreRender
 			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_COLOR_TOLERANCE, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
 			if (!err) infoP->tolerance = param.u.fs_d.value;
 
+			// Colors 2 and up; a disabled color's value is never read
+			for (A_long n = 2; n <= COLORLINES_MAX_COLORS && !err; n++) {
+				ColorLinesColor *color = &infoP->moreColors[n - 2];
+				AEFX_CLR_STRUCT(param);
+				err = PF_CHECKOUT_PARAM(in_dataP, COLOR_ENABLED_PARAM(n), in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
+				if (!err) color->enabled = param.u.bd.value;
+				if (err || !color->enabled) continue;
+
+				AEFX_CLR_STRUCT(param);
+				err = PF_CHECKOUT_PARAM(in_dataP, COLOR_PARAM(n), in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
+				if (!err) color->color = param.u.cd.value;
+
+				AEFX_CLR_STRUCT(param);
+				if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLOR_TOLERANCE_PARAM(n), in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
+				if (!err) color->tolerance = param.u.fs_d.value;
+			}
+
+			AEFX_CLR_STRUCT(param);
+			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_MATCH_SPACE, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
+			if (!err) infoP->matchSpace = param.u.pd.value;
+
+			AEFX_CLR_STRUCT(param);
+			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_MIN_LINE_SIZE, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
+			if (!err) infoP->minLineSize = param.u.sd.value;
+
 			AEFX_CLR_STRUCT(param);
 			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_FILL_MODE, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
 			if (!err) infoP->fillMode = param.u.pd.value;
@@ -1094,6 +2867,10 @@ static PF_Err PreRender(PF_InData *in_dataP, PF_OutData *out_dataP, PF_PreRender
 			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_SEARCH_RADIUS, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
 			if (!err) infoP->searchRadius = param.u.sd.value;
 
+			AEFX_CLR_STRUCT(param);
+			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_SAMPLE_COUNT, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
+			if (!err) infoP->sampleCount = param.u.sd.value;
+
 			AEFX_CLR_STRUCT(param);
 			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_IGNORE_TRANSPARENT, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
 			if (!err) infoP->ignoreTransparent = param.u.bd.value;
@@ -1118,6 +2895,14 @@ static PF_Err PreRender(PF_InData *in_dataP, PF_OutData *out_dataP, PF_PreRender
 			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_OUTPUT_MODE, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
 			if (!err) infoP->outputMode = param.u.pd.value;
 
+			AEFX_CLR_STRUCT(param);
+			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_HALF_FLOAT, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
+			if (!err) infoP->halfFloat = param.u.bd.value;
+
+			AEFX_CLR_STRUCT(param);
+			if (!err) err = PF_CHECKOUT_PARAM(in_dataP, COLORLINES_MEMORY_BUDGET, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &param);
+			if (!err) infoP->memoryBudget = param.u.sd.value;
+
 			if (!err) {
 				req.field = PF_Field_FRAME;
 				err = extraP->cb->checkout_layer(in_dataP->effect_ref, COLORLINES_INPUT, COLORLINES_INPUT, &req, in_dataP->current_time, in_dataP->time_step, in_dataP->time_scale, &in_result);
@@ -1134,14 +2919,99 @@ static PF_Err PreRender(PF_InData *in_dataP, PF_OutData *out_dataP, PF_PreRender
 	return err;
 }
 
+
+// Half Float Intermediates only changes 32-bit float renders: AE's ARGB128
+// or Premiere's BGRA_4444_32f
+static inline PF_Boolean UsesHalfFloat(const ColorLinesInfo *info, PF_PixelFormat format, PrPixelFormat premiereFormat) {
+	return info->halfFloat && (format == PF_PixelFormat_ARGB128 || premiereFormat == PrPixelFormat_BGRA_4444_32f);
+}
+
+// Frame key (see CX_InputKey). Settings the render ignores in this mode or
+// format stay out, as in the stage keys.
+static CXCacheKey ComputeFrameKey(const ColorLinesInfo *info, PF_PixelFormat format, const CXCacheKey &inputKey,
+                                  const PF_EffectWorld *output_worldP) {
+	CXHasher hasher;
+
+	hasher.Add(info->targetColor.red);
+	hasher.Add(info->targetColor.green);
+	hasher.Add(info->targetColor.blue);
+	hasher.Add(info->tolerance);
+	for (A_long i = 0; i < COLORLINES_MAX_COLORS - 1; i++) {
+		const ColorLinesColor *color = &info->moreColors[i];
+		hasher.Add(color->enabled);
+		if (!color->enabled) continue;
+		hasher.Add(color->color.red);
+		hasher.Add(color->color.green);
+		hasher.Add(color->color.blue);
+		hasher.Add(color->tolerance);
+	}
+	hasher.Add(info->matchSpace);
+	hasher.Add(info->minLineSize > 1 ? info->minLineSize : 0);
+	hasher.Add(info->fillMode);
+	hasher.Add(info->fillMode == FILL_MODE_PUSH_PULL ? 0 : info->searchRadius);
+	hasher.Add(info->fillMode == FILL_MODE_ADAPTIVE ? info->sampleCount : 0);
+	hasher.Add(info->ignoreTransparent);
+	hasher.Add(info->sampleBlur);
+	hasher.Add(info->brightness);
+	hasher.Add(info->contrast);
+	hasher.Add(info->saturation);
+	hasher.Add(info->outputMode);
+	hasher.Add(UsesHalfFloat(info, format, PrPixelFormat_Invalid));	// Only AE renders are cached
+
+	hasher.Add(output_worldP->width);
+	hasher.Add(output_worldP->height);
+	hasher.Add(output_worldP->extent_hint.left);
+	hasher.Add(output_worldP->extent_hint.top);
+	hasher.Add(output_worldP->extent_hint.right);
+	hasher.Add(output_worldP->extent_hint.bottom);
+
+	hasher.Add(inputKey.lo);
+	hasher.Add(inputKey.hi);
+	return hasher.Finish();
+}
+
+// format is the AE pixel format; premiereFormat, when valid, selects one of
+// Premiere's BGRA formats instead
+static PF_Err RenderColorLines(PF_InData *in_data, PF_OutData *out_data, ColorLinesInfo *infoP,
+                               PF_EffectWorld *output_worldP, PF_PixelFormat format, PrPixelFormat premiereFormat,
+                               ColorLinesStageCache *stageCache, const CXCacheKey &inputKey) {
+	PipelineContext ctx;
+	ctx.in_data = in_data;
+	ctx.out_data = out_data;
+	InitPipelineContext(&ctx, infoP, output_worldP);
+	ctx.halfFloat = UsesHalfFloat(infoP, format, premiereFormat);
+	if (stageCache) {
+		ctx.stageCache = stageCache;
+		ComputeDistanceKey(&ctx, inputKey);
+	}
+
+	switch (premiereFormat) {
+		case PrPixelFormat_BGRA_4444_8u:
+			return RenderFrame<PF_Pixel_BGRA_8u>(&ctx, output_worldP);
+		case PrPixelFormat_BGRA_4444_32f:
+			return RenderFrame<PF_Pixel_BGRA_32f>(&ctx, output_worldP);
+		default:
+			break;
+	}
+	switch (format) {
+		case PF_PixelFormat_ARGB32:
+			return RenderFrame<PF_Pixel8>(&ctx, output_worldP);
+		case PF_PixelFormat_ARGB64:
+			return RenderFrame<PF_Pixel16>(&ctx, output_worldP);
+		case PF_PixelFormat_ARGB128:
+			return RenderFrame<PF_PixelFloat>(&ctx, output_worldP);
+		default:
+			return PF_Err_BAD_CALLBACK_PARAM;
+	}
+}
+
 static PF_Err SmartRender(PF_InData *in_data, PF_OutData *out_data, PF_SmartRenderExtra *extraP) {
 	PF_Err err = PF_Err_NONE;
 	PF_EffectWorld *input_worldP = NULL, *output_worldP = NULL;
-	PF_EffectWorld tempWorld;
-	PF_Boolean tempWorldAllocated = FALSE;
 
 	AEFX_SuiteScoper<PF_HandleSuite1> handleSuite = AEFX_SuiteScoper<PF_HandleSuite1>(in_data, kPFHandleSuite, kPFHandleSuiteVersion1, out_data);
-	ColorLinesInfo *infoP = reinterpret_cast<ColorLinesInfo*>(handleSuite->host_lock_handle(reinterpret_cast<PF_Handle>(extraP->input->pre_render_data)));
+	PF_Handle infoH = reinterpret_cast<PF_Handle>(extraP->input->pre_render_data);
+	ColorLinesInfo *infoP = reinterpret_cast<ColorLinesInfo*>(handleSuite->host_lock_handle(infoH));
 
 	if (infoP) {
 		if (!err) err = extraP->cb->checkout_layer_pixels(in_data->effect_ref, COLORLINES_INPUT, &input_worldP);
@@ -1151,109 +3021,91 @@ static PF_Err SmartRender(PF_InData *in_data, PF_OutData *out_data, PF_SmartRend
 			infoP->srcWorld = input_worldP;
 			infoP->in_data = in_data;
 
-			// Allocate line mask
-			infoP->maskWidth = output_worldP->width;
-			infoP->maskHeight = output_worldP->height;
-			infoP->maskRowBytes = output_worldP->width;
-			infoP->lineMask = (A_u_char*)malloc(infoP->maskWidth * infoP->maskHeight);
-			if (infoP->lineMask) {
-				memset(infoP->lineMask, 0, infoP->maskWidth * infoP->maskHeight);
-			}
-
-			// Initialize processing context with precomputed values
-			ProcessingContext ctx;
-			InitProcessingContext(&ctx, infoP);
-
 			PF_PixelFormat format = PF_PixelFormat_INVALID;
 			AEFX_SuiteScoper<PF_WorldSuite2> wsP = AEFX_SuiteScoper<PF_WorldSuite2>(in_data, kPFWorldSuite, kPFWorldSuiteVersion2, out_data);
 			if (!err) err = wsP->PF_GetPixelFormat(input_worldP, &format);
 
-			// First pass: Fill line pixels and build mask
-			if (!err) {
-				switch (format) {
-					case PF_PixelFormat_ARGB32: {
-						AEFX_SuiteScoper<PF_Iterate8Suite2> iterSuite = AEFX_SuiteScoper<PF_Iterate8Suite2>(in_data, kPFIterate8Suite, kPFIterate8SuiteVersion2, out_data);
-						err = iterSuite->iterate(in_data, 0, output_worldP->height, input_worldP, &output_worldP->extent_hint, (void*)&ctx, FillAndMask8_Optimized, output_worldP);
-						break;
-					}
-					case PF_PixelFormat_ARGB64: {
-						AEFX_SuiteScoper<PF_iterate16Suite2> iterSuite = AEFX_SuiteScoper<PF_iterate16Suite2>(in_data, kPFIterate16Suite, kPFIterate16SuiteVersion2, out_data);
-						err = iterSuite->iterate(in_data, 0, output_worldP->height, input_worldP, &output_worldP->extent_hint, (void*)&ctx, FillAndMask16_Optimized, output_worldP);
-						break;
-					}
-					case PF_PixelFormat_ARGB128: {
-						AEFX_SuiteScoper<PF_iterateFloatSuite2> iterSuite = AEFX_SuiteScoper<PF_iterateFloatSuite2>(in_data, kPFIterateFloatSuite, kPFIterateFloatSuiteVersion2, out_data);
-						err = iterSuite->iterate(in_data, 0, output_worldP->height, input_worldP, &output_worldP->extent_hint, (void*)&ctx, FillAndMaskFloat_Optimized, output_worldP);
-						break;
-					}
-					default:
-						err = PF_Err_BAD_CALLBACK_PARAM;
-						break;
-				}
+			// AE formats only: the frame cache, then the stage cache
+			ColorLinesGlobalData *globalP = NULL;
+			if (in_data->global_data) {
+				globalP = reinterpret_cast<ColorLinesGlobalData*>(handleSuite->host_lock_handle(in_data->global_data));
 			}
+			PF_Boolean cacheable = globalP && CX_BytesPerPixel(format) > 0;
+			CXFrameCache *frameCache = cacheable ? globalP->frameCache : NULL;
+			ColorLinesStageCache *stageCache = cacheable ? globalP->stageCache : NULL;
+
+			CXCacheKey inputKey = { 0, 0 };
+			CXCacheKey frameKey = { 0, 0 };
+			CXFrameCache::ValuePtr cached;
+			bool reserved = false;
+			if (!err && cacheable) {
+				inputKey = CX_InputKey(input_worldP, format);
+				frameKey = ComputeFrameKey(infoP, format, inputKey, output_worldP);
+				cached = frameCache->FindOrReserve(frameKey, &reserved);
+			}
+			CXCacheReservation<CXFrameResult> reservation(frameCache, frameKey, reserved);
 
-			// Second pass: Apply blur if sampleBlur > 0
-			A_long blurRadius = (A_long)(infoP->sampleBlur / 10.0);
-			if (!err && blurRadius >= 1 && infoP->lineMask) {
-				// Precompute gaussian weights
-				PrecomputeGaussianWeights(blurRadius);
-
-				AEFX_SuiteScoper<PF_WorldSuite2> worldSuite = AEFX_SuiteScoper<PF_WorldSuite2>(in_data, kPFWorldSuite, kPFWorldSuiteVersion2, out_data);
-				err = worldSuite->PF_NewWorld(in_data->effect_ref, output_worldP->width, output_worldP->height, FALSE, format, &tempWorld);
-
-				if (!err) {
-					tempWorldAllocated = TRUE;
-
-					// Copy output to temp world
-					for (A_long y = 0; y < output_worldP->height; y++) {
-						char *srcRow = (char*)output_worldP->data + y * output_worldP->rowbytes;
-						char *dstRow = (char*)tempWorld.data + y * tempWorld.rowbytes;
-						memcpy(dstRow, srcRow, output_worldP->rowbytes);
-					}
-
-					// Setup blur context
-					BlurContext blurCtx;
-					blurCtx.info = infoP;
-					blurCtx.tempWorld = &tempWorld;
-					blurCtx.blurRadius = blurRadius;
-					blurCtx.blurSize = blurRadius * 2 + 1;
-
-					// Run blur pass
-					switch (format) {
-						case PF_PixelFormat_ARGB32: {
-							AEFX_SuiteScoper<PF_Iterate8Suite2> iterSuite = AEFX_SuiteScoper<PF_Iterate8Suite2>(in_data, kPFIterate8Suite, kPFIterate8SuiteVersion2, out_data);
-							err = iterSuite->iterate(in_data, 0, output_worldP->height, &tempWorld, &output_worldP->extent_hint, (void*)&blurCtx, BlurPass8_Optimized, output_worldP);
-							break;
-						}
-						case PF_PixelFormat_ARGB64: {
-							AEFX_SuiteScoper<PF_iterate16Suite2> iterSuite = AEFX_SuiteScoper<PF_iterate16Suite2>(in_data, kPFIterate16Suite, kPFIterate16SuiteVersion2, out_data);
-							err = iterSuite->iterate(in_data, 0, output_worldP->height, &tempWorld, &output_worldP->extent_hint, (void*)&blurCtx, BlurPass16_Optimized, output_worldP);
-							break;
-						}
-						case PF_PixelFormat_ARGB128: {
-							AEFX_SuiteScoper<PF_iterateFloatSuite2> iterSuite = AEFX_SuiteScoper<PF_iterateFloatSuite2>(in_data, kPFIterateFloatSuite, kPFIterateFloatSuiteVersion2, out_data);
-							err = iterSuite->iterate(in_data, 0, output_worldP->height, &tempWorld, &output_worldP->extent_hint, (void*)&blurCtx, BlurPassFloat_Optimized, output_worldP);
-							break;
-						}
-						default:
-							err = PF_Err_BAD_CALLBACK_PARAM;
-							break;
-					}
-				}
+			// Parameter changes: stages upstream of the change come from the stage cache
+			if (!err && !(cached && CX_RestoreFrameResult(*cached, output_worldP))) {
+				err = RenderColorLines(in_data, out_data, infoP, output_worldP, format, PrPixelFormat_Invalid, stageCache, inputKey);
 
-				if (tempWorldAllocated) {
-					worldSuite->PF_DisposeWorld(in_data->effect_ref, &tempWorld);
+				if (!err && reserved) {
+					std::shared_ptr<CXFrameResult> result = CX_CaptureFrameResult(output_worldP, format);
+					reservation.Fulfill(result, result->pixels.size());
 				}
 			}
 
-			// Free line mask
-			if (infoP->lineMask) {
-				free(infoP->lineMask);
-				infoP->lineMask = NULL;
+			if (globalP) {
+				handleSuite->host_unlock_handle(in_data->global_data);
 			}
 		}
 		extraP->cb->checkin_layer_pixels(in_data->effect_ref, COLORLINES_INPUT);
+		handleSuite->host_unlock_handle(infoH);
+	}
+	return err;
+}
+
+// Premiere renders through PF_Cmd_RENDER with the params already checked out.
+// Stage and frame keys assume AE pixel formats, so this path runs uncached.
+static PF_Err Render(PF_InData *in_data, PF_OutData *out_data, PF_ParamDef *params[], PF_LayerDef *output) {
+	PF_Err err = PF_Err_NONE;
+
+	ColorLinesInfo info;
+	AEFX_CLR_STRUCT(info);
+	info.targetColor = params[COLORLINES_TARGET_COLOR]->u.cd.value;
+	info.tolerance = params[COLORLINES_COLOR_TOLERANCE]->u.fs_d.value;
+	for (A_long n = 2; n <= COLORLINES_MAX_COLORS; n++) {
+		ColorLinesColor *color = &info.moreColors[n - 2];
+		color->enabled = params[COLOR_ENABLED_PARAM(n)]->u.bd.value;
+		color->color = params[COLOR_PARAM(n)]->u.cd.value;
+		color->tolerance = params[COLOR_TOLERANCE_PARAM(n)]->u.fs_d.value;
 	}
+	info.matchSpace = params[COLORLINES_MATCH_SPACE]->u.pd.value;
+	info.minLineSize = params[COLORLINES_MIN_LINE_SIZE]->u.sd.value;
+	info.fillMode = params[COLORLINES_FILL_MODE]->u.pd.value;
+	info.searchRadius = params[COLORLINES_SEARCH_RADIUS]->u.sd.value;
+	info.sampleCount = params[COLORLINES_SAMPLE_COUNT]->u.sd.value;
+	info.ignoreTransparent = params[COLORLINES_IGNORE_TRANSPARENT]->u.bd.value;
+	info.sampleBlur = params[COLORLINES_SAMPLE_BLUR]->u.fs_d.value;
+	info.brightness = params[COLORLINES_BRIGHTNESS]->u.fs_d.value;
+	info.contrast = params[COLORLINES_CONTRAST]->u.fs_d.value;
+	info.saturation = params[COLORLINES_SATURATION]->u.fs_d.value;
+	info.outputMode = params[COLORLINES_OUTPUT_MODE]->u.pd.value;
+	info.halfFloat = params[COLORLINES_HALF_FLOAT]->u.bd.value;
+	info.memoryBudget = params[COLORLINES_MEMORY_BUDGET]->u.sd.value;
+	info.srcWorld = &params[COLORLINES_INPUT]->u.ld;
+	info.in_data = in_data;
+
+	PrPixelFormat premiereFormat = PrPixelFormat_Invalid;
+	PF_PixelFormat format = PF_PixelFormat_INVALID;
+	ERR(CX_GetPremierePixelFormat(in_data, out_data, output, &premiereFormat));
+	if (!err && premiereFormat == PrPixelFormat_Invalid) {
+		AEFX_SuiteScoper<PF_WorldSuite2> wsP = AEFX_SuiteScoper<PF_WorldSuite2>(in_data, kPFWorldSuite, kPFWorldSuiteVersion2, out_data);
+		err = wsP->PF_GetPixelFormat(output, &format);
+	}
+
+	CXCacheKey inputKey = { 0, 0 };
+	ERR(RenderColorLines(in_data, out_data, &info, output, format, premiereFormat, NULL, inputKey));
 	return err;
 }
 
@@ -1269,7 +3121,9 @@ PF_Err EffectMain(PF_Cmd cmd, PF_InData *in_dataP, PF_OutData *out_data, PF_Para
 		switch (cmd) {
 			case PF_Cmd_ABOUT: err = About(in_dataP, out_data, params, output); break;
 			case PF_Cmd_GLOBAL_SETUP: err = GlobalSetup(in_dataP, out_data, params, output); break;
+			case PF_Cmd_GLOBAL_SETDOWN: err = GlobalSetdown(in_dataP, out_data); break;
 			case PF_Cmd_PARAMS_SETUP: err = ParamsSetup(in_dataP, out_data, params, output); break;
+			case PF_Cmd_RENDER: err = Render(in_dataP, out_data, params, output); break;
 			case PF_Cmd_SMART_PRE_RENDER: err = PreRender(in_dataP, out_data, (PF_PreRenderExtra*)extra); break;
 			case PF_Cmd_SMART_RENDER: err = SmartRender(in_dataP, out_data, (PF_SmartRenderExtra*)extra); break;
 		}
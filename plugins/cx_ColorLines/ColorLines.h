@@ -28,6 +28,12 @@
 #include "Param_Utils.h"
 #include "Smart_Utils.h"
 
+#include "CXComponents.h"
+#include "CXComputeCache.h"
+#include "CXFrameCache.h"
+#include "CXOKLab.h"
+#include "CXPalette.h"
+
 #ifdef AE_OS_WIN
 	#include <Windows.h>
 #endif
@@ -49,12 +55,41 @@ enum {
 	COLORLINES_COLOR_GROUP_START,
 	COLORLINES_TARGET_COLOR,
 	COLORLINES_COLOR_TOLERANCE,
+
+	// Additional Colors Group (inside Color Selection)
+	COLORLINES_MORE_COLORS_GROUP_START,
+	COLORLINES_COLOR2_ENABLED,
+	COLORLINES_COLOR2,
+	COLORLINES_COLOR2_TOLERANCE,
+	COLORLINES_COLOR3_ENABLED,
+	COLORLINES_COLOR3,
+	COLORLINES_COLOR3_TOLERANCE,
+	COLORLINES_COLOR4_ENABLED,
+	COLORLINES_COLOR4,
+	COLORLINES_COLOR4_TOLERANCE,
+	COLORLINES_COLOR5_ENABLED,
+	COLORLINES_COLOR5,
+	COLORLINES_COLOR5_TOLERANCE,
+	COLORLINES_COLOR6_ENABLED,
+	COLORLINES_COLOR6,
+	COLORLINES_COLOR6_TOLERANCE,
+	COLORLINES_COLOR7_ENABLED,
+	COLORLINES_COLOR7,
+	COLORLINES_COLOR7_TOLERANCE,
+	COLORLINES_COLOR8_ENABLED,
+	COLORLINES_COLOR8,
+	COLORLINES_COLOR8_TOLERANCE,
+	COLORLINES_MORE_COLORS_GROUP_END,
+
+	COLORLINES_MATCH_SPACE,
+	COLORLINES_MIN_LINE_SIZE,
 	COLORLINES_COLOR_GROUP_END,
 
 	// Fill Settings Group
 	COLORLINES_FILL_GROUP_START,
 	COLORLINES_FILL_MODE,
 	COLORLINES_SEARCH_RADIUS,
+	COLORLINES_SAMPLE_COUNT,
 	COLORLINES_IGNORE_TRANSPARENT,
 	COLORLINES_SAMPLE_BLUR,
 	COLORLINES_FILL_GROUP_END,
@@ -69,6 +104,8 @@ enum {
 	// Output Group
 	COLORLINES_OUTPUT_GROUP_START,
 	COLORLINES_OUTPUT_MODE,
+	COLORLINES_HALF_FLOAT,
+	COLORLINES_MEMORY_BUDGET,
 	COLORLINES_OUTPUT_GROUP_END,
 
 	COLORLINES_NUM_PARAMS
@@ -96,14 +133,54 @@ enum {
 
 	OUTPUT_GROUP_START_DISK_ID,
 	OUTPUT_MODE_DISK_ID,
-	OUTPUT_GROUP_END_DISK_ID
+	OUTPUT_GROUP_END_DISK_ID,
+
+	SAMPLE_COUNT_DISK_ID,
+	HALF_FLOAT_DISK_ID,
+	MEMORY_BUDGET_DISK_ID,
+	MIN_LINE_SIZE_DISK_ID,
+	MATCH_SPACE_DISK_ID,
+
+	MORE_COLORS_GROUP_START_DISK_ID,
+	COLOR2_ENABLED_DISK_ID,
+	COLOR2_DISK_ID,
+	COLOR2_TOLERANCE_DISK_ID,
+	COLOR3_ENABLED_DISK_ID,
+	COLOR3_DISK_ID,
+	COLOR3_TOLERANCE_DISK_ID,
+	COLOR4_ENABLED_DISK_ID,
+	COLOR4_DISK_ID,
+	COLOR4_TOLERANCE_DISK_ID,
+	COLOR5_ENABLED_DISK_ID,
+	COLOR5_DISK_ID,
+	COLOR5_TOLERANCE_DISK_ID,
+	COLOR6_ENABLED_DISK_ID,
+	COLOR6_DISK_ID,
+	COLOR6_TOLERANCE_DISK_ID,
+	COLOR7_ENABLED_DISK_ID,
+	COLOR7_DISK_ID,
+	COLOR7_TOLERANCE_DISK_ID,
+	COLOR8_ENABLED_DISK_ID,
+	COLOR8_DISK_ID,
+	COLOR8_TOLERANCE_DISK_ID,
+	MORE_COLORS_GROUP_END_DISK_ID
 };
 
+// Target Color is color 1; colors 2 to COLORLINES_MAX_COLORS each have an
+// Enabled checkbox, a Color and a Tolerance (param IDs and disk IDs alike)
+#define COLORLINES_MAX_COLORS		8
+#define COLOR_ENABLED_PARAM(n)		(COLORLINES_COLOR2_ENABLED + ((n) - 2) * 3)
+#define COLOR_PARAM(n)				(COLORLINES_COLOR2 + ((n) - 2) * 3)
+#define COLOR_TOLERANCE_PARAM(n)	(COLORLINES_COLOR2_TOLERANCE + ((n) - 2) * 3)
+#define COLOR_ENABLED_DISK_ID(n)	(COLOR2_ENABLED_DISK_ID + ((n) - 2) * 3)
+
 // Fill mode options
 enum FillMode {
 	FILL_MODE_NEAREST = 1,
 	FILL_MODE_AVERAGE,
 	FILL_MODE_WEIGHTED,
+	FILL_MODE_PUSH_PULL,		// Pyramid fill, ignores Search Radius
+	FILL_MODE_ADAPTIVE,			// Nearest Sample Count samples within Search Radius
 	FILL_MODE_NUM_MODES
 };
 
@@ -120,10 +197,19 @@ enum OutputMode {
 #define TOLERANCE_MAX		100.0
 #define TOLERANCE_DFLT		0.0
 
+// Minimum Line Size in pixels; smaller connected pieces are not lines, 0 keeps all
+#define MIN_LINE_SIZE_MIN	0
+#define MIN_LINE_SIZE_MAX	10000
+#define MIN_LINE_SIZE_DFLT	0
+
 #define SEARCH_RADIUS_MIN	1
 #define SEARCH_RADIUS_MAX	50
 #define SEARCH_RADIUS_DFLT	5
 
+#define SAMPLE_COUNT_MIN	1
+#define SAMPLE_COUNT_MAX	64
+#define SAMPLE_COUNT_DFLT	8
+
 #define SAMPLE_BLUR_MIN		0.0
 #define SAMPLE_BLUR_MAX		100.0
 #define SAMPLE_BLUR_DFLT	0.0
@@ -140,6 +226,11 @@ enum OutputMode {
 #define SATURATION_MAX		100.0
 #define SATURATION_DFLT		0.0
 
+// Memory Budget in MB; 0 renders the whole frame at once
+#define MEMORY_BUDGET_MIN	0
+#define MEMORY_BUDGET_MAX	8192
+#define MEMORY_BUDGET_DFLT	0
+
 
 extern "C" {
 
@@ -155,15 +246,26 @@ extern "C" {
 
 }
 
+// One of the additional target colors
+typedef struct {
+	PF_Boolean		enabled;
+	PF_Pixel		color;
+	PF_FpLong		tolerance;
+} ColorLinesColor;
+
 // Plugin processing info structure
 typedef struct ColorLinesInfo {
 	// Color selection
 	PF_Pixel		targetColor;
 	PF_FpLong		tolerance;
+	ColorLinesColor	moreColors[COLORLINES_MAX_COLORS - 1];	// Colors 2 and up
+	A_long			matchSpace;			// CX_MATCH_SPACE_RGB or CX_MATCH_SPACE_OKLAB
+	A_long			minLineSize;		// Pixels; matched pieces below it are left as they are
 
 	// Fill settings
 	A_long			fillMode;
 	A_long			searchRadius;
+	A_long			sampleCount;
 	PF_Boolean		ignoreTransparent;
 	PF_FpLong		sampleBlur;
 
@@ -174,6 +276,8 @@ typedef struct ColorLinesInfo {
 
 	// Output
 	A_long			outputMode;
+	PF_Boolean		halfFloat;			// 32-bit: hold line pixels as half floats between stages
+	A_long			memoryBudget;		// MB per render, 0 = whole frame; above it the frame renders in strips
 
 	// Source image info for neighbor lookup
 	PF_EffectWorld	*srcWorld;
@@ -182,22 +286,20 @@ typedef struct ColorLinesInfo {
 	// Extent offset for coordinate mapping
 	A_long			x_offset;
 	A_long			y_offset;
-
-	// Line mask for multi-pass processing
-	A_u_char		*lineMask;
-	A_long			maskWidth;
-	A_long			maskHeight;
-	A_long			maskRowBytes;
 } ColorLinesInfo, *ColorLinesInfoP, **ColorLinesInfoH;
 
-// Pixel format structures for Premiere compatibility
-typedef struct {
-	A_u_char	blue, green, red, alpha;
-} PF_Pixel_BGRA_8u;
-
-typedef struct {
-	PF_FpShort	blue, green, red, alpha;
-} PF_Pixel_BGRA_32f;
+// Intermediate pipeline products (mask, fill, adjust, blur), see ColorLines.cpp
+struct ColorLinesProduct;
+typedef CXComputeCache<ColorLinesProduct> ColorLinesStageCache;
+
+// Global data shared by all instances and render threads
+typedef struct ColorLinesGlobalData {
+	// Results of previously rendered frames, keyed by input content and params
+	CXFrameCache			*frameCache;
+	// Stage products, keyed by input content and the params each stage reads;
+	// in AE's compute cache where the host has one
+	ColorLinesStageCache	*stageCache;
+} ColorLinesGlobalData;
 
 
 #endif // COLOR_LINES_H
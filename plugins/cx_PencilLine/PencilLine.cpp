@@ -4,18 +4,44 @@
  *
  * Extracts multiple target colors and applies pencil line texture processing.
  * Uses SmartFX architecture with multi-bit-depth support (8/16/32-bit).
+ * In Premiere Pro, renders BGRA 8u/32f frames natively through PF_Cmd_RENDER.
  */
 
 #include "PencilLine.h"
+#include "CXMorphology.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
 
 // ============================================================================
 // Color matching functions (checks against all enabled colors)
 // Uses CX_IsTargetColor* from CXCommon.h
 // ============================================================================
 
-// Check if pixel matches any enabled target color (8-bit)
-static inline bool IsTargetColor8(const PF_Pixel8* pixel, const PencilLineInfo* info) {
+// Check if an 8-bit colour matches any enabled target color in OKLab. The
+// colour is converted once and compared with each entry's precomputed Lab.
+static inline bool IsTargetColorOKLab(A_long r8, A_long g8, A_long b8, const PencilLineInfo* info) {
+    const CXLab lab = CX_OKLabFrom8(r8, g8, b8);
+    for (A_long i = 0; i < info->colorCount; ++i) {
+        const ColorEntry& entry = info->colors[i];
+        if (!entry.enabled) continue;
+        if (CX_OKLabDistanceSq(lab, entry.lab) <= entry.toleranceSq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Check if pixel matches any enabled target color (8-bit, ARGB or BGRA)
+template <typename Pixel>
+static inline bool IsTargetColor8(const Pixel* pixel, const PencilLineInfo* info) {
+    if (info->matchSpace == CX_MATCH_SPACE_OKLAB) {
+        return IsTargetColorOKLab(pixel->red, pixel->green, pixel->blue, info);
+    }
     for (A_long i = 0; i < info->colorCount; ++i) {
         const ColorEntry& entry = info->colors[i];
         if (!entry.enabled) continue;
@@ -28,6 +54,10 @@ static inline bool IsTargetColor8(const PF_Pixel8* pixel, const PencilLineInfo*
 
 // Check if pixel matches any enabled target color (16-bit)
 static inline bool IsTargetColor16(const PF_Pixel16* pixel, const PencilLineInfo* info) {
+    if (info->matchSpace == CX_MATCH_SPACE_OKLAB) {
+        return IsTargetColorOKLab(CX_Channel16To8(pixel->red), CX_Channel16To8(pixel->green),
+                                  CX_Channel16To8(pixel->blue), info);
+    }
     for (A_long i = 0; i < info->colorCount; ++i) {
         const ColorEntry& entry = info->colors[i];
         if (!entry.enabled) continue;
@@ -38,8 +68,13 @@ static inline bool IsTargetColor16(const PF_Pixel16* pixel, const PencilLineInfo
     return false;
 }
 
-// Check if pixel matches any enabled target color (32-bit float)
-static inline bool IsTargetColorFloat(const PF_PixelFloat* pixel, const PencilLineInfo* info) {
+// Check if pixel matches any enabled target color (32-bit float, ARGB or BGRA)
+template <typename Pixel>
+static inline bool IsTargetColorFloat(const Pixel* pixel, const PencilLineInfo* info) {
+    if (info->matchSpace == CX_MATCH_SPACE_OKLAB) {
+        return IsTargetColorOKLab(CX_ChannelFloatTo8(pixel->red), CX_ChannelFloatTo8(pixel->green),
+                                  CX_ChannelFloatTo8(pixel->blue), info);
+    }
     for (A_long i = 0; i < info->colorCount; ++i) {
         const ColorEntry& entry = info->colors[i];
         if (!entry.enabled) continue;
@@ -51,22 +86,70 @@ static inline bool IsTargetColorFloat(const PF_PixelFloat* pixel, const PencilLi
 }
 
 // ============================================================================
-// Pencil texture processing (placeholder - to be implemented)
+// Pencil texture: line pixels lose coverage where the grain is light.
+// Graphite grain runs along the stroke (see the orientation stage below);
+// paper grain stays fixed in layer space.
 // ============================================================================
 
+// Texture rotations blended between; bin b turns the grain by b * pi / 8
+constexpr A_long TEXTURE_BINS = 8;
+static const float TEXTURE_BIN_COS[TEXTURE_BINS] = {
+    1.0f, 0.92387953f, 0.70710678f, 0.38268343f, 0.0f, -0.38268343f, -0.70710678f, -0.92387953f };
+static const float TEXTURE_BIN_SIN[TEXTURE_BINS] = {
+    0.0f, 0.38268343f, 0.70710678f, 0.92387953f, 1.0f, 0.92387953f, 0.70710678f, 0.38268343f };
+
+// Grain contrast around its mean of about 0.5
+constexpr float TEXTURE_GRAIN_CONTRAST = 2.0f;
+
+static inline bool HasPencilTexture(const PencilLineInfo* info)
+{
+    return info->grain && info->textureStrength > 0.0;
+}
+
+// Graphite grain along stroke angle bin `bin` at layer position (lx, ly)
+static inline float SampleGraphite(const PencilLineInfo* info, A_long bin, float lx, float ly)
+{
+    float c = TEXTURE_BIN_COS[bin], s = TEXTURE_BIN_SIN[bin];
+    float u = lx * c + ly * s;
+    float v = ly * c - lx * s;
+    return info->grain->Sample(CX_GRAIN_GRAPHITE, info->grainLevel,
+                               static_cast<A_long>(floorf(u)), static_cast<A_long>(floorf(v)));
+}
+
+// Fraction of the line pixel's alpha kept. orientation is the stroke angle,
+// 0-255 over [0, pi); the two nearest rotations are blended so the grain
+// turns smoothly along curved strokes.
+static inline float PencilCoverage(const PencilLineInfo* info, A_long x, A_long y, A_u_char orientation)
+{
+    A_long lx = x + info->grainOriginX;
+    A_long ly = y + info->grainOriginY;
+
+    float pos = orientation * (TEXTURE_BINS / 256.0f);
+    A_long bin = static_cast<A_long>(pos);
+    float t = pos - bin;
+    float graphite = SampleGraphite(info, bin, static_cast<float>(lx), static_cast<float>(ly)) * (1.0f - t) +
+                     SampleGraphite(info, (bin + 1) % TEXTURE_BINS, static_cast<float>(lx), static_cast<float>(ly)) * t;
+    float paper = info->grain->Sample(CX_GRAIN_PAPER, info->grainLevel, lx, ly);
+
+    float grain = ((graphite + paper) * 0.5f - 0.5f) * TEXTURE_GRAIN_CONTRAST + 0.5f;
+    grain = grain < 0.0f ? 0.0f : (grain > 1.0f ? 1.0f : grain);
+    float strength = static_cast<float>(info->textureStrength / TEXTURE_STRENGTH_MAX);
+    return 1.0f - strength * (1.0f - grain);
+}
+
+template <typename Pixel>
 static inline void ApplyPencilTexture8(
-    PF_Pixel8* outP,
-    const PF_Pixel8* inP,
+    Pixel* outP,
+    const Pixel* inP,
     const PencilLineInfo* info,
     A_long x,
-    A_long y)
+    A_long y,
+    A_u_char orientation)
 {
-    // Placeholder: Currently just copies the input
-    // Will be replaced with pencil texture algorithm
-    outP->alpha = inP->alpha;
-    outP->red = inP->red;
-    outP->green = inP->green;
-    outP->blue = inP->blue;
+    *outP = *inP;
+    if (HasPencilTexture(info)) {
+        outP->alpha = static_cast<A_u_char>(inP->alpha * PencilCoverage(info, x, y, orientation) + 0.5f);
+    }
 }
 
 static inline void ApplyPencilTexture16(
@@ -74,61 +157,105 @@ static inline void ApplyPencilTexture16(
     const PF_Pixel16* inP,
     const PencilLineInfo* info,
     A_long x,
-    A_long y)
+    A_long y,
+    A_u_char orientation)
 {
-    outP->alpha = inP->alpha;
-    outP->red = inP->red;
-    outP->green = inP->green;
-    outP->blue = inP->blue;
+    *outP = *inP;
+    if (HasPencilTexture(info)) {
+        outP->alpha = static_cast<A_u_short>(inP->alpha * PencilCoverage(info, x, y, orientation) + 0.5f);
+    }
 }
 
+template <typename Pixel>
 static inline void ApplyPencilTextureFloat(
-    PF_PixelFloat* outP,
-    const PF_PixelFloat* inP,
+    Pixel* outP,
+    const Pixel* inP,
     const PencilLineInfo* info,
     A_long x,
-    A_long y)
+    A_long y,
+    A_u_char orientation)
 {
-    outP->alpha = inP->alpha;
-    outP->red = inP->red;
-    outP->green = inP->green;
-    outP->blue = inP->blue;
+    *outP = *inP;
+    if (HasPencilTexture(info)) {
+        outP->alpha = inP->alpha * PencilCoverage(info, x, y, orientation);
+    }
 }
 
 // ============================================================================
-// Main processing functions (per bit depth)
+// Main processing (templated over bit depth)
 // ============================================================================
 
-PF_Err ProcessPencilLine8(
-    void*           refcon,
-    A_long          x,
-    A_long          y,
-    PF_Pixel8*      inP,
-    PF_Pixel8*      outP)
-{
-    PencilLineInfo* info = static_cast<PencilLineInfo*>(refcon);
+// Row bands rendered in parallel; each band keeps its own colour palette
+constexpr A_long RENDER_BANDS = 16;
 
-    // Use inP directly - iterate callback provides correct input pixel
-    bool isTargetColor = IsTargetColor8(inP, info);
+template <typename Pixel>
+struct PencilPixelTraits;
+
+template <>
+struct PencilPixelTraits<PF_Pixel8> {
+    static bool IsTarget(const PF_Pixel8* p, const PencilLineInfo* info) { return IsTargetColor8(p, info); }
+    static void ApplyTexture(PF_Pixel8* outP, const PF_Pixel8* inP, const PencilLineInfo* info, A_long x, A_long y, A_u_char orientation) {
+        ApplyPencilTexture8(outP, inP, info, x, y, orientation);
+    }
+};
 
+template <>
+struct PencilPixelTraits<PF_Pixel16> {
+    static bool IsTarget(const PF_Pixel16* p, const PencilLineInfo* info) { return IsTargetColor16(p, info); }
+    static void ApplyTexture(PF_Pixel16* outP, const PF_Pixel16* inP, const PencilLineInfo* info, A_long x, A_long y, A_u_char orientation) {
+        ApplyPencilTexture16(outP, inP, info, x, y, orientation);
+    }
+};
+
+template <>
+struct PencilPixelTraits<PF_PixelFloat> {
+    static bool IsTarget(const PF_PixelFloat* p, const PencilLineInfo* info) { return IsTargetColorFloat(p, info); }
+    static void ApplyTexture(PF_PixelFloat* outP, const PF_PixelFloat* inP, const PencilLineInfo* info, A_long x, A_long y, A_u_char orientation) {
+        ApplyPencilTextureFloat(outP, inP, info, x, y, orientation);
+    }
+};
+
+// Premiere's native layouts share the 8-bit and float code paths
+template <>
+struct PencilPixelTraits<PF_Pixel_BGRA_8u> {
+    static bool IsTarget(const PF_Pixel_BGRA_8u* p, const PencilLineInfo* info) { return IsTargetColor8(p, info); }
+    static void ApplyTexture(PF_Pixel_BGRA_8u* outP, const PF_Pixel_BGRA_8u* inP, const PencilLineInfo* info, A_long x, A_long y, A_u_char orientation) {
+        ApplyPencilTexture8(outP, inP, info, x, y, orientation);
+    }
+};
+
+template <>
+struct PencilPixelTraits<PF_Pixel_BGRA_32f> {
+    static bool IsTarget(const PF_Pixel_BGRA_32f* p, const PencilLineInfo* info) { return IsTargetColorFloat(p, info); }
+    static void ApplyTexture(PF_Pixel_BGRA_32f* outP, const PF_Pixel_BGRA_32f* inP, const PencilLineInfo* info, A_long x, A_long y, A_u_char orientation) {
+        ApplyPencilTextureFloat(outP, inP, info, x, y, orientation);
+    }
+};
+
+// Writes one output pixel from its classification; orientation is the
+// stroke angle of line pixels (0 when the texture is off)
+template <typename Pixel>
+static inline void ProcessPencilPixel(
+    const PencilLineInfo*   info,
+    A_long                  x,
+    A_long                  y,
+    const Pixel*            inP,
+    Pixel*                  outP,
+    bool                    isTargetColor,
+    A_u_char                orientation)
+{
     switch (info->outputMode) {
         case OUTPUT_MODE_LINE_ONLY:
             if (isTargetColor) {
-                ApplyPencilTexture8(outP, inP, info, x, y);
+                PencilPixelTraits<Pixel>::ApplyTexture(outP, inP, info, x, y, orientation);
             } else {
-                outP->alpha = 0;
-                outP->red = 0;
-                outP->green = 0;
-                outP->blue = 0;
+                *outP = Pixel{};
             }
             break;
 
         case OUTPUT_MODE_BG_ONLY:
             if (isTargetColor) {
-                outP->alpha = 0;
-                outP->red = 0;
-                outP->green = 0;
-                outP->blue = 0;
+                *outP = Pixel{};
             } else {
                 *outP = *inP;
             }
@@ -137,110 +264,821 @@ PF_Err ProcessPencilLine8(
         case OUTPUT_MODE_FULL:
         default:
             if (isTargetColor) {
-                ApplyPencilTexture8(outP, inP, info, x, y);
+                PencilPixelTraits<Pixel>::ApplyTexture(outP, inP, info, x, y, orientation);
             } else {
                 *outP = *inP;
             }
             break;
     }
+}
 
-    return PF_Err_NONE;
+struct PencilRenderJob {
+    const PencilLineInfo*   info;
+    const PF_EffectWorld*   input;
+    PF_EffectWorld*         output;
+    std::atomic<bool>*      found;          // Prescan: set once any pixel matches
+    bool                    passThrough;    // No pixel matches: copy or clear rows
+    A_u_char*               classified;     // Classification: mask being written
+    const A_u_char*         mask;           // Texture stage: 1 at line pixels, else NULL
+    const A_u_char*         orientation;    // Texture stage: stroke angle at line pixels
+};
+
+// Colour matching for one band of rows. The 16-colour test runs once per
+// unique colour; bands with too many colours fall back to per-pixel matching.
+template <typename Pixel>
+struct BandMatcher {
+    CXPalette<Pixel, bool> palette;
+    bool usePalette = true;
+
+    bool IsTarget(const Pixel* p, const PencilLineInfo* info) {
+        bool isNew = false;
+        bool* cached = usePalette ? palette.Lookup(*p, &isNew) : nullptr;
+        if (cached && !isNew) return *cached;
+        bool isTarget = PencilPixelTraits<Pixel>::IsTarget(p, info);
+        if (cached) {
+            *cached = isTarget;
+        } else {
+            usePalette = false;
+        }
+        return isTarget;
+    }
+};
+
+// Band range [y0, y1) of the output rows
+static inline void GetBandRows(A_long height, A_long band, A_long bandCount, A_long* y0, A_long* y1)
+{
+    *y0 = static_cast<A_long>(static_cast<int64_t>(height) * band / bandCount);
+    *y1 = static_cast<A_long>(static_cast<int64_t>(height) * (band + 1) / bandCount);
 }
 
-PF_Err ProcessPencilLine16(
-    void*           refcon,
-    A_long          x,
-    A_long          y,
-    PF_Pixel16*     inP,
-    PF_Pixel16*     outP)
+// ============================================================================
+// Prescan: empty cels and hold frames often have no line pixels at all.
+// Stops at the first matching pixel; without one the render is a row copy.
+// ============================================================================
+
+template <typename Pixel>
+static PF_Err PrescanPencilLineBand(
+    void*   refcon,
+    A_long  thread,
+    A_long  band,
+    A_long  bandCount)
 {
-    PencilLineInfo* info = static_cast<PencilLineInfo*>(refcon);
+    const PencilRenderJob* job = static_cast<const PencilRenderJob*>(refcon);
+    A_long y0, y1;
+    GetBandRows(job->output->height, band, bandCount, &y0, &y1);
+    CXPalette<Pixel, bool> palette;
+    const PencilLineInfo* info = job->info;
+    auto isTarget = [info](const Pixel* p) { return PencilPixelTraits<Pixel>::IsTarget(p, info); };
+
+    // OKLab matches convert each colour, so 8-bit rows take the palette too
+    CXTargetColor8 targets8[MAX_COLORS];
+    A_long targetCount8 = 0;
+    for (A_long i = 0; i < info->colorCount; ++i) {
+        const ColorEntry& entry = info->colors[i];
+        if (!entry.enabled) continue;
+        targets8[targetCount8++] = { entry.color.red, entry.color.green, entry.color.blue, entry.toleranceSq };
+    }
+    const CXTargetColor8* rgbTargets = (info->matchSpace == CX_MATCH_SPACE_OKLAB) ? nullptr : targets8;
 
-    // Use inP directly - iterate callback provides correct input pixel
-    bool isTargetColor = IsTargetColor16(inP, info);
+    for (A_long y = y0; y < y1 && !job->found->load(std::memory_order_relaxed); ++y) {
+        const Pixel* inRow = reinterpret_cast<const Pixel*>(
+            static_cast<const char*>(job->input->data) + y * job->input->rowbytes);
+        if (CX_RowHasTarget(inRow, job->output->width, &palette, isTarget, rgbTargets, targetCount8)) {
+            job->found->store(true, std::memory_order_relaxed);
+        }
+    }
+    return PF_Err_NONE;
+}
 
-    switch (info->outputMode) {
-        case OUTPUT_MODE_LINE_ONLY:
-            if (isTargetColor) {
-                ApplyPencilTexture16(outP, inP, info, x, y);
+// Writes the match mask of one band of rows, for the orientation and
+// line width stages
+template <typename Pixel>
+static PF_Err ClassifyPencilLineBand(
+    void*   refcon,
+    A_long  thread,
+    A_long  band,
+    A_long  bandCount)
+{
+    const PencilRenderJob* job = static_cast<const PencilRenderJob*>(refcon);
+    A_long y0, y1;
+    GetBandRows(job->output->height, band, bandCount, &y0, &y1);
+    BandMatcher<Pixel> matcher;
+
+    for (A_long y = y0; y < y1; ++y) {
+        const Pixel* inRow = reinterpret_cast<const Pixel*>(
+            static_cast<const char*>(job->input->data) + y * job->input->rowbytes);
+        A_u_char* maskRow = job->classified + static_cast<size_t>(y) * job->output->width;
+        for (A_long x = 0; x < job->output->width; ++x) {
+            maskRow[x] = matcher.IsTarget(inRow + x, job->info) ? 1 : 0;
+        }
+    }
+    return PF_Err_NONE;
+}
+
+// Renders one band of rows, from the mask and orientation when the texture
+// stage built them and by matching each pixel otherwise
+template <typename Pixel>
+static PF_Err ProcessPencilLineBand(
+    void*   refcon,
+    A_long  thread,
+    A_long  band,
+    A_long  bandCount)
+{
+    const PencilRenderJob* job = static_cast<const PencilRenderJob*>(refcon);
+    const PencilLineInfo* info = job->info;
+    A_long y0, y1;
+    GetBandRows(job->output->height, band, bandCount, &y0, &y1);
+    BandMatcher<Pixel> matcher;
+
+    for (A_long y = y0; y < y1; ++y) {
+        const Pixel* inRow = reinterpret_cast<const Pixel*>(
+            static_cast<const char*>(job->input->data) + y * job->input->rowbytes);
+        Pixel* outRow = reinterpret_cast<Pixel*>(
+            static_cast<char*>(job->output->data) + y * job->output->rowbytes);
+
+        if (job->passThrough) {
+            // Lines Only shows nothing; every other mode shows the input
+            if (info->outputMode == OUTPUT_MODE_LINE_ONLY) {
+                memset(outRow, 0, job->output->width * sizeof(Pixel));
             } else {
-                outP->alpha = 0;
-                outP->red = 0;
-                outP->green = 0;
-                outP->blue = 0;
+                memcpy(outRow, inRow, job->output->width * sizeof(Pixel));
             }
-            break;
+            continue;
+        }
 
-        case OUTPUT_MODE_BG_ONLY:
-            if (isTargetColor) {
-                outP->alpha = 0;
-                outP->red = 0;
-                outP->green = 0;
-                outP->blue = 0;
-            } else {
-                *outP = *inP;
+        if (job->mask) {
+            const size_t rowStart = static_cast<size_t>(y) * job->output->width;
+            for (A_long x = 0; x < job->output->width; ++x) {
+                ProcessPencilPixel(info, x, y, inRow + x, outRow + x, job->mask[rowStart + x] != 0,
+                                   job->orientation[rowStart + x]);
             }
-            break;
+            continue;
+        }
 
-        case OUTPUT_MODE_FULL:
-        default:
-            if (isTargetColor) {
-                ApplyPencilTexture16(outP, inP, info, x, y);
+        for (A_long x = 0; x < job->output->width; ++x) {
+            ProcessPencilPixel(info, x, y, inRow + x, outRow + x, matcher.IsTarget(inRow + x, info), 0);
+        }
+    }
+    return PF_Err_NONE;
+}
+
+// ============================================================================
+// Stroke orientation: structure tensor of the match mask
+// ============================================================================
+//
+// The gradient of the 0/1 match mask points across a line. Its outer product
+// smoothed with a Gaussian is the structure tensor J = [Jxx Jxy; Jxy Jyy],
+// whose dominant eigenvector is the mean cross-line direction at
+//   phi = atan2(2 Jxy, Jxx - Jyy) / 2,
+// so the stroke runs at phi + pi/2. The field is built per tile and only for
+// tiles holding line pixels; the angle is solved only at line pixels.
+
+constexpr A_long ORIENT_TILE = 64;
+constexpr A_long ORIENT_RADIUS = 4;         // Gaussian taps on each side
+constexpr float ORIENT_SIGMA = 1.5f;
+constexpr A_long ORIENT_TAPS = 2 * ORIENT_RADIUS + 1;
+
+struct OrientationJob {
+    A_long              width;
+    A_long              height;
+    A_long              tilesX;
+    const A_u_char*     mask;
+    A_u_char*           orientation;        // Written at line pixels only
+    float               weights[ORIENT_TAPS];
+};
+
+static void InitOrientationJob(OrientationJob* job, A_long width, A_long height,
+                               const A_u_char* mask, A_u_char* orientation)
+{
+    job->width = width;
+    job->height = height;
+    job->tilesX = (width + ORIENT_TILE - 1) / ORIENT_TILE;
+    job->mask = mask;
+    job->orientation = orientation;
+    for (A_long k = 0; k < ORIENT_TAPS; ++k) {
+        float d = static_cast<float>(k - ORIENT_RADIUS);
+        job->weights[k] = expf(-d * d / (2.0f * ORIENT_SIGMA * ORIENT_SIGMA));
+    }
+}
+
+static inline A_long OrientationTileCount(const OrientationJob* job)
+{
+    return job->tilesX * ((job->height + ORIENT_TILE - 1) / ORIENT_TILE);
+}
+
+// Index of the first non-zero byte of row[i, count), or count
+static inline A_long NextNonZero(const A_u_char* row, A_long i, A_long count)
+{
+    for (; i + 8 <= count; i += 8) {
+        uint64_t word;
+        memcpy(&word, row + i, sizeof(word));
+        if (word) break;
+    }
+    while (i < count && !row[i]) ++i;
+    return i;
+}
+
+static PF_Err OrientTile(
+    void*   refcon,
+    A_long  thread,
+    A_long  tile,
+    A_long  tileCount)
+{
+    const OrientationJob* job = static_cast<const OrientationJob*>(refcon);
+    const A_long x0 = (tile % job->tilesX) * ORIENT_TILE;
+    const A_long y0 = (tile / job->tilesX) * ORIENT_TILE;
+    const A_long tw = (job->width - x0 < ORIENT_TILE) ? job->width - x0 : ORIENT_TILE;
+    const A_long th = (job->height - y0 < ORIENT_TILE) ? job->height - y0 : ORIENT_TILE;
+
+    bool anyLine = false;
+    for (A_long y = y0; y < y0 + th && !anyLine; ++y) {
+        anyLine = memchr(job->mask + static_cast<size_t>(y) * job->width + x0, 1, tw) != nullptr;
+    }
+    if (!anyLine) return PF_Err_NONE;
+
+    // Tensor over the tile plus the blur radius; the mask patch adds one more
+    // pixel for the central differences. Rows and columns clamp at the frame.
+    const A_long R = ORIENT_RADIUS;
+    const A_long gw = tw + 2 * R, gh = th + 2 * R;
+    const A_long pw = gw + 2, ph = gh + 2;
+    const A_long px0 = x0 - R - 1;
+    const bool inside = px0 >= 0 && px0 + pw <= job->width;
+    std::unique_ptr<A_u_char[]> patch(new A_u_char[static_cast<size_t>(pw) * ph]);
+    for (A_long j = 0; j < ph; ++j) {
+        A_long y = y0 - R - 1 + j;
+        y = y < 0 ? 0 : (y >= job->height ? job->height - 1 : y);
+        const A_u_char* maskRow = job->mask + static_cast<size_t>(y) * job->width;
+        A_u_char* patchRow = patch.get() + static_cast<size_t>(j) * pw;
+        if (inside) {
+            memcpy(patchRow, maskRow + px0, pw);
+            continue;
+        }
+        for (A_long i = 0; i < pw; ++i) {
+            A_long x = px0 + i;
+            patchRow[i] = maskRow[x < 0 ? 0 : (x >= job->width ? job->width - 1 : x)];
+        }
+    }
+
+    // Mask gradients are -1, 0 or 1 and vanish away from line edges. The
+    // horizontal pass scatters only edge samples into the rows they touch and
+    // the vertical pass gathers only at line pixels, so the work follows the
+    // lines rather than the tile area. Zero runs are skipped 8 bytes at a time.
+    std::unique_ptr<A_u_char[]> edge(new A_u_char[gw]);
+    std::unique_ptr<float[]> filtered(new float[static_cast<size_t>(tw) * gh * 3]);
+    std::vector<A_u_char> rowUsed(gh, 0);
+    const float* w = job->weights;
+
+    for (A_long j = 0; j < gh; ++j) {
+        const A_u_char* up = patch.get() + static_cast<size_t>(j) * pw + 1;
+        const A_u_char* mid = up + pw;
+        const A_u_char* down = mid + pw;
+        A_u_char anyEdge = 0;
+        for (A_long i = 0; i < gw; ++i) {
+            edge[i] = (mid[i + 1] ^ mid[i - 1]) | (down[i] ^ up[i]);
+            anyEdge |= edge[i];
+        }
+        if (!anyEdge) continue;
+
+        // Column c of the output sums samples c .. c + 2R of the row
+        float* hxx = filtered.get() + static_cast<size_t>(j) * tw * 3;
+        float* hxy = hxx + tw;
+        float* hyy = hxy + tw;
+        std::fill(hxx, hxx + tw * 3, 0.0f);
+        rowUsed[j] = 1;
+        for (A_long i = NextNonZero(edge.get(), 0, gw); i < gw; i = NextNonZero(edge.get(), i + 1, gw)) {
+            float gx = static_cast<float>(mid[i + 1] - mid[i - 1]);
+            float gy = static_cast<float>(down[i] - up[i]);
+            float pxx = gx * gx, pxy = gx * gy, pyy = gy * gy;
+            A_long c0 = i - 2 * R > 0 ? i - 2 * R : 0;
+            A_long c1 = i < tw - 1 ? i : tw - 1;
+            for (A_long c = c0; c <= c1; ++c) {
+                float wk = w[i - c];
+                hxx[c] += wk * pxx;
+                hxy[c] += wk * pxy;
+                hyy[c] += wk * pyy;
+            }
+        }
+    }
+
+    for (A_long j = 0; j < th; ++j) {
+        const size_t rowStart = static_cast<size_t>(y0 + j) * job->width + x0;
+        const A_u_char* maskRow = job->mask + rowStart;
+        A_u_char* orientRow = job->orientation + rowStart;
+        for (A_long i = NextNonZero(maskRow, 0, tw); i < tw; i = NextNonZero(maskRow, i + 1, tw)) {
+            float sxx = 0.0f, sxy = 0.0f, syy = 0.0f;
+            for (A_long k = 0; k < ORIENT_TAPS; ++k) {
+                if (!rowUsed[j + k]) continue;
+                const float* h = filtered.get() + static_cast<size_t>(j + k) * tw * 3 + i;
+                sxx += w[k] * h[0];
+                sxy += w[k] * h[tw];
+                syy += w[k] * h[2 * tw];
+            }
+            float a = sxx - syy;
+            float b = 2.0f * sxy;
+            if (a * a + b * b < 1e-12f) {
+                orientRow[i] = 0;       // Flat inside a wide line: no direction
+                continue;
+            }
+            // Stroke angle in (0, pi], stored as 0-255 over [0, pi)
+            float stroke = 0.5f * atan2f(b, a) + 1.5707963f;
+            orientRow[i] = static_cast<A_u_char>(static_cast<A_long>(stroke * (256.0f / 3.14159265f) + 0.5f) & 0xFF);
+        }
+    }
+    return PF_Err_NONE;
+}
+
+// ============================================================================
+// Line width: grow or shrink the matched lines with a square brush
+// ============================================================================
+//
+// At DEFAULT_LINE_WIDTH lines stay as drawn; each step above widens them by
+// one pixel and each step below thins them by one. The brush is a running
+// max (grow) or min (shrink) from CXMorphology.h, constant cost per pixel
+// at any width. Odd steps use an even brush, whose window reaches one pixel
+// further right (down) than left (up) (CX_MorphAnchor): growing adds the odd
+// pixel on the left/top edge and shrinking takes it off the right/bottom
+// edge, so such lines move half a pixel up and left.
+//
+// The filter runs on pixel sources instead of mask bits, so a widened pixel
+// takes the colour of a line pixel under the brush and a thinned one the
+// colour of a background pixel under it:
+//   grow:   line = index + 1, background = 0;     max > 0 reaches a line
+//   shrink: line = NONE,      background = index; min < NONE reaches background
+// Outside the frame counts as background when growing and as line when
+// shrinking, so the frame edge neither adds nor removes line pixels.
+
+constexpr A_u_long LINE_SOURCE_NONE = 0xFFFFFFFF;
+
+// Columns per task of the vertical pass
+constexpr A_long LINE_WIDTH_COLUMN_CHUNK = 64;
+
+struct LineWidthJob {
+    const PencilLineInfo*   info;
+    const PF_EffectWorld*   input;
+    PF_EffectWorld*         output;
+    bool                    grow;
+    A_long                  size;       // Brush side in pixels
+    const A_u_char*         mask;       // 1 at matched pixels
+    const A_u_char*         orientation;// Texture stage: stroke angle at matched pixels, else NULL
+    A_u_long*               sources;    // Filter input; also tells which pixels matched
+    A_u_long*               filtered;   // Vertical pass, then the horizontal one in place
+};
+
+static inline bool IsLineSource(const LineWidthJob* job, A_u_long source)
+{
+    return job->grow ? source != 0 : source == LINE_SOURCE_NONE;
+}
+
+// Filter input for one band of rows
+static PF_Err LineSourcesBand(
+    void*   refcon,
+    A_long  thread,
+    A_long  band,
+    A_long  bandCount)
+{
+    const LineWidthJob* job = static_cast<const LineWidthJob*>(refcon);
+    const A_long width = job->output->width;
+    A_long y0, y1;
+    GetBandRows(job->output->height, band, bandCount, &y0, &y1);
+
+    for (A_long y = y0; y < y1; ++y) {
+        const A_u_long rowStart = static_cast<A_u_long>(y) * width;
+        for (A_long x = 0; x < width; ++x) {
+            A_u_long index = rowStart + x;
+            bool isTargetColor = job->mask[index] != 0;
+            if (job->grow) {
+                job->sources[index] = isTargetColor ? index + 1 : 0;
             } else {
-                *outP = *inP;
+                job->sources[index] = isTargetColor ? LINE_SOURCE_NONE : index;
             }
-            break;
+        }
     }
+    return PF_Err_NONE;
+}
 
+// Vertical pass over one chunk of columns
+template <typename Op>
+static PF_Err LineWidthColumnChunk(
+    void*   refcon,
+    A_long  thread,
+    A_long  chunk,
+    A_long  chunkCount)
+{
+    const LineWidthJob* job = static_cast<const LineWidthJob*>(refcon);
+    const A_long width = job->output->width;
+    const A_long height = job->output->height;
+    const A_long x0 = chunk * LINE_WIDTH_COLUMN_CHUNK;
+    const A_long columns = (width - x0 < LINE_WIDTH_COLUMN_CHUNK) ? width - x0 : LINE_WIDTH_COLUMN_CHUNK;
+    const A_u_long identity = job->grow ? 0 : LINE_SOURCE_NONE;
+
+    std::vector<A_u_long> g(CX_RunningExtremumColumnsScratch(columns, height, job->size));
+    std::vector<A_u_long> h(g.size());
+    CX_RunningExtremumColumns<A_u_long, Op>(job->sources + x0, width, job->filtered + x0, width,
+                                            columns, height, job->size, identity, g.data(), h.data());
     return PF_Err_NONE;
 }
 
-PF_Err ProcessPencilLineFloat(
-    void*           refcon,
-    A_long          x,
-    A_long          y,
-    PF_PixelFloat*  inP,
-    PF_PixelFloat*  outP)
+// Horizontal pass over one band of rows
+template <typename Op>
+static PF_Err LineWidthRowBand(
+    void*   refcon,
+    A_long  thread,
+    A_long  band,
+    A_long  bandCount)
 {
-    PencilLineInfo* info = static_cast<PencilLineInfo*>(refcon);
+    const LineWidthJob* job = static_cast<const LineWidthJob*>(refcon);
+    const A_long width = job->output->width;
+    const A_u_long identity = job->grow ? 0 : LINE_SOURCE_NONE;
+    A_long y0, y1;
+    GetBandRows(job->output->height, band, bandCount, &y0, &y1);
+
+    std::vector<A_u_long> g(CX_RunningExtremumRowScratch(width, job->size));
+    std::vector<A_u_long> h(g.size());
+    for (A_long y = y0; y < y1; ++y) {
+        size_t rowStart = static_cast<size_t>(y) * width;
+        CX_RunningExtremumRow<A_u_long, Op>(job->filtered + rowStart, job->filtered + rowStart,
+                                            width, job->size, identity, g.data(), h.data());
+    }
+    return PF_Err_NONE;
+}
 
-    // Use inP directly - iterate callback provides correct input pixel
-    bool isTargetColor = IsTargetColorFloat(inP, info);
+// Writes one band of rows from the filtered sources
+template <typename Pixel>
+static PF_Err WriteLineWidthBand(
+    void*   refcon,
+    A_long  thread,
+    A_long  band,
+    A_long  bandCount)
+{
+    const LineWidthJob* job = static_cast<const LineWidthJob*>(refcon);
+    const A_long width = job->output->width;
+    A_long y0, y1;
+    GetBandRows(job->output->height, band, bandCount, &y0, &y1);
+
+    for (A_long y = y0; y < y1; ++y) {
+        const Pixel* inRow = reinterpret_cast<const Pixel*>(
+            static_cast<const char*>(job->input->data) + y * job->input->rowbytes);
+        Pixel* outRow = reinterpret_cast<Pixel*>(
+            static_cast<char*>(job->output->data) + y * job->output->rowbytes);
+        const A_u_long rowStart = static_cast<A_u_long>(y) * width;
+
+        for (A_long x = 0; x < width; ++x) {
+            A_u_long index = rowStart + x;
+            A_u_long source = job->filtered[index];
+            bool wasLine = IsLineSource(job, job->sources[index]);
+            bool isLine = wasLine;
+
+            // Pixels that change class take their colour from the source pixel
+            A_u_long from = index;
+            if (job->grow && !wasLine && source != 0) {
+                isLine = true;
+                from = source - 1;
+            } else if (!job->grow && wasLine && source != LINE_SOURCE_NONE) {
+                isLine = false;
+                from = source;
+            }
 
-    switch (info->outputMode) {
-        case OUTPUT_MODE_LINE_ONLY:
-            if (isTargetColor) {
-                ApplyPencilTextureFloat(outP, inP, info, x, y);
-            } else {
-                outP->alpha = 0.0f;
-                outP->red = 0.0f;
-                outP->green = 0.0f;
-                outP->blue = 0.0f;
+            const Pixel* srcP = inRow + x;
+            if (from != index) {
+                A_long sy = static_cast<A_long>(from / width);
+                srcP = reinterpret_cast<const Pixel*>(
+                    static_cast<const char*>(job->input->data) + sy * job->input->rowbytes) + (from - static_cast<A_u_long>(sy) * width);
             }
-            break;
+            // Widened pixels follow the stroke of the line pixel they copy
+            A_u_char orientation = (isLine && job->orientation) ? job->orientation[from] : 0;
+            ProcessPencilPixel(job->info, x, y, srcP, outRow + x, isLine, orientation);
+        }
+    }
+    return PF_Err_NONE;
+}
 
-        case OUTPUT_MODE_BG_ONLY:
-            if (isTargetColor) {
-                outP->alpha = 0.0f;
-                outP->red = 0.0f;
-                outP->green = 0.0f;
-                outP->blue = 0.0f;
-            } else {
-                *outP = *inP;
+// Full render when Line Width differs from DEFAULT_LINE_WIDTH, from the
+// match mask and, with texture, the stroke field of the lines as drawn
+template <typename Pixel>
+static PF_Err ProcessLineWidth(
+    PF_InData*              in_data,
+    PF_OutData*             out_data,
+    const PencilLineInfo*   info,
+    const PF_EffectWorld*   input_worldP,
+    PF_EffectWorld*         output_worldP,
+    const A_u_char*         mask,
+    const A_u_char*         orientation,
+    A_long                  bands)
+{
+    PF_Err err = PF_Err_NONE;
+    AEFX_SuiteScoper<PF_Iterate8Suite2> iterSuite = AEFX_SuiteScoper<PF_Iterate8Suite2>(
+        in_data, kPFIterate8Suite, kPFIterate8SuiteVersion2, out_data);
+
+    const A_long delta = info->lineWidth - DEFAULT_LINE_WIDTH;
+    const size_t pixels = static_cast<size_t>(output_worldP->width) * output_worldP->height;
+    std::vector<A_u_long> sources(pixels);
+    std::vector<A_u_long> filtered(pixels);
+
+    LineWidthJob job = { info, input_worldP, output_worldP, delta > 0, (delta > 0 ? delta : -delta) + 1,
+                         mask, orientation, sources.data(), filtered.data() };
+    A_long chunks = (output_worldP->width + LINE_WIDTH_COLUMN_CHUNK - 1) / LINE_WIDTH_COLUMN_CHUNK;
+
+    ERR(iterSuite->iterate_generic(bands, &job, LineSourcesBand));
+    if (job.grow) {
+        ERR(iterSuite->iterate_generic(chunks, &job, LineWidthColumnChunk<CXMaxOp>));
+        ERR(iterSuite->iterate_generic(bands, &job, LineWidthRowBand<CXMaxOp>));
+    } else {
+        ERR(iterSuite->iterate_generic(chunks, &job, LineWidthColumnChunk<CXMinOp>));
+        ERR(iterSuite->iterate_generic(bands, &job, LineWidthRowBand<CXMinOp>));
+    }
+    ERR(iterSuite->iterate_generic(bands, &job, WriteLineWidthBand<Pixel>));
+    return err;
+}
+
+// Key of the planes PencilLine classifies a frame into. The enabled colours
+// are the key set, so instances keying the same colours share the planes.
+static CXCacheKey ComputeMaskKey(
+    const PencilLineInfo*   info,
+    const CXCacheKey&       inputKey,
+    const PF_EffectWorld*   output_worldP,
+    bool                    textured)
+{
+    CXColorKey keys[MAX_COLORS];
+    A_long keyCount = 0;
+    for (A_long i = 0; i < info->colorCount; ++i) {
+        const ColorEntry& entry = info->colors[i];
+        if (!entry.enabled) continue;
+        keys[keyCount].red = entry.color.red;
+        keys[keyCount].green = entry.color.green;
+        keys[keyCount].blue = entry.color.blue;
+        keys[keyCount].toleranceSq = entry.toleranceSq;
+        keyCount++;
+    }
+    A_long planes = CX_MASK_PLANE_MASK | (textured ? CX_MASK_PLANE_ORIENTATION : 0);
+    return CX_MaskKey(inputKey, output_worldP->width, output_worldP->height, info->matchSpace,
+                      keys, keyCount, planes);
+}
+
+// Renders the frame. With a mask cache, the match mask and stroke field come
+// from an instance that classified the same input and colours before, or
+// are stored for the next one; inputKey identifies the input content.
+template <typename Pixel>
+static PF_Err ProcessPencilLine(
+    PF_InData*              in_data,
+    PF_OutData*             out_data,
+    const PencilLineInfo*   info,
+    const PF_EffectWorld*   input_worldP,
+    PF_EffectWorld*         output_worldP,
+    CXMaskCache*            maskCache,
+    const CXCacheKey&       inputKey)
+{
+    PF_Err err = PF_Err_NONE;
+    A_long bands = output_worldP->height < RENDER_BANDS ? output_worldP->height : RENDER_BANDS;
+    if (bands <= 0) return PF_Err_NONE;
+
+    AEFX_SuiteScoper<PF_Iterate8Suite2> iterSuite = AEFX_SuiteScoper<PF_Iterate8Suite2>(
+        in_data, kPFIterate8Suite, kPFIterate8SuiteVersion2, out_data);
+
+    bool anyEnabled = false;
+    for (A_long i = 0; i < info->colorCount; ++i) {
+        anyEnabled = anyEnabled || info->colors[i].enabled;
+    }
+
+    // Textured lines need the whole mask for the stroke orientation first,
+    // and Line Width filters the mask; plain lines are matched per pixel
+    const bool textured = HasPencilTexture(info);
+    const bool needMask = anyEnabled && (textured || info->lineWidth != DEFAULT_LINE_WIDTH);
+
+    CXMaskCache* cache = needMask ? maskCache : nullptr;
+    CXCacheKey maskKey = { 0, 0 };
+    CXMaskCache::ValuePtr planes;
+    bool reserved = false;
+    if (cache) {
+        maskKey = ComputeMaskKey(info, inputKey, output_worldP, textured);
+        planes = cache->FindOrReserve(maskKey, &reserved);
+    }
+    CXCacheReservation<CXMaskPlanes, CXMaskCache> reservation(cache, maskKey, reserved);
+
+    std::atomic<bool> found(false);
+    PencilRenderJob job = { info, input_worldP, output_worldP, &found, false, nullptr, nullptr, nullptr };
+    if (planes) {
+        found.store(planes->anyMatch);
+    } else if (anyEnabled) {
+        ERR(iterSuite->iterate_generic(bands, &job, PrescanPencilLineBand<Pixel>));
+    }
+    job.passThrough = !found.load();
+
+    if (!err && needMask && !planes) {
+        std::shared_ptr<CXMaskPlanes> built = std::make_shared<CXMaskPlanes>();
+        built->width = output_worldP->width;
+        built->height = output_worldP->height;
+        built->anyMatch = !job.passThrough;
+        if (built->anyMatch) {
+            const size_t pixels = static_cast<size_t>(output_worldP->width) * output_worldP->height;
+            built->mask.resize(pixels);
+            job.classified = built->mask.data();
+            ERR(iterSuite->iterate_generic(bands, &job, ClassifyPencilLineBand<Pixel>));
+            job.classified = nullptr;
+
+            if (!err && textured) {
+                built->orientation.resize(pixels);
+                OrientationJob orientJob;
+                InitOrientationJob(&orientJob, output_worldP->width, output_worldP->height,
+                                   built->mask.data(), built->orientation.data());
+                ERR(iterSuite->iterate_generic(OrientationTileCount(&orientJob), &orientJob, OrientTile));
             }
-            break;
+        }
+        if (!err && reserved) {
+            reservation.Fulfill(built, built->Bytes());
+        }
+        planes = built;
+    }
+    if (err) return err;
+
+    if (!job.passThrough && needMask) {
+        job.mask = planes->mask.data();
+        job.orientation = textured ? planes->orientation.data() : nullptr;
+        if (info->lineWidth != DEFAULT_LINE_WIDTH) {
+            return ProcessLineWidth<Pixel>(in_data, out_data, info, input_worldP, output_worldP,
+                                           job.mask, job.orientation, bands);
+        }
+    }
+    ERR(iterSuite->iterate_generic(bands, &job, ProcessPencilLineBand<Pixel>));
+    return err;
+}
 
-        case OUTPUT_MODE_FULL:
+// ============================================================================
+// Parameter snapshots
+// ============================================================================
+
+// PreRender needs all 53 color, texture and output params every frame, yet
+// in a typical setup few of them (often none) are keyframed. The state of
+// all params over the whole timeline identifies a setup: the plan cached
+// for it holds the values read when it was first seen and lists the params
+// that vary over time, which are the only ones checked out again.
+struct PencilParamPlan {
+    PF_State timeline;              // State of all non-layer params over all time
+    PencilLineInfo info;            // Param values, grain fields unset
+    std::vector<A_long> animated;   // Params checked out again every frame
+};
+
+// A few hundred setups; each plan is well under a kilobyte
+constexpr size_t PENCIL_PARAM_PLAN_BUDGET = 256 * sizeof(PencilParamPlan);
+
+// Params with a value (not the input layer or a group topic/end)
+static inline bool IsValueParam(A_long index)
+{
+    switch (index) {
+        case PENCILLINE_INPUT:
+        case PENCILLINE_COLOR_GROUP:
+        case PENCILLINE_COLOR_GROUP_END:
+        case PENCILLINE_TEXTURE_GROUP:
+        case PENCILLINE_TEXTURE_GROUP_END:
+        case PENCILLINE_OUTPUT_GROUP:
+        case PENCILLINE_OUTPUT_GROUP_END:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// Store the value of param `index` into info
+static void StoreParam(PencilLineInfo* info, A_long index, const PF_ParamDef& param)
+{
+    if (index >= PENCILLINE_COLOR1_ENABLED && index <= PENCILLINE_COLOR16_TOLERANCE) {
+        ColorEntry& entry = info->colors[(index - PENCILLINE_COLOR1_ENABLED) / 3];
+        switch ((index - PENCILLINE_COLOR1_ENABLED) % 3) {
+            case 0:
+                entry.enabled = param.u.bd.value;
+                break;
+            case 1:
+                entry.color = param.u.cd.value;
+                entry.lab = CX_OKLabFrom8(entry.color.red, entry.color.green, entry.color.blue);
+                break;
+            default:
+                entry.tolerance = param.u.fs_d.value;
+                // Precompute squared tolerance using common helper
+                entry.toleranceSq = CX_ToleranceToDistSq(entry.tolerance);
+                break;
+        }
+        return;
+    }
+
+    switch (index) {
+        case PENCILLINE_MATCH_SPACE:
+            info->matchSpace = param.u.pd.value;
+            break;
+        case PENCILLINE_LINE_WIDTH:
+            info->lineWidth = param.u.sd.value;
+            break;
+        case PENCILLINE_LINE_DENSITY:
+            info->lineDensity = param.u.fs_d.value;
+            break;
+        case PENCILLINE_TEXTURE_STRENGTH:
+            info->textureStrength = param.u.fs_d.value;
+            break;
+        case PENCILLINE_OUTPUT_MODE:
+            info->outputMode = param.u.pd.value;
+            break;
         default:
-            if (isTargetColor) {
-                ApplyPencilTextureFloat(outP, inP, info, x, y);
-            } else {
-                *outP = *inP;
-            }
             break;
     }
+}
 
-    return PF_Err_NONE;
+// Check out param `index` at the current time into info
+static PF_Err CheckoutPencilParam(PF_InData* in_data, A_long index, PencilLineInfo* info)
+{
+    PF_Err err = PF_Err_NONE;
+    PF_ParamDef param;
+    AEFX_CLR_STRUCT(param);
+
+    ERR(PF_CHECKOUT_PARAM(in_data, index, in_data->current_time,
+                          in_data->time_step, in_data->time_scale, &param));
+    if (!err) {
+        StoreParam(info, index, param);
+    }
+    PF_CHECKIN_PARAM(in_data, &param);
+    return err;
+}
+
+// Fill info with the param values at the current time. A new setup checks
+// out every param and classifies it: static when its state over all time
+// equals its state over this frame, animated otherwise (keyframes and
+// expressions both make the two differ). Hosts whose states depend on the
+// range asked for only ever see animated params, which is slower but safe.
+static PF_Err ReadPencilParams(
+    PF_InData*              in_data,
+    PF_OutData*             out_data,
+    PencilParamPlanCache*   planCache,
+    PencilLineInfo*         info)
+{
+    PF_Err err = PF_Err_NONE;
+    info->colorCount = MAX_COLORS;
+
+    if (!planCache) {
+        for (A_long index = 0; index < PENCILLINE_NUM_PARAMS; ++index) {
+            if (IsValueParam(index)) {
+                ERR(CheckoutPencilParam(in_data, index, info));
+            }
+        }
+        return err;
+    }
+
+    AEFX_SuiteScoper<PF_ParamUtilsSuite3> paramSuite = AEFX_SuiteScoper<PF_ParamUtilsSuite3>(
+        in_data, kPFParamUtilsSuite, kPFParamUtilsSuiteVersion3, out_data);
+
+    PF_State timeline;
+    AEFX_CLR_STRUCT(timeline);
+    ERR(paramSuite->PF_GetCurrentState(in_data->effect_ref, PF_ParamIndex_CHECK_ALL_EXCEPT_LAYER_PARAMS,
+                                       nullptr, nullptr, &timeline));
+    if (err) return err;
+
+    // States are opaque: the hash only finds the candidate plan
+    CXHasher hasher;
+    hasher.Update(&timeline, sizeof(timeline));
+    const CXCacheKey planKey = hasher.Finish();
+
+    PencilParamPlanCache::ValuePtr plan = planCache->Find(planKey);
+    if (plan) {
+        A_Boolean identical = FALSE;
+        ERR(paramSuite->PF_AreStatesIdentical(in_data->effect_ref, &plan->timeline, &timeline, &identical));
+        if (!err && identical) {
+            *info = plan->info;
+            for (A_long index : plan->animated) {
+                ERR(CheckoutPencilParam(in_data, index, info));
+            }
+            return err;
+        }
+    }
+
+    std::shared_ptr<PencilParamPlan> built;
+    try {
+        built = std::make_shared<PencilParamPlan>();
+        built->animated.reserve(PENCILLINE_NUM_PARAMS);
+    } catch (const std::bad_alloc&) {
+        built.reset();      // Read this frame without keeping a plan
+    }
+
+    const A_Time frameStart = { in_data->current_time, in_data->time_scale };
+    const A_Time frameDuration = { in_data->time_step, in_data->time_scale };
+    for (A_long index = 0; index < PENCILLINE_NUM_PARAMS && !err; ++index) {
+        if (!IsValueParam(index)) continue;
+        ERR(CheckoutPencilParam(in_data, index, info));
+        if (!built) continue;
+
+        PF_State overTime, overFrame;
+        AEFX_CLR_STRUCT(overTime);
+        AEFX_CLR_STRUCT(overFrame);
+        A_Boolean isStatic = FALSE;
+        ERR(paramSuite->PF_GetCurrentState(in_data->effect_ref, index, nullptr, nullptr, &overTime));
+        ERR(paramSuite->PF_GetCurrentState(in_data->effect_ref, index, &frameStart, &frameDuration, &overFrame));
+        ERR(paramSuite->PF_AreStatesIdentical(in_data->effect_ref, &overTime, &overFrame, &isStatic));
+        if (!err && !isStatic) {
+            built->animated.push_back(index);
+        }
+    }
+
+    if (!err && built) {
+        built->timeline = timeline;
+        built->info = *info;
+        planCache->Insert(planKey, built, sizeof(PencilParamPlan) + built->animated.capacity() * sizeof(A_long));
+    }
+    return err;
 }
 
 // ============================================================================
@@ -257,6 +1095,58 @@ PF_Err GlobalSetup(
     out_data->out_flags2 = PF_OutFlag2_FLOAT_COLOR_AWARE |
                            PF_OutFlag2_SUPPORTS_SMART_RENDER |
                            PF_OutFlag2_SUPPORTS_THREADED_RENDERING;
+
+    // Premiere: take its BGRA frames as they are
+    PF_Err err = CX_AddPremierePixelFormats(in_data, out_data);
+    if (err) return err;
+
+    AEFX_SuiteScoper<PF_HandleSuite1> handleSuite = AEFX_SuiteScoper<PF_HandleSuite1>(
+        in_data, kPFHandleSuite, kPFHandleSuiteVersion1, out_data);
+    PF_Handle globalH = handleSuite->host_new_handle(sizeof(PencilLineGlobalData));
+    if (!globalH) return PF_Err_OUT_OF_MEMORY;
+
+    PencilLineGlobalData* global = reinterpret_cast<PencilLineGlobalData*>(
+        handleSuite->host_lock_handle(globalH));
+    if (!global) {
+        handleSuite->host_dispose_handle(globalH);
+        return PF_Err_OUT_OF_MEMORY;
+    }
+    global->frameCache = new CXFrameCache(CX_FRAME_CACHE_BUDGET);
+    global->planCache = new PencilParamPlanCache(PENCIL_PARAM_PLAN_BUDGET);
+    global->maskCache = new CXMaskCache(PLUGIN_MATCH_NAME " Mask Planes", CX_MASK_CACHE_BUDGET);
+    global->maskCache->AttachHost(in_data);
+    // Without grain (out of memory) lines render untextured
+    global->grainAtlas = CXGrainAtlas::Acquire();
+    handleSuite->host_unlock_handle(globalH);
+
+    out_data->global_data = globalH;
+    return PF_Err_NONE;
+}
+
+PF_Err GlobalSetdown(
+    PF_InData*      in_data,
+    PF_OutData*     out_data)
+{
+    if (!in_data->global_data) return PF_Err_NONE;
+
+    AEFX_SuiteScoper<PF_HandleSuite1> handleSuite = AEFX_SuiteScoper<PF_HandleSuite1>(
+        in_data, kPFHandleSuite, kPFHandleSuiteVersion1, out_data);
+    PencilLineGlobalData* global = reinterpret_cast<PencilLineGlobalData*>(
+        handleSuite->host_lock_handle(in_data->global_data));
+    if (global) {
+        delete global->frameCache;
+        global->frameCache = nullptr;
+        delete global->planCache;
+        global->planCache = nullptr;
+        global->maskCache->DetachHost(in_data);
+        delete global->maskCache;
+        global->maskCache = nullptr;
+        CXGrainAtlas::Release(global->grainAtlas);
+        global->grainAtlas = nullptr;
+        handleSuite->host_unlock_handle(in_data->global_data);
+    }
+    handleSuite->host_dispose_handle(in_data->global_data);
+    out_data->global_data = nullptr;
     return PF_Err_NONE;
 }
 
@@ -321,6 +1211,14 @@ PF_Err ParamsSetup(
     def.flags = PF_ParamFlag_START_COLLAPSED;
     PF_ADD_TOPIC("Color Selection", DISK_ID_COLOR_GROUP);
 
+    // Match space, shared by all colors
+    AEFX_CLR_STRUCT(def);
+    PF_ADD_POPUP("Match Colors In",
+                 CX_MATCH_SPACE_NUM_SPACES - 1,
+                 CX_MATCH_SPACE_RGB,
+                 CX_MATCH_SPACE_POPUP,
+                 DISK_ID_MATCH_SPACE);
+
     // Add all 16 color parameters (first color enabled by default)
     ERR(AddColorParams(in_data, 1,  TRUE,  DISK_ID_COLOR1_ENABLED,  DISK_ID_COLOR1,  DISK_ID_COLOR1_TOLERANCE));
     ERR(AddColorParams(in_data, 2,  FALSE, DISK_ID_COLOR2_ENABLED,  DISK_ID_COLOR2,  DISK_ID_COLOR2_TOLERANCE));
@@ -460,66 +1358,19 @@ PF_Err PreRender(
     // Initialize info structure
     memset(info, 0, sizeof(PencilLineInfo));
 
-    // Fixed 16 colors
-    info->colorCount = MAX_COLORS;
-
-    // Checkout all color parameters
-    for (A_long i = 0; i < MAX_COLORS; ++i) {
-        PF_ParamDef enabledParam, colorParam, toleranceParam;
-        AEFX_CLR_STRUCT(enabledParam);
-        AEFX_CLR_STRUCT(colorParam);
-        AEFX_CLR_STRUCT(toleranceParam);
-
-        A_long colorNum = i + 1;  // 1-based
-
-        ERR(PF_CHECKOUT_PARAM(in_data, COLOR_ENABLED_PARAM(colorNum), in_data->current_time,
-                              in_data->time_step, in_data->time_scale, &enabledParam));
-        ERR(PF_CHECKOUT_PARAM(in_data, COLOR_PARAM(colorNum), in_data->current_time,
-                              in_data->time_step, in_data->time_scale, &colorParam));
-        ERR(PF_CHECKOUT_PARAM(in_data, COLOR_TOLERANCE_PARAM(colorNum), in_data->current_time,
-                              in_data->time_step, in_data->time_scale, &toleranceParam));
-
-        if (!err) {
-            info->colors[i].enabled = enabledParam.u.bd.value;
-            info->colors[i].color = colorParam.u.cd.value;
-            info->colors[i].tolerance = toleranceParam.u.fs_d.value;
-
-            // Precompute squared tolerance using common helper
-            info->colors[i].toleranceSq = CX_ToleranceToDistSq(info->colors[i].tolerance);
-        }
-
-        PF_CHECKIN_PARAM(in_data, &enabledParam);
-        PF_CHECKIN_PARAM(in_data, &colorParam);
-        PF_CHECKIN_PARAM(in_data, &toleranceParam);
+    // Color, texture and output parameters, mostly from the plan of this setup
+    PencilLineGlobalData* global = nullptr;
+    if (in_data->global_data) {
+        global = reinterpret_cast<PencilLineGlobalData*>(
+            handleSuite->host_lock_handle(in_data->global_data));
     }
-
-    // Checkout texture and output parameters
-    PF_ParamDef lineWidthParam, lineDensityParam, textureStrengthParam, outputModeParam;
-    AEFX_CLR_STRUCT(lineWidthParam);
-    AEFX_CLR_STRUCT(lineDensityParam);
-    AEFX_CLR_STRUCT(textureStrengthParam);
-    AEFX_CLR_STRUCT(outputModeParam);
-
-    ERR(PF_CHECKOUT_PARAM(in_data, PENCILLINE_LINE_WIDTH, in_data->current_time,
-                          in_data->time_step, in_data->time_scale, &lineWidthParam));
-    ERR(PF_CHECKOUT_PARAM(in_data, PENCILLINE_LINE_DENSITY, in_data->current_time,
-                          in_data->time_step, in_data->time_scale, &lineDensityParam));
-    ERR(PF_CHECKOUT_PARAM(in_data, PENCILLINE_TEXTURE_STRENGTH, in_data->current_time,
-                          in_data->time_step, in_data->time_scale, &textureStrengthParam));
-    ERR(PF_CHECKOUT_PARAM(in_data, PENCILLINE_OUTPUT_MODE, in_data->current_time,
-                          in_data->time_step, in_data->time_scale, &outputModeParam));
-
-    if (!err) {
-        info->lineWidth = lineWidthParam.u.sd.value;
-        info->lineDensity = lineDensityParam.u.fs_d.value;
-        info->textureStrength = textureStrengthParam.u.fs_d.value;
-        info->outputMode = outputModeParam.u.pd.value;
+    ERR(ReadPencilParams(in_data, out_data, global ? global->planCache : nullptr, info));
+    if (global) {
+        handleSuite->host_unlock_handle(in_data->global_data);
     }
 
-    PF_CHECKIN_PARAM(in_data, &lineWidthParam);
-    PF_CHECKIN_PARAM(in_data, &lineDensityParam);
-    PF_CHECKIN_PARAM(in_data, &textureStrengthParam);
-    PF_CHECKIN_PARAM(in_data, &outputModeParam);
+    // Previews at reduced resolution sample a coarser grain level
+    info->grainLevel = CX_GrainLevelForDownsample(in_data->downsample_x, in_data->downsample_y);
 
     // Request input checkout
     req.preserve_rgb_of_zero_alpha = TRUE;
@@ -543,6 +1394,39 @@ PF_Err PreRender(
     return err;
 }
 
+// Frame key (see CX_InputKey)
+static CXCacheKey ComputeFrameKey(
+    const PencilLineInfo*   info,
+    const CXCacheKey&       inputKey,
+    const PF_EffectWorld*   output_worldP)
+{
+    CXHasher hasher;
+
+    hasher.Add(info->matchSpace);
+    for (A_long i = 0; i < info->colorCount; ++i) {
+        const ColorEntry& entry = info->colors[i];
+        hasher.Add(entry.enabled);
+        if (!entry.enabled) continue;
+        hasher.Add(entry.color.red);
+        hasher.Add(entry.color.green);
+        hasher.Add(entry.color.blue);
+        hasher.Add(entry.toleranceSq);
+    }
+    hasher.Add(info->lineWidth);
+    hasher.Add(info->textureStrength);
+    hasher.Add(info->grainLevel);
+    hasher.Add(info->outputMode);
+
+    hasher.Add(output_worldP->width);
+    hasher.Add(output_worldP->height);
+    hasher.Add(output_worldP->origin_x);     // Grain is anchored in layer space
+    hasher.Add(output_worldP->origin_y);
+
+    hasher.Add(inputKey.lo);
+    hasher.Add(inputKey.hi);
+    return hasher.Finish();
+}
+
 PF_Err SmartRender(
     PF_InData*              in_data,
     PF_OutData*             out_data,
@@ -576,57 +1460,55 @@ PF_Err SmartRender(
                 in_data, kPFWorldSuite, kPFWorldSuiteVersion2, out_data);
             ERR(wsP->PF_GetPixelFormat(input_worldP, &format));
 
-            if (!err) {
+            // AE formats only: the frame cache, then the mask cache
+            PencilLineGlobalData* global = nullptr;
+            if (in_data->global_data) {
+                global = reinterpret_cast<PencilLineGlobalData*>(
+                    handleSuite->host_lock_handle(in_data->global_data));
+            }
+            const bool cacheable = global && CX_BytesPerPixel(format) > 0;
+            CXFrameCache* frameCache = cacheable ? global->frameCache : nullptr;
+            CXMaskCache* maskCache = cacheable ? global->maskCache : nullptr;
+            info->grain = global ? global->grainAtlas : nullptr;
+            info->grainOriginX = output_worldP->origin_x;
+            info->grainOriginY = output_worldP->origin_y;
+
+            CXCacheKey inputKey = { 0, 0 };
+            CXCacheKey frameKey = { 0, 0 };
+            CXFrameCache::ValuePtr cached;
+            bool reserved = false;
+            if (!err && frameCache) {
+                inputKey = CX_InputKey(input_worldP, format);
+                frameKey = ComputeFrameKey(info, inputKey, output_worldP);
+                cached = frameCache->FindOrReserve(frameKey, &reserved);
+            }
+            CXCacheReservation<CXFrameResult> reservation(frameCache, frameKey, reserved);
+            bool restored = !err && cached && CX_RestoreFrameResult(*cached, output_worldP);
+
+            if (!err && !restored) {
                 switch (format) {
                     case PF_PixelFormat_ARGB128:
-                        {
-                            AEFX_SuiteScoper<PF_iterateFloatSuite2> iterSuite = AEFX_SuiteScoper<PF_iterateFloatSuite2>(
-                                in_data, kPFIterateFloatSuite, kPFIterateFloatSuiteVersion2, out_data);
-                            ERR(iterSuite->iterate(
-                                in_data,
-                                0,
-                                output_worldP->height,
-                                input_worldP,
-                                nullptr,
-                                info,
-                                ProcessPencilLineFloat,
-                                output_worldP));
-                        }
+                        ERR(ProcessPencilLine<PF_PixelFloat>(in_data, out_data, info, input_worldP, output_worldP, maskCache, inputKey));
                         break;
 
                     case PF_PixelFormat_ARGB64:
-                        {
-                            AEFX_SuiteScoper<PF_iterate16Suite2> iterSuite = AEFX_SuiteScoper<PF_iterate16Suite2>(
-                                in_data, kPFIterate16Suite, kPFIterate16SuiteVersion2, out_data);
-                            ERR(iterSuite->iterate(
-                                in_data,
-                                0,
-                                output_worldP->height,
-                                input_worldP,
-                                nullptr,
-                                info,
-                                ProcessPencilLine16,
-                                output_worldP));
-                        }
+                        ERR(ProcessPencilLine<PF_Pixel16>(in_data, out_data, info, input_worldP, output_worldP, maskCache, inputKey));
                         break;
 
                     case PF_PixelFormat_ARGB32:
                     default:
-                        {
-                            AEFX_SuiteScoper<PF_Iterate8Suite2> iterSuite = AEFX_SuiteScoper<PF_Iterate8Suite2>(
-                                in_data, kPFIterate8Suite, kPFIterate8SuiteVersion2, out_data);
-                            ERR(iterSuite->iterate(
-                                in_data,
-                                0,
-                                output_worldP->height,
-                                input_worldP,
-                                nullptr,
-                                info,
-                                ProcessPencilLine8,
-                                output_worldP));
-                        }
+                        ERR(ProcessPencilLine<PF_Pixel8>(in_data, out_data, info, input_worldP, output_worldP, maskCache, inputKey));
                         break;
                 }
+
+                if (!err && reserved) {
+                    std::shared_ptr<CXFrameResult> result = CX_CaptureFrameResult(output_worldP, format);
+                    reservation.Fulfill(result, result->pixels.size());
+                }
+            }
+
+            if (global) {
+                handleSuite->host_unlock_handle(in_data->global_data);
             }
         }
     }
@@ -640,6 +1522,84 @@ PF_Err SmartRender(
     return err;
 }
 
+// Premiere renders through PF_Cmd_RENDER with the params already checked out.
+// The frame and mask caches key on AE pixel formats, so this path runs uncached.
+PF_Err Render(
+    PF_InData*      in_data,
+    PF_OutData*     out_data,
+    PF_ParamDef*    params[],
+    PF_LayerDef*    output)
+{
+    PF_Err err = PF_Err_NONE;
+
+    PencilLineInfo info;
+    memset(&info, 0, sizeof(PencilLineInfo));
+    info.colorCount = MAX_COLORS;
+    for (A_long index = 0; index < PENCILLINE_NUM_PARAMS; ++index) {
+        if (IsValueParam(index)) {
+            StoreParam(&info, index, *params[index]);
+        }
+    }
+    info.grainLevel = CX_GrainLevelForDownsample(in_data->downsample_x, in_data->downsample_y);
+    info.grainOriginX = in_data->output_origin_x;
+    info.grainOriginY = in_data->output_origin_y;
+
+    // The atlas outlives every render, so its pointer stays valid unlocked
+    if (in_data->global_data) {
+        AEFX_SuiteScoper<PF_HandleSuite1> handleSuite = AEFX_SuiteScoper<PF_HandleSuite1>(
+            in_data, kPFHandleSuite, kPFHandleSuiteVersion1, out_data);
+        PencilLineGlobalData* global = reinterpret_cast<PencilLineGlobalData*>(
+            handleSuite->host_lock_handle(in_data->global_data));
+        if (global) {
+            info.grain = global->grainAtlas;
+            handleSuite->host_unlock_handle(in_data->global_data);
+        }
+    }
+
+    PF_EffectWorld* input_worldP = &params[PENCILLINE_INPUT]->u.ld;
+    const CXCacheKey inputKey = { 0, 0 };
+
+    PrPixelFormat premiereFormat = PrPixelFormat_Invalid;
+    ERR(CX_GetPremierePixelFormat(in_data, out_data, output, &premiereFormat));
+    if (err) return err;
+
+    switch (premiereFormat) {
+        case PrPixelFormat_BGRA_4444_32f:
+            ERR(ProcessPencilLine<PF_Pixel_BGRA_32f>(in_data, out_data, &info, input_worldP, output, nullptr, inputKey));
+            break;
+
+        case PrPixelFormat_BGRA_4444_8u:
+            ERR(ProcessPencilLine<PF_Pixel_BGRA_8u>(in_data, out_data, &info, input_worldP, output, nullptr, inputKey));
+            break;
+
+        default: {
+            PF_PixelFormat format = PF_PixelFormat_INVALID;
+            AEFX_SuiteScoper<PF_WorldSuite2> wsP = AEFX_SuiteScoper<PF_WorldSuite2>(
+                in_data, kPFWorldSuite, kPFWorldSuiteVersion2, out_data);
+            ERR(wsP->PF_GetPixelFormat(output, &format));
+            if (err) break;
+
+            switch (format) {
+                case PF_PixelFormat_ARGB128:
+                    ERR(ProcessPencilLine<PF_PixelFloat>(in_data, out_data, &info, input_worldP, output, nullptr, inputKey));
+                    break;
+
+                case PF_PixelFormat_ARGB64:
+                    ERR(ProcessPencilLine<PF_Pixel16>(in_data, out_data, &info, input_worldP, output, nullptr, inputKey));
+                    break;
+
+                case PF_PixelFormat_ARGB32:
+                default:
+                    ERR(ProcessPencilLine<PF_Pixel8>(in_data, out_data, &info, input_worldP, output, nullptr, inputKey));
+                    break;
+            }
+            break;
+        }
+    }
+
+    return err;
+}
+
 // ============================================================================
 // Main entry point
 // ============================================================================
@@ -671,6 +1631,10 @@ extern "C" DllExport PF_Err EffectMain(
             err = GlobalSetup(in_data, out_data);
             break;
 
+        case PF_Cmd_GLOBAL_SETDOWN:
+            err = GlobalSetdown(in_data, out_data);
+            break;
+
         case PF_Cmd_PARAMS_SETUP:
             err = ParamsSetup(in_data, out_data);
             break;
@@ -679,6 +1643,10 @@ extern "C" DllExport PF_Err EffectMain(
             err = UpdateParameterUI(in_data, out_data, params);
             break;
 
+        case PF_Cmd_RENDER:
+            err = Render(in_data, out_data, params, output);
+            break;
+
         case PF_Cmd_SMART_PRE_RENDER:
             err = PreRender(in_data, out_data, static_cast<PF_PreRenderExtra*>(extra));
             break;
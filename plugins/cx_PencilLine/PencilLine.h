@@ -22,6 +22,11 @@
 #include "Smart_Utils.h"
 
 #include "CXCommon.h"
+#include "CXFrameCache.h"
+#include "CXGrainAtlas.h"
+#include "CXMaskCache.h"
+#include "CXOKLab.h"
+#include "CXPalette.h"
 
 #ifdef AE_OS_WIN
     #include <Windows.h>
@@ -57,6 +62,7 @@ enum {
 
     // Color Selection Group
     PENCILLINE_COLOR_GROUP,
+    PENCILLINE_MATCH_SPACE,
 
     // Color 1-16 (each has: Enabled, Color, Tolerance)
     PENCILLINE_COLOR1_ENABLED,
@@ -125,7 +131,7 @@ enum {
 
     PENCILLINE_COLOR_GROUP_END,
 
-    // Pencil Texture Group (placeholder for future parameters)
+    // Pencil Texture Group
     PENCILLINE_TEXTURE_GROUP,
     PENCILLINE_LINE_WIDTH,
     PENCILLINE_LINE_DENSITY,
@@ -143,6 +149,7 @@ enum {
 // Disk IDs (persistent, never reuse)
 enum {
     DISK_ID_COLOR_GROUP = 1,
+    DISK_ID_MATCH_SPACE,
 
     // Color 1-16 disk IDs (each color uses 3 consecutive IDs)
     DISK_ID_COLOR1_ENABLED = 10,
@@ -212,10 +219,12 @@ enum {
     DISK_ID_COLOR_GROUP_END = 200,
 
     DISK_ID_TEXTURE_GROUP = 210,
-    DISK_ID_LINE_WIDTH,
+    DISK_ID_LINE_WIDTH_PLACEHOLDER,         // Retired: the unused slider saved any width here
     DISK_ID_LINE_DENSITY,
-    DISK_ID_TEXTURE_STRENGTH,
+    DISK_ID_TEXTURE_STRENGTH_PLACEHOLDER,   // Retired: the unused slider saved 50 here
     DISK_ID_TEXTURE_GROUP_END,
+    DISK_ID_TEXTURE_STRENGTH,
+    DISK_ID_LINE_WIDTH,
 
     DISK_ID_OUTPUT_GROUP = 220,
     DISK_ID_OUTPUT_MODE,
@@ -231,7 +240,7 @@ enum {
 constexpr PF_FpLong DEFAULT_TOLERANCE = 0.0;
 constexpr A_long DEFAULT_LINE_WIDTH = 2;
 constexpr PF_FpLong DEFAULT_LINE_DENSITY = 50.0;
-constexpr PF_FpLong DEFAULT_TEXTURE_STRENGTH = 50.0;
+constexpr PF_FpLong DEFAULT_TEXTURE_STRENGTH = 0.0;
 
 // Parameter ranges
 constexpr PF_FpLong TOLERANCE_MIN = 0.0;
@@ -249,6 +258,7 @@ struct ColorEntry {
     PF_Pixel color;
     PF_FpLong tolerance;
     A_long toleranceSq;     // Precomputed squared tolerance
+    CXLab lab;              // Color in OKLab, for perceptual matching
 };
 
 // Processing info structure passed between PreRender and SmartRender
@@ -256,16 +266,37 @@ struct PencilLineInfo {
     // Color selection parameters
     A_long colorCount;              // Active color count (always 16)
     ColorEntry colors[MAX_COLORS];  // All color entries
+    A_long matchSpace;              // CX_MATCH_SPACE_RGB or CX_MATCH_SPACE_OKLAB
 
     // Pencil texture parameters
-    A_long lineWidth;
+    A_long lineWidth;               // DEFAULT_LINE_WIDTH keeps lines as drawn
     PF_FpLong lineDensity;
     PF_FpLong textureStrength;
+    const CXGrainAtlas* grain;      // Shared grain textures, NULL if unavailable
+    A_long grainLevel;              // Mip level matching the render's downsample
+    A_long grainOriginX;            // Layer position of output pixel (0, 0),
+    A_long grainOriginY;            // so the grain stays put across tiles
 
     // Output mode
     A_long outputMode;
 };
 
+// Parameter values compiled for one parameter state, see PencilLine.cpp
+struct PencilParamPlan;
+typedef CXLRUCache<PencilParamPlan> PencilParamPlanCache;
+
+// Global data shared by all instances and render threads
+struct PencilLineGlobalData {
+    // Results of previously rendered frames, keyed by input content and params
+    CXFrameCache* frameCache;
+    // PreRender parameter snapshots, keyed by the state of all params over time
+    PencilParamPlanCache* planCache;
+    // Match masks and stroke fields, keyed by input content and colour set
+    CXMaskCache* maskCache;
+    // Paper and graphite grain, acquired from the process-wide atlas
+    CXGrainAtlas* grainAtlas;
+};
+
 // Function declarations
 extern "C" {
     DllExport PF_Err EffectMain(
@@ -282,6 +313,10 @@ PF_Err GlobalSetup(
     PF_InData*      in_data,
     PF_OutData*     out_data);
 
+PF_Err GlobalSetdown(
+    PF_InData*      in_data,
+    PF_OutData*     out_data);
+
 PF_Err ParamsSetup(
     PF_InData*      in_data,
     PF_OutData*     out_data);
@@ -300,3 +335,9 @@ PF_Err SmartRender(
     PF_InData*              in_data,
     PF_OutData*             out_data,
     PF_SmartRenderExtra*    extra);
+
+PF_Err Render(
+    PF_InData*      in_data,
+    PF_OutData*     out_data,
+    PF_ParamDef*    params[],
+    PF_LayerDef*    output);
@@ -15,11 +15,33 @@
 #include "AE_Effect.h"
 #include "AE_EffectCB.h"
 #include "AE_Macros.h"
+#include "AEFX_SuiteHelper.h"
+#include "PrSDKAESupport.h"
+
+#include "CXPalette.h"
 
 #ifdef AE_OS_WIN
 	#include <Windows.h>
 #endif
 
+#if defined(_M_X64) || defined(__SSE2__)
+	#include <emmintrin.h>
+	#define CX_SSE2 1
+#else
+	#define CX_SSE2 0
+#endif
+
+// F16C half float conversion (GCC/Clang -mf16c, MSVC /arch:AVX2)
+#if CX_SSE2 && (defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__)))
+	#include <immintrin.h>
+	#define CX_F16C 1
+#else
+	#define CX_F16C 0
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
 // ============================================================================
 // Version Info
 // ============================================================================
@@ -75,6 +97,51 @@ static inline void CX_UnionLRect(const PF_LRect *src, PF_LRect *dst) {
 	if (src->bottom > dst->bottom) dst->bottom = src->bottom;
 }
 
+// ============================================================================
+// Premiere Pro Pixel Formats
+// ============================================================================
+//
+// Premiere's native 8-bit and 32-bit formats are BGRA_4444_8u and
+// BGRA_4444_32f: the channel ranges of PF_Pixel8 and PF_PixelFloat in reversed
+// order. An effect that registers them receives Premiere's frames as they are,
+// without a conversion to ARGB and back around it. Premiere renders through
+// PF_Cmd_RENDER, not SmartFX.
+
+typedef struct {
+    A_u_char    blue, green, red, alpha;
+} PF_Pixel_BGRA_8u;
+
+typedef struct {
+    PF_FpShort  blue, green, red, alpha;
+} PF_Pixel_BGRA_32f;
+
+static inline PF_Boolean CX_IsPremiere(const PF_InData *in_data) {
+    return in_data->appl_id == 'PrMr';
+}
+
+// GlobalSetup: replace Premiere's default ARGB formats with its native BGRA ones
+static inline PF_Err CX_AddPremierePixelFormats(PF_InData *in_data, PF_OutData *out_data) {
+    if (!CX_IsPremiere(in_data)) return PF_Err_NONE;
+
+    AEFX_SuiteScoper<PF_PixelFormatSuite1> pixelFormatSuite =
+        AEFX_SuiteScoper<PF_PixelFormatSuite1>(in_data, kPFPixelFormatSuite, kPFPixelFormatSuiteVersion1, out_data);
+    PF_Err err = pixelFormatSuite->ClearSupportedPixelFormats(in_data->effect_ref);
+    if (!err) err = pixelFormatSuite->AddSupportedPixelFormat(in_data->effect_ref, PrPixelFormat_BGRA_4444_32f);
+    if (!err) err = pixelFormatSuite->AddSupportedPixelFormat(in_data->effect_ref, PrPixelFormat_BGRA_4444_8u);
+    return err;
+}
+
+// PF_Cmd_RENDER in Premiere: format of a world, PrPixelFormat_Invalid elsewhere
+static inline PF_Err CX_GetPremierePixelFormat(PF_InData *in_data, PF_OutData *out_data,
+                                               PF_EffectWorld *world, PrPixelFormat *format) {
+    *format = PrPixelFormat_Invalid;
+    if (!CX_IsPremiere(in_data)) return PF_Err_NONE;
+
+    AEFX_SuiteScoper<PF_PixelFormatSuite1> pixelFormatSuite =
+        AEFX_SuiteScoper<PF_PixelFormatSuite1>(in_data, kPFPixelFormatSuite, kPFPixelFormatSuiteVersion1, out_data);
+    return pixelFormatSuite->GetPixelFormat(world, format);
+}
+
 // ============================================================================
 // Color Matching Functions (all operate in 8-bit space for AE color picker compatibility)
 // ============================================================================
@@ -83,8 +150,20 @@ static inline void CX_UnionLRect(const PF_LRect *src, PF_LRect *dst) {
 // sqrt(255^2 * 3) ≈ 441.67, so tolerance 100 = full range
 constexpr PF_FpLong CX_TOLERANCE_SCALE = 4.4167;
 
-// 8-bit color matching
-static inline PF_Boolean CX_IsTargetColor8(const PF_Pixel8* pixel,
+// Channel conversions into the 8-bit matching space.
+// Precise conversion: 16-bit (0-32768) to 8-bit (0-255)
+static inline A_long CX_Channel16To8(A_u_short v) {
+    return static_cast<A_long>(static_cast<double>(v) / PF_MAX_CHAN16 * PF_MAX_CHAN8 + 0.5);
+}
+
+// Float (0.0-1.0) to 8-bit (0-255) with clamping
+static inline A_long CX_ChannelFloatTo8(PF_FpShort v) {
+    return static_cast<A_long>(CX_CLAMP(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+// 8-bit color matching (PF_Pixel8 or PF_Pixel_BGRA_8u)
+template <typename Pixel>
+static inline PF_Boolean CX_IsTargetColor8(const Pixel* pixel,
                                             A_long targetR, A_long targetG, A_long targetB,
                                             A_long toleranceSq) {
     A_long dr = static_cast<A_long>(pixel->red) - targetR;
@@ -98,10 +177,9 @@ static inline PF_Boolean CX_IsTargetColor8(const PF_Pixel8* pixel,
 static inline PF_Boolean CX_IsTargetColor16(const PF_Pixel16* pixel,
                                              A_long targetR8, A_long targetG8, A_long targetB8,
                                              A_long toleranceSq8) {
-    // Precise conversion: 16-bit (0-32768) to 8-bit (0-255)
-    A_long r8 = static_cast<A_long>(static_cast<double>(pixel->red) / PF_MAX_CHAN16 * PF_MAX_CHAN8 + 0.5);
-    A_long g8 = static_cast<A_long>(static_cast<double>(pixel->green) / PF_MAX_CHAN16 * PF_MAX_CHAN8 + 0.5);
-    A_long b8 = static_cast<A_long>(static_cast<double>(pixel->blue) / PF_MAX_CHAN16 * PF_MAX_CHAN8 + 0.5);
+    A_long r8 = CX_Channel16To8(pixel->red);
+    A_long g8 = CX_Channel16To8(pixel->green);
+    A_long b8 = CX_Channel16To8(pixel->blue);
     A_long dr = r8 - targetR8;
     A_long dg = g8 - targetG8;
     A_long db = b8 - targetB8;
@@ -109,14 +187,15 @@ static inline PF_Boolean CX_IsTargetColor16(const PF_Pixel16* pixel,
     return (distSq <= toleranceSq8);
 }
 
-// 32-bit float color matching (converts to 8-bit space for comparison)
-static inline PF_Boolean CX_IsTargetColorFloat(const PF_PixelFloat* pixel,
+// 32-bit float color matching (converts to 8-bit space for comparison),
+// PF_PixelFloat or PF_Pixel_BGRA_32f
+template <typename Pixel>
+static inline PF_Boolean CX_IsTargetColorFloat(const Pixel* pixel,
                                                 A_long targetR8, A_long targetG8, A_long targetB8,
                                                 A_long toleranceSq8) {
-    // Float (0.0-1.0) to 8-bit (0-255) with clamping
-    A_long r8 = static_cast<A_long>(CX_CLAMP(pixel->red, 0.0f, 1.0f) * 255.0f + 0.5f);
-    A_long g8 = static_cast<A_long>(CX_CLAMP(pixel->green, 0.0f, 1.0f) * 255.0f + 0.5f);
-    A_long b8 = static_cast<A_long>(CX_CLAMP(pixel->blue, 0.0f, 1.0f) * 255.0f + 0.5f);
+    A_long r8 = CX_ChannelFloatTo8(pixel->red);
+    A_long g8 = CX_ChannelFloatTo8(pixel->green);
+    A_long b8 = CX_ChannelFloatTo8(pixel->blue);
     A_long dr = r8 - targetR8;
     A_long dg = g8 - targetG8;
     A_long db = b8 - targetB8;
@@ -130,6 +209,109 @@ static inline A_long CX_ToleranceToDistSq(PF_FpLong tolerance) {
     return maxDist * maxDist;
 }
 
+// True if any pixel of the row matches the target (8-bit), stopping at the first hit.
+// Used to detect frames without line pixels before doing any per-pixel work.
+// Pixel is PF_Pixel8 or PF_Pixel_BGRA_8u.
+template <typename Pixel>
+static inline PF_Boolean CX_RowHasTargetColor8(const Pixel* row, A_long count,
+                                                A_long targetR, A_long targetG, A_long targetB,
+                                                A_long toleranceSq) {
+    A_long x = 0;
+#if CX_SSE2
+    // Four pixels per step: 16-bit channel differences (alpha masked out),
+    // squared and summed with madd, then the two partial sums per pixel added.
+    // Lanes follow the memory order: A R G B, or B G R A for Premiere.
+    const bool bgra = offsetof(Pixel, alpha) != 0;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgbMask = bgra ? _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1)
+                                 : _mm_set_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+    const __m128i target = bgra ? _mm_set_epi16(0, (short)targetR, (short)targetG, (short)targetB,
+                                                0, (short)targetR, (short)targetG, (short)targetB)
+                                : _mm_set_epi16((short)targetB, (short)targetG, (short)targetR, 0,
+                                                (short)targetB, (short)targetG, (short)targetR, 0);
+    const __m128i limit = _mm_set1_epi32(toleranceSq + 1);
+    for (; x + 4 <= count; x += 4) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        __m128i d01 = _mm_sub_epi16(_mm_and_si128(_mm_unpacklo_epi8(px, zero), rgbMask), target);
+        __m128i d23 = _mm_sub_epi16(_mm_and_si128(_mm_unpackhi_epi8(px, zero), rgbMask), target);
+        __m128i s01 = _mm_madd_epi16(d01, d01);
+        __m128i s23 = _mm_madd_epi16(d23, d23);
+        s01 = _mm_add_epi32(s01, _mm_shuffle_epi32(s01, _MM_SHUFFLE(2, 3, 0, 1)));
+        s23 = _mm_add_epi32(s23, _mm_shuffle_epi32(s23, _MM_SHUFFLE(2, 3, 0, 1)));
+        // Lanes 0 and 2 hold the per-pixel squared distances
+        int hits = _mm_movemask_epi8(_mm_cmpgt_epi32(limit, s01)) | _mm_movemask_epi8(_mm_cmpgt_epi32(limit, s23));
+        if (hits & 0x0F0F) return TRUE;
+    }
+#endif
+    for (; x < count; ++x) {
+        if (CX_IsTargetColor8(row + x, targetR, targetG, targetB, toleranceSq)) return TRUE;
+    }
+    return FALSE;
+}
+
+// One target of the 8-bit row prescan, as CX_RowHasTargetColor8 takes it
+struct CXTargetColor8 {
+    A_long red, green, blue;
+    A_long toleranceSq;
+};
+
+// Row prescan with the per-pixel test isTarget(const Pixel*), memoized per
+// colour until the palette fills up
+template <typename Pixel, typename IsTarget>
+static inline PF_Boolean CX_RowHasTargetCached(const Pixel* row, A_long count,
+                                                CXPalette<Pixel, bool>* palette, IsTarget isTarget) {
+    bool usePalette = true;
+    for (A_long x = 0; x < count; ++x) {
+        bool isNew = false;
+        bool* cached = usePalette ? palette->Lookup(row[x], &isNew) : NULL;
+        if (cached && !isNew) {
+            if (*cached) return TRUE;
+            continue;
+        }
+        if (isTarget(row + x)) return TRUE;
+        if (cached) {
+            *cached = false;
+        } else {
+            usePalette = false;
+        }
+    }
+    return FALSE;
+}
+
+// True if any pixel of the row is a target, stopping at the first hit; the
+// prescan that lets a plugin skip frames without line pixels. 8-bit rows
+// test the plain RGB targets8 directly with SSE2, one target at a time.
+// Pass NULL targets8 when isTarget does more than RGB distances (OKLab
+// converts each colour), so every depth goes through the palette.
+template <typename Pixel, typename IsTarget>
+static inline PF_Boolean CX_RowHasTarget(const Pixel* row, A_long count, CXPalette<Pixel, bool>* palette,
+                                          IsTarget isTarget, const CXTargetColor8* targets8, A_long targetCount8) {
+    return CX_RowHasTargetCached(row, count, palette, isTarget);
+}
+
+template <typename Pixel8, typename IsTarget>
+static inline PF_Boolean CX_RowHasTarget8(const Pixel8* row, A_long count, CXPalette<Pixel8, bool>* palette,
+                                           IsTarget isTarget, const CXTargetColor8* targets8, A_long targetCount8) {
+    if (!targets8) return CX_RowHasTargetCached(row, count, palette, isTarget);
+    for (A_long i = 0; i < targetCount8; ++i) {
+        const CXTargetColor8& t = targets8[i];
+        if (CX_RowHasTargetColor8(row, count, t.red, t.green, t.blue, t.toleranceSq)) return TRUE;
+    }
+    return FALSE;
+}
+
+template <typename IsTarget>
+static inline PF_Boolean CX_RowHasTarget(const PF_Pixel8* row, A_long count, CXPalette<PF_Pixel8, bool>* palette,
+                                          IsTarget isTarget, const CXTargetColor8* targets8, A_long targetCount8) {
+    return CX_RowHasTarget8(row, count, palette, isTarget, targets8, targetCount8);
+}
+
+template <typename IsTarget>
+static inline PF_Boolean CX_RowHasTarget(const PF_Pixel_BGRA_8u* row, A_long count, CXPalette<PF_Pixel_BGRA_8u, bool>* palette,
+                                          IsTarget isTarget, const CXTargetColor8* targets8, A_long targetCount8) {
+    return CX_RowHasTarget8(row, count, palette, isTarget, targets8, targetCount8);
+}
+
 // ============================================================================
 // RGB <-> HSL Conversion
 // ============================================================================
@@ -181,4 +363,97 @@ static inline void CX_HSLtoRGB(PF_FpLong h, PF_FpLong s, PF_FpLong l,
 	}
 }
 
+// ============================================================================
+// Half Float Conversion
+// ============================================================================
+//
+// IEEE binary16: 11 significant bits (relative rounding error <= 2^-11, about
+// 0.05%), normal range 6.1e-5 .. 65504. Values are clamped to +-65504 before
+// rounding to nearest even, so HDR highlights saturate instead of becoming
+// infinite. The scalar and F16C paths produce identical bits for non-NaN input.
+
+#define CX_HALF_MAX 65504.0f
+
+static inline A_u_short CX_FloatToHalf(float f) {
+    if (f > CX_HALF_MAX) f = CX_HALF_MAX;
+    else if (f < -CX_HALF_MAX) f = -CX_HALF_MAX;
+
+    A_u_long x;
+    memcpy(&x, &f, sizeof(x));
+    A_u_long sign = (x >> 16) & 0x8000;
+    x &= 0x7FFFFFFF;
+
+    if (x > 0x7F800000) return (A_u_short)(sign | 0x7E00);   // NaN
+    if (x < 0x38800000) {
+        // Subnormal half: round |f| / 2^-24 to an integer
+        if (x < 0x33000000) return (A_u_short)sign;
+        A_u_long shift = 126 - (x >> 23);
+        A_u_long m = (x & 0x7FFFFF) | 0x800000;
+        A_u_long h = m >> shift;
+        A_u_long rem = m & ((1u << shift) - 1);
+        A_u_long halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) h++;
+        return (A_u_short)(sign | h);
+    }
+
+    // Normal: rebias the exponent, round the 13 dropped mantissa bits
+    A_u_long h = (x >> 13) - (112 << 10);
+    A_u_long rem = x & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return (A_u_short)(sign | h);
+}
+
+static inline float CX_HalfToFloat(A_u_short h) {
+    A_u_long sign = (A_u_long)(h & 0x8000) << 16;
+    A_u_long e = (h >> 10) & 0x1F;
+    A_u_long m = h & 0x3FF;
+    A_u_long x;
+
+    if (e == 0) {
+        if (m == 0) {
+            x = sign;
+        } else {
+            // Subnormal half: normalize into a float exponent
+            e = 113;
+            while (!(m & 0x400)) {
+                m <<= 1;
+                e--;
+            }
+            x = sign | (e << 23) | ((m & 0x3FF) << 13);
+        }
+    } else if (e == 31) {
+        x = sign | 0x7F800000 | (m << 13);
+    } else {
+        x = sign | ((e + 112) << 23) | (m << 13);
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// Row conversions, four values per F16C instruction
+static inline void CX_FloatToHalfRow(const float *src, A_u_short *dst, A_long count) {
+    A_long i = 0;
+#if CX_F16C
+    const __m128 hi = _mm_set1_ps(CX_HALF_MAX);
+    const __m128 lo = _mm_set1_ps(-CX_HALF_MAX);
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i), hi), lo);
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < count; ++i) dst[i] = CX_FloatToHalf(src[i]);
+}
+
+static inline void CX_HalfToFloatRow(const A_u_short *src, float *dst, A_long count) {
+    A_long i = 0;
+#if CX_F16C
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(src + i))));
+    }
+#endif
+    for (; i < count; ++i) dst[i] = CX_HalfToFloat(src[i]);
+}
+
 #endif // CX_COMMON_H
@@ -0,0 +1,313 @@
+/*
+	CXComponents.h
+
+	Connected components of a line mask, labelled in parallel.
+
+	Line pixels are 8-connected, so diagonal strokes stay in one piece. The
+	frame is cut into horizontal bands and labelled in three passes:
+
+	1. LabelBand (parallel): a raster scan with union-find over the band's
+	   own rows gives every line pixel a provisional label local to the band.
+	2. Merge (serial): the first row of each band is joined to the last row
+	   of the band above, and the components are numbered 1..count in raster
+	   order of their first pixel, whatever the band count.
+	3. ResolveBand (parallel): the label plane gets the final numbers and
+	   each band gathers the stats of its pixels; Finish sums them up.
+
+	The serial merge reads bands - 1 rows, so a frame costs two parallel
+	scans however many specks it holds. The band callbacks below match
+	iterate_generic with the labeller as refcon.
+*/
+
+#pragma once
+#ifndef CX_COMPONENTS_H
+#define CX_COMPONENTS_H
+
+#include "CXCommon.h"
+
+#include <algorithm>
+#include <vector>
+
+// One component: bounding box [left, right) x [top, bottom), pixel count and
+// mean colour. The colour is 0 unless ResolveBand was given one.
+typedef struct {
+	A_long		left, top, right, bottom;
+	A_u_long	pixels;
+	float		red, green, blue;
+} CXComponentStats;
+
+class CXComponentLabeler {
+public:
+	// mask is width x height, nonzero at line pixels; labels receives one
+	// label per pixel, 0 off the lines. Passes 1 and 3 run `bands` tasks.
+	CXComponentLabeler(const A_u_char *mask, A_long width, A_long height, A_long bands, A_u_long *labels)
+		: m_mask(mask), m_labels(labels), m_width(width), m_count(0) {
+		if (bands > height) bands = height;
+		m_bands.resize(bands > 0 ? bands : 0);
+		for (A_long b = 0; b < BandCount(); b++) {
+			m_bands[b].y0 = static_cast<A_long>(static_cast<int64_t>(height) * b / bands);
+			m_bands[b].y1 = static_cast<A_long>(static_cast<int64_t>(height) * (b + 1) / bands);
+		}
+	}
+
+	A_long BandCount() const {
+		return static_cast<A_long>(m_bands.size());
+	}
+
+	// Number of components, after Merge()
+	A_u_long Count() const {
+		return m_count;
+	}
+
+	// Pass 1: provisional labels within one band
+	void LabelBand(A_long band) {
+		Band &b = m_bands[band];
+		std::vector<A_u_long> &parent = b.parent;
+		parent.assign(1, 0);
+
+		for (A_long y = b.y0; y < b.y1; y++) {
+			const A_u_char *m = m_mask + static_cast<size_t>(y) * m_width;
+			const A_u_char *mUp = (y > b.y0) ? m - m_width : NULL;
+			A_u_long *l = m_labels + static_cast<size_t>(y) * m_width;
+			const A_u_long *lUp = l - m_width;
+
+			for (A_long x = 0; x < m_width; x++) {
+				if (!m[x]) {
+					l[x] = 0;
+					continue;
+				}
+				// Decision tree over the scanned neighbours: N touches all of
+				// NW, NE and W; without N, only NE and NW or NE and W may
+				// belong to different sets
+				A_u_long label = 0;
+				if (mUp) {
+					bool nw = x > 0 && mUp[x - 1];
+					bool ne = x + 1 < m_width && mUp[x + 1];
+					if (mUp[x]) {
+						label = lUp[x];
+					} else if (ne) {
+						label = lUp[x + 1];
+						if (nw) {
+							label = Union(parent, label, lUp[x - 1]);
+						} else if (x > 0 && m[x - 1]) {
+							label = Union(parent, label, l[x - 1]);
+						}
+					} else if (nw) {
+						label = lUp[x - 1];
+					}
+				}
+				if (!label && x > 0 && m[x - 1]) {
+					label = l[x - 1];
+				}
+				if (!label) {
+					label = static_cast<A_u_long>(parent.size());
+					parent.push_back(label);
+				}
+				l[x] = label;
+			}
+		}
+
+		// Sets link to their smallest label, so one ascending pass flattens
+		// them; roots are numbered in order of their first pixel
+		const A_u_long labels = static_cast<A_u_long>(parent.size());
+		b.local.assign(labels, 0);
+		b.roots = 0;
+		for (A_u_long l = 1; l < labels; l++) {
+			parent[l] = parent[parent[l]];
+			b.local[l] = (parent[l] == l) ? b.roots++ : b.local[parent[l]];
+		}
+	}
+
+	// Pass 2: joins the bands and numbers the components. Returns the count.
+	A_u_long Merge() {
+		std::vector<A_u_long> offsets(m_bands.size() + 1, 0);
+		for (size_t b = 0; b < m_bands.size(); b++) {
+			offsets[b + 1] = offsets[b] + m_bands[b].roots;
+		}
+		std::vector<A_u_long> parent(offsets.back());
+		for (A_u_long i = 0; i < parent.size(); i++) parent[i] = i;
+
+		for (size_t b = 1; b < m_bands.size(); b++) {
+			const Band &band = m_bands[b];
+			const Band &above = m_bands[b - 1];
+			const size_t row = static_cast<size_t>(band.y0) * m_width;
+			const A_u_char *m = m_mask + row;
+			const A_u_char *mUp = m - m_width;
+			const A_u_long *l = m_labels + row;
+			const A_u_long *lUp = l - m_width;
+
+			for (A_long x = 0; x < m_width; x++) {
+				if (!m[x]) continue;
+				A_u_long here = offsets[b] + band.local[l[x]];
+				A_long x0 = x > 0 ? x - 1 : 0;
+				A_long x1 = x + 1 < m_width ? x + 1 : x;
+				for (A_long nx = x0; nx <= x1; nx++) {
+					if (mUp[nx]) Union(parent, here, offsets[b - 1] + above.local[lUp[nx]]);
+				}
+			}
+		}
+
+		// Smallest index first: band order, then raster order within a band
+		std::vector<A_u_long> component(parent.size());
+		m_count = 0;
+		for (A_u_long i = 0; i < parent.size(); i++) {
+			A_u_long root = Find(parent, i);
+			component[i] = (root == i) ? ++m_count : component[root];
+		}
+		for (size_t b = 0; b < m_bands.size(); b++) {
+			Band &band = m_bands[b];
+			band.component.assign(component.begin() + offsets[b], component.begin() + offsets[b + 1]);
+		}
+		return m_count;
+	}
+
+	// Pass 3: final labels and the stats of one band
+	void ResolveBand(A_long band) {
+		Resolve<false>(band, NoColor());
+	}
+
+	// Same, with the mean colour: colorOf(x, y, rgb) writes a line pixel's colour
+	template<typename ColorOf>
+	void ResolveBand(A_long band, const ColorOf &colorOf) {
+		Resolve<true>(band, colorOf);
+	}
+
+	// Stats of every component after pass 3; stats[label - 1]
+	void Finish(std::vector<CXComponentStats> *stats) const {
+		std::vector<Accum> total(m_count);
+		for (size_t b = 0; b < m_bands.size(); b++) {
+			const Band &band = m_bands[b];
+			for (size_t c = 0; c < band.stats.size(); c++) {
+				total[band.component[c] - 1].Add(band.stats[c]);
+			}
+		}
+		stats->resize(m_count);
+		for (A_u_long i = 0; i < m_count; i++) {
+			const Accum &a = total[i];
+			CXComponentStats &s = (*stats)[i];
+			s.left = a.left;
+			s.top = a.top;
+			s.right = a.right;
+			s.bottom = a.bottom;
+			s.pixels = a.pixels;
+			double scale = a.pixels ? 1.0 / a.pixels : 0.0;
+			s.red = static_cast<float>(a.red * scale);
+			s.green = static_cast<float>(a.green * scale);
+			s.blue = static_cast<float>(a.blue * scale);
+		}
+	}
+
+	CXComponentLabeler(const CXComponentLabeler&) = delete;
+	CXComponentLabeler& operator=(const CXComponentLabeler&) = delete;
+
+private:
+	struct Accum {
+		A_long		left, top, right, bottom;
+		A_u_long	pixels;
+		double		red, green, blue;
+
+		Accum() : left(0), top(0), right(0), bottom(0), pixels(0), red(0), green(0), blue(0) {}
+
+		void Add(const Accum &o) {
+			if (!o.pixels) return;
+			if (!pixels) {
+				*this = o;
+				return;
+			}
+			left = std::min(left, o.left);
+			top = std::min(top, o.top);
+			right = std::max(right, o.right);
+			bottom = std::max(bottom, o.bottom);
+			pixels += o.pixels;
+			red += o.red;
+			green += o.green;
+			blue += o.blue;
+		}
+	};
+
+	struct Band {
+		A_long					y0, y1;
+		std::vector<A_u_long>	parent;		// Provisional label -> root label
+		std::vector<A_u_long>	local;		// Provisional label -> index of its root in the band
+		A_u_long				roots;
+		std::vector<A_u_long>	component;	// Root index -> final label
+		std::vector<Accum>		stats;		// Root index -> stats of the band's pixels
+	};
+
+	struct NoColor {
+		void operator()(A_long, A_long, float*) const {}
+	};
+
+	static A_u_long Find(std::vector<A_u_long> &parent, A_u_long i) {
+		while (parent[i] != i) {
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	}
+
+	// Links the larger root below the smaller one and returns the root
+	static A_u_long Union(std::vector<A_u_long> &parent, A_u_long a, A_u_long b) {
+		a = Find(parent, a);
+		b = Find(parent, b);
+		if (a < b) {
+			parent[b] = a;
+			return a;
+		}
+		parent[a] = b;
+		return b;
+	}
+
+	template<bool kColor, typename ColorOf>
+	void Resolve(A_long band, const ColorOf &colorOf) {
+		Band &b = m_bands[band];
+		b.stats.assign(b.roots, Accum());
+
+		for (A_long y = b.y0; y < b.y1; y++) {
+			A_u_long *l = m_labels + static_cast<size_t>(y) * m_width;
+			for (A_long x = 0; x < m_width; x++) {
+				if (!l[x]) continue;
+				A_u_long root = b.local[l[x]];
+				l[x] = b.component[root];
+
+				Accum &a = b.stats[root];
+				if (!a.pixels) {
+					a.left = x;
+					a.top = y;
+					a.right = x + 1;
+				} else {
+					a.left = std::min(a.left, x);
+					a.right = std::max(a.right, x + 1);
+				}
+				a.bottom = y + 1;
+				a.pixels++;
+				if (kColor) {
+					float rgb[3];
+					colorOf(x, y, rgb);
+					a.red += rgb[0];
+					a.green += rgb[1];
+					a.blue += rgb[2];
+				}
+			}
+		}
+	}
+
+	const A_u_char		*m_mask;
+	A_u_long			*m_labels;
+	A_long				m_width;
+	std::vector<Band>	m_bands;
+	A_u_long			m_count;
+};
+
+// iterate_generic callbacks; refcon is the CXComponentLabeler
+static PF_Err CX_LabelComponentsBand(void *refcon, A_long, A_long band, A_long) {
+	reinterpret_cast<CXComponentLabeler*>(refcon)->LabelBand(band);
+	return PF_Err_NONE;
+}
+
+static PF_Err CX_ResolveComponentsBand(void *refcon, A_long, A_long band, A_long) {
+	reinterpret_cast<CXComponentLabeler*>(refcon)->ResolveBand(band);
+	return PF_Err_NONE;
+}
+
+#endif // CX_COMPONENTS_H
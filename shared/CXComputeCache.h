@@ -0,0 +1,206 @@
+/*
+	CXComputeCache.h
+
+	CX Animation Tools - Intermediate Caches in AE's Compute Cache
+	After Effects 2022 and later keep effect intermediates in a host-managed
+	compute cache: it counts against the user's memory settings, is purged
+	with AE's other caches and is shared by the MFR render threads. A
+	CXComputeCache registers one cache class there in GlobalSetup and stores
+	its values in it. Hosts without the suite (older AE, Premiere) get a
+	private CXLRUCache with a fixed budget instead.
+
+	Both back ends offer the CXLRUCache interface, so callers keep using
+	Find(), FindOrReserve(), Insert() and CXCacheReservation. Values are
+	shared pointers: the host entry holds one reference, and a value checked
+	out stays valid after AE evicts its entry. Reservations are tracked here,
+	so concurrent renders of one key still wait for the first.
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#pragma once
+#ifndef CX_COMPUTE_CACHE_H
+#define CX_COMPUTE_CACHE_H
+
+#include "CXCommon.h"
+#include "CXFrameCache.h"
+#include "AE_ComputeCacheSuite.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_set>
+
+template<typename V>
+class CXComputeCache {
+public:
+	typedef std::shared_ptr<const V> ValuePtr;
+
+	// cacheId names the class in AE's cache; unique per plugin and value type
+	CXComputeCache(const char *cacheId, size_t localBudget)
+		: m_cacheId(cacheId), m_host(NULL), m_local(localBudget) {}
+
+	// GlobalSetup: store values in AE's compute cache when the host has one
+	void AttachHost(PF_InData *in_data) {
+		AEGP_ComputeCacheSuite1 *suite = NULL;
+		if (AEFX_AcquireSuite(in_data, NULL, kAEGPComputeCacheSuite, kAEGPComputeCacheSuiteVersion1,
+		                      NULL, reinterpret_cast<void**>(&suite)) != PF_Err_NONE || !suite) {
+			return;
+		}
+		static const AEGP_ComputeCacheCallbacks callbacks = { GenerateKey, Compute, ApproxSize, DeleteValue };
+		if (suite->AEGP_ClassRegister(m_cacheId, &callbacks) != A_Err_NONE) {
+			AEFX_ReleaseSuite(in_data, NULL, kAEGPComputeCacheSuite, kAEGPComputeCacheSuiteVersion1, NULL);
+			return;
+		}
+		m_host = suite;
+	}
+
+	// GlobalSetdown: unregister the class, which frees its host entries
+	void DetachHost(PF_InData *in_data) {
+		if (!m_host) return;
+		m_host->AEGP_ClassUnregister(m_cacheId);
+		AEFX_ReleaseSuite(in_data, NULL, kAEGPComputeCacheSuite, kAEGPComputeCacheSuiteVersion1, NULL);
+		m_host = NULL;
+	}
+
+	bool UsesHost() const {
+		return m_host != NULL;
+	}
+
+	ValuePtr Find(const CXCacheKey &key) {
+		if (!m_host) return m_local.Find(key);
+		return HostFind(key);
+	}
+
+	// Returns the cached value, or NULL with *reservedP set when the caller
+	// should compute the value and Insert()/Release() it.
+	ValuePtr FindOrReserve(const CXCacheKey &key, bool *reservedP) {
+		if (!m_host) return m_local.FindOrReserve(key, reservedP);
+
+		// Host lookups take AE's own locks, so m_mutex only guards m_pending
+		*reservedP = false;
+		for (;;) {
+			ValuePtr hit = HostFind(key);
+			if (hit) return hit;
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_pending.insert(key).second) break;
+			m_pendingDone.wait(lock, [&] { return m_pending.find(key) == m_pending.end(); });
+		}
+
+		// Another render may have stored the value after our lookup missed
+		ValuePtr hit = HostFind(key);
+		if (hit) {
+			Release(key);
+			return hit;
+		}
+		*reservedP = true;
+		return ValuePtr();
+	}
+
+	void Insert(const CXCacheKey &key, ValuePtr value, size_t bytes) {
+		if (!m_host) {
+			m_local.Insert(key, value, bytes);
+			return;
+		}
+		if (value) HostStore(key, value, bytes);
+		Release(key);
+	}
+
+	void Release(const CXCacheKey &key) {
+		if (!m_host) {
+			m_local.Release(key);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.erase(key);
+		}
+		m_pendingDone.notify_all();
+	}
+
+	// Local entries only; AE purges its own cache
+	void Clear() {
+		m_local.Clear();
+	}
+
+	CXComputeCache(const CXComputeCache&) = delete;
+	CXComputeCache& operator=(const CXComputeCache&) = delete;
+
+private:
+	// Options passed through the host: the key, and for a store the value
+	struct Request {
+		CXCacheKey	key;
+		ValuePtr	value;
+		size_t		bytes;
+	};
+
+	// What AE holds for one entry
+	struct Stored {
+		ValuePtr	value;
+		size_t		bytes;
+	};
+
+	static A_Err GenerateKey(AEGP_CCComputeOptionsRefconP optionsP, AEGP_CCComputeKeyP keyP) {
+		static_assert(sizeof(*keyP) >= sizeof(CXCacheKey), "compute cache keys hold 128 bits");
+		const Request *request = reinterpret_cast<const Request*>(optionsP);
+		memset(keyP, 0, sizeof(*keyP));
+		memcpy(keyP, &request->key, sizeof(CXCacheKey));
+		return A_Err_NONE;
+	}
+
+	// Values are built by the caller; a store only hands them over
+	static A_Err Compute(AEGP_CCComputeOptionsRefconP optionsP, AEGP_CCComputeValueRefconP *valuePP) {
+		const Request *request = reinterpret_cast<const Request*>(optionsP);
+		if (!request->value) return A_Err_GENERIC;
+		Stored *stored = new (std::nothrow) Stored;
+		if (!stored) return A_Err_ALLOC;
+		stored->value = request->value;
+		stored->bytes = request->bytes;
+		*valuePP = reinterpret_cast<AEGP_CCComputeValueRefconP>(stored);
+		return A_Err_NONE;
+	}
+
+	static size_t ApproxSize(AEGP_CCComputeValueRefconP valueP) {
+		return reinterpret_cast<const Stored*>(valueP)->bytes;
+	}
+
+	static void DeleteValue(AEGP_CCComputeValueRefconP valueP) {
+		delete reinterpret_cast<Stored*>(valueP);
+	}
+
+	ValuePtr HostFind(const CXCacheKey &key) {
+		Request request = { key, ValuePtr(), 0 };
+		AEGP_CCCheckoutReceiptP receipt = NULL;
+		ValuePtr value;
+		if (m_host->AEGP_CheckoutCached(m_cacheId, reinterpret_cast<AEGP_CCComputeOptionsRefconP>(&request),
+		                                &receipt) == A_Err_NONE && receipt) {
+			AEGP_CCComputeValueRefconP stored = NULL;
+			if (m_host->AEGP_GetReceiptComputeValue(receipt, &stored) == A_Err_NONE && stored) {
+				value = reinterpret_cast<const Stored*>(stored)->value;
+			}
+			m_host->AEGP_CheckinComputeReceipt(receipt);
+		}
+		return value;
+	}
+
+	void HostStore(const CXCacheKey &key, ValuePtr value, size_t bytes) {
+		Request request = { key, value, bytes };
+		AEGP_CCCheckoutReceiptP receipt = NULL;
+		if (m_host->AEGP_ComputeIfNeededAndCheckout(m_cacheId, reinterpret_cast<AEGP_CCComputeOptionsRefconP>(&request),
+		                                            true, &receipt) == A_Err_NONE && receipt) {
+			m_host->AEGP_CheckinComputeReceipt(receipt);
+		}
+	}
+
+	const char *m_cacheId;
+	AEGP_ComputeCacheSuite1 *m_host;
+	CXLRUCache<V> m_local;
+	std::mutex m_mutex;
+	std::condition_variable m_pendingDone;
+	std::unordered_set<CXCacheKey, CXCacheKeyHash> m_pending;
+};
+
+#endif // CX_COMPUTE_CACHE_H
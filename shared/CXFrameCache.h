@@ -0,0 +1,432 @@
+/*
+	CXFrameCache.h
+
+	CX Animation Tools - Content-Keyed Frame Cache
+	Fast content hashing of effect worlds and a size-bounded, thread-safe LRU
+	cache used to reuse render results across byte-identical input frames
+	(held cels on 2s/3s).
+
+	Copyright (c) 2025 CX Animation Tools
+*/
+
+#pragma once
+#ifndef CX_FRAME_CACHE_H
+#define CX_FRAME_CACHE_H
+
+#include "CXCommon.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+	#include <emmintrin.h>
+	#define CX_HASH_SSE2 1
+#else
+	#define CX_HASH_SSE2 0
+#endif
+
+// ============================================================================
+// Cache Budget
+// ============================================================================
+
+// Default memory budget per plugin for cached frame results
+constexpr size_t CX_FRAME_CACHE_BUDGET = static_cast<size_t>(256) << 20;
+
+// ============================================================================
+// 128-bit Cache Key
+// ============================================================================
+
+struct CXCacheKey {
+	uint64_t lo;
+	uint64_t hi;
+
+	bool operator==(const CXCacheKey &other) const {
+		return lo == other.lo && hi == other.hi;
+	}
+};
+
+struct CXCacheKeyHash {
+	size_t operator()(const CXCacheKey &key) const {
+		return static_cast<size_t>(key.lo ^ (key.hi * 0x9E3779B97F4A7C15ULL));
+	}
+};
+
+// ============================================================================
+// Streaming Content Hasher
+// ============================================================================
+
+// Stripe-based accumulate hash (XXH3-style): 64-byte stripes feed eight 64-bit
+// lanes with a 32x32->64 multiply per lane. The key advances every stripe so
+// reordered data hashes differently, and lanes are scrambled every 16 stripes.
+// The SSE2 and scalar paths produce identical results.
+class CXHasher {
+public:
+	explicit CXHasher(uint64_t seed = 0) : m_bufLen(0), m_total(0), m_stripes(0) {
+		for (int i = 0; i < 8; i++) {
+			m_acc[i] = kSecret[i] ^ seed;
+		}
+	}
+
+	void Update(const void *data, size_t len) {
+		const unsigned char *p = static_cast<const unsigned char*>(data);
+		m_total += len;
+
+		if (m_bufLen > 0) {
+			size_t take = CX_MIN(len, sizeof(m_buf) - m_bufLen);
+			memcpy(m_buf + m_bufLen, p, take);
+			m_bufLen += take;
+			p += take;
+			len -= take;
+			if (m_bufLen < sizeof(m_buf)) return;
+			ConsumeStripes(m_buf, 1);
+			m_bufLen = 0;
+		}
+
+		size_t stripes = len / kStripeLen;
+		if (stripes > 0) {
+			ConsumeStripes(p, stripes);
+			p += stripes * kStripeLen;
+			len -= stripes * kStripeLen;
+		}
+
+		if (len > 0) {
+			memcpy(m_buf, p, len);
+			m_bufLen = len;
+		}
+	}
+
+	// Mix in a scalar value (no padding bytes, so never pass structs)
+	template<typename T>
+	void Add(const T &value) {
+		static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>, "Add() takes scalar values only");
+		Update(&value, sizeof(T));
+	}
+
+	CXCacheKey Finish() const {
+		CXHasher tail = *this;
+		if (tail.m_bufLen > 0) {
+			memset(tail.m_buf + tail.m_bufLen, 0, sizeof(tail.m_buf) - tail.m_bufLen);
+			tail.ConsumeStripes(tail.m_buf, 1);
+		}
+
+		uint64_t lo = m_total * kPrime64_1;
+		uint64_t hi = ~m_total * kPrime64_2;
+		for (int i = 0; i < 8; i++) {
+			lo = RotL(lo ^ (tail.m_acc[i] * kPrime64_2), 31) * kPrime64_1;
+			hi = RotL(hi + (tail.m_acc[i] ^ RotL(tail.m_acc[i], 23)), 27) * kPrime64_2;
+		}
+
+		CXCacheKey key;
+		key.lo = Avalanche(lo);
+		key.hi = Avalanche(hi ^ key.lo);
+		return key;
+	}
+
+private:
+	static constexpr size_t kStripeLen = 64;
+	static constexpr uint64_t kPrime64_1 = 0x9E3779B185EBCA87ULL;
+	static constexpr uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+	static constexpr uint64_t kKeyStep = 0x9E3779B97F4A7C15ULL;
+	static constexpr uint32_t kPrime32 = 0x9E3779B1U;
+	static constexpr uint64_t kSecret[8] = {
+		0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+		0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL
+	};
+	static constexpr uint64_t kScramble[8] = {
+		0x1F67B3B7A4A44072ULL, 0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL,
+		0x4C263A81E69035E0ULL, 0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL
+	};
+
+	static inline uint64_t RotL(uint64_t v, int r) {
+		return (v << r) | (v >> (64 - r));
+	}
+
+	static inline uint64_t Avalanche(uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	static inline uint64_t Load64(const unsigned char *p) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	void ConsumeStripes(const unsigned char *p, size_t count) {
+		uint64_t key[8];
+		for (int i = 0; i < 8; i++) {
+			key[i] = kSecret[i] + m_stripes * kKeyStep;
+		}
+
+#if CX_HASH_SSE2
+		__m128i acc[4], k[4];
+		for (int j = 0; j < 4; j++) {
+			acc[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_acc + j * 2));
+			k[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + j * 2));
+		}
+		const __m128i step = _mm_set1_epi64x(static_cast<long long>(kKeyStep));
+		const __m128i prime = _mm_set1_epi32(static_cast<int>(kPrime32));
+
+		for (size_t s = 0; s < count; s++, p += kStripeLen) {
+			for (int j = 0; j < 4; j++) {
+				__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + j * 16));
+				__m128i dk = _mm_xor_si128(d, k[j]);
+				acc[j] = _mm_add_epi64(acc[j], _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+				acc[j] = _mm_add_epi64(acc[j], _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1))));
+				k[j] = _mm_add_epi64(k[j], step);
+			}
+
+			if ((++m_stripes & 15) == 0) {
+				for (int j = 0; j < 4; j++) {
+					__m128i a = _mm_xor_si128(acc[j], _mm_srli_epi64(acc[j], 47));
+					a = _mm_xor_si128(a, _mm_loadu_si128(reinterpret_cast<const __m128i*>(kScramble + j * 2)));
+					__m128i mulLo = _mm_mul_epu32(a, prime);
+					__m128i mulHi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+					acc[j] = _mm_add_epi64(mulLo, _mm_slli_epi64(mulHi, 32));
+				}
+			}
+		}
+
+		for (int j = 0; j < 4; j++) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(m_acc + j * 2), acc[j]);
+		}
+#else
+		for (size_t s = 0; s < count; s++, p += kStripeLen) {
+			for (int i = 0; i < 8; i++) {
+				uint64_t d = Load64(p + i * 8);
+				uint64_t dk = d ^ key[i];
+				m_acc[i ^ 1] += d;
+				m_acc[i] += (dk & 0xFFFFFFFFULL) * (dk >> 32);
+				key[i] += kKeyStep;
+			}
+
+			if ((++m_stripes & 15) == 0) {
+				for (int i = 0; i < 8; i++) {
+					uint64_t a = m_acc[i] ^ (m_acc[i] >> 47);
+					a ^= kScramble[i];
+					m_acc[i] = a * kPrime32;
+				}
+			}
+		}
+#endif
+	}
+
+	uint64_t m_acc[8];
+	unsigned char m_buf[kStripeLen];
+	size_t m_bufLen;
+	uint64_t m_total;
+	uint64_t m_stripes;
+};
+
+// ============================================================================
+// World Helpers
+// ============================================================================
+
+static inline A_long CX_BytesPerPixel(PF_PixelFormat format) {
+	switch (format) {
+		case PF_PixelFormat_ARGB32:  return static_cast<A_long>(sizeof(PF_Pixel8));
+		case PF_PixelFormat_ARGB64:  return static_cast<A_long>(sizeof(PF_Pixel16));
+		case PF_PixelFormat_ARGB128: return static_cast<A_long>(sizeof(PF_PixelFloat));
+		default:                     return 0;
+	}
+}
+
+// Hash the visible pixels of a world (row padding is skipped)
+static inline void CX_HashWorld(CXHasher &hasher, const PF_EffectWorld *world, PF_PixelFormat format) {
+	A_long bpp = CX_BytesPerPixel(format);
+	size_t rowLen = static_cast<size_t>(world->width) * bpp;
+
+	hasher.Add(static_cast<A_long>(format));
+	hasher.Add(world->width);
+	hasher.Add(world->height);
+	for (A_long y = 0; y < world->height; y++) {
+		hasher.Update(static_cast<const char*>(world->data) + static_cast<size_t>(y) * world->rowbytes, rowLen);
+	}
+}
+
+// Identity of an input frame. A plugin's frame key hashes every setting the
+// output depends on, the output geometry and this key, so the frames of a
+// held cel share one cached result; intermediate keys derive from it too.
+static inline CXCacheKey CX_InputKey(const PF_EffectWorld *world, PF_PixelFormat format) {
+	CXHasher hasher;
+	CX_HashWorld(hasher, world, format);
+	return hasher.Finish();
+}
+
+// ============================================================================
+// Thread-Safe LRU Cache
+// ============================================================================
+
+// Size-bounded LRU map from content key to immutable values. Values are handed
+// out as shared_ptr so an entry evicted by another render thread stays valid
+// while it is being read.
+//
+// FindOrReserve() lets concurrent renders of the same key (MFR rendering two
+// frames of one held cel) wait for the first thread instead of duplicating
+// the work. A reservation is always ended by Insert() or Release().
+template<typename V>
+class CXLRUCache {
+public:
+	typedef std::shared_ptr<const V> ValuePtr;
+
+	explicit CXLRUCache(size_t budgetBytes) : m_budget(budgetBytes), m_used(0) {}
+
+	ValuePtr Find(const CXCacheKey &key) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return FindLocked(key);
+	}
+
+	// Returns the cached value, or NULL with *reservedP set when the caller
+	// should compute the value and Insert()/Release() it.
+	ValuePtr FindOrReserve(const CXCacheKey &key, bool *reservedP) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		*reservedP = false;
+		for (;;) {
+			ValuePtr hit = FindLocked(key);
+			if (hit) return hit;
+			if (m_pending.find(key) == m_pending.end()) break;
+			m_pendingDone.wait(lock);
+		}
+		m_pending.insert(key);
+		*reservedP = true;
+		return ValuePtr();
+	}
+
+	void Insert(const CXCacheKey &key, ValuePtr value, size_t bytes) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.erase(key);
+
+			if (value && bytes <= m_budget && m_map.find(key) == m_map.end()) {
+				m_lru.push_front(Entry{ key, value, bytes });
+				m_map[key] = m_lru.begin();
+				m_used += bytes;
+
+				while (m_used > m_budget && !m_lru.empty()) {
+					Entry &victim = m_lru.back();
+					m_used -= victim.bytes;
+					m_map.erase(victim.key);
+					m_lru.pop_back();
+				}
+			}
+		}
+		m_pendingDone.notify_all();
+	}
+
+	void Release(const CXCacheKey &key) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.erase(key);
+		}
+		m_pendingDone.notify_all();
+	}
+
+	void Clear() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_lru.clear();
+		m_map.clear();
+		m_used = 0;
+	}
+
+private:
+	struct Entry {
+		CXCacheKey key;
+		ValuePtr value;
+		size_t bytes;
+	};
+
+	ValuePtr FindLocked(const CXCacheKey &key) {
+		auto it = m_map.find(key);
+		if (it == m_map.end()) return ValuePtr();
+		m_lru.splice(m_lru.begin(), m_lru, it->second);
+		return it->second->value;
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_pendingDone;
+	std::list<Entry> m_lru;
+	std::unordered_map<CXCacheKey, typename std::list<Entry>::iterator, CXCacheKeyHash> m_map;
+	std::unordered_set<CXCacheKey, CXCacheKeyHash> m_pending;
+	size_t m_budget;
+	size_t m_used;
+};
+
+// Ends a FindOrReserve() reservation on every exit path. Cache is any cache
+// with the CXLRUCache interface.
+template<typename V, typename Cache = CXLRUCache<V> >
+class CXCacheReservation {
+public:
+	CXCacheReservation(Cache *cache, const CXCacheKey &key, bool reserved)
+		: m_cache(cache), m_key(key), m_reserved(reserved) {}
+
+	~CXCacheReservation() {
+		if (m_reserved) m_cache->Release(m_key);
+	}
+
+	void Fulfill(typename Cache::ValuePtr value, size_t bytes) {
+		if (!m_reserved) return;
+		m_cache->Insert(m_key, value, bytes);
+		m_reserved = false;
+	}
+
+	CXCacheReservation(const CXCacheReservation&) = delete;
+	CXCacheReservation& operator=(const CXCacheReservation&) = delete;
+
+private:
+	Cache *m_cache;
+	CXCacheKey m_key;
+	bool m_reserved;
+};
+
+// ============================================================================
+// Frame Results
+// ============================================================================
+
+// Tightly packed copy of a rendered output world
+struct CXFrameResult {
+	A_long width;
+	A_long height;
+	size_t rowLen;
+	std::vector<char> pixels;
+};
+
+typedef CXLRUCache<CXFrameResult> CXFrameCache;
+
+static inline std::shared_ptr<CXFrameResult> CX_CaptureFrameResult(const PF_EffectWorld *world, PF_PixelFormat format) {
+	std::shared_ptr<CXFrameResult> result = std::make_shared<CXFrameResult>();
+	result->width = world->width;
+	result->height = world->height;
+	result->rowLen = static_cast<size_t>(world->width) * CX_BytesPerPixel(format);
+	result->pixels.resize(result->rowLen * world->height);
+
+	for (A_long y = 0; y < world->height; y++) {
+		memcpy(&result->pixels[result->rowLen * y],
+		       static_cast<const char*>(world->data) + static_cast<size_t>(y) * world->rowbytes,
+		       result->rowLen);
+	}
+	return result;
+}
+
+static inline PF_Boolean CX_RestoreFrameResult(const CXFrameResult &result, PF_EffectWorld *world) {
+	if (result.width != world->width || result.height != world->height) return FALSE;
+
+	for (A_long y = 0; y < world->height; y++) {
+		memcpy(static_cast<char*>(world->data) + static_cast<size_t>(y) * world->rowbytes,
+		       &result.pixels[result.rowLen * y],
+		       result.rowLen);
+	}
+	return TRUE;
+}
+
+#endif // CX_FRAME_CACHE_H
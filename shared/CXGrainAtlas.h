@@ -0,0 +1,203 @@
+/*
+	CXGrainAtlas.h
+
+	Tileable paper and graphite grain for pencil textures.
+
+	The textures are generated once per process and shared read-only by every
+	instance and render thread: GlobalSetup acquires the atlas, GlobalSetdown
+	releases it, and the last release frees it. Each texture is a power of two
+	wide and tall so sampling wraps with a mask, and carries a box-filtered mip
+	chain down to 1 x 1. Downsampled previews sample the level matching their
+	resolution, so the grain keeps its look in layer space instead of aliasing.
+
+	Grain is value noise over lattices from CXRandom.h, summed over octaves
+	whose periods divide the texture size, so every level tiles seamlessly.
+*/
+
+#pragma once
+#ifndef CX_GRAIN_ATLAS_H
+#define CX_GRAIN_ATLAS_H
+
+#include "CXCommon.h"
+#include "CXRandom.h"
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+
+enum CXGrainKind {
+	CX_GRAIN_PAPER = 0,		// Isotropic tooth of the paper
+	CX_GRAIN_GRAPHITE,		// Fine horizontal streaks of the lead
+	CX_GRAIN_NUM_KINDS
+};
+
+#define CX_GRAIN_SIZE_LOG2	8		// 256 x 256 texels at level 0
+#define CX_GRAIN_LEVELS		(CX_GRAIN_SIZE_LOG2 + 1)
+#define CX_GRAIN_SEED		0x43584752u		// 'CXGR'
+
+// One mip level of one texture; texels are in [0, 1] with mean near 0.5
+typedef struct {
+	A_long			size;		// Width and height
+	A_long			mask;		// size - 1, for wrapping
+	const float		*texels;
+} CXGrainLevel;
+
+class CXGrainAtlas {
+public:
+	// Process-wide atlas, generated on first acquire. NULL when out of memory.
+	static CXGrainAtlas *Acquire() {
+		Registry &r = GetRegistry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		if (!r.atlas) {
+			try {
+				r.atlas = new CXGrainAtlas();
+			} catch (const std::bad_alloc &) {
+				return NULL;
+			}
+		}
+		r.refs++;
+		return r.atlas;
+	}
+
+	static void Release(CXGrainAtlas *atlas) {
+		if (!atlas) return;
+		Registry &r = GetRegistry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		if (--r.refs == 0) {
+			delete r.atlas;
+			r.atlas = NULL;
+		}
+	}
+
+	const CXGrainLevel &Level(CXGrainKind kind, A_long level) const {
+		return m_levels[kind][level];
+	}
+
+	// Texel (x, y) of a level, wrapping in both directions
+	float Sample(CXGrainKind kind, A_long level, A_long x, A_long y) const {
+		const CXGrainLevel &l = m_levels[kind][level];
+		return l.texels[(y & l.mask) * l.size + (x & l.mask)];
+	}
+
+private:
+	struct Registry {
+		std::mutex		mutex;
+		CXGrainAtlas	*atlas;
+		A_long			refs;
+		Registry() : atlas(NULL), refs(0) {}
+	};
+
+	static Registry &GetRegistry() {
+		static Registry registry;
+		return registry;
+	}
+
+	CXGrainAtlas() {
+		const A_long size = 1 << CX_GRAIN_SIZE_LOG2;
+		size_t total = 0;
+		for (A_long level = 0; level < CX_GRAIN_LEVELS; level++) {
+			total += static_cast<size_t>(size >> level) * (size >> level);
+		}
+		m_texels.resize(total * CX_GRAIN_NUM_KINDS);
+
+		float *next = &m_texels[0];
+		for (int kind = 0; kind < CX_GRAIN_NUM_KINDS; kind++) {
+			float *texels[CX_GRAIN_LEVELS];
+			for (A_long level = 0; level < CX_GRAIN_LEVELS; level++) {
+				CXGrainLevel &l = m_levels[kind][level];
+				l.size = size >> level;
+				l.mask = l.size - 1;
+				l.texels = texels[level] = next;
+				next += static_cast<size_t>(l.size) * l.size;
+			}
+			Generate(static_cast<CXGrainKind>(kind), texels[0], size);
+			for (A_long level = 1; level < CX_GRAIN_LEVELS; level++) {
+				Downsample(m_levels[kind][level - 1], texels[level]);
+			}
+		}
+	}
+
+	CXGrainAtlas(const CXGrainAtlas&) = delete;
+	CXGrainAtlas& operator=(const CXGrainAtlas&) = delete;
+
+	static float Smooth(float t) {
+		return t * t * (3.0f - 2.0f * t);
+	}
+
+	// Adds one octave of value noise with cellsX x cellsY lattice cells
+	// across the tile. Both counts divide size, so the octave tiles.
+	static void AddOctave(float *dst, A_long size, A_long cellsX, A_long cellsY, float amplitude, const CXRandomStream *s) {
+		std::vector<float> lattice(static_cast<size_t>(cellsX) * cellsY);
+		for (A_long j = 0; j < cellsY; j++) {
+			CX_RandomRow(s, 0, j, cellsX, 0, &lattice[static_cast<size_t>(j) * cellsX]);
+		}
+		const A_long cellW = size / cellsX, cellH = size / cellsY;
+		for (A_long y = 0; y < size; y++) {
+			A_long j0 = y / cellH, j1 = (j0 + 1) % cellsY;
+			float ty = Smooth(static_cast<float>(y % cellH) / cellH);
+			const float *row0 = &lattice[static_cast<size_t>(j0) * cellsX];
+			const float *row1 = &lattice[static_cast<size_t>(j1) * cellsX];
+			float *dstRow = dst + static_cast<size_t>(y) * size;
+			for (A_long x = 0; x < size; x++) {
+				A_long i0 = x / cellW, i1 = (i0 + 1) % cellsX;
+				float tx = Smooth(static_cast<float>(x % cellW) / cellW);
+				float top = row0[i0] + (row0[i1] - row0[i0]) * tx;
+				float bottom = row1[i0] + (row1[i1] - row1[i0]) * tx;
+				dstRow[x] += (top + (bottom - top) * ty) * amplitude;
+			}
+		}
+	}
+
+	static void Generate(CXGrainKind kind, float *dst, A_long size) {
+		std::fill(dst, dst + static_cast<size_t>(size) * size, 0.0f);
+		float amplitudeSum = 0.0f;
+		float amplitude = 0.25f;
+		// Coarse to fine, weighted towards the fine octaves: paper from 16
+		// cells up to one per texel, graphite stretched 8:1 along x
+		for (A_long octave = 0; octave < 5; octave++) {
+			CXRandomStream s = CX_MakeRandomStream(CX_GRAIN_SEED, static_cast<A_u_long>(kind), 0, static_cast<A_u_long>(octave));
+			A_long cellsY = 16 << octave;
+			A_long cellsX = (kind == CX_GRAIN_GRAPHITE) ? std::max<A_long>(cellsY / 8, 1) : cellsY;
+			AddOctave(dst, size, cellsX, cellsY, amplitude, &s);
+			amplitudeSum += amplitude;
+			amplitude *= 1.5f;
+		}
+		for (size_t i = 0, n = static_cast<size_t>(size) * size; i < n; i++) {
+			dst[i] /= amplitudeSum;
+		}
+	}
+
+	// 2 x 2 box filter; sizes are powers of two, so the result still tiles
+	static void Downsample(const CXGrainLevel &src, float *dst) {
+		const A_long size = src.size / 2;
+		for (A_long y = 0; y < size; y++) {
+			const float *row0 = src.texels + static_cast<size_t>(2 * y) * src.size;
+			const float *row1 = row0 + src.size;
+			for (A_long x = 0; x < size; x++) {
+				dst[static_cast<size_t>(y) * size + x] =
+					(row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1]) * 0.25f;
+			}
+		}
+	}
+
+	std::vector<float>	m_texels;
+	CXGrainLevel		m_levels[CX_GRAIN_NUM_KINDS][CX_GRAIN_LEVELS];
+};
+
+// Mip level for a render at the given downsample factors: one texel of the
+// level covers about one output pixel. Uses the coarser axis.
+static inline A_long CX_GrainLevelForDownsample(PF_RationalScale downsample_x, PF_RationalScale downsample_y) {
+	A_long level = 0;
+	const PF_RationalScale *axes[2] = { &downsample_x, &downsample_y };
+	for (int i = 0; i < 2; i++) {
+		A_u_longlong num = static_cast<A_u_long>(axes[i]->num > 0 ? axes[i]->num : 1);
+		A_u_longlong den = axes[i]->den > 0 ? axes[i]->den : 1;
+		A_long axisLevel = 0;
+		while (axisLevel + 1 < CX_GRAIN_LEVELS && (num << (axisLevel + 1)) <= den) axisLevel++;
+		if (axisLevel > level) level = axisLevel;
+	}
+	return level;
+}
+
+#endif // CX_GRAIN_ATLAS_H
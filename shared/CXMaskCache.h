@@ -0,0 +1,97 @@
+/*
+	CXMaskCache.h
+
+	Classification planes shared between stacked instances.
+
+	Templates stack several instances of an effect on one layer, each keying
+	the same input frame. The planes that classify a frame against a colour
+	key set depend only on the input pixels and the keys, so they are cached
+	in the plugin's global data, which every instance and render thread of
+	the plugin shares, and an instance keying a frame another one already
+	classified takes its planes instead of matching every pixel again.
+
+	The cache lives in AE's compute cache where the host has one (see
+	CXComputeCache.h). Entries are immutable and handed out as shared
+	pointers: an entry in use stays valid when it is evicted. Each plugin
+	binary has its own cache.
+*/
+
+#pragma once
+#ifndef CX_MASK_CACHE_H
+#define CX_MASK_CACHE_H
+
+#include "CXCommon.h"
+#include "CXComputeCache.h"
+#include "CXFrameCache.h"
+
+#include <algorithm>
+#include <vector>
+
+// Memory budget per plugin for cached classification planes, without AE's
+// compute cache
+constexpr size_t CX_MASK_CACHE_BUDGET = static_cast<size_t>(128) << 20;
+
+// Planes an entry holds, mixed into its key
+enum {
+	CX_MASK_PLANE_MASK			= 1 << 0,
+	CX_MASK_PLANE_ORIENTATION	= 1 << 1
+};
+
+// One colour key: 8-bit target colour and squared 8-bit distance tolerance
+typedef struct {
+	A_u_char	red, green, blue;
+	A_long		toleranceSq;
+} CXColorKey;
+
+// Classification of one input frame against one colour key set
+struct CXMaskPlanes {
+	A_long					width;
+	A_long					height;
+	bool					anyMatch;		// False: no pixel matches and the planes are empty
+	std::vector<A_u_char>	mask;			// 1 where any key matches, else 0
+	std::vector<A_u_char>	orientation;	// Stroke angle at matched pixels, if built
+
+	size_t Bytes() const {
+		return sizeof(*this) + mask.size() + orientation.size();
+	}
+};
+
+typedef CXComputeCache<CXMaskPlanes> CXMaskCache;
+
+static inline bool CX_ColorKeyLess(const CXColorKey &a, const CXColorKey &b) {
+	if (a.red != b.red) return a.red < b.red;
+	if (a.green != b.green) return a.green < b.green;
+	if (a.blue != b.blue) return a.blue < b.blue;
+	return a.toleranceSq < b.toleranceSq;
+}
+
+static inline bool CX_ColorKeyEqual(const CXColorKey &a, const CXColorKey &b) {
+	return a.red == b.red && a.green == b.green && a.blue == b.blue && a.toleranceSq == b.toleranceSq;
+}
+
+// Key of the planes of one input frame. The keys are sorted and deduplicated
+// in place first, so the same colours in other slots share an entry.
+// matchSpace is the CX_MATCH_SPACE_* the tolerances are measured in.
+static inline CXCacheKey CX_MaskKey(const CXCacheKey &inputKey, A_long width, A_long height, A_long matchSpace,
+                                    CXColorKey *keys, A_long keyCount, A_long planes) {
+	std::sort(keys, keys + keyCount, CX_ColorKeyLess);
+	keyCount = static_cast<A_long>(std::unique(keys, keys + keyCount, CX_ColorKeyEqual) - keys);
+
+	CXHasher hasher;
+	hasher.Add(inputKey.lo);
+	hasher.Add(inputKey.hi);
+	hasher.Add(width);
+	hasher.Add(height);
+	hasher.Add(planes);
+	hasher.Add(matchSpace);
+	hasher.Add(keyCount);
+	for (A_long i = 0; i < keyCount; i++) {
+		hasher.Add(keys[i].red);
+		hasher.Add(keys[i].green);
+		hasher.Add(keys[i].blue);
+		hasher.Add(keys[i].toleranceSq);
+	}
+	return hasher.Finish();
+}
+
+#endif // CX_MASK_CACHE_H
@@ -0,0 +1,126 @@
+/*
+	CXMorphology.h
+
+	Running min/max filters for growing and shrinking masks.
+
+	A square structuring element is separable: a size x size max (dilation)
+	or min (erosion) is a 1-D pass along the columns followed by one along
+	the rows. Each pass uses the van Herk/Gil-Werman scheme: the padded line
+	is cut into blocks of `size` samples, g holds the running extremum from
+	each block start and h the running extremum towards each block end. A
+	window covers at most two blocks, so
+
+		out[x] = op(h[x], g[x + size - 1])
+
+	and every sample costs three applications of op whatever the size.
+*/
+
+#pragma once
+#ifndef CX_MORPHOLOGY_H
+#define CX_MORPHOLOGY_H
+
+#include "CXCommon.h"
+
+#include <algorithm>
+#include <cstddef>
+
+struct CXMaxOp {
+	template<typename T> static inline T Apply(T a, T b) { return std::max(a, b); }
+};
+
+struct CXMinOp {
+	template<typename T> static inline T Apply(T a, T b) { return std::min(a, b); }
+};
+
+// Filter window of `size` samples around x: [x - (size - 1) / 2, x + size / 2].
+// Even sizes reach one sample further right (down).
+static inline A_long CX_MorphAnchor(A_long size) {
+	return (size - 1) / 2;
+}
+
+// Buffer entries CX_RunningExtremumRow needs for g and h each
+static inline size_t CX_RunningExtremumRowScratch(A_long count, A_long size) {
+	return static_cast<size_t>(count) + size - 1;
+}
+
+// One row: dst[x] = op over src in the window of x. Samples outside
+// [0, count) are `identity` (0 for max, the type's maximum for min).
+// src and dst may be the same row.
+template<typename T, typename Op>
+static void CX_RunningExtremumRow(const T *src, T *dst, A_long count, A_long size, T identity, T *g, T *h) {
+	if (size <= 1) {
+		if (dst != src) std::copy(src, src + count, dst);
+		return;
+	}
+	const A_long anchor = CX_MorphAnchor(size);
+	const A_long padded = count + size - 1;
+
+	// h first holds the padded line, then the running extremum to each block end
+	std::fill(h, h + anchor, identity);
+	std::copy(src, src + count, h + anchor);
+	std::fill(h + anchor + count, h + padded, identity);
+	for (A_long start = 0; start < padded; start += size) {
+		A_long end = std::min(start + size, padded);
+		g[start] = h[start];
+		for (A_long i = start + 1; i < end; i++) g[i] = Op::Apply(g[i - 1], h[i]);
+		for (A_long i = end - 2; i >= start; i--) h[i] = Op::Apply(h[i], h[i + 1]);
+	}
+	for (A_long x = 0; x < count; x++) {
+		dst[x] = Op::Apply(h[x], g[x + size - 1]);
+	}
+}
+
+// Buffer entries CX_RunningExtremumColumns needs for g and h each
+static inline size_t CX_RunningExtremumColumnsScratch(A_long width, A_long height, A_long size) {
+	return static_cast<size_t>(width) * (height + size - 1);
+}
+
+// Same filter down the columns of a width x height block. Rows are handled
+// whole, so every step is a contiguous run that vectorizes across x.
+// Strides are in elements; src and dst must not overlap.
+template<typename T, typename Op>
+static void CX_RunningExtremumColumns(const T *src, size_t srcStride, T *dst, size_t dstStride,
+                                      A_long width, A_long height, A_long size, T identity, T *g, T *h) {
+	if (size <= 1) {
+		for (A_long y = 0; y < height; y++) {
+			std::copy(src + y * srcStride, src + y * srcStride + width, dst + y * dstStride);
+		}
+		return;
+	}
+	const A_long anchor = CX_MorphAnchor(size);
+	const A_long padded = height + size - 1;
+	const size_t w = static_cast<size_t>(width);
+
+	for (A_long i = 0; i < padded; i++) {
+		A_long y = i - anchor;
+		T *hRow = h + i * w;
+		if (y >= 0 && y < height) {
+			std::copy(src + y * srcStride, src + y * srcStride + width, hRow);
+		} else {
+			std::fill(hRow, hRow + w, identity);
+		}
+	}
+	for (A_long start = 0; start < padded; start += size) {
+		A_long end = std::min(start + size, padded);
+		std::copy(h + start * w, h + (start + 1) * w, g + start * w);
+		for (A_long i = start + 1; i < end; i++) {
+			T *gRow = g + i * w;
+			const T *gPrev = gRow - w;
+			const T *hRow = h + i * w;
+			for (size_t x = 0; x < w; x++) gRow[x] = Op::Apply(gPrev[x], hRow[x]);
+		}
+		for (A_long i = end - 2; i >= start; i--) {
+			T *hRow = h + i * w;
+			const T *hNext = hRow + w;
+			for (size_t x = 0; x < w; x++) hRow[x] = Op::Apply(hRow[x], hNext[x]);
+		}
+	}
+	for (A_long y = 0; y < height; y++) {
+		const T *hRow = h + y * w;
+		const T *gRow = g + (y + size - 1) * w;
+		T *dstRow = dst + y * dstStride;
+		for (size_t x = 0; x < w; x++) dstRow[x] = Op::Apply(hRow[x], gRow[x]);
+	}
+}
+
+#endif // CX_MORPHOLOGY_H
@@ -0,0 +1,123 @@
+/*
+	CXOKLab.h
+
+	Perceptual colour matching in OKLab.
+
+	Equal RGB distances look very different across hues: a tolerance that
+	catches a dark blue line's antialiasing reaches far into neighbouring
+	greens and greys. OKLab (Ottosson 2020) is close to perceptually uniform,
+	so one tolerance covers about the same visible spread for any target.
+
+	Matching reduces every bit depth to an 8-bit colour first (see the
+	matching functions in CXCommon.h), so conversions only ever see 8-bit
+	sRGB channels. The sRGB decoding and the first OKLab matrix are linear
+	per channel: each channel value's contribution to LMS is tabulated once
+	per process (3 x 256 entries), a conversion adds three of them, takes
+	three cube roots and applies the second matrix. Both plugins cache match
+	results per unique colour, so flat cels convert each colour once per
+	band and cost the same as RGB matching.
+
+	Distances are scaled so that black to white is CX_OKLAB_SCALE, the RGB
+	diagonal, and a tolerance selects a similar amount in both spaces.
+*/
+
+#pragma once
+#ifndef CX_OKLAB_H
+#define CX_OKLAB_H
+
+#include "CXCommon.h"
+
+#include <cmath>
+#include <cstring>
+
+// Match Colors In popup values
+enum CXMatchSpace {
+	CX_MATCH_SPACE_RGB = 1,
+	CX_MATCH_SPACE_OKLAB,
+	CX_MATCH_SPACE_NUM_SPACES
+};
+
+#define CX_MATCH_SPACE_POPUP	"RGB|Perceptual (OKLab)"
+
+// OKLab units to 8-bit RGB distance units: L runs 0..1 from black to white
+constexpr float CX_OKLAB_SCALE = static_cast<float>(CX_TOLERANCE_SCALE * 100.0);
+
+typedef struct {
+	float	L, a, b;
+} CXLab;
+
+class CXOKLabTable {
+public:
+	static const CXOKLabTable &Get() {
+		static const CXOKLabTable table;
+		return table;
+	}
+
+	// Contribution of channel c (0 red, 1 green, 2 blue) at 8-bit value v to l, m, s
+	const float *LMS(int c, A_long v) const {
+		return m_lms[c][v];
+	}
+
+private:
+	CXOKLabTable() {
+		static const double M1[3][3] = {
+			{ 0.4122214708, 0.5363325363, 0.0514459929 },
+			{ 0.2119034982, 0.6806995451, 0.1073969566 },
+			{ 0.0883024619, 0.2817188376, 0.6299787005 }
+		};
+		for (A_long v = 0; v < 256; v++) {
+			double e = v / 255.0;
+			double linear = (e <= 0.04045) ? e / 12.92 : pow((e + 0.055) / 1.055, 2.4);
+			for (int c = 0; c < 3; c++) {
+				for (int k = 0; k < 3; k++) {
+					m_lms[c][v][k] = static_cast<float>(M1[k][c] * linear);
+				}
+			}
+		}
+	}
+
+	float	m_lms[3][256][3];
+};
+
+// Cube root of x >= 0: exponent-thirds estimate refined by two Newton steps,
+// relative error about 1e-6
+static inline float CX_FastCbrt(float x) {
+	if (x <= 0.0f) return 0.0f;
+	A_u_long bits;
+	memcpy(&bits, &x, sizeof(bits));
+	bits = bits / 3 + 0x2A5137A0;
+	float y;
+	memcpy(&y, &bits, sizeof(y));
+	y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+	y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+	return y;
+}
+
+// OKLab of an 8-bit sRGB colour
+static inline CXLab CX_OKLabFrom8(A_long r8, A_long g8, A_long b8) {
+	const CXOKLabTable &table = CXOKLabTable::Get();
+	const float *r = table.LMS(0, r8);
+	const float *g = table.LMS(1, g8);
+	const float *b = table.LMS(2, b8);
+	float l = CX_FastCbrt(r[0] + g[0] + b[0]);
+	float m = CX_FastCbrt(r[1] + g[1] + b[1]);
+	float s = CX_FastCbrt(r[2] + g[2] + b[2]);
+
+	CXLab lab;
+	lab.L = 0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s;
+	lab.a = 1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s;
+	lab.b = 0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s;
+	return lab;
+}
+
+// Squared distance in 8-bit RGB units, rounded up so that only identical
+// colours are at distance 0 and d <= toleranceSq holds exactly as in RGB
+static inline A_long CX_OKLabDistanceSq(const CXLab &p, const CXLab &t) {
+	float dL = p.L - t.L;
+	float da = p.a - t.a;
+	float db = p.b - t.b;
+	float d2 = (dL * dL + da * da + db * db) * (CX_OKLAB_SCALE * CX_OKLAB_SCALE);
+	return static_cast<A_long>(ceilf(d2));
+}
+
+#endif // CX_OKLAB_H
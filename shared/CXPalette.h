@@ -0,0 +1,96 @@
+/*
+	CXPalette.h
+
+	Per-colour memoization for flat-colour cel frames.
+
+	Cel layers hold a few hundred unique pixel values, so per-pixel work that
+	only depends on the pixel value (color keying, color adjustments) can run
+	once per unique colour. CXPalette maps raw pixel values to a cached result
+	and reports when the frame has too many colours to be worth it.
+*/
+
+#pragma once
+#ifndef CX_PALETTE_H
+#define CX_PALETTE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Unique colours a palette holds before callers fall back to per-pixel work
+#define CX_PALETTE_MAX_COLORS	1024
+
+// Open-addressing table keyed by the raw bytes of a pixel.
+//
+// Lookup() returns the result slot for a pixel. When *isNewP is set the
+// colour was just added and the caller must compute and store the result.
+// Lookup() returns NULL for a new colour once the palette is full; callers
+// then switch to direct evaluation for the rest of their pixels.
+//
+// Not thread safe: each worker owns its own palette.
+template<typename P, typename V>
+class CXPalette {
+public:
+	explicit CXPalette(size_t maxColors = CX_PALETTE_MAX_COLORS)
+		: m_maxColors(maxColors), m_count(0), m_last(NULL) {
+		size_t capacity = 16;
+		while (capacity < maxColors * 2) capacity <<= 1;
+		m_slots.resize(capacity);
+		m_mask = capacity - 1;
+	}
+
+	V* Lookup(const P &pixel, bool *isNewP) {
+		*isNewP = false;
+
+		// Flat fills repeat the previous pixel most of the time
+		if (m_last && memcmp(&m_last->key, &pixel, sizeof(P)) == 0) return &m_last->value;
+
+		for (size_t i = Hash(pixel) & m_mask;; i = (i + 1) & m_mask) {
+			Slot &slot = m_slots[i];
+			if (!slot.used) {
+				if (m_count >= m_maxColors) return NULL;
+				slot.used = true;
+				slot.key = pixel;
+				m_count++;
+				*isNewP = true;
+				m_last = &slot;
+				return &slot.value;
+			}
+			if (memcmp(&slot.key, &pixel, sizeof(P)) == 0) {
+				m_last = &slot;
+				return &slot.value;
+			}
+		}
+	}
+
+	size_t Size() const { return m_count; }
+
+private:
+	struct Slot {
+		P		key;
+		V		value;
+		bool	used;
+		Slot() : key(), value(), used(false) {}
+	};
+
+	static size_t Hash(const P &pixel) {
+		const unsigned char *bytes = reinterpret_cast<const unsigned char*>(&pixel);
+		uint64_t h = 0;
+		for (size_t offset = 0; offset < sizeof(P); offset += 8) {
+			uint64_t word = 0;
+			memcpy(&word, bytes + offset, sizeof(P) - offset < 8 ? sizeof(P) - offset : 8);
+			h = (h ^ word) * 0x9E3779B97F4A7C15ull;
+			h ^= h >> 29;
+		}
+		return static_cast<size_t>(h);
+	}
+
+	std::vector<Slot>	m_slots;
+	size_t				m_mask;
+	size_t				m_maxColors;
+	size_t				m_count;
+	Slot				*m_last;
+};
+
+#endif // CX_PALETTE_H
@@ -0,0 +1,132 @@
+/*
+	CXRandom.h
+
+	Counter-based random numbers for per-pixel effects.
+
+	Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+	3") is a keyed bijection on 128-bit counters: the random value of a pixel
+	is a pure function of (x, y, frame, index) and the key (seed, stream).
+	There is no generator state to share or advance, so results do not depend
+	on how rows are split across render threads, on tiling or on the render
+	region, and a frame rendered twice is identical.
+
+	index separates draws at the same pixel (e.g. one per target colour);
+	stream separates independent uses of the same seed (density, grain, ...).
+*/
+
+#pragma once
+#ifndef CX_RANDOM_H
+#define CX_RANDOM_H
+
+#include "CXCommon.h"
+
+#define CX_PHILOX_M0		0xD2511F53u
+#define CX_PHILOX_M1		0xCD9E8D57u
+#define CX_PHILOX_W0		0x9E3779B9u
+#define CX_PHILOX_W1		0xBB67AE85u
+#define CX_PHILOX_ROUNDS	10
+
+// Key and fixed counter words of one random stream
+typedef struct {
+	A_u_long	key[2];		// seed, stream
+	A_u_long	frame;
+	A_u_long	index;
+} CXRandomStream;
+
+static inline CXRandomStream CX_MakeRandomStream(A_u_long seed, A_u_long stream, A_u_long frame, A_u_long index) {
+	CXRandomStream s;
+	s.key[0] = seed;
+	s.key[1] = stream;
+	s.frame = frame;
+	s.index = index;
+	return s;
+}
+
+// Philox4x32-10 on one counter, in place
+static inline void CX_Philox4x32(A_u_long ctr[4], const A_u_long key[2]) {
+	A_u_long k0 = key[0], k1 = key[1];
+	for (int round = 0; round < CX_PHILOX_ROUNDS; round++) {
+		A_u_longlong p0 = static_cast<A_u_longlong>(CX_PHILOX_M0) * ctr[0];
+		A_u_longlong p1 = static_cast<A_u_longlong>(CX_PHILOX_M1) * ctr[2];
+		A_u_long c0 = static_cast<A_u_long>(p1 >> 32) ^ ctr[1] ^ k0;
+		A_u_long c2 = static_cast<A_u_long>(p0 >> 32) ^ ctr[3] ^ k1;
+		ctr[1] = static_cast<A_u_long>(p1);
+		ctr[3] = static_cast<A_u_long>(p0);
+		ctr[0] = c0;
+		ctr[2] = c2;
+		k0 += CX_PHILOX_W0;
+		k1 += CX_PHILOX_W1;
+	}
+}
+
+// Four random words of pixel (x, y)
+static inline void CX_RandomPixel(const CXRandomStream *s, A_long x, A_long y, A_u_long out[4]) {
+	out[0] = static_cast<A_u_long>(x);
+	out[1] = static_cast<A_u_long>(y);
+	out[2] = s->frame;
+	out[3] = s->index;
+	CX_Philox4x32(out, s->key);
+}
+
+// Top 24 bits as a float in [0, 1), exact in single precision
+static inline float CX_RandomUnit(A_u_long bits) {
+	return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+#if CX_SSE2
+// Low and high 32 bits of a * b for four unsigned lanes
+static inline void CX_MulHiLo32(__m128i a, __m128i b, __m128i *hi, __m128i *lo) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	// even/odd hold 64-bit products of lanes 0, 2 and 1, 3
+	*lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+	                         _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	*hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 3, 1)),
+	                         _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 3, 1)));
+}
+
+// Philox4x32-10 on four counters at once, one counter word per register
+static inline void CX_Philox4x32x4(__m128i *c0, __m128i *c1, __m128i *c2, __m128i *c3, const A_u_long key[2]) {
+	const __m128i m0 = _mm_set1_epi32(static_cast<int>(CX_PHILOX_M0));
+	const __m128i m1 = _mm_set1_epi32(static_cast<int>(CX_PHILOX_M1));
+	A_u_long k0 = key[0], k1 = key[1];
+	for (int round = 0; round < CX_PHILOX_ROUNDS; round++) {
+		__m128i hi0, lo0, hi1, lo1;
+		CX_MulHiLo32(m0, *c0, &hi0, &lo0);
+		CX_MulHiLo32(m1, *c2, &hi1, &lo1);
+		*c0 = _mm_xor_si128(_mm_xor_si128(hi1, *c1), _mm_set1_epi32(static_cast<int>(k0)));
+		*c2 = _mm_xor_si128(_mm_xor_si128(hi0, *c3), _mm_set1_epi32(static_cast<int>(k1)));
+		*c1 = lo1;
+		*c3 = lo0;
+		k0 += CX_PHILOX_W0;
+		k1 += CX_PHILOX_W1;
+	}
+}
+#endif
+
+// Random floats in [0, 1) for pixels x0 .. x0 + count - 1 of row y, one per
+// pixel from word `word` (0-3) of its Philox output. Equal to
+// CX_RandomUnit(CX_RandomPixel(...)[word]) for every pixel, whatever x0.
+static inline void CX_RandomRow(const CXRandomStream *s, A_long x0, A_long y, A_long count, int word, float *dst) {
+	A_long i = 0;
+#if CX_SSE2
+	const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+	const __m128 scale = _mm_set1_ps(1.0f / 16777216.0f);
+	for (; i + 4 <= count; i += 4) {
+		__m128i c0 = _mm_add_epi32(_mm_set1_epi32(x0 + i), lane);
+		__m128i c1 = _mm_set1_epi32(y);
+		__m128i c2 = _mm_set1_epi32(static_cast<int>(s->frame));
+		__m128i c3 = _mm_set1_epi32(static_cast<int>(s->index));
+		CX_Philox4x32x4(&c0, &c1, &c2, &c3, s->key);
+		__m128i bits = (word == 0) ? c0 : (word == 1) ? c1 : (word == 2) ? c2 : c3;
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(bits, 8)), scale));
+	}
+#endif
+	for (; i < count; i++) {
+		A_u_long out[4];
+		CX_RandomPixel(s, x0 + i, y, out);
+		dst[i] = CX_RandomUnit(out[word]);
+	}
+}
+
+#endif // CX_RANDOM_H